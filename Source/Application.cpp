@@ -18,6 +18,9 @@
 
 #include "Application.h"
 
+#include <algorithm>
+#include <iostream>
+
 #include <QMessageBox>
 
 #include <Config.h>
@@ -27,6 +30,16 @@
 #include "Core/GlobalMedia.h"
 #include "Core/Settings.h"
 #include "Core/Update.h"
+#include "Core/AdvCapture.h"
+#include "Core/LoadGenerator.h"
+
+#if defined APD_BUILD_BENCHMARK
+    #include "Benchmark.h"
+#endif
+
+#if defined APD_BUILD_SELF_TEST
+    #include "SelfTest.h"
+#endif
 
 void ApdApplication::PreConstruction()
 {
@@ -116,7 +129,10 @@ bool ApdApplication::Prepare(int argc, char *argv[])
 
     const auto &opts = _launchOptsMgr.Parse(argc, argv);
 
-    Logger::Initialize(opts.enableTrace);
+    Logger::Initialize(opts.enableTrace, opts.enableAsyncLog);
+
+    _startupProfile.isEnabled = opts.startupProfile;
+    MarkStartupPhase("Logger initialized");
 
     LOG(Info, "Launched. Version: '{}'", Config::Version::String);
 #if defined APD_BUILD_GIT_HASH
@@ -130,8 +146,6 @@ bool ApdApplication::Prepare(int argc, char *argv[])
 
     LOG(Info, "Opts: {}", opts);
 
-    Logger::CleanUpOldLogFiles();
-
     QFont font;
     font.setFamily("Segoe UI");
     font.setFamilies({"Segoe UI Variable", "Segoe UI", "Microsoft YaHei UI"});
@@ -142,6 +156,9 @@ bool ApdApplication::Prepare(int argc, char *argv[])
     setQuitOnLastWindowClosed(false);
 
     connect(this, &ApdApplication::SetTranslatorSafely, this, &ApdApplication::SetTranslator);
+    connect(
+        this, &ApdApplication::SetTaskbarStatusBehaviorSafely, this,
+        &ApdApplication::SetTaskbarStatusBehavior);
 
 #if defined APD_OS_WIN
     Core::OS::Windows::Winrt::Initialize();
@@ -149,23 +166,172 @@ bool ApdApplication::Prepare(int argc, char *argv[])
 
     // pre-load for InitTranslator
     const auto settingsLoadResult = Core::Settings::Load();
+    MarkStartupPhase("Settings loaded");
+
+    // The tests construct whatever they test themselves
+    //
+    if (opts.selfTest) {
+        return true;
+    }
+
+    // The replay, the load test and the benchmarks only need the settings, they don't construct
+    // the GUI or touch the radio
+    //
+    if (!opts.replayPath.empty() || opts.loadTestDevices != 0 || !opts.benchmarkPath.empty()) {
+        return true;
+    }
 
     InitTranslator();
+    MarkStartupPhase("Translator initialized");
+
+    _ipcServer = std::make_unique<Core::Ipc::Server>();
+    _ipcServer->Listen();
+    MarkStartupPhase("IPC server listening");
+
+    // Only the ear detection automation and the IPC clients, no window, tray icon or media
+    // player is constructed. The settings are configured by a run with the GUI.
+    //
+    if (opts.headless) {
+        _apdMgr = std::make_unique<Core::AirPods::Manager>(nullptr);
+        if (opts.captureAdv) {
+            _apdMgr->StartCapture(Core::AdvCapture::NewCaptureFilePath());
+        }
+        MarkStartupPhase("Headless manager constructed");
+
+        Core::Settings::Apply();
+        MarkStartupPhase("Settings applied");
+        return true;
+    }
 
+    // `TaskbarStatus` and the other windows are constructed on first use
+    //
     _trayIcon = std::make_unique<Gui::TrayIcon>();
-    _taskbarStatus = std::make_unique<Gui::TaskbarStatus>();
+    MarkStartupPhase("Tray icon shown");
+
     _mainWindow = std::make_unique<Gui::MainWindow>();
+    MarkStartupPhase("Main window constructed");
+
+    _apdMgr = std::make_unique<Core::AirPods::Manager>(_mainWindow.get());
+    if (opts.captureAdv) {
+        _apdMgr->StartCapture(Core::AdvCapture::NewCaptureFilePath());
+    }
+
     _lowAudioLatencyController = std::make_unique<Core::LowAudioLatency::Controller>();
+    MarkStartupPhase("Low audio latency controller constructed");
 
     InitSettings(settingsLoadResult);
+    MarkStartupPhase("Settings applied");
 
     return true;
 }
 
 int ApdApplication::Run()
 {
-    _mainWindow->GetApdMgr().StartScanner();
-    return exec();
+#if defined APD_BUILD_SELF_TEST
+    if (_launchOptsMgr.GetOpts().selfTest) {
+        return SelfTest::Run();
+    }
+#endif
+    if (!_launchOptsMgr.GetOpts().replayPath.empty()) {
+        return RunReplay();
+    }
+    if (_launchOptsMgr.GetOpts().loadTestDevices != 0) {
+        return RunLoadTest();
+    }
+#if defined APD_BUILD_BENCHMARK
+    if (!_launchOptsMgr.GetOpts().benchmarkPath.empty()) {
+        return Benchmark::Run(QString::fromStdString(_launchOptsMgr.GetOpts().benchmarkPath));
+    }
+#endif
+
+    _apdMgr->StartScanner();
+
+    QMetaObject::invokeMethod(
+        this, [] { MarkStartupPhase("Event loop started"); }, Qt::QueuedConnection);
+
+    const int result = exec();
+
+    // Don't lose the pending changes of the settings
+    //
+    Core::Settings::Flush();
+    return result;
+}
+
+int ApdApplication::RunReplay()
+{
+    using namespace std::chrono;
+
+    const auto &opts = _launchOptsMgr.GetOpts();
+    const auto current = Core::Settings::GetCurrent();
+
+    Core::AdvCapture::ReplayOptions replayOptions;
+    replayOptions.path = QString::fromStdString(opts.replayPath);
+    replayOptions.speed = opts.replayMaxSpeed ? Core::AdvCapture::ReplaySpeed::Max
+                                              : Core::AdvCapture::ReplaySpeed::Original;
+    replayOptions.rssiMin = current.rssi_min;
+    replayOptions.stateTimeoutMin = milliseconds{current.state_timeout_min_ms};
+    replayOptions.stateTimeoutMax = milliseconds{current.state_timeout_max_ms};
+
+    const auto optReport = Core::AdvCapture::Replay(replayOptions);
+    if (!optReport.has_value()) {
+        std::cerr << "Replay failed, see the log for details." << std::endl;
+        return 1;
+    }
+
+    const auto &report = optReport.value();
+    const auto elapsedMs = duration_cast<microseconds>(report.elapsed).count() / 1000.0;
+    const auto timeToFirstState =
+        report.timeToFirstState.has_value()
+            ? std::format("{}ms", duration_cast<milliseconds>(*report.timeToFirstState).count())
+            : std::string{"none"};
+    const auto reportText = std::format(
+        "Records: {}, decoded: {}, accepted: {}, state updates: {}, time to first state: {}, "
+        "recorded: {}ms, elapsed: {:.3f}ms",
+        report.records, report.decoded, report.accepted, report.stateUpdates, timeToFirstState,
+        duration_cast<milliseconds>(report.recordedDuration).count(), elapsedMs);
+
+    LOG(Info, "Replay finished. {}", reportText);
+    std::cout << reportText << std::endl;
+    return 0;
+}
+
+int ApdApplication::RunLoadTest()
+{
+    using namespace std::chrono;
+
+    const auto &opts = _launchOptsMgr.GetOpts();
+    const auto current = Core::Settings::GetCurrent();
+
+    Core::LoadGenerator::LoadOptions loadOptions;
+    loadOptions.devices = opts.loadTestDevices;
+    loadOptions.packetsPerSecond = opts.loadTestRate;
+    loadOptions.duration = seconds{opts.loadTestDuration};
+    loadOptions.rssiMin = current.rssi_min;
+    loadOptions.stateTimeoutMin = milliseconds{current.state_timeout_min_ms};
+    loadOptions.stateTimeoutMax = milliseconds{current.state_timeout_max_ms};
+    if (opts.captureAdv) {
+        loadOptions.capturePath = Core::AdvCapture::NewCaptureFilePath();
+    }
+
+    const auto optReport = Core::LoadGenerator::Run(loadOptions);
+    if (!optReport.has_value()) {
+        std::cerr << "Load test failed, see the log for details." << std::endl;
+        return 1;
+    }
+
+    const auto &report = optReport.value();
+    const auto elapsedSeconds = duration<double>{report.elapsed}.count();
+    const auto reportText = std::format(
+        "Packets: {}, accepted: {}, state updates: {}, throughput: {:.0f} packets/s, "
+        "OnAdvReceived p50: {}ns, p99: {}ns, max: {}ns, decision accuracy: {:.2f}%",
+        report.packets, report.accepted, report.stateUpdates,
+        elapsedSeconds > 0 ? report.packets / elapsedSeconds : 0.0, report.callP50.count(),
+        report.callP99.count(), report.callMax.count(),
+        report.decisions > 0 ? 100.0 * report.correctDecisions / report.decisions : 0.0);
+
+    LOG(Info, "Load test finished. {}", reportText);
+    std::cout << reportText << std::endl;
+    return 0;
 }
 
 const QVector<QLocale> &ApdApplication::AvailableLocales()
@@ -243,6 +409,54 @@ void ApdApplication::InitTranslator()
     SetTranslator(localeFromSettings.isEmpty() ? QLocale{} : QLocale{localeFromSettings});
 }
 
+void ApdApplication::SetTaskbarStatusBehavior(Core::Settings::TaskbarStatusBehavior value)
+{
+    if (_mainWindow == nullptr) {
+        return;
+    }
+
+    if (_taskbarStatus == nullptr) {
+        if (value == Core::Settings::TaskbarStatusBehavior::Disable) {
+            return;
+        }
+
+        LOG(Info, "Construct TaskbarStatus on first use.");
+        _taskbarStatus = std::make_unique<Gui::TaskbarStatus>();
+        _mainWindow->SyncTaskbarStatus(*_taskbarStatus);
+    }
+    _taskbarStatus->OnSettingsChangedSafely(value);
+}
+
+void ApdApplication::MarkStartupPhase(std::string_view name)
+{
+    if (!_startupProfile.isEnabled) {
+        return;
+    }
+
+    using namespace std::chrono;
+
+    std::lock_guard<std::mutex> lock{_startupProfile.mutex};
+
+    auto &phases = _startupProfile.phases;
+    if (std::find(phases.begin(), phases.end(), name) != phases.end()) {
+        return;
+    }
+    phases.emplace_back(name);
+
+    // The working set is logged to compare the launch modes, e.g. with and without `--headless`
+    //
+    size_t workingSet = 0;
+#if defined APD_OS_WIN
+    workingSet = Core::OS::Windows::Process::GetWorkingSetSize().value_or(0);
+#endif
+
+    const auto now = StartupProfile::Clock::now();
+    LOG(Info, "Startup profile: '{}' at {}ms (+{}ms), working set: {}KiB", name,
+        duration_cast<milliseconds>(now - _startupProfile.launchTime).count(),
+        duration_cast<milliseconds>(now - _startupProfile.lastTime).count(), workingSet / 1024);
+    _startupProfile.lastTime = now;
+}
+
 void ApdApplication::QuitSafely()
 {
     QMetaObject::invokeMethod(qApp, &QApplication::quit, Qt::QueuedConnection);
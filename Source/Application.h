@@ -18,7 +18,12 @@
 
 #pragma once
 
+#include <mutex>
+#include <atomic>
 #include <memory>
+#include <chrono>
+#include <vector>
+#include <string_view>
 #include <SingleApplication>
 
 #include <QTranslator>
@@ -29,6 +34,7 @@
 #include "Gui/DownloadWindow.h"
 #include "Core/AirPods.h"
 #include "Core/LowAudioLatency.h"
+#include "Core/Ipc.h"
 #include "Opts.h"
 
 class ApdApplication : public SingleApplication
@@ -58,6 +64,14 @@ public:
     {
         return _lowAudioLatencyController;
     }
+    inline auto &GetIpcServer()
+    {
+        return _ipcServer;
+    }
+    inline auto &GetApdMgr()
+    {
+        return _apdMgr;
+    }
 
     inline auto GetCurrentLoadedLocaleIndex()
     {
@@ -68,24 +82,47 @@ public:
 
     static void QuitSafely();
 
+    // Logs the time elapsed since the launch and since the previous phase if the startup is
+    // being profiled. Each phase is only logged the first time it's reached. Thread-safe.
+    //
+    static void MarkStartupPhase(std::string_view name);
+
 Q_SIGNALS:
     void SetTranslatorSafely(const QLocale &locale);
+    void SetTaskbarStatusBehaviorSafely(Core::Settings::TaskbarStatusBehavior value);
 
 private:
+    struct StartupProfile {
+        using Clock = std::chrono::steady_clock;
+
+        std::atomic<bool> isEnabled{false};
+        std::mutex mutex;
+        Clock::time_point launchTime{Clock::now()}, lastTime{launchTime};
+        std::vector<std::string_view> phases;
+    };
+
     static inline Opts::LaunchOptsManager _launchOptsMgr;
+    static inline StartupProfile _startupProfile;
     QTranslator _translator;
     int _currentLoadedLocaleIndex{0};
+    // Outlives the main window, whose manager publishes to it
+    std::unique_ptr<Core::Ipc::Server> _ipcServer;
     std::unique_ptr<Gui::TrayIcon> _trayIcon;
     std::unique_ptr<Gui::TaskbarStatus> _taskbarStatus;
     std::unique_ptr<Gui::MainWindow> _mainWindow;
     std::unique_ptr<Gui::DownloadWindow> _downloadWindow;
     std::unique_ptr<Core::LowAudioLatency::Controller> _lowAudioLatencyController;
+    // Destroyed first, it reports to all of the above
+    std::unique_ptr<Core::AirPods::Manager> _apdMgr;
 
     void InitSettings(Core::Settings::LoadResult loadResult);
     void FirstTimeUse();
+    int RunReplay();
+    int RunLoadTest();
 
     void SetTranslator(const QLocale &locale);
     void InitTranslator();
+    void SetTaskbarStatusBehavior(Core::Settings::TaskbarStatusBehavior value);
 };
 
 #define ApdApp (dynamic_cast<ApdApplication *>(QCoreApplication::instance()))
@@ -0,0 +1,350 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Benchmark.h"
+
+#include <array>
+#include <mutex>
+#include <format>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <string_view>
+#include <iostream>
+
+#include <QFile>
+#include <QSysInfo>
+#include <nlohmann/json.hpp>
+
+#include <Config.h>
+#include "Helper.h"
+#include "Logger.h"
+#include "Core/AppleCP.h"
+#include "Core/AirPods.h"
+#include "Core/LoadGenerator.h"
+#include "Gui/TrayIcon.h"
+
+using json = nlohmann::json;
+using namespace std::chrono_literals;
+
+namespace Benchmark {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using ReceivedData = Core::Bluetooth::AdvertisementWatcher::ReceivedData;
+
+// A batch is repeated with more iterations until it runs at least this long
+//
+constexpr auto kMinBatchDuration = 500ms;
+constexpr uint64_t kMaxIterations = 1'000'000'000;
+
+// The results are accumulated here so that the compiler cannot drop the measured work
+//
+volatile uint64_t gSink = 0;
+
+struct Result {
+    std::string name;
+    uint64_t iterations{0};
+    Clock::duration elapsed{};
+};
+
+// `function(iterations)` runs one batch of the given number of iterations
+//
+template <class Function>
+Result Measure(std::string name, Function &&function)
+{
+    uint64_t iterations = 1;
+
+    while (true) {
+        const auto begin = Clock::now();
+        function(iterations);
+        const auto elapsed = Clock::now() - begin;
+
+        if (elapsed >= kMinBatchDuration || iterations >= kMaxIterations) {
+            LOG(Info, "Benchmark: {}, iterations: {}, ns/iteration: {:.2f}", name, iterations,
+                std::chrono::duration<double, std::nano>{elapsed}.count() / iterations);
+            return Result{std::move(name), iterations, elapsed};
+        }
+
+        // Aim a bit over the minimum duration, but never grow more than 10x at once
+        //
+        const double scale = elapsed.count() > 0 ? 1.4 * kMinBatchDuration / elapsed : 10.0;
+        iterations = std::min(
+            kMaxIterations,
+            std::max(iterations + 1, static_cast<uint64_t>(iterations * std::min(scale, 10.0))));
+    }
+}
+
+std::array<uint8_t, Core::AppleCP::AirPodsLayout::kSize>
+MakeAirPodsPayload(Core::AirPods::Side side, uint8_t leftBattery, uint8_t rightBattery)
+{
+    return Core::LoadGenerator::MakePayload(Core::LoadGenerator::PayloadFields{
+        .side = side,
+        .pods = {leftBattery, rightBattery},
+        .caseBox = 8,
+        .inEar = {true, true},
+    });
+}
+
+ReceivedData MakeReceivedData(std::span<const uint8_t> payload, uint64_t address)
+{
+    ReceivedData data;
+    data.rssi = -50;
+    data.address = address;
+    data.originTime = Core::Latency::Clock::now();
+
+    Core::Bluetooth::AdvertisementWatcher::ManufacturerData entry;
+    entry.companyId = Core::AppleCP::VendorId;
+    entry.data.assign(payload);
+    data.manufacturerData.push_back(entry);
+    return data;
+}
+
+Result BenchAirPodsView()
+{
+    const auto payload = MakeAirPodsPayload(Core::AirPods::Side::Left, 9, 8);
+
+    return Measure("AppleCP/AirPodsView", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            const auto optView = Core::AppleCP::As<Core::AppleCP::AirPodsView>(payload);
+            gSink = gSink + optView->GetLeftBattery().Value() + optView->IsLidOpened();
+        }
+    });
+}
+
+Result BenchAirPodsBatch()
+{
+    constexpr size_t kRecords = 4096;
+
+    std::vector<uint8_t> records;
+    records.reserve(kRecords * Core::AppleCP::AirPodsLayout::kSize);
+    for (size_t i = 0; i < kRecords; ++i) {
+        const auto payload = MakeAirPodsPayload(
+            i % 2 == 0 ? Core::AirPods::Side::Left : Core::AirPods::Side::Right, i % 11, 10);
+        records.insert(records.end(), payload.begin(), payload.end());
+    }
+
+    Core::AppleCP::AirPodsBatch batch;
+
+    return Measure(
+        std::format("AppleCP/DecodeAirPodsBatch/Records:{}", kRecords), [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                Core::AppleCP::DecodeAirPodsBatch(records, batch);
+                gSink = gSink + batch.leftBattery[i % kRecords];
+            }
+        });
+}
+
+Result BenchAdvertisementDecode()
+{
+    const auto payload = MakeAirPodsPayload(Core::AirPods::Side::Left, 9, 8);
+    const auto data = MakeReceivedData(payload, 0x1122334455);
+
+    return Measure("AirPods/Advertisement/Decode", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            const auto optAdv = Core::AirPods::Details::Advertisement::Decode(data);
+            gSink = gSink + optAdv.has_value();
+        }
+    });
+}
+
+Result BenchStateManager()
+{
+    // Both sides of one pair, with the battery changing every few packets so that the state
+    // is rebuilt and compared as it is in practice
+    //
+    std::vector<Core::AirPods::Details::Advertisement> advs;
+    for (uint8_t battery = 5; battery <= 8; ++battery) {
+        for (auto side : {Core::AirPods::Side::Left, Core::AirPods::Side::Right}) {
+            const auto payload = MakeAirPodsPayload(side, battery, battery);
+            const auto address = side == Core::AirPods::Side::Left ? 0x1122334455 : 0x1122334466;
+            advs.emplace_back(
+                Core::AirPods::Details::Advertisement::Decode(MakeReceivedData(payload, address))
+                    .value());
+        }
+    }
+
+    // The default limit rejects everything, the packets must get through to be measured
+    //
+    Core::AirPods::Details::StateManager stateMgr{false};
+    stateMgr.OnRssiMinChanged(-80);
+
+    return Measure("AirPods/StateManager/OnAdvReceived", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            const auto result = stateMgr.OnAdvReceived(advs[i % advs.size()]);
+            gSink = gSink + result.accepted + result.updateEvent.has_value();
+        }
+    });
+}
+
+// The dispatch of `Helper::Callback` before it was copy-on-write, kept as the baseline
+//
+template <class Function>
+class LockedCallback
+{
+public:
+    inline LockedCallback &operator+=(Function &&callback)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _callbacks.emplace_back(_nextHandle++, std::move(callback));
+        return *this;
+    }
+
+    template <class... Args>
+    inline void Invoke(Args &&...args) const
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        for (const auto &callbackInfo : _callbacks) {
+            callbackInfo.second(args...);
+        }
+    }
+
+private:
+    mutable std::mutex _mutex;
+    Helper::CbHandle _nextHandle{1};
+    std::vector<std::pair<Helper::CbHandle, Function>> _callbacks;
+};
+
+template <class CallbackT>
+Result BenchCallbackInvoke(std::string_view kind, size_t subscribers, size_t threadCount)
+{
+    CallbackT callback;
+    for (size_t i = 0; i < subscribers; ++i) {
+        callback += [](uint64_t value) { gSink = gSink + value; };
+    }
+
+    return Measure(
+        std::format(
+            "Helper/Callback/{}/Subscribers:{}/Threads:{}", kind, subscribers, threadCount),
+        [&](uint64_t iterations) {
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < threadCount; ++i) {
+                threads.emplace_back([&, count = iterations / threadCount] {
+                    for (uint64_t i = 0; i < count; ++i) {
+                        callback.Invoke(i);
+                    }
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+        });
+}
+
+Result BenchTimerReset(size_t threadCount)
+{
+    Helper::Timer timer{1h, [] {}};
+
+    return Measure(
+        std::format("Helper/Timer/Reset/Threads:{}", threadCount), [&](uint64_t iterations) {
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < threadCount; ++i) {
+                threads.emplace_back([&, count = iterations / threadCount] {
+                    for (uint64_t i = 0; i < count; ++i) {
+                        timer.Reset();
+                    }
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+        });
+}
+
+Result BenchTrayIconRendering()
+{
+    return Measure("Gui/TrayIcon/GenerateIcon", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            const auto optIcon = Gui::TrayIcon::GenerateIcon(
+                64, QString::number(i % 101), i % 2 == 0 ? std::optional<QColor>{} : Qt::red);
+            gSink = gSink + optIcon.has_value();
+        }
+    });
+}
+} // namespace
+
+int Run(const QString &outputPath)
+{
+    LOG(Info, "Benchmark: Started.");
+
+    std::vector<Result> results;
+    results.emplace_back(BenchAirPodsView());
+    results.emplace_back(BenchAirPodsBatch());
+    results.emplace_back(BenchAdvertisementDecode());
+    results.emplace_back(BenchStateManager());
+    for (size_t threadCount : {1, 4}) {
+        for (size_t subscribers : {1, 8, 64}) {
+            using Function = std::function<void(uint64_t)>;
+            results.emplace_back(
+                BenchCallbackInvoke<LockedCallback<Function>>("Locked", subscribers, threadCount));
+            results.emplace_back(
+                BenchCallbackInvoke<Helper::Callback<Function>>("Cow", subscribers, threadCount));
+        }
+    }
+    for (size_t threadCount : {1, 2, 4}) {
+        results.emplace_back(BenchTimerReset(threadCount));
+    }
+    results.emplace_back(BenchTrayIconRendering());
+
+    json benchmarks = json::array();
+    for (const auto &result : results) {
+        const auto nsPerIteration =
+            std::chrono::duration<double, std::nano>{result.elapsed}.count() / result.iterations;
+
+        benchmarks.push_back({
+            {"name", result.name},
+            {"run_type", "iteration"},
+            {"iterations", result.iterations},
+            {"real_time", nsPerIteration},
+            {"time_unit", "ns"},
+        });
+    }
+
+    const json output = {
+        {"context",
+         {
+             {"executable", Config::ProgramName},
+             {"version", Config::Version::String},
+             {"host_name", QSysInfo::machineHostName().toStdString()},
+             {"num_cpus", std::thread::hardware_concurrency()},
+#if defined APD_DEBUG
+             {"library_build_type", "debug"},
+#else
+             {"library_build_type", "release"},
+#endif
+         }},
+        {"benchmarks", benchmarks},
+    };
+
+    QFile file{outputPath};
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        LOG(Error, "Benchmark: Open '{}' failed. error: '{}'", outputPath, file.errorString());
+        std::cerr << "Open the output file failed." << std::endl;
+        return 1;
+    }
+    file.write(QByteArray::fromStdString(output.dump(4)));
+
+    LOG(Info, "Benchmark: Finished, results written to '{}'.", outputPath);
+    std::cout << output.dump(4) << std::endl;
+    return 0;
+}
+
+} // namespace Benchmark
@@ -0,0 +1,33 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <QString>
+
+// The in-process benchmarks of the hot paths, built only with `APD_BUILD_TESTS`
+//
+namespace Benchmark {
+
+// Runs all the benchmarks and writes the results to the file as JSON, in the same shape as the
+// output of Google Benchmark so that the usual comparison tools work on it. Returns the exit
+// code.
+//
+int Run(const QString &outputPath);
+
+} // namespace Benchmark
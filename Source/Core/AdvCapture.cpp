@@ -0,0 +1,298 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "AdvCapture.h"
+
+#include <array>
+#include <random>
+#include <thread>
+#include <cstring>
+
+#include <QDateTime>
+
+#include "../Utils.h"
+#include "../Logger.h"
+#include "AirPods.h"
+#include "AppleCP.h"
+
+namespace Core::AdvCapture {
+
+namespace {
+
+constexpr std::array<char, 8> kMagic{'A', 'P', 'D', 'A', 'D', 'V', 'C', '\0'};
+constexpr uint32_t kVersion = 1;
+// Timestamp, address hash and RSSI
+constexpr size_t kRecordFixedSize = 8 + 8 + 2;
+constexpr size_t kMaxRecordSize =
+    kRecordFixedSize + Bluetooth::AdvertisementWatcher::kMaxManufacturerDataSize;
+
+template <class T>
+void PutLittleEndian(uint8_t *buffer, T value)
+{
+    using UnsignedT = std::make_unsigned_t<T>;
+    auto unsignedValue = static_cast<UnsignedT>(value);
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        buffer[i] = static_cast<uint8_t>(unsignedValue >> (i * 8));
+    }
+}
+
+template <class T>
+T GetLittleEndian(const uint8_t *buffer)
+{
+    using UnsignedT = std::make_unsigned_t<T>;
+    UnsignedT unsignedValue = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        unsignedValue |= static_cast<UnsignedT>(buffer[i]) << (i * 8);
+    }
+    return static_cast<T>(unsignedValue);
+}
+
+// The finalizer of SplitMix64, a bijection on 64-bit values
+//
+uint64_t MixAddress(uint64_t address, uint64_t salt)
+{
+    uint64_t value = address ^ salt;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+} // namespace
+
+//////////////////////////////////////////////////
+// Writer
+//
+
+Writer::Writer(const QString &path) : _file{path}
+{
+    if (!_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        LOG(Warn, "AdvCapture: Open '{}' failed. error: '{}'", path, _file.errorString());
+        return;
+    }
+
+    std::array<uint8_t, kMagic.size() + sizeof(kVersion)> header;
+    std::memcpy(header.data(), kMagic.data(), kMagic.size());
+    PutLittleEndian(header.data() + kMagic.size(), kVersion);
+    _file.write(reinterpret_cast<const char *>(header.data()), header.size());
+
+    _salt = std::mt19937_64{std::random_device{}()}();
+
+    LOG(Info, "AdvCapture: Capturing to '{}'.", path);
+}
+
+Writer::~Writer()
+{
+    if (_file.isOpen()) {
+        LOG(Info, "AdvCapture: Captured {} records.", _count);
+    }
+}
+
+bool Writer::IsOpen() const
+{
+    return _file.isOpen();
+}
+
+void Writer::Append(const ReceivedData &data, std::span<const uint8_t> appleData)
+{
+    std::array<uint8_t, sizeof(uint16_t) + kMaxRecordSize> record;
+
+    const size_t payloadSize = std::min(appleData.size(), kMaxRecordSize - kRecordFixedSize);
+    const size_t recordSize = kRecordFixedSize + payloadSize;
+
+    uint8_t *cursor = record.data();
+    PutLittleEndian(cursor, static_cast<uint16_t>(recordSize));
+    cursor += sizeof(uint16_t);
+    PutLittleEndian(cursor, static_cast<int64_t>(data.timestamp.time_since_epoch().count()));
+    cursor += sizeof(int64_t);
+    PutLittleEndian(cursor, MixAddress(data.address, _salt));
+    cursor += sizeof(uint64_t);
+    PutLittleEndian(cursor, data.rssi);
+    cursor += sizeof(int16_t);
+    std::memcpy(cursor, appleData.data(), payloadSize);
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    if (!_file.isOpen()) {
+        return;
+    }
+
+    // The file is buffered, so a record costs no system call most of the time
+    //
+    const auto size = static_cast<qint64>(sizeof(uint16_t) + recordSize);
+    if (_file.write(reinterpret_cast<const char *>(record.data()), size) != size) {
+        LOG(Warn, "AdvCapture: Write failed, stop capturing. error: '{}'", _file.errorString());
+        _file.close();
+        return;
+    }
+    ++_count;
+}
+
+//////////////////////////////////////////////////
+// Reader
+//
+
+Reader::Reader(const QString &path) : _file{path}
+{
+    if (!_file.open(QIODevice::ReadOnly)) {
+        LOG(Warn, "AdvCapture: Open '{}' failed. error: '{}'", path, _file.errorString());
+        return;
+    }
+
+    std::array<uint8_t, kMagic.size() + sizeof(kVersion)> header;
+    if (_file.read(reinterpret_cast<char *>(header.data()), header.size()) !=
+            static_cast<qint64>(header.size()) ||
+        std::memcmp(header.data(), kMagic.data(), kMagic.size()) != 0)
+    {
+        LOG(Warn, "AdvCapture: '{}' is not a capture file.", path);
+        return;
+    }
+
+    const auto version = GetLittleEndian<uint32_t>(header.data() + kMagic.size());
+    if (version != kVersion) {
+        LOG(Warn, "AdvCapture: Unsupported capture version. Version: {}, Expect: {}", version,
+            kVersion);
+        return;
+    }
+    _isValid = true;
+}
+
+bool Reader::IsOpen() const
+{
+    return _isValid;
+}
+
+std::optional<ReceivedData> Reader::Next()
+{
+    if (!_isValid) {
+        return std::nullopt;
+    }
+
+    std::array<uint8_t, kMaxRecordSize> record;
+
+    uint8_t sizeBuffer[sizeof(uint16_t)];
+    if (_file.read(reinterpret_cast<char *>(sizeBuffer), sizeof(sizeBuffer)) !=
+        sizeof(sizeBuffer))
+    {
+        return std::nullopt;
+    }
+
+    const auto recordSize = GetLittleEndian<uint16_t>(sizeBuffer);
+    if (recordSize < kRecordFixedSize || recordSize > kMaxRecordSize ||
+        _file.read(reinterpret_cast<char *>(record.data()), recordSize) !=
+            static_cast<qint64>(recordSize))
+    {
+        LOG(Warn, "AdvCapture: Corrupt record at offset {}.", _file.pos());
+        _isValid = false;
+        return std::nullopt;
+    }
+
+    const uint8_t *cursor = record.data();
+
+    ReceivedData data;
+    data.timestamp = Timestamp{Timestamp::duration{GetLittleEndian<int64_t>(cursor)}};
+    cursor += sizeof(int64_t);
+    data.address = GetLittleEndian<uint64_t>(cursor);
+    cursor += sizeof(uint64_t);
+    data.rssi = GetLittleEndian<int16_t>(cursor);
+    cursor += sizeof(int16_t);
+    data.originTime = Latency::Clock::now();
+
+    ReceivedData::ManufacturerData entry;
+    entry.companyId = AppleCP::VendorId;
+    entry.data.assign({cursor, recordSize - kRecordFixedSize});
+    data.manufacturerData.push_back(entry);
+
+    return data;
+}
+
+QString NewCaptureFilePath()
+{
+    QDir directory = Utils::File::GetWorkspace();
+    directory.mkpath("Captures");
+    directory.cd("Captures");
+
+    return directory.absoluteFilePath(
+        QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") + ".apdcap");
+}
+
+//////////////////////////////////////////////////
+// Replay
+//
+
+std::optional<ReplayReport> Replay(const ReplayOptions &options)
+{
+    using namespace std::chrono;
+
+    Reader reader{options.path};
+    if (!reader.IsOpen()) {
+        return std::nullopt;
+    }
+
+    AirPods::Details::StateManager stateMgr{false};
+    stateMgr.OnRssiMinChanged(options.rssiMin);
+    stateMgr.OnStateTimeoutChanged(options.stateTimeoutMin, options.stateTimeoutMax);
+
+    LOG(Info, "AdvCapture: Replay '{}'. Speed: {}", options.path,
+        options.speed == ReplaySpeed::Max ? "Max" : "Original");
+
+    ReplayReport report;
+    std::optional<Timestamp> firstTimestamp;
+
+    const auto begin = steady_clock::now();
+
+    while (auto optData = reader.Next()) {
+        const auto &data = optData.value();
+        ++report.records;
+
+        if (!firstTimestamp.has_value()) {
+            firstTimestamp = data.timestamp;
+        }
+        report.recordedDuration = data.timestamp - firstTimestamp.value();
+
+        // The virtual clock only waits for the wall clock at the original speed
+        //
+        if (options.speed == ReplaySpeed::Original) {
+            std::this_thread::sleep_until(begin + report.recordedDuration);
+        }
+
+        stateMgr.AdvanceTo(data.timestamp);
+
+        const auto optAdv = AirPods::Details::Advertisement::Decode(data);
+        if (!optAdv.has_value()) {
+            continue;
+        }
+        ++report.decoded;
+
+        const auto result = stateMgr.OnAdvReceived(optAdv.value());
+        if (result.accepted) {
+            ++report.accepted;
+        }
+        if (result.updateEvent.has_value()) {
+            ++report.stateUpdates;
+            if (!report.timeToFirstState.has_value()) {
+                report.timeToFirstState = report.recordedDuration;
+            }
+            LOG(Trace, "AdvCapture: State updated at {}ms. Changed fields: {:#x}",
+                duration_cast<milliseconds>(report.recordedDuration).count(),
+                result.updateEvent->changedFields.toInt());
+        }
+    }
+
+    report.elapsed = steady_clock::now() - begin;
+    return report;
+}
+
+} // namespace Core::AdvCapture
@@ -0,0 +1,111 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <span>
+#include <mutex>
+#include <chrono>
+#include <optional>
+
+#include <QFile>
+#include <QString>
+
+#include "Bluetooth.h"
+
+namespace Core::AdvCapture {
+
+using ReceivedData = Bluetooth::AdvertisementWatcher::ReceivedData;
+using Timestamp = Bluetooth::AdvertisementWatcher::Timestamp;
+
+// A capture is a compact binary file of the received Apple advertisements, so that a tracking
+// problem can be reproduced and measured offline. All integers are little-endian.
+//
+//   Header: "APDADVC\0", uint32 version
+//   Record: uint16 size of the rest, int64 timestamp ticks, uint64 address hash, int16 RSSI,
+//           the Apple manufacturer data
+//
+// The addresses are mixed with a random salt per capture. The mixing is a bijection, so the
+// sources stay distinct while the real addresses are not recorded.
+//
+class Writer
+{
+public:
+    Writer(const QString &path);
+    ~Writer();
+
+    bool IsOpen() const;
+
+    // Thread-safe
+    //
+    void Append(const ReceivedData &data, std::span<const uint8_t> appleData);
+
+private:
+    std::mutex _mutex;
+    QFile _file;
+    uint64_t _salt{0};
+    uint64_t _count{0};
+};
+
+class Reader
+{
+public:
+    Reader(const QString &path);
+
+    bool IsOpen() const;
+
+    // Returns `std::nullopt` at the end or if the rest of the file is corrupt
+    //
+    std::optional<ReceivedData> Next();
+
+private:
+    QFile _file;
+    bool _isValid{false};
+};
+
+// Creates a new capture file in the workspace, named after the current time
+//
+QString NewCaptureFilePath();
+
+//////////////////////////////////////////////////
+// Replay
+//
+
+enum class ReplaySpeed : uint32_t { Original, Max };
+
+struct ReplayOptions {
+    QString path;
+    ReplaySpeed speed{ReplaySpeed::Max};
+    int16_t rssiMin{-80};
+    std::chrono::milliseconds stateTimeoutMin{2000}, stateTimeoutMax{10000};
+};
+
+struct ReplayReport {
+    uint64_t records{0}, decoded{0}, accepted{0}, stateUpdates{0};
+    Timestamp::duration recordedDuration{};
+    // From the first record to the first state, on the recorded clock
+    std::optional<Timestamp::duration> timeToFirstState;
+    std::chrono::nanoseconds elapsed{};
+};
+
+// Feeds a capture through `Advertisement` and a `StateManager` on a virtual clock, the
+// deadlines of the state manager follow the recorded timestamps at any speed
+//
+std::optional<ReplayReport> Replay(const ReplayOptions &options);
+
+} // namespace Core::AdvCapture
@@ -21,139 +21,668 @@
 #include <mutex>
 #include <chrono>
 #include <thread>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <string_view>
 #include <QVector>
 #include <QMetaObject>
 
 #include "Bluetooth.h"
 #include "GlobalMedia.h"
+#include "LowAudioLatency.h"
+#include "BatteryHistory.h"
 #include "../Helper.h"
 #include "../Logger.h"
 #include "../Assert.h"
+#include "../Profiler.h"
 #include "../Application.h"
-#include "../Gui/MainWindow.h"
 
 using namespace Core;
 using namespace std::chrono_literals;
 
 namespace Core::AirPods {
-namespace Details {
+
+StateFields DiffState(const State &lhs, const State &rhs)
+{
+    return StateBits{lhs}.Diff(StateBits{rhs});
+}
 
 //
-// Advertisement
+// StateBits
 //
 
-bool Advertisement::IsDesiredAdv(const Bluetooth::AdvertisementWatcher::ReceivedData &data)
+namespace {
+
+namespace StateBitsLayout {
+
+constexpr uint64_t kModelShift = 0, kModelBits = 8;
+// The pods and the case each take a byte: a battery nibble and the flags above it
+constexpr uint64_t kLeftShift = 8, kRightShift = 16, kCaseShift = 24;
+constexpr uint64_t kBatteryBits = 4, kBatteryUnavailable = 0xF;
+constexpr uint64_t kChargingBit = 4, kInEarBit = 5, kLidOpenedBit = 5, kBothPodsInCaseBit = 6;
+
+constexpr uint64_t kBatteryMask = (1ull << kBatteryBits) - 1;
+
+constexpr uint64_t Bit(uint64_t shift, uint64_t bit)
 {
-    auto iter = data.manufacturerDataMap.find(AppleCP::VendorId);
-    if (iter == data.manufacturerDataMap.end()) {
-        LOG(Info, "IsDesiredAdv false1");
-        return false;
-    }
+    return 1ull << (shift + bit);
+}
 
-    const auto &manufacturerData = (*iter).second;
-    if (!AppleCP::AirPods::IsValid(manufacturerData)) {
-        LOG(Info, "IsDesiredAdv false2");
-        return false;
+constexpr uint64_t PodShift(Side side)
+{
+    return side == Side::Left ? kLeftShift : kRightShift;
+}
+
+static_assert(Helper::ToUnderlying(Model::_Max) <= (1u << kModelBits));
+
+struct FieldMask {
+    StateField field;
+    uint64_t mask;
+};
+
+constexpr std::array<FieldMask, 10> kFieldMasks{{
+    {StateField::Model, ((1ull << kModelBits) - 1) << kModelShift},
+    {StateField::LeftBattery, kBatteryMask << kLeftShift},
+    {StateField::LeftCharging, Bit(kLeftShift, kChargingBit)},
+    {StateField::LeftInEar, Bit(kLeftShift, kInEarBit)},
+    {StateField::RightBattery, kBatteryMask << kRightShift},
+    {StateField::RightCharging, Bit(kRightShift, kChargingBit)},
+    {StateField::RightInEar, Bit(kRightShift, kInEarBit)},
+    {StateField::CaseBattery, kBatteryMask << kCaseShift},
+    {StateField::CaseCharging, Bit(kCaseShift, kChargingBit)},
+    {StateField::CaseLid, Bit(kCaseShift, kLidOpenedBit) | Bit(kCaseShift, kBothPodsInCaseBit)},
+}};
+
+uint64_t PackBattery(const Battery &battery)
+{
+    return battery.Available() ? std::min<uint64_t>((battery.Value() + 5) / 10, 10)
+                               : kBatteryUnavailable;
+}
+
+Battery UnpackBattery(uint64_t bits)
+{
+    const auto nibble = bits & kBatteryMask;
+    return nibble == kBatteryUnavailable ? Battery{} : Battery{(Battery::ValueType)nibble * 10};
+}
+
+} // namespace StateBitsLayout
+} // namespace
+
+StateBits::StateBits(const State &state)
+{
+    using namespace StateBitsLayout;
+
+    const auto packPod = [](const PodState &pod) {
+        return PackBattery(pod.battery) | (uint64_t)pod.isCharging << kChargingBit |
+               (uint64_t)pod.isInEar << kInEarBit;
+    };
+
+    const auto caseBits = PackBattery(state.caseBox.battery) |
+                          (uint64_t)state.caseBox.isCharging << kChargingBit |
+                          (uint64_t)state.caseBox.isLidOpened << kLidOpenedBit |
+                          (uint64_t)state.caseBox.isBothPodsInCase << kBothPodsInCaseBit;
+
+    _value = (uint64_t)Helper::ToUnderlying(state.model) << kModelShift |
+             packPod(state.pods.left) << kLeftShift | packPod(state.pods.right) << kRightShift |
+             caseBits << kCaseShift;
+}
+
+State StateBits::ToState(QString displayName) const
+{
+    State result;
+    result.model = GetModel();
+    result.displayName = std::move(displayName);
+
+    for (const auto side : {Side::Left, Side::Right}) {
+        auto &pod = side == Side::Left ? result.pods.left : result.pods.right;
+        pod.battery = GetBattery(side);
+        pod.isCharging = IsCharging(side);
+        pod.isInEar = IsInEar(side);
     }
 
-    LOG(Info, "IsDesiredAdv true");
-    return true;
+    result.caseBox.battery = GetCaseBattery();
+    result.caseBox.isCharging = IsCaseCharging();
+    result.caseBox.isLidOpened = IsLidOpened();
+    result.caseBox.isBothPodsInCase = IsBothPodsInCase();
+    return result;
 }
 
-Advertisement::Advertisement(const Bluetooth::AdvertisementWatcher::ReceivedData &data)
+Model StateBits::GetModel() const
 {
-    APD_ASSERT(IsDesiredAdv(data));
-    _data = data;
+    using namespace StateBitsLayout;
+    return (Model)((_value >> kModelShift) & ((1ull << kModelBits) - 1));
+}
 
-    auto protocol = AppleCP::As<AppleCP::AirPods>(GetMfrData());
-    APD_ASSERT(protocol.has_value());
-    _protocol = std::move(protocol.value());
+Battery StateBits::GetBattery(Side side) const
+{
+    return StateBitsLayout::UnpackBattery(_value >> StateBitsLayout::PodShift(side));
+}
+
+Battery StateBits::GetCaseBattery() const
+{
+    return StateBitsLayout::UnpackBattery(_value >> StateBitsLayout::kCaseShift);
+}
+
+bool StateBits::IsCharging(Side side) const
+{
+    using namespace StateBitsLayout;
+    return (_value & Bit(PodShift(side), kChargingBit)) != 0;
+}
+
+bool StateBits::IsCaseCharging() const
+{
+    using namespace StateBitsLayout;
+    return (_value & Bit(kCaseShift, kChargingBit)) != 0;
+}
+
+bool StateBits::IsInEar(Side side) const
+{
+    using namespace StateBitsLayout;
+    return (_value & Bit(PodShift(side), kInEarBit)) != 0;
+}
+
+bool StateBits::IsBothInEar() const
+{
+    return IsInEar(Side::Left) && IsInEar(Side::Right);
+}
+
+bool StateBits::IsLidOpened() const
+{
+    using namespace StateBitsLayout;
+    return (_value & Bit(kCaseShift, kLidOpenedBit)) != 0;
+}
+
+bool StateBits::IsBothPodsInCase() const
+{
+    using namespace StateBitsLayout;
+    return (_value & Bit(kCaseShift, kBothPodsInCaseBit)) != 0;
+}
+
+StateFields StateBits::Diff(const StateBits &rhs) const
+{
+    const auto changed = _value ^ rhs._value;
+
+    StateFields result;
+    for (const auto &[field, mask] : StateBitsLayout::kFieldMasks) {
+        result.setFlag(field, (changed & mask) != 0);
+    }
+    return result;
+}
+
+namespace Details {
+
+//
+// Advertisement
+//
+
+auto Advertisement::Decode(const Bluetooth::AdvertisementWatcher::ReceivedData &data)
+    -> std::optional<Advertisement>
+{
+    const auto optManufacturerData = data.FindManufacturerData(AppleCP::VendorId);
+    if (!optManufacturerData.has_value()) {
+        LOG(Trace, "Decode failed. Reason: No Apple manufacturer data.");
+        return std::nullopt;
+    }
+
+    // Decoded in place, the bytes are not copied
+    //
+    const auto optPacket = AppleCP::As<AppleCP::AirPodsView>(optManufacturerData.value());
+    if (!optPacket.has_value()) {
+        LOG(Trace, "Decode failed. Reason: Not an AirPods packet.");
+        return std::nullopt;
+    }
+    const auto &packet = optPacket.value();
+
+    LOG(Trace, "AirPods advertisement received. Data: {}, Address Hash: {}, RSSI: {}",
+        Helper::ToString(std::span<const uint8_t>{packet.Desensitize()}),
+        Helper::Hash(data.address), data.rssi);
+
+    Advertisement adv;
+    adv._rssi = data.rssi;
+    adv._timestamp = data.timestamp;
+    adv._address = data.address;
 
     // Store state
     //
 
-    _state.model = _protocol.GetModel();
-    _state.side = _protocol.GetBroadcastedSide();
+    auto &state = adv._state;
 
-    _state.pods.left.battery = _protocol.GetLeftBattery();
-    _state.pods.left.isCharging = _protocol.IsLeftCharging();
-    _state.pods.left.isInEar = _protocol.IsLeftInEar();
+    state.model = packet.GetModel();
+    state.color = packet.GetColor();
+    state.side = packet.GetBroadcastedSide();
 
-    _state.pods.right.battery = _protocol.GetRightBattery();
-    _state.pods.right.isCharging = _protocol.IsRightCharging();
-    _state.pods.right.isInEar = _protocol.IsRightInEar();
+    state.pods.left.battery = packet.GetLeftBattery();
+    state.pods.left.isCharging = packet.IsLeftCharging();
+    state.pods.left.isInEar = packet.IsLeftInEar();
 
-    _state.caseBox.battery = _protocol.GetCaseBattery();
-    _state.caseBox.isCharging = _protocol.IsCaseCharging();
+    state.pods.right.battery = packet.GetRightBattery();
+    state.pods.right.isCharging = packet.IsRightCharging();
+    state.pods.right.isInEar = packet.IsRightInEar();
 
-    _state.caseBox.isBothPodsInCase = _protocol.IsBothPodsInCase();
-    _state.caseBox.isLidOpened = _protocol.IsLidOpened();
+    state.caseBox.battery = packet.GetCaseBattery();
+    state.caseBox.isCharging = packet.IsCaseCharging();
 
-    if (_state.pods.left.battery.Available()) {
-        _state.pods.left.battery = _state.pods.left.battery.Value() * 10;
+    state.caseBox.isBothPodsInCase = packet.IsBothPodsInCase();
+    state.caseBox.isLidOpened = packet.IsLidOpened();
+
+    if (state.pods.left.battery.Available()) {
+        state.pods.left.battery = state.pods.left.battery.Value() * 10;
     }
-    if (_state.pods.right.battery.Available()) {
-        _state.pods.right.battery = _state.pods.right.battery.Value() * 10;
+    if (state.pods.right.battery.Available()) {
+        state.pods.right.battery = state.pods.right.battery.Value() * 10;
     }
-    if (_state.caseBox.battery.Available()) {
-        _state.caseBox.battery = _state.caseBox.battery.Value() * 10;
+    if (state.caseBox.battery.Available()) {
+        state.caseBox.battery = state.caseBox.battery.Value() * 10;
     }
+
+    return adv;
+}
+
+auto Advertisement::Repeat(const Bluetooth::AdvertisementWatcher::ReceivedData &data) const
+    -> Advertisement
+{
+    Advertisement adv = *this;
+    adv._rssi = data.rssi;
+    adv._timestamp = data.timestamp;
+    return adv;
 }
 
 int16_t Advertisement::GetRssi() const
 {
-    return _data.rssi;
+    return _rssi;
 }
 
-const auto &Advertisement::GetTimestamp() const
+auto Advertisement::GetTimestamp() const -> Timestamp
 {
-    return _data.timestamp;
+    return _timestamp;
 }
 
 auto Advertisement::GetAddress() const -> AddressType
 {
-    return _data.address;
+    return _address;
+}
+
+auto Advertisement::GetAdvState() const -> const AdvState &
+{
+    return _state;
+}
+
+//
+// CadenceEstimator
+//
+
+void CadenceEstimator::Update(Timestamp timestamp, std::chrono::milliseconds maxInterval)
+{
+    const auto lastTimestamp = std::exchange(_lastTimestamp, timestamp);
+    if (!lastTimestamp.has_value() || timestamp <= lastTimestamp.value()) {
+        return;
+    }
+
+    const auto intervalMs =
+        std::chrono::duration<double, std::milli>{timestamp - lastTimestamp.value()}.count();
+    if (intervalMs > maxInterval.count()) {
+        return;
+    }
+
+    if (_samples++ == 0) {
+        _meanMs = intervalMs;
+        _varianceMs2 = 0;
+        return;
+    }
+
+    const auto diff = intervalMs - _meanMs;
+    const auto increment = kAlpha * diff;
+    _meanMs += increment;
+    _varianceMs2 = (1 - kAlpha) * (_varianceMs2 + diff * increment);
+}
+
+void CadenceEstimator::Reset()
+{
+    _lastTimestamp.reset();
+    _meanMs = 0;
+    _varianceMs2 = 0;
+    _samples = 0;
+}
+
+std::chrono::milliseconds
+CadenceEstimator::GetTimeout(std::chrono::milliseconds min, std::chrono::milliseconds max) const
+{
+    if (_samples < kMinSamples) {
+        return max;
+    }
+
+    const auto timeoutMs =
+        kMissedIntervals * _meanMs + kDeviationFactor * std::sqrt(_varianceMs2);
+    return std::clamp(
+        std::chrono::milliseconds{static_cast<std::chrono::milliseconds::rep>(timeoutMs)}, min,
+        max);
+}
+
+std::chrono::milliseconds CadenceEstimator::GetMean() const
+{
+    return std::chrono::milliseconds{static_cast<std::chrono::milliseconds::rep>(_meanMs)};
+}
+
+std::chrono::milliseconds CadenceEstimator::GetDeviation() const
+{
+    return std::chrono::milliseconds{
+        static_cast<std::chrono::milliseconds::rep>(std::sqrt(_varianceMs2))};
 }
 
-std::vector<uint8_t> Advertisement::GetDesensitizedData() const
+//
+// RssiFilter
+//
+
+double RssiFilter::Update(int16_t rssi)
+{
+    if (!_estimate.has_value()) {
+        _estimate = rssi;
+        _errorCovariance = kMeasurementNoise;
+        return _estimate.value();
+    }
+
+    _errorCovariance += kProcessNoise;
+    const auto gain = _errorCovariance / (_errorCovariance + kMeasurementNoise);
+    _estimate = _estimate.value() + gain * (rssi - _estimate.value());
+    _errorCovariance *= 1 - gain;
+
+    return _estimate.value();
+}
+
+//
+// Tracker
+//
+
+auto Tracker::Feed(const Advertisement &adv) -> FeedResult
 {
-    auto desensitizedData = _protocol.Desensitize();
+    size_t index;
+    double rssi;
 
-    std::vector<uint8_t> result(sizeof(desensitizedData), 0);
-    std::memcpy(result.data(), &desensitizedData, sizeof(desensitizedData));
+    _desiredRejection.reset();
+
+    auto sourceIter = _sourceIndex.find(adv.GetAddress());
+    if (sourceIter != _sourceIndex.end()) {
+        auto &source = *sourceIter->second;
+
+        // The cluster slot may have been reused by another device since this address was last seen
+        //
+        if (_clusters[source.cluster].id != source.clusterId) {
+            source.cluster = AssignCluster(adv);
+            source.clusterId = _clusters[source.cluster].id;
+        }
+        index = source.cluster;
+        rssi = source.rssi.Update(adv.GetRssi());
+
+        _sources.splice(_sources.begin(), _sources, sourceIter->second);
+    }
+    else {
+        index = AssignCluster(adv);
+
+        if (_sources.size() >= kMaxSources) {
+            _sourceIndex.erase(_sources.back().address);
+            _sources.pop_back();
+        }
+        _sources.push_front(Source{adv.GetAddress(), index, _clusters[index].id});
+        _sourceIndex.emplace(adv.GetAddress(), _sources.begin());
+        rssi = _sources.front().rssi.Update(adv.GetRssi());
+        Metrics::Set(Metrics::Gauge::TrackedSources, (int64_t)_sources.size());
+    }
+
+    UpdateCluster(_clusters[index], adv, rssi);
+    UpdateDesired(index, adv.GetTimestamp());
+
+    FeedResult result{.isDesired = _desired == index, .rssi = rssi};
+    if (!result.isDesired) {
+        if (_desiredModel != Model::Unknown && adv.GetAdvState().model != _desiredModel) {
+            result.dropReason = Metrics::DropReason::ModelMismatch;
+        }
+        else {
+            result.dropReason = _desiredRejection.value_or(Metrics::DropReason::NotDesired);
+        }
+    }
     return result;
 }
 
-auto Advertisement::GetAdvState() const -> const AdvState &
+auto Tracker::GetDesiredCluster() const -> std::optional<ClusterId>
 {
-    return _state;
+    if (!_desired.has_value()) {
+        return std::nullopt;
+    }
+    return _clusters[_desired.value()].id;
+}
+
+void Tracker::SetDesiredModel(Model model)
+{
+    _desiredModel = model;
+
+    if (_desired.has_value() && !IsCandidate(_clusters[_desired.value()], 0)) {
+        _desired.reset();
+    }
 }
 
-const std::vector<uint8_t> &Advertisement::GetMfrData() const
+void Tracker::SetRssiMin(int16_t rssiMin)
 {
-    auto iter = _data.manufacturerDataMap.find(AppleCP::VendorId);
-    APD_ASSERT(iter != _data.manufacturerDataMap.end());
+    _rssiMin = rssiMin;
+
+    if (_desired.has_value() && !IsCandidate(_clusters[_desired.value()], 0)) {
+        _desired.reset();
+    }
+}
+
+void Tracker::Reset()
+{
+    _sources.clear();
+    _sourceIndex.clear();
+    _clusters.fill(Cluster{});
+    _desired.reset();
+}
+
+size_t Tracker::AssignCluster(const Advertisement &adv)
+{
+    const auto now = adv.GetTimestamp();
+
+    std::optional<size_t> best;
+    double bestScore = 0;
+
+    for (size_t i = 0; i < _clusters.size(); ++i) {
+        const auto &cluster = _clusters[i];
+        if (!cluster.used || now - cluster.lastSeen > kClusterExpiry) {
+            continue;
+        }
+
+        // Why the source didn't join the desired device is kept for the metrics
+        //
+        const auto score = Score(cluster, adv, i == _desired ? &_desiredRejection : nullptr);
+        if (score.has_value() && (!best.has_value() || score.value() > bestScore)) {
+            best = i;
+            bestScore = score.value();
+        }
+    }
 
-    return (*iter).second;
+    if (best.has_value()) {
+        LOG(Trace, "Tracker: New source joined cluster '{}'. Score: {:.2f}",
+            _clusters[best.value()].id, bestScore);
+        return best.value();
+    }
+    return AllocateCluster(adv);
+}
+
+std::optional<double> Tracker::Score(
+    const Cluster &cluster, const Advertisement &adv,
+    std::optional<Metrics::DropReason> *rejection) const
+{
+    const auto reject = [&](Metrics::DropReason reason) -> std::optional<double> {
+        if (rejection != nullptr) {
+            *rejection = reason;
+        }
+        return std::nullopt;
+    };
+
+    const auto &advState = adv.GetAdvState();
+
+    if (advState.model != cluster.model || advState.color != cluster.color) {
+        return reject(Metrics::DropReason::ModelMismatch);
+    }
+
+    double score = 0;
+
+    // The battery changes in steps of 10, so the data of the same device in a short time
+    // can not differ more than that
+    //
+    const auto isContinuous = [&](const Battery &lhs, const Battery &rhs) {
+        if (!lhs.Available() || !rhs.Available()) {
+            return true;
+        }
+        const auto diff = lhs.Value() > rhs.Value() ? lhs.Value() - rhs.Value()
+                                                    : rhs.Value() - lhs.Value();
+        if (diff > kMaxBatteryStep) {
+            return false;
+        }
+        score += diff == 0 ? 2 : 1;
+        return true;
+    };
+
+    if (!isContinuous(advState.pods.left.battery, cluster.pods.left) ||
+        !isContinuous(advState.pods.right.battery, cluster.pods.right) ||
+        !isContinuous(advState.caseBox.battery, cluster.caseBox))
+    {
+        return reject(Metrics::DropReason::BatteryDiff);
+    }
+
+    const auto rssiDiff = std::abs(adv.GetRssi() - cluster.rssi);
+    if (rssiDiff > kMaxRssiJump) {
+        return reject(Metrics::DropReason::RssiDiff);
+    }
+    score += 3 * (1 - rssiDiff / kMaxRssiJump);
+
+    return score;
+}
+
+size_t Tracker::AllocateCluster(const Advertisement &adv)
+{
+    const auto now = adv.GetTimestamp();
+
+    // Prefer a free or expired slot, otherwise evict the least recently seen one
+    //
+    std::optional<size_t> victim;
+    for (size_t i = 0; i < _clusters.size(); ++i) {
+        const auto &cluster = _clusters[i];
+        if (!cluster.used || now - cluster.lastSeen > kClusterExpiry) {
+            victim = i;
+            break;
+        }
+        if (i != _desired &&
+            (!victim.has_value() || cluster.lastSeen < _clusters[victim.value()].lastSeen))
+        {
+            victim = i;
+        }
+    }
+    APD_ASSERT(victim.has_value());
+
+    if (_desired == victim) {
+        _desired.reset();
+    }
+
+    const auto &advState = adv.GetAdvState();
+
+    auto &cluster = _clusters[victim.value()];
+    cluster = Cluster{
+        .id = _nextClusterId++,
+        .used = true,
+        .model = advState.model,
+        .color = advState.color,
+        .rssi = static_cast<double>(adv.GetRssi()),
+    };
+
+    LOG(Trace, "Tracker: New cluster '{}'. Model: {}", cluster.id,
+        Helper::ToString(cluster.model));
+
+    Metrics::Set(
+        Metrics::Gauge::TrackedClusters,
+        std::ranges::count_if(_clusters, [&](const Cluster &cluster) {
+            return cluster.used && now - cluster.lastSeen <= kClusterExpiry;
+        }));
+
+    return victim.value();
+}
+
+void Tracker::UpdateCluster(Cluster &cluster, const Advertisement &adv, double rssi)
+{
+    const auto &advState = adv.GetAdvState();
+
+    if (advState.pods.left.battery.Available()) {
+        cluster.pods.left = advState.pods.left.battery;
+    }
+    if (advState.pods.right.battery.Available()) {
+        cluster.pods.right = advState.pods.right.battery;
+    }
+    if (advState.caseBox.battery.Available()) {
+        cluster.caseBox = advState.caseBox.battery;
+    }
+
+    cluster.rssi = rssi;
+    cluster.lastSeen = adv.GetTimestamp();
+    ++cluster.hits;
+}
+
+void Tracker::UpdateDesired(size_t index, Timestamp now)
+{
+    if (_desired == index) {
+        return;
+    }
+
+    // Nothing to compete with, accept it at once to cut the time to the first state. It must be
+    // strong enough still, a distant device taken first would hold off the user's own until they
+    // have enough hits and margin to take over.
+    //
+    const auto &cluster = _clusters[index];
+    if (!IsCandidate(cluster, _desired.has_value() ? kMinHits : 0)) {
+        return;
+    }
+
+    if (_desired.has_value()) {
+        const auto &desired = _clusters[_desired.value()];
+        if (now - desired.lastSeen <= kDesiredPresence &&
+            cluster.rssi < desired.rssi + kSwitchMarginRssi)
+        {
+            return;
+        }
+    }
+
+    LOG(Info, "Tracker: Desired device changed to cluster '{}'. RSSI: {:.1f}", cluster.id,
+        cluster.rssi);
+    _desired = index;
+}
+
+bool Tracker::IsCandidate(const Cluster &cluster, uint32_t minHits) const
+{
+    return cluster.used && cluster.hits >= minHits && cluster.rssi >= _rssiMin &&
+           (_desiredModel == Model::Unknown || cluster.model == _desiredModel);
 }
 
 //
 // StateManager
 //
 
-StateManager::StateManager()
+StateManager::StateManager(bool isLive) : _isLive{isLive}
 {
-    _lostTimer.Start(10s, [this] {
+    if (!_isLive) {
+        return;
+    }
+
+    _lostTimer.Start(_timeoutMax, [this] {
         std::lock_guard<std::mutex> lock{_mutex};
         DoLost();
     });
 
-    _stateResetTimer.left.Start(10s, [this] {
+    _stateResetTimer.left.Start(_timeoutMax, [this] {
         std::lock_guard<std::mutex> lock{_mutex};
         DoStateReset(Side::Left);
     });
 
-    _stateResetTimer.right.Start(10s, [this] {
+    _stateResetTimer.right.Start(_timeoutMax, [this] {
         std::lock_guard<std::mutex> lock{_mutex};
         DoStateReset(Side::Right);
     });
@@ -162,20 +691,61 @@ StateManager::StateManager()
 std::optional<State> StateManager::GetCurrentState() const
 {
     std::lock_guard<std::mutex> lock{_mutex};
-    return _cachedState;
+
+    if (!_cachedState.has_value()) {
+        return std::nullopt;
+    }
+    return _cachedState->ToState();
+}
+
+void StateManager::AdvanceTo(Advertisement::Timestamp now)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    APD_ASSERT(!_isLive);
+
+    if (_lostDeadline.has_value() && now >= _lostDeadline.value()) {
+        _lostDeadline.reset();
+        DoLost();
+    }
+
+    for (const auto side : {Side::Left, Side::Right}) {
+        auto &deadline = side == Side::Left ? _stateResetDeadline.left : _stateResetDeadline.right;
+        if (deadline.has_value() && now >= deadline.value()) {
+            deadline.reset();
+            DoStateReset(side);
+        }
+    }
 }
 
-auto StateManager::OnAdvReceived(Advertisement adv) -> std::optional<UpdateEvent>
+auto StateManager::OnAdvReceived(const Advertisement &adv, bool repeated) -> AdvResult
 {
     std::lock_guard<std::mutex> lock{_mutex};
 
+    const auto lastTrackedCluster = _trackedCluster;
+
     if (!IsPossibleDesiredAdv(adv)) {
-        LOG(Warn, "This adv may not be broadcast from the device we desire.");
-        return std::nullopt;
+        return {};
+    }
+
+    // The state can only change if the side is now picked from another source or has been
+    // reset, otherwise building and comparing it is skipped
+    //
+    const auto &lastAdv = adv.GetAdvState().side == Side::Left ? _adv.left : _adv.right;
+    const bool unchanged = repeated && lastTrackedCluster == _trackedCluster &&
+                           lastAdv.has_value() && lastAdv->first.GetAddress() == adv.GetAddress();
+
+    UpdateAdv(adv);
+
+    if (unchanged) {
+        return {.accepted = true};
     }
 
-    UpdateAdv(std::move(adv));
-    return UpdateState();
+    auto updateEvent = UpdateState();
+    if (updateEvent.has_value()) {
+        Metrics::Increment(Metrics::Counter::AcceptedUpdates);
+    }
+    return {.accepted = true, .updateEvent = std::move(updateEvent)};
 }
 
 void StateManager::Disconnect()
@@ -190,107 +760,116 @@ void StateManager::OnRssiMinChanged(int16_t rssiMin)
 {
     std::lock_guard<std::mutex> lock{_mutex};
     _rssiMin = rssiMin;
+    _tracker.SetRssiMin(rssiMin);
 }
 
-bool StateManager::IsPossibleDesiredAdv(const Advertisement &adv) const
+void StateManager::OnDesiredModelChanged(Model model)
 {
-    const auto advRssi = adv.GetRssi();
-    if (advRssi < _rssiMin) {
-        LOG(Warn,
-            "IsPossibleDesiredAdv returns false. Reason: RSSI is less than the limit. "
-            "curr: '{}' min: '{}'",
-            advRssi, _rssiMin);
-        return false;
-    }
+    std::lock_guard<std::mutex> lock{_mutex};
 
-    const auto &advState = adv.GetAdvState();
+    LOG(Info, "StateManager: Desired model: {}", Helper::ToString(model));
+    _tracker.SetDesiredModel(model);
+}
 
-    auto &lastAdv = advState.side == Side::Left ? _adv.left : _adv.right;
-    auto &lastAnotherAdv = advState.side == Side::Left ? _adv.right : _adv.left;
+void StateManager::OnStateTimeoutChanged(
+    std::chrono::milliseconds min, std::chrono::milliseconds max)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    _timeoutMax = max;
+    _timeoutMin = std::min(min, max);
+}
 
-    // If the Random Non-resolvable Address of our devices is changed
-    // or the packet is sent from another device that it isn't ours
+bool StateManager::IsPossibleDesiredAdv(const Advertisement &adv)
+{
+    // Every packet is fed to the tracker, even the weak ones, to keep the clusters accurate
     //
-    if (lastAdv.has_value() && lastAdv->first.GetAddress() != adv.GetAddress()) {
-        const auto &lastAdvState = lastAdv->first.GetAdvState();
-
-        if (advState.model != lastAdvState.model) {
-            LOG(Warn, "IsPossibleDesiredAdv returns false. Reason: model new='{}' old='{}'",
-                Helper::ToString(advState.model), Helper::ToString(lastAdvState.model));
-            return false;
-        }
-
-        Battery::ValueType leftBatteryDiff = 0, rightBatteryDiff = 0, caseBatteryDiff = 0;
-
-        using SignedBatteryValueT = std::make_signed_t<Battery::ValueType>;
-
-        if (advState.pods.left.battery.Available() && lastAdvState.pods.left.battery.Available()) {
-            leftBatteryDiff = std::abs(
-                static_cast<SignedBatteryValueT>(advState.pods.left.battery.Value()) -
-                static_cast<SignedBatteryValueT>(lastAdvState.pods.left.battery.Value()));
-        }
-        if (advState.pods.right.battery.Available() && lastAdvState.pods.right.battery.Available())
-        {
-            rightBatteryDiff = std::abs(
-                static_cast<SignedBatteryValueT>(advState.pods.right.battery.Value()) -
-                static_cast<SignedBatteryValueT>(lastAdvState.pods.right.battery.Value()));
-        }
-        if (advState.caseBox.battery.Available() && lastAdvState.caseBox.battery.Available()) {
-            caseBatteryDiff = std::abs(
-                static_cast<SignedBatteryValueT>(advState.caseBox.battery.Value()) -
-                static_cast<SignedBatteryValueT>(lastAdvState.caseBox.battery.Value()));
-        }
-
-        // The battery changes in steps of 1, so the data of two packets in a short time
-        // can not exceed 1, otherwise it is not our device
-        //
-        if (leftBatteryDiff > 1 || rightBatteryDiff > 1 || caseBatteryDiff > 1) {
-            LOG(Warn,
-                "IsPossibleDesiredAdv returns false. Reason: BatteryDiff l='{}' r='{}' c='{}'",
-                leftBatteryDiff, rightBatteryDiff, caseBatteryDiff);
-            return false;
-        }
-
-        int16_t rssiDiff = std::abs(advRssi - lastAdv->first.GetRssi());
-        if (rssiDiff > 50) {
-            LOG(Warn, "IsPossibleDesiredAdv returns false. Reason: Current side rssiDiff '{}'",
-                rssiDiff);
-            return false;
-        }
+    const auto result = _tracker.Feed(adv);
+    if (!result.isDesired) {
+        LOG(Trace, "IsPossibleDesiredAdv returns false. Reason: Not from the desired device.");
+        Metrics::Drop(result.dropReason);
+        return false;
+    }
 
-        LOG(Warn, "Address changed, but it might still be the same device.");
+    if (result.rssi < _rssiMin) {
+        Metrics::Drop(Metrics::DropReason::RssiTooLow);
+        LOG(Warn,
+            "IsPossibleDesiredAdv returns false. Reason: RSSI is less than the limit. "
+            "curr: '{}' filtered: '{:.1f}' min: '{}'",
+            adv.GetRssi(), result.rssi, _rssiMin);
+        return false;
     }
 
-    if (lastAnotherAdv.has_value()) {
-        int16_t rssiDiff = std::abs(advRssi - lastAnotherAdv->first.GetRssi());
-        if (rssiDiff > 50) {
-            LOG(Warn, "IsPossibleDesiredAdv returns false. Reason: Another side rssiDiff '{}'",
-                rssiDiff);
-            return false;
-        }
+    // The states of the previous device must not be mixed into the new one
+    //
+    const auto cluster = _tracker.GetDesiredCluster();
+    if (_trackedCluster.has_value() && _trackedCluster != cluster) {
+        LOG(Info, "StateManager: Tracked device changed.");
+        _adv.left.reset();
+        _adv.right.reset();
     }
+    _trackedCluster = cluster;
 
     return true;
 }
 
-void StateManager::UpdateAdv(Advertisement adv)
+void StateManager::UpdateAdv(const Advertisement &adv)
 {
-    _lostTimer.Reset();
+    // The deadlines follow the learned advertising cadence, so a device out of range is lost
+    // quickly, while a device advertising slowly (e.g. with the lid closed) is not reset
+    //
+    const auto timestamp = adv.GetTimestamp();
+
+    _lostCadence.Update(timestamp, _timeoutMax);
+    const auto lostTimeout = _lostCadence.GetTimeout(_timeoutMin, _timeoutMax);
+    if (_isLive) {
+        _lostTimer.Reset(lostTimeout);
+    }
+    else {
+        _lostDeadline = timestamp + lostTimeout;
+    }
 
     const auto &advState = adv.GetAdvState();
 
+    auto &cadence = advState.side == Side::Left ? _stateResetCadence.left
+                                                : _stateResetCadence.right;
+    cadence.Update(timestamp, _timeoutMax);
+
+    const auto resetTimeout = cadence.GetTimeout(_timeoutMin, _timeoutMax);
+
+    // The sides are ordered by the reception time, which is the same on a replay
+    //
     if (advState.side == Side::Left) {
-        _stateResetTimer.left.Reset();
-        _adv.left = std::make_pair(std::move(adv), Clock::now());
+        if (_isLive) {
+            _stateResetTimer.left.Reset(resetTimeout);
+        }
+        else {
+            _stateResetDeadline.left = timestamp + resetTimeout;
+        }
+        _adv.left = std::make_pair(adv, timestamp);
     }
     else if (advState.side == Side::Right) {
-        _stateResetTimer.right.Reset();
-        _adv.right = std::make_pair(std::move(adv), Clock::now());
+        if (_isLive) {
+            _stateResetTimer.right.Reset(resetTimeout);
+        }
+        else {
+            _stateResetDeadline.right = timestamp + resetTimeout;
+        }
+        _adv.right = std::make_pair(adv, timestamp);
     }
+
+    LOG(Trace,
+        "Learned cadence. Side: {}, Mean: {}ms, Deviation: {}ms, Reset: {}ms. "
+        "Any side mean: {}ms, Deviation: {}ms, Lost: {}ms",
+        Helper::ToString(advState.side), cadence.GetMean().count(),
+        cadence.GetDeviation().count(), resetTimeout.count(), _lostCadence.GetMean().count(),
+        _lostCadence.GetDeviation().count(),
+        _lostCadence.GetTimeout(_timeoutMin, _timeoutMax).count());
 }
 
 auto StateManager::UpdateState() -> std::optional<UpdateEvent>
 {
+    APD_PROFILE_ZONE();
+
     Helper::Sides<std::pair<Advertisement::AdvState, Timestamp>> cachedAdvState;
 
     if (_adv.left.has_value()) {
@@ -325,25 +904,48 @@ auto StateManager::UpdateState() -> std::optional<UpdateEvent>
 
 #undef PICK_SIDE
 
-    if (newState == _cachedState) {
+    const StateBits newBits{newState};
+    if (newBits == _cachedState) {
         return std::nullopt;
     }
 
-    auto oldState = std::move(_cachedState);
-    _cachedState = std::move(newState);
+    const auto changedFields = _cachedState.has_value() ? _cachedState->Diff(newBits)
+                                                        : StateFields{StateField::All};
+
+    const auto oldState = _cachedState;
+    _cachedState = newBits;
 
-    return UpdateEvent{.oldState = std::move(oldState), .newState = _cachedState.value()};
+    const auto sideState = [&](const auto &adv) -> std::optional<StateBits> {
+        if (!adv.has_value()) {
+            return std::nullopt;
+        }
+        const auto &advState = adv->first.GetAdvState();
+        return StateBits{State{
+            .model = advState.model, .pods = advState.pods, .caseBox = advState.caseBox}};
+    };
+
+    return UpdateEvent{
+        .oldState = oldState,
+        .newState = newBits,
+        .changedFields = changedFields,
+        .sideStates = {.left = sideState(_adv.left), .right = sideState(_adv.right)},
+    };
 }
 
 void StateManager::ResetAll()
 {
     if (_cachedState.has_value()) {
-        ApdApp->GetMainWindow()->DisconnectSafely();
+        _cbLost.Invoke();
     }
 
     _adv.left.reset();
     _adv.right.reset();
     _cachedState.reset();
+    _trackedCluster.reset();
+
+    _lostCadence.Reset();
+    _stateResetCadence.left.Reset();
+    _stateResetCadence.right.Reset();
 }
 
 void StateManager::DoLost()
@@ -362,23 +964,302 @@ void StateManager::DoStateReset(Side side)
         adv.reset();
     }
 }
+
+//
+// StateMailbox
+//
+
+StateMailbox::StateMailbox(FnDeliver deliver) : _deliver{std::move(deliver)} {}
+
+StateMailbox::~StateMailbox()
+{
+    Helper::Scheduler::TaskPtr task;
+    {
+        std::lock_guard<std::mutex> lock{_deliverMutex};
+        task = std::move(_task);
+    }
+    if (task != nullptr) {
+        Helper::Scheduler::GetInstance().Cancel(task);
+    }
+}
+
+void StateMailbox::Post(
+    StateBits state, QString displayName, StateFields changedFields, bool urgent)
+{
+    // Merge the fields of the update that hasn't been delivered yet
+    //
+    const auto undelivered = _slot.exchange(nullptr);
+    if (undelivered != nullptr) {
+        changedFields |= undelivered->changedFields;
+    }
+    _slot.store(
+        std::make_shared<const Update>(Update{state, std::move(displayName), changedFields}));
+
+    if (urgent) {
+        Deliver();
+        return;
+    }
+
+    // A delivery is already scheduled, it will pick up the latest update
+    //
+    if (_pending.exchange(true)) {
+        return;
+    }
+
+    const auto now = Helper::Scheduler::Clock::now();
+    const auto deliverAt = _lastDelivery.load() + _minInterval.load();
+    if (deliverAt <= now) {
+        Deliver();
+        return;
+    }
+
+    // The previous task has already run or is about to find nothing to deliver. It's cancelled
+    // outside the lock, because it takes the lock itself.
+    //
+    Helper::Scheduler::TaskPtr previous;
+    {
+        std::lock_guard<std::mutex> lock{_deliverMutex};
+        previous = std::exchange(
+            _task, Helper::Scheduler::GetInstance().ScheduleOnce(
+                       std::chrono::duration_cast<std::chrono::milliseconds>(deliverAt - now),
+                       [this] { Deliver(); }));
+    }
+    if (previous != nullptr) {
+        Helper::Scheduler::GetInstance().Cancel(previous);
+    }
+}
+
+void StateMailbox::Clear()
+{
+    Helper::Scheduler::TaskPtr task;
+    {
+        // Waits for a delivery in progress, so nothing is delivered after this returns
+        //
+        std::lock_guard<std::mutex> lock{_deliverMutex};
+        task = std::move(_task);
+        _slot.store(nullptr);
+        _pending = false;
+    }
+    if (task != nullptr) {
+        Helper::Scheduler::GetInstance().Cancel(task);
+    }
+}
+
+void StateMailbox::SetMaxRate(uint32_t updatesPerSecond)
+{
+    _minInterval = updatesPerSecond == 0 ? std::chrono::milliseconds::zero()
+                                         : std::chrono::milliseconds{1000 / updatesPerSecond};
+}
+
+void StateMailbox::Deliver()
+{
+    std::lock_guard<std::mutex> lock{_deliverMutex};
+
+    // Cleared before taking the update, so that a later post schedules a new delivery
+    //
+    _pending = false;
+
+    const auto update = _slot.exchange(nullptr);
+    if (update == nullptr) {
+        return;
+    }
+
+    _lastDelivery = Helper::Scheduler::Clock::now();
+    // The full `State` for the GUI, limited to the update rate. The IPC clients get their own
+    // copy from `OnStateChanged` on every change.
+    //
+    _deliver(update->state.ToState(update->displayName), update->changedFields);
+}
+
+//////////////////////////////////////////////////
+// ActionExecutor
+//
+
+ActionExecutor::ActionExecutor() : _thread{&ActionExecutor::Run, this} {}
+
+ActionExecutor::~ActionExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _stop = true;
+    }
+    _conVar.notify_one();
+    _thread.join();
+}
+
+void ActionExecutor::Post(Kind kind, std::function<void()> action)
+{
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        auto &pending = _pending.at(Helper::ToUnderlying(kind));
+        if (pending) {
+            LOG(Trace, "ActionExecutor: Pending action of kind '{}' is replaced.",
+                Helper::ToUnderlying(kind));
+            _order.erase(std::find(_order.begin(), _order.end(), kind));
+        }
+        pending = std::move(action);
+        _order.push_back(kind);
+    }
+    _conVar.notify_one();
+}
+
+void ActionExecutor::Run()
+{
+    std::unique_lock<std::mutex> lock{_mutex};
+
+    while (true) {
+        _conVar.wait(lock, [this] { return _stop || !_order.empty(); });
+        if (_stop) {
+            return;
+        }
+
+        const auto kind = _order.front();
+        _order.pop_front();
+        auto action = std::move(_pending.at(Helper::ToUnderlying(kind)));
+        _pending.at(Helper::ToUnderlying(kind)) = nullptr;
+
+        lock.unlock();
+        action();
+        lock.lock();
+    }
+}
+
+//
+// TransitionDebouncer
+//
+
+TransitionDebouncer::TransitionDebouncer(FnExpired expired, std::optional<bool> immediate)
+    : _immediate{immediate}, _task{std::make_shared<Helper::Scheduler::Task>()}
+{
+    // Make sure the scheduler outlives us, the task is cancelled in the destructor
+    //
+    Helper::Scheduler::GetInstance();
+
+    _task->callback = std::move(expired);
+}
+
+TransitionDebouncer::~TransitionDebouncer()
+{
+    Helper::Scheduler::GetInstance().Cancel(_task);
+}
+
+std::optional<bool> TransitionDebouncer::Feed(bool value, bool agreed)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    if (!_committed.has_value()) {
+        _committed = value;
+        return std::nullopt;
+    }
+
+    if (value == _committed) {
+        if (_pending.has_value()) {
+            LOG(Trace, "TransitionDebouncer: Transition to '{}' cancelled.", _pending.value());
+            _pending.reset();
+        }
+        return std::nullopt;
+    }
+
+    if (agreed || value == _immediate || _window.count() == 0) {
+        _committed = value;
+        _pending.reset();
+        return value;
+    }
+
+    // The task isn't cancelled on flipping back, `Expire` checks the pending transition anyway
+    //
+    if (!_pending.has_value()) {
+        _pending = value;
+        _pendingSince = Helper::Scheduler::Clock::now();
+        _task->deadline = _pendingSince + _window;
+        Helper::Scheduler::GetInstance().Schedule(_task);
+    }
+    return std::nullopt;
+}
+
+std::optional<bool> TransitionDebouncer::Expire()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    if (!_pending.has_value() || Helper::Scheduler::Clock::now() < _pendingSince + _window) {
+        return std::nullopt;
+    }
+
+    _committed = _pending;
+    _pending.reset();
+    return _committed;
+}
+
+void TransitionDebouncer::Reset(std::optional<bool> committed)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    _committed = committed;
+    _pending.reset();
+}
+
+void TransitionDebouncer::SetWindow(std::chrono::milliseconds window)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    _window = window;
+    if (_pending.has_value()) {
+        _task->deadline = _pendingSince + _window;
+        Helper::Scheduler::GetInstance().Schedule(_task);
+    }
+}
+
 } // namespace Details
 
 //
 // Manager
 //
 
-Manager::Manager()
+Manager::Manager(Observer *observer)
+    : _observer{observer},
+      _stateMailbox{[this](const State &state, StateFields changedFields) {
+          Notify(&Observer::OnStateUpdated, state, changedFields);
+      }},
+      // The popup is expected as soon as the lid is opened, only closing it is debounced
+      //
+      _lidDebouncer{
+          [this] {
+              Metrics::ManagerLockGuard lock{_mutex};
+              OnTransitionExpired();
+          },
+          true},
+      _inEarDebouncer{[this] {
+          Metrics::ManagerLockGuard lock{_mutex};
+          OnTransitionExpired();
+      }},
+      _adWatcher{Bluetooth::AdvertisementWatcher::ManufacturerDataFilter{
+          AppleCP::VendorId, {Helper::ToUnderlying(AppleCP::PacketType::ProximityPairing)}}}
 {
+    // The state still waiting for the limiter must not be delivered after the disconnection
+    //
+    _stateMgr.CbLost() += [this] {
+        _stateMailbox.Clear();
+        PublishStatus("Disconnected");
+        Notify(&Observer::OnDisconnected);
+    };
+
     _adWatcher.CbReceived() += [this](auto &&...args) {
-        std::lock_guard<std::mutex> lock{_mutex};
+        Metrics::ManagerLockGuard lock{_mutex};
         OnAdvertisementReceived(std::forward<decltype(args)>(args)...);
     };
 
     _adWatcher.CbStateChanged() += [this](auto &&...args) {
-        std::lock_guard<std::mutex> lock{_mutex};
+        Metrics::ManagerLockGuard lock{_mutex};
         OnAdvWatcherStateChanged(std::forward<decltype(args)>(args)...);
     };
+
+    _metricsSummaryTimer.Start(kMetricsSummaryInterval, [] {
+        const auto summary = Metrics::Summary();
+        if (!summary.empty()) {
+            LOG(Info, "Metrics: {}", summary);
+        }
+    });
 }
 
 void Manager::StartScanner()
@@ -389,6 +1270,18 @@ void Manager::StartScanner()
     else {
         LOG(Info, "Bluetooth AdvWatcher start succeeded.");
     }
+    ApdApplication::MarkStartupPhase("Advertisement watcher started");
+}
+
+void Manager::StartCapture(const QString &path)
+{
+    auto capture = std::make_unique<AdvCapture::Writer>(path);
+    if (!capture->IsOpen()) {
+        return;
+    }
+
+    Metrics::ManagerLockGuard lock{_mutex};
+    _capture = std::move(capture);
 }
 
 void Manager::StopScanner()
@@ -403,27 +1296,62 @@ void Manager::StopScanner()
 
 void Manager::OnRssiMinChanged(int16_t rssiMin)
 {
-    std::lock_guard<std::mutex> lock{_mutex};
+    Metrics::ManagerLockGuard lock{_mutex};
     _stateMgr.OnRssiMinChanged(rssiMin);
 }
 
+void Manager::OnStateTimeoutChanged(std::chrono::milliseconds min, std::chrono::milliseconds max)
+{
+    Metrics::ManagerLockGuard lock{_mutex};
+    _stateMgr.OnStateTimeoutChanged(min, max);
+}
+
+void Manager::OnStateUpdateRateChanged(uint32_t updatesPerSecond)
+{
+    _stateMailbox.SetMaxRate(updatesPerSecond);
+}
+
+void Manager::OnTransitionDebounceChanged(std::chrono::milliseconds window)
+{
+    _lidDebouncer.SetWindow(window);
+    _inEarDebouncer.SetWindow(window);
+}
+
 void Manager::OnAutomaticEarDetectionChanged(bool enable)
 {
-    std::lock_guard<std::mutex> lock{_mutex};
+    Metrics::ManagerLockGuard lock{_mutex};
     _automaticEarDetection = enable;
 }
 
 void Manager::OnBoundDeviceAddressChanged(uint64_t address)
 {
-    std::unique_lock<std::mutex> lock{_mutex};
+    std::unique_lock<decltype(_mutex)> lock{_mutex};
 
+    // The callbacks are shared by all handles of the device, so they must be unregistered
+    //
+    if (_boundDevice.has_value()) {
+        _boundDevice->CbConnectionStatusChanged().Unregister(_boundDeviceCbHandle);
+    }
     _boundDevice.reset();
     _deviceConnected = false;
+    _boundModel = Model::Unknown;
     _stateMgr.Disconnect();
+    _stateMailbox.Clear();
+    _adWatcher.SetScanMode(Bluetooth::AdvertisementWatcher::ScanMode::LowPower);
+
+    // Results of the lookups started before are discarded
+    //
+    const auto bindGeneration = ++_bindGeneration;
 
     // Unbind device
     //
     if (address == 0) {
+        _stateMgr.OnDesiredModelChanged(Model::Unknown);
+        Notify(&Observer::OnBoundModelChanged, std::nullopt);
+        if (const auto &controller = ApdApp->GetLowAudioLatencyController()) {
+            controller->BoundDeviceChangedSafely(QUuid{}, false);
+        }
+        PublishStatus("Unbind");
         LOG(Info, "Unbind device.");
         return;
     }
@@ -431,8 +1359,23 @@ void Manager::OnBoundDeviceAddressChanged(uint64_t address)
     // Bind to a new device
     //
     LOG(Info, "Bind a new device.");
+    PublishStatus("Disconnected");
+
+    lock.unlock();
+
+    Bluetooth::DeviceManager::FindDevice(
+        address, [this, bindGeneration](std::optional<Bluetooth::Device> optDevice) {
+            Metrics::ManagerLockGuard lock{_mutex};
+            if (bindGeneration != _bindGeneration) {
+                LOG(Info, "The bound device has been changed, discard the lookup result.");
+                return;
+            }
+            OnBoundDeviceFound(std::move(optDevice));
+        });
+}
 
-    auto optDevice = Bluetooth::DeviceManager::FindDevice(address);
+void Manager::OnBoundDeviceFound(std::optional<Bluetooth::Device> optDevice)
+{
     if (!optDevice.has_value()) {
         LOG(Error, "Find device by address failed.");
         return;
@@ -440,16 +1383,29 @@ void Manager::OnBoundDeviceAddressChanged(uint64_t address)
 
     _boundDevice = std::move(optDevice);
 
+    const auto model = AirPods::FindModelById(_boundDevice->GetProductId());
+    _boundModel = model;
+    _stateMgr.OnDesiredModelChanged(model);
+    Notify(
+        &Observer::OnBoundModelChanged,
+        model != Model::Unknown ? std::optional<Model>{model} : std::nullopt);
+
     _deviceName = QString::fromStdString([&] {
         auto name = _boundDevice->GetName();
         // See https://github.com/SpriteOvO/AirPodsDesktop/issues/15
         return name.find("Bluetooth") != std::string::npos ? std::string{} : name;
     }());
 
-    _boundDevice->CbConnectionStatusChanged() += [this](auto &&...args) {
-        std::lock_guard<std::mutex> lock{_mutex};
-        OnBoundDeviceConnectionStateChanged(std::forward<decltype(args)>(args)...);
-    };
+    _boundDeviceCbHandle = _boundDevice->CbConnectionStatusChanged().Register(
+        [this, bindGeneration = _bindGeneration](auto &&...args) {
+            Metrics::ManagerLockGuard lock{_mutex};
+            // An invocation in flight may still arrive after being unregistered
+            //
+            if (bindGeneration != _bindGeneration) {
+                return;
+            }
+            OnBoundDeviceConnectionStateChanged(std::forward<decltype(args)>(args)...);
+        });
 
     OnBoundDeviceConnectionStateChanged(_boundDevice->GetConnectionState());
 
@@ -467,6 +1423,18 @@ void Manager::OnBoundDeviceConnectionStateChanged(Bluetooth::DeviceState state)
         _stateMgr.Disconnect();
     }
 
+    // Nothing is shown for a disconnected device, so the scan only needs to be good enough to
+    // notice the lid being opened until the device connects
+    //
+    _adWatcher.SetScanMode(
+        newDeviceConnected || std::chrono::steady_clock::now() < _scanBoostUntil
+            ? Bluetooth::AdvertisementWatcher::ScanMode::Full
+            : Bluetooth::AdvertisementWatcher::ScanMode::LowPower);
+
+    if (const auto &controller = ApdApp->GetLowAudioLatencyController()) {
+        controller->BoundDeviceChangedSafely(_boundDevice->GetContainerId(), newDeviceConnected);
+    }
+
     LOG(Info, "The device we bound is updated. state: {}, current: {}, new: {}", state, _deviceConnected,
         newDeviceConnected);
 }
@@ -474,48 +1442,101 @@ void Manager::OnBoundDeviceConnectionStateChanged(Bluetooth::DeviceState state)
 void Manager::OnStateChanged(Details::StateManager::UpdateEvent updateEvent)
 {
     const auto &oldState = updateEvent.oldState;
-    auto &newState = updateEvent.newState;
+    const auto &newState = updateEvent.newState;
 
-    newState.displayName =
-        _deviceName.isEmpty() ? Helper::ToString(newState.model) : _deviceName.remove(" - Find My");
+    const QString displayName = _deviceName.isEmpty() ? Helper::ToString(newState.GetModel())
+                                                      : _deviceName.remove(" - Find My");
 
-    ApdApp->GetMainWindow()->UpdateStateSafely(newState);
+    if (!oldState.has_value() || displayName != _deliveredDisplayName) {
+        updateEvent.changedFields |= StateField::DisplayName;
+        _deliveredDisplayName = displayName;
+    }
 
-    // Lid opened
+    // The state is assembled from whichever side broadcast most recently, so the transitions are
+    // debounced unless both sides agree on them
     //
-    bool newLidOpened = newState.caseBox.isLidOpened && newState.caseBox.isBothPodsInCase;
-    bool lidStateSwitched;
+    const auto &sides = updateEvent.sideStates;
+    const auto agreed = [&](auto predicate, bool value) {
+        return sides.left.has_value() && sides.right.has_value() &&
+               predicate(sides.left.value()) == value && predicate(sides.right.value()) == value;
+    };
+    const auto lidOpened = [](const StateBits &state) {
+        return state.IsLidOpened() && state.IsBothPodsInCase();
+    };
+    const auto bothInEar = [](const StateBits &state) { return state.IsBothInEar(); };
+
     if (!oldState.has_value()) {
-        lidStateSwitched = newLidOpened;
-    }
-    else {
-        bool oldLidOpened = oldState->caseBox.isLidOpened && oldState->caseBox.isBothPodsInCase;
-        lidStateSwitched = oldLidOpened != newLidOpened;
+        _lidDebouncer.Reset(false);
+        _inEarDebouncer.Reset();
     }
+
+    // Lid opened
+    //
+    const bool newLidOpened = lidOpened(newState);
+    const auto lidCommit = _lidDebouncer.Feed(newLidOpened, agreed(lidOpened, newLidOpened));
+    const bool lidStateSwitched = lidCommit.has_value();
+
+    // Recorded before the state is posted, so the GUI predicts from it
+    //
+    BatteryHistory::Record(newState);
+
+    Latency::Record(Latency::Stage::StateChanged, _advOrigin);
+    Latency::Handoff(Latency::Stage::GuiDispatch, _advOrigin);
+
+    // The popup shows the state, so the lid events are not rate limited
+    //
+    _stateMailbox.Post(newState, displayName, updateEvent.changedFields, lidStateSwitched);
+
+    // Unlike the GUI, the local tools get every update with its own changed fields
+    //
+    ApdApp->GetIpcServer()->PublishStateSafely(
+        newState.ToState(displayName), updateEvent.changedFields);
+
     if (lidStateSwitched) {
-        OnLidOpened(newLidOpened);
+        OnLidOpened(lidCommit.value());
     }
 
     // Both in ear
     //
-    if (oldState.has_value()) {
-        bool oldBothInEar = oldState->pods.left.isInEar && oldState->pods.right.isInEar;
-        bool newBothInEar = newState.pods.left.isInEar && newState.pods.right.isInEar;
-        if (oldBothInEar != newBothInEar) {
-            OnBothInEar(newBothInEar);
-        }
+    const bool newBothInEar = bothInEar(newState);
+    const auto inEarCommit = _inEarDebouncer.Feed(newBothInEar, agreed(bothInEar, newBothInEar));
+    if (inEarCommit.has_value()) {
+        OnBothInEar(inEarCommit.value());
+    }
+}
+
+void Manager::OnTransitionExpired()
+{
+    // A transition still pending when the state was lost is dropped
+    //
+    if (!_stateMgr.GetCurrentState().has_value()) {
+        _lidDebouncer.Reset();
+        _inEarDebouncer.Reset();
+        return;
     }
+
+    if (const auto opened = _lidDebouncer.Expire()) {
+        OnLidOpened(opened.value());
+    }
+    if (const auto isBothInEar = _inEarDebouncer.Expire()) {
+        OnBothInEar(isBothInEar.value());
+    }
+}
+
+// The local tools get the status from here rather than from the GUI, so that they get it in the
+// headless mode too. The literals are the protocol, they are not translated.
+//
+void Manager::PublishStatus(const QString &status)
+{
+    ApdApp->GetIpcServer()->PublishStatusSafely(status);
 }
 
 void Manager::OnLidOpened(bool opened)
 {
-    auto &mainWindow = ApdApp->GetMainWindow();
     if (opened) {
-        mainWindow->ShowSafely();
-    }
-    else {
-        mainWindow->HideSafely();
+        Latency::Handoff(Latency::Stage::WindowShown, _advOrigin);
     }
+    Notify(&Observer::OnLidOpened, opened);
 }
 
 void Manager::OnBothInEar(bool isBothInEar)
@@ -525,48 +1546,140 @@ void Manager::OnBothInEar(bool isBothInEar)
         return;
     }
 
-    if (isBothInEar) {
-        Core::GlobalMedia::Play();
-    }
-    else {
-        Core::GlobalMedia::Pause();
-    }
+    // Controlling the media players may take a while, the advertisements are not held up by it
+    //
+    _actionExecutor.Post(
+        Details::ActionExecutor::Kind::Media, [isBothInEar, origin = _advOrigin] {
+            if (isBothInEar) {
+                Core::GlobalMedia::Play();
+            }
+            else {
+                Core::GlobalMedia::Pause();
+            }
+            Latency::Record(Latency::Stage::MediaAction, origin);
+        });
 }
 
 bool Manager::OnAdvertisementReceived(const Bluetooth::AdvertisementWatcher::ReceivedData &data)
 {
-    if (!Details::Advertisement::IsDesiredAdv(data)) {
+    APD_PROFILE_ZONE();
+
+    Metrics::Increment(Metrics::Counter::PacketsReceived);
+
+    const auto optManufacturerData = data.FindManufacturerData(AppleCP::VendorId);
+    if (!optManufacturerData.has_value()) {
+        Metrics::Drop(Metrics::DropReason::NonApple);
         return false;
     }
 
-    Details::Advertisement adv{data};
+    _advOrigin = data.originTime;
+    ApdApplication::MarkStartupPhase("First Apple advertisement received");
 
-    LOG(Trace, "AirPods advertisement received. Data: {}, Address Hash: {}, RSSI: {}",
-        Helper::ToString(adv.GetDesensitizedData()), Helper::Hash(data.address), data.rssi);
+    if (_capture) {
+        _capture->Append(data, optManufacturerData.value());
+    }
+
+    const auto &manufacturerData = optManufacturerData.value();
+    const auto hash = Helper::Hash(std::string_view{
+        reinterpret_cast<const char *>(manufacturerData.data()), manufacturerData.size()});
+
+    // AirPods repeat the same payload many times per second, the repeats skip the decoding and
+    // only count toward the liveness
+    //
+    auto iter = _payloadCache.find(data.address);
+    if (iter != _payloadCache.end() && iter->second.hash == hash) {
+        if (!_deviceConnected) {
+            Metrics::Drop(Metrics::DropReason::Disconnected);
+            return false;
+        }
+
+        auto &entry = iter->second;
+        entry.lastSeen = data.timestamp;
+        auto result = _stateMgr.OnAdvReceived(entry.adv.Repeat(data), entry.accepted);
+        entry.accepted = result.accepted;
+        if (result.accepted) {
+            Latency::Record(Latency::Stage::StateAccepted, _advOrigin);
+        }
+        if (result.updateEvent.has_value()) {
+            OnStateChanged(std::move(result.updateEvent.value()));
+        }
+        return true;
+    }
+
+    const auto optAdv = Details::Advertisement::Decode(data);
+    if (!optAdv.has_value()) {
+        Metrics::Drop(Metrics::DropReason::InvalidPacket);
+        return false;
+    }
+    Latency::Record(Latency::Stage::Decode, _advOrigin);
+
+    const auto &adv = optAdv.value();
 
     if (!_deviceConnected) {
-        LOG(Info, "AirPods advertisement received, but device disconnected.");
+        LOG(Trace, "AirPods advertisement received, but device disconnected.");
+        Metrics::Drop(Metrics::DropReason::Disconnected);
+        OnDisconnectedAdvReceived(adv);
         return false;
     }
 
-    auto optUpdateEvent = _stateMgr.OnAdvReceived(Details::Advertisement{data});
-    if (optUpdateEvent.has_value()) {
-        OnStateChanged(std::move(optUpdateEvent.value()));
+    auto result = _stateMgr.OnAdvReceived(adv);
+    if (result.accepted) {
+        Latency::Record(Latency::Stage::StateAccepted, _advOrigin);
+    }
+
+    PayloadCacheEntry entry{hash, adv, result.accepted, data.timestamp};
+    if (iter != _payloadCache.end()) {
+        iter->second = std::move(entry);
+    }
+    else {
+        if (_payloadCache.size() >= kMaxPayloadCache) {
+            _payloadCache.erase(std::ranges::min_element(_payloadCache, {}, [](const auto &pair) {
+                return pair.second.lastSeen;
+            }));
+        }
+        _payloadCache.emplace(data.address, std::move(entry));
+    }
+
+    if (result.updateEvent.has_value()) {
+        OnStateChanged(std::move(result.updateEvent.value()));
     }
     return true;
 }
 
+// The lid opening is the earliest sign that the device is about to connect, the full scan is
+// switched on right away so that the first state is there as soon as the connection completes
+//
+void Manager::OnDisconnectedAdvReceived(const Details::Advertisement &adv)
+{
+    using ScanMode = Bluetooth::AdvertisementWatcher::ScanMode;
+
+    const auto &advState = adv.GetAdvState();
+    const auto now = std::chrono::steady_clock::now();
+
+    if (advState.caseBox.isLidOpened &&
+        (_boundModel == Model::Unknown || advState.model == _boundModel))
+    {
+        _scanBoostUntil = now + kScanBoostDuration;
+        _adWatcher.SetScanMode(ScanMode::Full);
+    }
+    else if (now >= _scanBoostUntil) {
+        _adWatcher.SetScanMode(ScanMode::LowPower);
+    }
+}
+
 void Manager::OnAdvWatcherStateChanged(
     Bluetooth::AdvertisementWatcher::State state, const std::optional<std::string> &optError)
 {
     switch (state) {
     case Core::Bluetooth::AdvertisementWatcher::State::Started:
-        ApdApp->GetMainWindow()->AvailableSafely();
+        Notify(&Observer::OnAvailable);
         LOG(Info, "Bluetooth AdvWatcher started.");
         break;
 
     case Core::Bluetooth::AdvertisementWatcher::State::Stopped:
-        ApdApp->GetMainWindow()->UnavailableSafely();
+        _stateMailbox.Clear();
+        PublishStatus("Unavailable");
+        Notify(&Observer::OnUnavailable);
         LOG(Warn, "Bluetooth AdvWatcher stopped. Error: '{}'.", optError.value_or("nullopt"));
         break;
 
@@ -575,33 +1688,34 @@ void Manager::OnAdvWatcherStateChanged(
     }
 }
 
-std::vector<Bluetooth::Device> GetDevices()
+void GetDevices(Bluetooth::DeviceManager::FnDevices callback)
 {
-    std::vector<Bluetooth::Device> devices =
-        Bluetooth::DeviceManager::GetDevicesByState(Bluetooth::DeviceState::Paired);
-
-    LOG(Info, "Paired devices count: {}", devices.size());
-
-    devices.erase(
-        std::remove_if(
-            devices.begin(), devices.end(),
-            [](const auto &device) {
-                const auto vendorId = device.GetVendorId();
-                const auto productId = device.GetProductId();
-
-                const auto doErase =
-                    vendorId != AppleCP::VendorId ||
-                    AppleCP::AirPods::GetModel(productId) == AirPods::Model::Unknown;
-
-                LOG(Trace, "Device VendorId: '{}', ProductId: '{}', doErase: {}", vendorId,
-                    productId, doErase);
-
-                return doErase;
-            }),
-        devices.end());
-
-    LOG(Info, "AirPods devices count: {} (filtered)", devices.size());
-    return devices;
+    Bluetooth::DeviceManager::GetDevicesByState(
+        Bluetooth::DeviceState::Paired,
+        [callback = std::move(callback)](std::vector<Bluetooth::Device> devices) {
+            LOG(Info, "Paired devices count: {}", devices.size());
+
+            devices.erase(
+                std::remove_if(
+                    devices.begin(), devices.end(),
+                    [](const auto &device) {
+                        const auto vendorId = device.GetVendorId();
+                        const auto productId = device.GetProductId();
+
+                        const auto doErase =
+                            vendorId != AppleCP::VendorId ||
+                            AirPods::FindModelById(productId) == AirPods::Model::Unknown;
+
+                        LOG(Trace, "Device VendorId: '{}', ProductId: '{}', doErase: {}",
+                            vendorId, productId, doErase);
+
+                        return doErase;
+                    }),
+                devices.end());
+
+            LOG(Info, "AirPods devices count: {} (filtered)", devices.size());
+            callback(std::move(devices));
+        });
 }
 
 } // namespace Core::AirPods
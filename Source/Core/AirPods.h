@@ -18,10 +18,24 @@
 
 #pragma once
 
+#include <list>
+#include <deque>
+#include <array>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <thread>
 #include <functional>
+#include <condition_variable>
+#include <unordered_map>
 
+#include <QFlags>
+
+#include "../Profiler.h"
 #include "Bluetooth.h"
 #include "AppleCP.h"
+#include "AdvCapture.h"
+#include "Metrics.h"
 
 namespace Core::AirPods {
 
@@ -67,112 +81,556 @@ struct State {
     bool operator==(const State &rhs) const = default;
 };
 
+// The fields of `State` that the GUI components redraw separately
+//
+enum class StateField : uint32_t {
+    Model = 0b00000000001,
+    DisplayName = 0b00000000010,
+    LeftBattery = 0b00000000100,
+    LeftCharging = 0b00000001000,
+    LeftInEar = 0b00000010000,
+    RightBattery = 0b00000100000,
+    RightCharging = 0b00001000000,
+    RightInEar = 0b00010000000,
+    CaseBattery = 0b00100000000,
+    CaseCharging = 0b01000000000,
+    CaseLid = 0b10000000000, // `isLidOpened` and `isBothPodsInCase`
+    All = 0b11111111111,
+};
+Q_DECLARE_FLAGS(StateFields, StateField)
+
+// `DisplayName` is not compared, it's filled in by `Manager`
+//
+StateFields DiffState(const State &lhs, const State &rhs);
+
+// `State` packed into 8 bytes without the display name, so that it's copied, compared, diffed
+// and hashed in O(1) on every update. The batteries are kept in the steps of 10 that the
+// devices advertise, with a sentinel for unavailable.
+//
+class StateBits
+{
+public:
+    constexpr StateBits() = default;
+    explicit StateBits(const State &state);
+
+    State ToState(QString displayName = {}) const;
+
+    Model GetModel() const;
+
+    Battery GetBattery(Side side) const;
+    Battery GetCaseBattery() const;
+    bool IsCharging(Side side) const;
+    bool IsCaseCharging() const;
+    bool IsInEar(Side side) const;
+    bool IsBothInEar() const;
+    bool IsLidOpened() const;
+    bool IsBothPodsInCase() const;
+
+    // `DisplayName` is never set
+    //
+    StateFields Diff(const StateBits &rhs) const;
+
+    inline uint64_t GetValue() const
+    {
+        return _value;
+    }
+
+    bool operator==(const StateBits &rhs) const = default;
+
+private:
+    uint64_t _value{0};
+};
+static_assert(sizeof(StateBits) == 8);
+
 //
 // Classes
 //
 
 namespace Details {
 
+// The decoded result of a single AirPods advertisement, each packet is validated and decoded
+// exactly once and then this small record is passed around by value.
+//
 class Advertisement
 {
 public:
     using AddressType = decltype(Bluetooth::AdvertisementWatcher::ReceivedData::address);
+    using Timestamp = Bluetooth::AdvertisementWatcher::Timestamp;
+
+    struct AdvState {
+        Model model{Model::Unknown};
+        PodsState pods;
+        CaseState caseBox;
+        AppleCP::Color color{AppleCP::Color::White};
+        Side side{Side::Left};
 
-    struct AdvState : AirPods::State {
-        Side side;
+        bool operator==(const AdvState &rhs) const = default;
     };
 
-    static bool IsDesiredAdv(const Bluetooth::AdvertisementWatcher::ReceivedData &data);
+    static std::optional<Advertisement>
+    Decode(const Bluetooth::AdvertisementWatcher::ReceivedData &data);
 
-    Advertisement(const Bluetooth::AdvertisementWatcher::ReceivedData &data);
+    // A repeat of an identical payload only differs in the reception, it's not decoded again
+    //
+    Advertisement Repeat(const Bluetooth::AdvertisementWatcher::ReceivedData &data) const;
 
     int16_t GetRssi() const;
-    const auto &GetTimestamp() const;
+    Timestamp GetTimestamp() const;
     AddressType GetAddress() const;
-    std::vector<uint8_t> GetDesensitizedData() const;
     const AdvState &GetAdvState() const;
 
 private:
-    Bluetooth::AdvertisementWatcher::ReceivedData _data;
-    AppleCP::AirPods _protocol;
+    int16_t _rssi{};
+    Timestamp _timestamp{};
+    AddressType _address{};
     AdvState _state;
 
-    const std::vector<uint8_t> &GetMfrData() const;
+    Advertisement() = default;
+};
+static_assert(std::is_trivially_copyable_v<Advertisement>);
+
+// Learns the inter-arrival time of advertisements with an EWMA of its mean and variance, the
+// timeout derived from it tolerates a few missing advertisements.
+//
+class CadenceEstimator
+{
+public:
+    using Timestamp = Advertisement::Timestamp;
+
+    // Gaps longer than `maxInterval` are breaks in the stream rather than its cadence, so they
+    // are not learned
+    //
+    void Update(Timestamp timestamp, std::chrono::milliseconds maxInterval);
+    void Reset();
+
+    // Returns `max` until enough samples have been learned
+    //
+    std::chrono::milliseconds
+    GetTimeout(std::chrono::milliseconds min, std::chrono::milliseconds max) const;
+
+    std::chrono::milliseconds GetMean() const;
+    std::chrono::milliseconds GetDeviation() const;
+
+private:
+    constexpr static inline double kAlpha = 1.0 / 8;
+    constexpr static inline double kMissedIntervals = 3;
+    constexpr static inline double kDeviationFactor = 4;
+    constexpr static inline size_t kMinSamples = 4;
+
+    std::optional<Timestamp> _lastTimestamp;
+    double _meanMs{0}, _varianceMs2{0};
+    size_t _samples{0};
+};
+
+// A 1-D Kalman filter over the RSSI of a single source, so that one noisy sample neither
+// rejects a valid packet nor moves the device off its trajectory.
+//
+class RssiFilter
+{
+public:
+    double Update(int16_t rssi);
+
+private:
+    // Process and measurement noise, in dBm^2
+    constexpr static inline double kProcessNoise = 1;
+    constexpr static inline double kMeasurementNoise = 16;
+
+    std::optional<double> _estimate;
+    double _errorCovariance{kMeasurementNoise};
+};
+
+// AirPods use Random Non-resolvable device addresses for privacy reasons. This means we can't
+// "Remember" the user's AirPods by any device property, and in a dense environment many devices
+// of the same model are in range at the same time.
+//
+// The tracker keeps every concurrent source (address) and clusters them into physical devices,
+// scored on model, color, battery continuity and RSSI trajectory. The desired device is picked
+// from the clusters rather than from the last packet. Both tables are bounded and a packet from
+// a known source costs O(1), only a new source is scored against the clusters.
+//
+class Tracker
+{
+public:
+    using AddressType = Advertisement::AddressType;
+    using Timestamp = Advertisement::Timestamp;
+    using ClusterId = uint32_t;
+
+    struct FeedResult {
+        bool isDesired{false};
+        double rssi{0}; // Filtered RSSI of the source
+        // Why it's not from the desired device, only meaningful if `isDesired` is false
+        Metrics::DropReason dropReason{Metrics::DropReason::NotDesired};
+    };
+
+    // The desired device may be changed by the advertisement
+    //
+    FeedResult Feed(const Advertisement &adv);
+
+    std::optional<ClusterId> GetDesiredCluster() const;
+
+    // `Model::Unknown` accepts any model
+    //
+    void SetDesiredModel(Model model);
+    // A cluster weaker than this never becomes the desired device
+    //
+    void SetRssiMin(int16_t rssiMin);
+    void Reset();
+
+private:
+    constexpr static inline size_t kMaxSources = 64;
+    constexpr static inline size_t kMaxClusters = 16;
+    constexpr static inline auto kClusterExpiry = std::chrono::seconds{60};
+    // The desired device can only be taken over by a stronger one while it's present
+    constexpr static inline auto kDesiredPresence = std::chrono::seconds{10};
+    constexpr static inline Battery::ValueType kMaxBatteryStep = 10;
+    constexpr static inline int16_t kMaxRssiJump = 30;
+    // A new cluster must be stronger by this margin to take over the desired one
+    constexpr static inline double kSwitchMarginRssi = 8;
+    // Hits needed to take over the desired device, the first device is accepted at once
+    constexpr static inline uint32_t kMinHits = 3;
+
+    struct Cluster {
+        ClusterId id{0};
+        bool used{false};
+        Model model{Model::Unknown};
+        AppleCP::Color color{AppleCP::Color::White};
+        Helper::Sides<Battery> pods;
+        Battery caseBox;
+        double rssi{0}; // Filtered RSSI of the last source
+        Timestamp lastSeen{};
+        uint32_t hits{0};
+    };
+
+    struct Source {
+        AddressType address{};
+        size_t cluster{0}; // Index to `_clusters`, valid while the id matches
+        ClusterId clusterId{0};
+        RssiFilter rssi;
+    };
+
+    // The front is the most recently seen source
+    std::list<Source> _sources;
+    std::unordered_map<AddressType, std::list<Source>::iterator> _sourceIndex;
+    std::array<Cluster, kMaxClusters> _clusters;
+    std::optional<size_t> _desired;
+    ClusterId _nextClusterId{1};
+    Model _desiredModel{Model::Unknown};
+    int16_t _rssiMin{std::numeric_limits<int16_t>::max()};
+    std::optional<Metrics::DropReason> _desiredRejection;
+
+    size_t AssignCluster(const Advertisement &adv);
+    std::optional<double> Score(
+        const Cluster &cluster, const Advertisement &adv,
+        std::optional<Metrics::DropReason> *rejection = nullptr) const;
+    size_t AllocateCluster(const Advertisement &adv);
+    void UpdateCluster(Cluster &cluster, const Advertisement &adv, double rssi);
+    void UpdateDesired(size_t index, Timestamp now);
+    bool IsCandidate(const Cluster &cluster, uint32_t minHits) const;
 };
 
-// AirPods use Random Non-resolvable device addresses for privacy reasons. This means we
-// can't "Remember" the user's AirPods by any device property. Here we track our desired
-// devices in some non-elegant ways, but obviously it is sometimes unreliable.
+// Tracks the state of the desired device picked by the tracker.
 //
 class StateManager
 {
 public:
     struct UpdateEvent {
-        std::optional<State> oldState;
-        State newState;
+        std::optional<StateBits> oldState;
+        StateBits newState;
+        StateFields changedFields{StateField::All};
+        // The state as broadcast by each side alone, empty if the side hasn't been seen
+        Helper::Sides<std::optional<StateBits>> sideStates;
     };
 
-    StateManager();
+    struct AdvResult {
+        bool accepted{false};
+        std::optional<UpdateEvent> updateEvent;
+    };
+
+    using FnLost = std::function<void()>;
+
+    // A live state manager runs its deadlines on timers. Otherwise, e.g. when replaying a
+    // capture, the deadlines are only checked by `AdvanceTo` on the clock of the advertisements.
+    //
+    explicit StateManager(bool isLive = true);
+
+    // Invoked with the state manager locked when the state of the device is lost
+    //
+    inline auto &CbLost()
+    {
+        return _cbLost;
+    }
 
     std::optional<State> GetCurrentState() const;
 
-    std::optional<UpdateEvent> OnAdvReceived(Advertisement adv);
+    // Runs the deadlines that have expired by `now`, only for a non-live state manager
+    //
+    void AdvanceTo(Advertisement::Timestamp now);
+
+    // If `repeated` is true, the advertisement repeats the last accepted payload of its source,
+    // so it only refreshes the deadlines and the tracking
+    //
+    AdvResult OnAdvReceived(const Advertisement &adv, bool repeated = false);
     void Disconnect();
 
     void OnRssiMinChanged(int16_t rssiMin);
+    void OnStateTimeoutChanged(std::chrono::milliseconds min, std::chrono::milliseconds max);
+    void OnDesiredModelChanged(Model model);
 
 private:
-    using Clock = std::chrono::steady_clock;
-    using Timestamp = std::chrono::time_point<Clock>;
+    using Timestamp = Advertisement::Timestamp;
 
     mutable std::mutex _mutex;
 
+    const bool _isLive;
+    Helper::Callback<FnLost> _cbLost;
     Helper::Timer _lostTimer;
     Helper::Sides<Helper::Timer> _stateResetTimer;
+    std::optional<Timestamp> _lostDeadline;
+    Helper::Sides<std::optional<Timestamp>> _stateResetDeadline;
+    CadenceEstimator _lostCadence;
+    Helper::Sides<CadenceEstimator> _stateResetCadence;
+    std::chrono::milliseconds _timeoutMin{std::chrono::seconds{2}},
+        _timeoutMax{std::chrono::seconds{10}};
     Helper::Sides<std::optional<std::pair<Advertisement, Timestamp>>> _adv;
-    std::optional<State> _cachedState;
+    std::optional<StateBits> _cachedState;
     int16_t _rssiMin{std::numeric_limits<int16_t>::max()};
 
-    bool IsPossibleDesiredAdv(const Advertisement &adv) const;
-    void UpdateAdv(Advertisement adv);
+    Tracker _tracker;
+    std::optional<Tracker::ClusterId> _trackedCluster;
+
+    bool IsPossibleDesiredAdv(const Advertisement &adv);
+    void UpdateAdv(const Advertisement &adv);
     std::optional<UpdateEvent> UpdateState();
     void ResetAll();
 
     void DoLost();
     void DoStateReset(Side side);
 };
+// A latest-wins mailbox for the state updates to the GUI. It delivers at most a given number of
+// updates per second, the undelivered updates are merged into the latest one, so the final
+// state is always delivered. Urgent updates bypass the limiter.
+//
+class StateMailbox
+{
+public:
+    using FnDeliver = std::function<void(const State &, StateFields)>;
+
+    StateMailbox(FnDeliver deliver);
+    ~StateMailbox();
+
+    // Must be posted from one thread at a time
+    //
+    void Post(StateBits state, QString displayName, StateFields changedFields, bool urgent);
+
+    // Drops the update waiting for the limiter, nothing is delivered after this returns until
+    // the next post
+    //
+    void Clear();
+
+    // Zero means unlimited
+    //
+    void SetMaxRate(uint32_t updatesPerSecond);
+
+private:
+    struct Update {
+        StateBits state;
+        QString displayName;
+        StateFields changedFields;
+    };
+
+    FnDeliver _deliver;
+    std::atomic<std::shared_ptr<const Update>> _slot;
+    std::atomic<bool> _pending{false};
+    std::atomic<std::chrono::milliseconds> _minInterval{std::chrono::milliseconds::zero()};
+    std::atomic<Helper::Scheduler::TimePoint> _lastDelivery{};
+    std::mutex _deliverMutex;
+    // Guarded by `_deliverMutex`
+    Helper::Scheduler::TaskPtr _task;
+
+    void Deliver();
+};
+
+// Debounces a boolean derived from the state, such as both in ear. A transition is only
+// committed once the new value has been stable for the window, or at once if both sides agree on
+// it, so a pod being adjusted or the sides disagreeing briefly doesn't cause bursts of actions.
+// Flipping back before the window has passed cancels the transition. A transition to the
+// immediate value, if any, is never delayed.
+//
+// The owner is notified when the window of a pending transition has passed, and should call
+// `Expire` then. The commits are returned rather than invoked, so the owner decides under its own
+// lock in which order they run.
+//
+class TransitionDebouncer
+{
+public:
+    using FnExpired = std::function<void()>;
+
+    TransitionDebouncer(FnExpired expired, std::optional<bool> immediate = std::nullopt);
+    ~TransitionDebouncer();
+
+    // Returns the value to commit now, if any
+    //
+    std::optional<bool> Feed(bool value, bool agreed);
+    std::optional<bool> Expire();
+
+    // Forgets the pending transition, the next value fed is taken as the committed one unless an
+    // initial value is specified
+    //
+    void Reset(std::optional<bool> committed = std::nullopt);
+
+    // Zero commits every transition at once
+    //
+    void SetWindow(std::chrono::milliseconds window);
+
+private:
+    std::mutex _mutex;
+    const std::optional<bool> _immediate;
+    std::chrono::milliseconds _window{std::chrono::milliseconds::zero()};
+    std::optional<bool> _committed, _pending;
+    Helper::Scheduler::TimePoint _pendingSince{};
+    Helper::Scheduler::TaskPtr _task;
+};
+
+// Runs the side effects of the state changes on its own thread in the posted order, so that the
+// advertisement processing never waits for them. A pending action is replaced by a newer one of
+// the same kind, so only the latest one runs.
+//
+class ActionExecutor
+{
+public:
+    enum class Kind : uint32_t {
+        Media,
+        _Max
+    };
+
+    ActionExecutor();
+    ~ActionExecutor();
+
+    void Post(Kind kind, std::function<void()> action);
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _conVar;
+    std::deque<Kind> _order;
+    std::array<std::function<void()>, Helper::ToUnderlying(Kind::_Max)> _pending;
+    bool _stop{false};
+    std::thread _thread;
+
+    void Run();
+};
 } // namespace Details
 
+// What the manager reports to the user interface. The calls are made on the Bluetooth threads
+// with the manager locked, so an observer should only post them to its own thread.
+//
+class Observer
+{
+public:
+    virtual ~Observer() = default;
+
+    virtual void OnStateUpdated(const State &state, StateFields changedFields) = 0;
+    virtual void OnDisconnected() = 0;
+    virtual void OnAvailable() = 0;
+    virtual void OnUnavailable() = 0;
+    virtual void OnBoundModelChanged(std::optional<Model> model) = 0;
+    virtual void OnLidOpened(bool opened) = 0;
+};
+
 class Manager
 {
 public:
-    Manager();
+    // Without an observer, e.g. in the headless mode, the state only goes to the automation and
+    // the IPC clients
+    //
+    explicit Manager(Observer *observer);
 
     void StartScanner();
     void StopScanner();
 
+    // Records the received Apple advertisements to the file from now on
+    //
+    void StartCapture(const QString &path);
+
     void OnRssiMinChanged(int16_t rssiMin);
+    void OnStateTimeoutChanged(std::chrono::milliseconds min, std::chrono::milliseconds max);
+    void OnStateUpdateRateChanged(uint32_t updatesPerSecond);
+    void OnTransitionDebounceChanged(std::chrono::milliseconds window);
     void OnAutomaticEarDetectionChanged(bool enable);
     void OnBoundDeviceAddressChanged(uint64_t address);
 
 private:
-    std::mutex _mutex;
-    Bluetooth::AdvertisementWatcher _adWatcher;
-    Details::StateManager _stateMgr;
-    std::optional<Bluetooth::Device> _boundDevice;
+    struct PayloadCacheEntry {
+        size_t hash{0};
+        Details::Advertisement adv;
+        bool accepted{false};
+        // The least recently seen source is evicted when the cache is full
+        Details::Advertisement::Timestamp lastSeen{};
+    };
+
+    constexpr static inline size_t kMaxPayloadCache = 64;
+    constexpr static inline auto kMetricsSummaryInterval = std::chrono::minutes{5};
+    // How long a lid opening keeps the full scan on while the device is still connecting
+    constexpr static inline auto kScanBoostDuration = std::chrono::seconds{30};
+
+    // Members are destroyed in reverse order, so whatever invokes the handlers below is declared
+    // after everything the handlers use. The watcher is destroyed first, it joins its ingest
+    // thread, and no advertisement is handled afterwards.
+    //
+    APD_PROFILE_LOCKABLE(std::mutex, _mutex);
+    Observer *const _observer;
+    std::unordered_map<Details::Advertisement::AddressType, PayloadCacheEntry> _payloadCache;
+    Details::StateMailbox _stateMailbox;
+    Details::ActionExecutor _actionExecutor;
+    std::unique_ptr<AdvCapture::Writer> _capture;
     QString _deviceName;
+    QString _deliveredDisplayName;
+    // The moment the advertisement being processed was received, for the latency tracing
+    Latency::Clock::time_point _advOrigin{};
     bool _deviceConnected{false};
+    Model _boundModel{Model::Unknown};
+    std::chrono::steady_clock::time_point _scanBoostUntil{};
     bool _automaticEarDetection{false};
+    uint64_t _bindGeneration{0};
+    Details::StateManager _stateMgr;
+    Details::TransitionDebouncer _lidDebouncer, _inEarDebouncer;
+    Helper::Timer _metricsSummaryTimer;
+    std::optional<Bluetooth::Device> _boundDevice;
+    Helper::CbHandle _boundDeviceCbHandle{0};
+    Bluetooth::AdvertisementWatcher _adWatcher;
 
+    template <class Method, class... Args>
+    inline void Notify(Method method, Args &&...args)
+    {
+        if (_observer != nullptr) {
+            (_observer->*method)(std::forward<Args>(args)...);
+        }
+    }
+
+    void OnBoundDeviceFound(std::optional<Bluetooth::Device> optDevice);
     void OnBoundDeviceConnectionStateChanged(Bluetooth::DeviceState state);
+    void OnDisconnectedAdvReceived(const Details::Advertisement &adv);
     void OnStateChanged(Details::StateManager::UpdateEvent updateEvent);
+    void PublishStatus(const QString &status);
     void OnLidOpened(bool opened);
     void OnBothInEar(bool isBothInEar);
+    void OnTransitionExpired();
     bool OnAdvertisementReceived(const Bluetooth::AdvertisementWatcher::ReceivedData &data);
     void OnAdvWatcherStateChanged(
         Bluetooth::AdvertisementWatcher::State state, const std::optional<std::string> &optError);
 };
 
-std::vector<Core::Bluetooth::Device> GetDevices();
+// The callback is invoked on the Bluetooth worker thread
+//
+void GetDevices(Bluetooth::DeviceManager::FnDevices callback);
 
 } // namespace Core::AirPods
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(Core::AirPods::StateFields)
+
+template <>
+struct std::hash<Core::AirPods::StateBits> {
+    inline size_t operator()(const Core::AirPods::StateBits &value) const noexcept
+    {
+        return std::hash<uint64_t>{}(value.GetValue());
+    }
+};
@@ -18,150 +18,289 @@
 
 #include "AppleCP.h"
 
+#include <bit>
+#include <cstring>
+
 namespace Core::AppleCP {
 
-bool AirPods::IsValid(const std::vector<uint8_t> &data)
+bool AirPodsView::IsValid(std::span<const uint8_t> data)
 {
-    if (data.size() != sizeof(AirPods)) {
-        LOG(Info, "IsValid false1");
+    if (data.size() != kSize) {
+        LOG(Trace, "IsValid false1");
         return false;
     }
 
-    constexpr uint8_t shouldRemainingLength =
-        sizeof(AirPods) - (offsetof(Header, remainingLength) + sizeof(Header::remainingLength));
+    constexpr uint8_t shouldRemainingLength = kSize - (AirPodsLayout::kOffsetRemainingLength + 1);
 
-    Header *packet = (Header *)(data.data());
-    if (packet->packetType != PacketType::ProximityPairing ||
-        packet->remainingLength != shouldRemainingLength)
+    if (data[AirPodsLayout::kOffsetPacketType] !=
+            Helper::ToUnderlying(PacketType::ProximityPairing) ||
+        data[AirPodsLayout::kOffsetRemainingLength] != shouldRemainingLength)
     {
-        LOG(Info, "IsValid false2");
+        LOG(Trace, "IsValid false2");
         return false;
     }
 
-    LOG(Info, "IsValid true");
+    LOG(Trace, "IsValid true");
     return true;
 }
 
-Core::AirPods::Model AirPods::GetModel(uint16_t modelId)
-{
-    LOG(Info, "GetModel: {}", modelId);
-    switch (modelId) {
-    case 0x2002:
-        return Core::AirPods::Model::AirPods_1;
-    case 0x200F:
-        return Core::AirPods::Model::AirPods_2;
-    case 0x2013:
-        return Core::AirPods::Model::AirPods_3;
-    case 0x2019:
-        return Core::AirPods::Model::AirPods_4;
-    case 0x201B:
-        return Core::AirPods::Model::AirPods_4_ANC;
-    case 0x200E:
-        return Core::AirPods::Model::AirPods_Pro;
-    case 0x2014:
-        return Core::AirPods::Model::AirPods_Pro_2;
-    case 0x2024:
-        return Core::AirPods::Model::AirPods_Pro_2_USB_C;
-    case 0x200A:
-        return Core::AirPods::Model::AirPods_Max;
-        // case 0x2003:
-        //    return Core::AirPods::Model::Powerbeats_3;
-        // case 0x2005:
-        //    return Core::AirPods::Model::Beats_X;
-        // case 0x2006:
-        //    return Core::AirPods::Model::Beats_Solo3;
-    case 0x2012:
-        return Core::AirPods::Model::Beats_Fit_Pro;
-    default:
-        return Core::AirPods::Model::Unknown;
-    }
-}
-
-Core::AirPods::Side AirPods::GetBroadcastedSide() const
+Core::AirPods::Side AirPodsView::GetBroadcastedSide() const
 {
-    return broadcastFrom == 1 ? Core::AirPods::Side::Left : Core::AirPods::Side::Right;
+    return Get(AirPodsLayout::kBroadcastFrom) == 1 ? Core::AirPods::Side::Left
+                                                   : Core::AirPods::Side::Right;
 }
 
-bool AirPods::IsLeftBroadcasted() const
+bool AirPodsView::IsLeftBroadcasted() const
 {
     return GetBroadcastedSide() == Core::AirPods::Side::Left;
 }
 
-bool AirPods::IsRightBroadcasted() const
+bool AirPodsView::IsRightBroadcasted() const
 {
     return GetBroadcastedSide() == Core::AirPods::Side::Right;
 }
 
-Core::AirPods::Model AirPods::GetModel() const
+uint16_t AirPodsView::GetModelId() const
+{
+    return (uint16_t)(_data[AirPodsLayout::kOffsetModelId] |
+                      (_data[AirPodsLayout::kOffsetModelId + 1] << 8));
+}
+
+Core::AirPods::Model AirPodsView::GetModel() const
+{
+    return Core::AirPods::FindModelById(GetModelId());
+}
+
+Color AirPodsView::GetColor() const
 {
-    return GetModel(modelId);
+    return (Color)_data[AirPodsLayout::kOffsetColor];
 }
 
-Core::AirPods::Battery AirPods::GetLeftBattery() const
+Core::AirPods::Battery AirPodsView::GetLeftBattery() const
 {
-    const auto val = (IsLeftBroadcasted() ? battery.curr : battery.anot);
+    const auto val = Get(IsLeftBroadcasted() ? AirPodsLayout::kCurrBattery
+                                             : AirPodsLayout::kAnotBattery);
     return (val >= 0 && val <= 10) ? val : Core::AirPods::Battery{};
 }
 
-Core::AirPods::Battery AirPods::GetRightBattery() const
+Core::AirPods::Battery AirPodsView::GetRightBattery() const
 {
-    const auto val = (IsRightBroadcasted() ? battery.curr : battery.anot);
+    const auto val = Get(IsRightBroadcasted() ? AirPodsLayout::kCurrBattery
+                                              : AirPodsLayout::kAnotBattery);
     return (val >= 0 && val <= 10) ? val : Core::AirPods::Battery{};
 }
 
-Core::AirPods::Battery AirPods::GetCaseBattery() const
+Core::AirPods::Battery AirPodsView::GetCaseBattery() const
 {
-    const auto val = battery.caseBox;
+    const auto val = Get(AirPodsLayout::kCaseBattery);
     return (val >= 0 && val <= 10) ? val : Core::AirPods::Battery{};
 }
 
-bool AirPods::IsLeftCharging() const
+bool AirPodsView::IsLeftCharging() const
 {
-    return (IsLeftBroadcasted() ? battery.currCharging : battery.anotCharging) != 0;
+    return Get(IsLeftBroadcasted() ? AirPodsLayout::kCurrCharging
+                                   : AirPodsLayout::kAnotCharging) != 0;
 }
 
-bool AirPods::IsRightCharging() const
+bool AirPodsView::IsRightCharging() const
 {
-    return (IsRightBroadcasted() ? battery.currCharging : battery.anotCharging) != 0;
+    return Get(IsRightBroadcasted() ? AirPodsLayout::kCurrCharging
+                                    : AirPodsLayout::kAnotCharging) != 0;
 }
 
-bool AirPods::IsBothPodsInCase() const
+bool AirPodsView::IsBothPodsInCase() const
 {
-    return bothInCase;
+    return Get(AirPodsLayout::kBothInCase) != 0;
 }
 
-bool AirPods::IsLidOpened() const
+bool AirPodsView::IsLidOpened() const
 {
-    return lid.closed == 0;
+    return Get(AirPodsLayout::kLidClosed) == 0;
 }
 
-bool AirPods::IsCaseCharging() const
+bool AirPodsView::IsCaseCharging() const
 {
-    return battery.caseCharging;
+    return Get(AirPodsLayout::kCaseCharging) != 0;
 }
 
-bool AirPods::IsLeftInEar() const
+bool AirPodsView::IsLeftInEar() const
 {
     // If it's charging, the "ear" will be set in one of the multiple devices, idk why..
     // so we need to filter it
     //     vvvvvvvvvvvvvvvvvvvv
-    return !IsLeftCharging() && (IsLeftBroadcasted() ? currInEar : anotInEar);
+    return !IsLeftCharging() &&
+           Get(IsLeftBroadcasted() ? AirPodsLayout::kCurrInEar : AirPodsLayout::kAnotInEar) != 0;
 }
 
-bool AirPods::IsRightInEar() const
+bool AirPodsView::IsRightInEar() const
 {
-    return !IsRightCharging() && (IsRightBroadcasted() ? currInEar : anotInEar);
+    return !IsRightCharging() &&
+           Get(IsRightBroadcasted() ? AirPodsLayout::kCurrInEar : AirPodsLayout::kAnotInEar) != 0;
 }
 
-AirPods AirPods::Desensitize() const
+std::array<uint8_t, AirPodsView::kSize> AirPodsView::Desensitize() const
 {
-    auto result = *this;
+    std::array<uint8_t, kSize> result;
+    std::copy(_data.begin(), _data.end(), result.begin());
 
     // This field may be some kind of hash or encrypted payload.
     // So it may contain personal information about the user.
     //
-    std::memset(result.unk12, 0, sizeof(result.unk12));
+    std::fill_n(result.begin() + AirPodsLayout::kOffsetHash, AirPodsLayout::kHashSize, 0);
 
     return result;
 }
+
+//
+// Batch decoding
+//
+
+namespace {
+
+// Every lane of the words is a byte of a record, the lane `i` belongs to the record `i`
+//
+constexpr size_t kLanes = 8;
+constexpr uint64_t kLaneOnes = 0x0101010101010101ull;
+
+// The status fields live in these bytes of the packet
+//
+constexpr size_t kStatusFirst = 5, kStatusCount = 4;
+
+using StatusLanes = std::array<uint64_t, kStatusCount>;
+
+constexpr bool IsStatusField(const BitField &field)
+{
+    return field.offset >= kStatusFirst && field.offset < kStatusFirst + kStatusCount;
+}
+
+static_assert(
+    IsStatusField(AirPodsLayout::kCurrInEar) && IsStatusField(AirPodsLayout::kBothInCase) &&
+    IsStatusField(AirPodsLayout::kAnotInEar) && IsStatusField(AirPodsLayout::kBroadcastFrom) &&
+    IsStatusField(AirPodsLayout::kCurrBattery) && IsStatusField(AirPodsLayout::kAnotBattery) &&
+    IsStatusField(AirPodsLayout::kCaseBattery) && IsStatusField(AirPodsLayout::kCurrCharging) &&
+    IsStatusField(AirPodsLayout::kAnotCharging) && IsStatusField(AirPodsLayout::kCaseCharging) &&
+    IsStatusField(AirPodsLayout::kLidClosed));
+
+// The lanes are stored to the outputs by `memcpy`
+static_assert(std::endian::native == std::endian::little);
+
+inline uint64_t Extract(const StatusLanes &lanes, const BitField &field)
+{
+    return (lanes[field.offset - kStatusFirst] >> field.shift) &
+           (kLaneOnes * ((1u << field.bits) - 1));
+}
+
+// Lanes of 0 or 1 to lanes of 0x00 or 0xFF, the lanes don't carry into each other
+//
+inline uint64_t ToMask(uint64_t bits)
+{
+    return bits * 0xFF;
+}
+
+inline uint64_t Select(uint64_t mask, uint64_t ifSet, uint64_t ifClear)
+{
+    return (ifSet & mask) | (ifClear & ~mask);
+}
+
+// Lanes of battery nibbles over 10 to `kBatteryUnavailable`. A nibble plus 117 reaches bit 7
+// only if it's over 10, and never carries out of its lane.
+//
+inline uint64_t MarkUnavailable(uint64_t nibbles)
+{
+    const auto over = ((nibbles + kLaneOnes * (0x80 - 11)) >> 7) & kLaneOnes;
+    return nibbles | ToMask(over);
+}
+
+template <class T>
+inline void StoreLanes(std::vector<T> &output, size_t index, uint64_t lanes, size_t count)
+{
+    static_assert(sizeof(T) == 1);
+    std::memcpy(output.data() + index, &lanes, count);
+}
+
+} // namespace
+
+void DecodeAirPodsBatch(std::span<const uint8_t> records, AirPodsBatch &output)
+{
+    namespace Layout = AirPodsLayout;
+
+    const size_t count = records.size() / Layout::kSize;
+
+    output.isValid.resize(count);
+    output.modelId.resize(count);
+    output.side.resize(count);
+    output.leftBattery.resize(count);
+    output.rightBattery.resize(count);
+    output.caseBattery.resize(count);
+    output.charging.resize(count);
+    output.inEar.resize(count);
+    output.lid.resize(count);
+
+    constexpr uint8_t shouldRemainingLength = Layout::kSize - (Layout::kOffsetRemainingLength + 1);
+
+    for (size_t base = 0; base < count; base += kLanes) {
+        const size_t lanesCount = std::min(kLanes, count - base);
+
+        // Transpose the status bytes of the records into the lanes, the rest is per record
+        //
+        StatusLanes lanes{};
+        for (size_t lane = 0; lane < lanesCount; ++lane) {
+            const auto *record = records.data() + (base + lane) * Layout::kSize;
+
+            for (size_t i = 0; i < kStatusCount; ++i) {
+                lanes[i] |= (uint64_t)record[kStatusFirst + i] << (lane * 8);
+            }
+
+            output.isValid[base + lane] =
+                record[Layout::kOffsetPacketType] ==
+                    Helper::ToUnderlying(PacketType::ProximityPairing) &&
+                record[Layout::kOffsetRemainingLength] == shouldRemainingLength;
+            output.modelId[base + lane] = (uint16_t)(record[Layout::kOffsetModelId] |
+                                                     (record[Layout::kOffsetModelId + 1] << 8));
+        }
+
+        const auto isLeft = Extract(lanes, Layout::kBroadcastFrom);
+        const auto leftMask = ToMask(isLeft);
+
+        const auto currBattery = MarkUnavailable(Extract(lanes, Layout::kCurrBattery));
+        const auto anotBattery = MarkUnavailable(Extract(lanes, Layout::kAnotBattery));
+
+        const auto currCharging = Extract(lanes, Layout::kCurrCharging);
+        const auto anotCharging = Extract(lanes, Layout::kAnotCharging);
+        const auto leftCharging = Select(leftMask, currCharging, anotCharging);
+        const auto rightCharging = Select(leftMask, anotCharging, currCharging);
+
+        // The "ear" bit of a charging pod is meaningless, see `AirPodsView::IsLeftInEar`
+        //
+        const auto currInEar = Extract(lanes, Layout::kCurrInEar);
+        const auto anotInEar = Extract(lanes, Layout::kAnotInEar);
+        const auto leftInEar = Select(leftMask, currInEar, anotInEar) & ~leftCharging;
+        const auto rightInEar = Select(leftMask, anotInEar, currInEar) & ~rightCharging;
+
+        const auto lidOpened = Extract(lanes, Layout::kLidClosed) ^ kLaneOnes;
+        const auto bothInCase = Extract(lanes, Layout::kBothInCase);
+
+        // `Side::Left` is 0 and `Side::Right` is 1
+        //
+        static_assert(
+            Helper::ToUnderlying(Core::AirPods::Side::Left) == 0 &&
+            Helper::ToUnderlying(Core::AirPods::Side::Right) == 1);
+        StoreLanes(output.side, base, isLeft ^ kLaneOnes, lanesCount);
+
+        StoreLanes(
+            output.leftBattery, base, Select(leftMask, currBattery, anotBattery), lanesCount);
+        StoreLanes(
+            output.rightBattery, base, Select(leftMask, anotBattery, currBattery), lanesCount);
+        StoreLanes(
+            output.caseBattery, base, MarkUnavailable(Extract(lanes, Layout::kCaseBattery)),
+            lanesCount);
+
+        StoreLanes(
+            output.charging, base,
+            leftCharging | (rightCharging << 1) | (Extract(lanes, Layout::kCaseCharging) << 2),
+            lanesCount);
+        StoreLanes(output.inEar, base, leftInEar | (rightInEar << 1), lanesCount);
+        StoreLanes(output.lid, base, lidOpened | (bothInCase << 1), lanesCount);
+    }
+}
 } // namespace Core::AppleCP
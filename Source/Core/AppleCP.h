@@ -18,7 +18,11 @@
 
 #pragma once
 
+#include <span>
+#include <array>
 #include <vector>
+#include <concepts>
+#include <optional>
 
 #include "Base.h"
 
@@ -26,8 +30,6 @@
 //
 namespace Core::AppleCP {
 
-#pragma pack(push)
-#pragma pack(1)
 enum class PacketType : uint8_t {
     AirPrint = 0x3,
     AirDrop = 0x5,
@@ -59,12 +61,55 @@ enum class Color : uint8_t {
     Yellow = 0xC,
 };
 
-struct Header {
-    PacketType packetType;
-    uint8_t remainingLength; // Remaining length of this packet
+constexpr uint16_t VendorId = 76;
+
+// The location of a field inside a byte of the packet
+//
+struct BitField {
+    size_t offset; // Byte offset from the beginning of the packet
+    uint8_t shift;
+    uint8_t bits;
+
+    constexpr uint8_t Extract(uint8_t byte) const
+    {
+        return (byte >> shift) & ((1u << bits) - 1);
+    }
 };
 
-constexpr uint16_t VendorId = 76;
+// The layout of the proximity pairing message, shared by all the decoders so that there is only
+// one definition of where each field lives.
+//
+namespace AirPodsLayout {
+
+constexpr size_t kSize = 27;
+
+constexpr size_t kOffsetPacketType = 0;
+constexpr size_t kOffsetRemainingLength = 1; // Remaining length of this packet
+constexpr size_t kOffsetModelId = 3;         // uint16_t, little-endian
+constexpr size_t kOffsetColor = 9;
+constexpr size_t kOffsetHash = 11; // Hash or encrypted payload
+constexpr size_t kHashSize = 16;
+
+constexpr BitField kCurrInEar{5, 1, 1};
+constexpr BitField kBothInCase{5, 2, 1};
+constexpr BitField kAnotInEar{5, 3, 1};
+constexpr BitField kBroadcastFrom{5, 5, 1}; // This advertisement is broadcast from which earphone.
+
+constexpr BitField kCurrBattery{6, 0, 4}; // Battery remaining [0, 10], otherwise unavailable
+constexpr BitField kAnotBattery{6, 4, 4}; // Battery remaining [0, 10], otherwise unavailable
+constexpr BitField kCaseBattery{7, 0, 4}; // Battery remaining [0, 10], otherwise unavailable
+constexpr BitField kCurrCharging{7, 4, 1};
+constexpr BitField kAnotCharging{7, 5, 1};
+constexpr BitField kCaseCharging{7, 6, 1};
+
+// This count increases if the lid opened or closed once, and resets if overflow or no longer
+// broadcasting advertisements
+//
+constexpr BitField kLidSwitchCount{8, 0, 3};
+constexpr BitField kLidClosed{8, 3, 1};
+
+static_assert(kOffsetHash + kHashSize == kSize);
+} // namespace AirPodsLayout
 
 // About "Flipped":
 //
@@ -97,17 +142,27 @@ constexpr uint16_t VendorId = 76;
 //      one earphone is working and the other is charging (lid opened), the Bluetooth device in
 //      both earphones is made discoverable, and the battery of the case is sent and synced.
 //
-class AirPods : Header
+// This class is a view, it decodes the fields in place from the referenced bytes, so the bytes
+// must outlive it.
+//
+class AirPodsView
 {
 public:
-    static bool IsValid(const std::vector<uint8_t> &data);
-    static Core::AirPods::Model GetModel(uint16_t modelId);
+    constexpr static size_t kSize = AirPodsLayout::kSize;
+
+    static bool IsValid(std::span<const uint8_t> data);
+
+    // The data must be validated by `IsValid`
+    //
+    explicit inline AirPodsView(std::span<const uint8_t, kSize> data) : _data{data} {}
 
     Core::AirPods::Side GetBroadcastedSide() const;
     bool IsLeftBroadcasted() const;
     bool IsRightBroadcasted() const;
 
+    uint16_t GetModelId() const;
     Core::AirPods::Model GetModel() const;
+    Color GetColor() const; // Untested because I don't have a device other than white
 
     Core::AirPods::Battery GetLeftBattery() const;
     Core::AirPods::Battery GetRightBattery() const;
@@ -123,53 +178,62 @@ public:
     bool IsLeftInEar() const;
     bool IsRightInEar() const;
 
-    AirPods Desensitize() const;
+    std::array<uint8_t, kSize> Desensitize() const;
 
 private:
-    uint8_t unk1[1];
-    uint16_t modelId;
-    struct {
-        uint8_t unk4 : 1;
-        uint8_t currInEar : 1;
-        uint8_t bothInCase : 1;
-        uint8_t anotInEar : 1;
-        uint8_t unk6 : 1;
-        uint8_t broadcastFrom : 1; // This advertisement is broadcast from which earphone.
-        uint8_t unk7 : 1;
-        uint8_t unk8 : 1;
-    };
-    struct {
-        uint8_t curr : 4;         // Battery remaining [0, 10], otherwise unavailable
-        uint8_t anot : 4;         // Battery remaining [0, 10], otherwise unavailable
-        uint8_t caseBox : 4;      // Battery remaining [0, 10], otherwise unavailable
-        uint8_t currCharging : 1; // If it's charging (value != 0)
-        uint8_t anotCharging : 1; // If it's charging (value != 0)
-        uint8_t caseCharging : 1; // If it's charging (value != 0)
-        uint8_t unk9 : 1;
-    } battery;
-    struct {
-        uint8_t switchCount : 3; // This count increases if the lid opened or closed once, and
-                                 // resets if overflow or no longer broadcasting advertisements
-        uint8_t closed : 1;
-        uint8_t unk10 : 4;
-    } lid;
-    Color color; // Untested because I don't have a device other than white
-    uint8_t unk11[1];
-    uint8_t unk12[16]; // Hash or encrypted payload
+    std::span<const uint8_t, kSize> _data;
+
+    inline uint8_t Get(const BitField &field) const
+    {
+        return field.Extract(_data[field.offset]);
+    }
 };
-static_assert(sizeof(AirPods) == 27);
-#pragma pack(pop)
 
 template <class T>
-concept KindOfACPStruct = std::is_base_of_v<Header, T>;
+concept KindOfACPView = requires(std::span<const uint8_t> data)
+{
+    { T::IsValid(data) } -> std::same_as<bool>;
+    T::kSize;
+};
 
-template <KindOfACPStruct T>
-std::optional<T> As(const std::vector<uint8_t> &data)
+template <KindOfACPView T>
+std::optional<T> As(std::span<const uint8_t> data)
 {
     if (!T::IsValid(data)) {
         return std::nullopt;
     }
 
-    return *(T *)data.data();
+    return T{data.first<T::kSize>()};
 }
+
+// The struct-of-arrays result of `DecodeAirPodsBatch`, one element per record. The fields are
+// already mapped from "current" and "another" to left and right, as `AirPodsView` does.
+//
+struct AirPodsBatch {
+    constexpr static inline uint8_t kBatteryUnavailable = 0xFF;
+
+    // Bits of `charging`, `inEar` and `lid`
+    constexpr static inline uint8_t kLeft = 1 << 0, kRight = 1 << 1, kCase = 1 << 2;
+    constexpr static inline uint8_t kLidOpened = 1 << 0, kBothInCase = 1 << 1;
+
+    std::vector<uint8_t> isValid;
+    std::vector<uint16_t> modelId;
+    std::vector<uint8_t> side; // The broadcasting side, the underlying value of `Side`
+    // Battery remaining [0, 10], otherwise `kBatteryUnavailable`
+    std::vector<uint8_t> leftBattery, rightBattery, caseBattery;
+    std::vector<uint8_t> charging;
+    std::vector<uint8_t> inEar;
+    std::vector<uint8_t> lid;
+
+    inline size_t size() const
+    {
+        return isValid.size();
+    }
+};
+
+// Decodes a packed array of `AirPodsView::kSize` byte records, e.g. from a day of captures,
+// eight records at a time with SWAR arithmetic on one byte lane per record. The fields of the
+// invalid records are unspecified.
+//
+void DecodeAirPodsBatch(std::span<const uint8_t> records, AirPodsBatch &output);
 } // namespace Core::AppleCP
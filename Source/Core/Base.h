@@ -18,7 +18,10 @@
 
 #pragma once
 
+#include <array>
 #include <optional>
+#include <algorithm>
+#include <string_view>
 
 #include "../Helper.h"
 #include "../Logger.h"
@@ -83,41 +86,110 @@ enum class Model : uint32_t {
 
 enum class Side : uint32_t { Left, Right };
 
+//
+// Model registry
+//
+
+struct ModelInfo {
+    Model model;
+    uint16_t id; // Model id in the proximity pairing message, 0 if unknown or untested
+    std::string_view displayName;
+
+    // It's not possible to set video padding background color or get video resolution just
+    // through Qt, so we hardcode it here
+    //
+    std::string_view animation;
+    uint16_t animationWidth, animationHeight;
+
+    bool hasAnc, hasCaseBattery;
+};
+
+namespace Details {
+
+constexpr std::string_view kVideoAirPods1 = "qrc:/Resource/Video/AirPods_1.avi";
+constexpr std::string_view kVideoAirPods2 = "qrc:/Resource/Video/AirPods_2.avi";
+constexpr std::string_view kVideoAirPods3 = "qrc:/Resource/Video/AirPods_3.avi";
+constexpr std::string_view kVideoAirPodsPro = "qrc:/Resource/Video/AirPods_Pro.avi";
+constexpr std::string_view kVideoAirPodsPro2 = "qrc:/Resource/Video/AirPods_Pro_2.avi";
+constexpr std::string_view kVideoAirPodsMax = "qrc:/Resource/Video/AirPods_Max.avi";
+constexpr std::string_view kVideoBeatsFitPro = "qrc:/Resource/Video/Beats_Fit_Pro.avi";
+
+// Adding a new model only requires a new entry here (and in the enum), the entries must be in
+// the same order as the enum.
+//
+// clang-format off
+constexpr std::array<ModelInfo, Helper::ToUnderlying(Model::_Max)> kModels{{
+    // model                      id      displayName              animation          width height anc    case
+    {Model::Unknown,              0,      "Unknown",               kVideoAirPods1,    800,  400,   false, false},
+    {Model::AirPods_1,            0x2002, "AirPods 1",             kVideoAirPods1,    800,  400,   false, true },
+    {Model::AirPods_2,            0x200F, "AirPods 2",             kVideoAirPods2,    800,  400,   false, true },
+    {Model::AirPods_3,            0x2013, "AirPods 3",             kVideoAirPods3,    900,  450,   false, true },
+    {Model::AirPods_4,            0x2019, "AirPods 4",             kVideoAirPods1,    800,  400,   false, true },
+    {Model::AirPods_4_ANC,        0x201B, "AirPods 4 (ANC)",       kVideoAirPods1,    800,  400,   true,  true },
+    {Model::AirPods_Pro,          0x200E, "AirPods Pro",           kVideoAirPodsPro,  900,  450,   true,  true },
+    {Model::AirPods_Pro_2,        0x2014, "AirPods Pro 2",         kVideoAirPodsPro2, 900,  450,   true,  true },
+    {Model::AirPods_Pro_2_USB_C,  0x2024, "AirPods Pro 2 (USB-C)", kVideoAirPodsPro2, 900,  450,   true,  true },
+    {Model::AirPods_Max,          0x200A, "AirPods Max",           kVideoAirPodsMax,  600,  650,   true,  false},
+    {Model::Powerbeats_3,         0,      "Powerbeats 3",          kVideoAirPods1,    800,  400,   false, false}, // 0x2003, untested
+    {Model::Beats_X,              0,      "BeatsX",                kVideoAirPods1,    800,  400,   false, false}, // 0x2005, untested
+    {Model::Beats_Solo3,          0,      "BeatsSolo3",            kVideoAirPods1,    800,  400,   false, false}, // 0x2006, untested
+    {Model::Beats_Fit_Pro,        0x2012, "Beats Fit Pro",         kVideoBeatsFitPro, 900,  450,   true,  true },
+}};
+// clang-format on
+
+static_assert(std::ranges::all_of(kModels, [](const ModelInfo &info) {
+    return (size_t)(&info - kModels.data()) == Helper::ToUnderlying(info.model);
+}));
+
+constexpr size_t kIdentifiableModelCount =
+    std::ranges::count_if(kModels, [](const ModelInfo &info) { return info.id != 0; });
+
+struct ModelIdEntry {
+    uint16_t id;
+    Model model;
+};
+
+// Sorted by id at compile time for binary search
+//
+constexpr auto kModelIds = [] {
+    std::array<ModelIdEntry, kIdentifiableModelCount> result{};
+    size_t count = 0;
+    for (const auto &info : kModels) {
+        if (info.id != 0) {
+            result[count++] = {info.id, info.model};
+        }
+    }
+    std::ranges::sort(result, {}, &ModelIdEntry::id);
+    return result;
+}();
+
+static_assert(std::ranges::adjacent_find(kModelIds, {}, &ModelIdEntry::id) == kModelIds.end(),
+              "Duplicate model id.");
+} // namespace Details
+
+constexpr const ModelInfo &GetModelInfo(Model model)
+{
+    const auto index = Helper::ToUnderlying(model);
+    return Details::kModels[index < Details::kModels.size() ? index : 0];
+}
+
+constexpr Model FindModelById(uint16_t id)
+{
+    const auto iter =
+        std::ranges::lower_bound(Details::kModelIds, id, {}, &Details::ModelIdEntry::id);
+    return iter != Details::kModelIds.end() && iter->id == id ? iter->model : Model::Unknown;
+}
+
+static_assert(FindModelById(0x2014) == Model::AirPods_Pro_2);
+static_assert(FindModelById(0x2003) == Model::Unknown);
+
 } // namespace Core::AirPods
 
 template <>
 inline QString Helper::ToString<Core::AirPods::Model>(const Core::AirPods::Model &value)
 {
-    switch (value) {
-    case Core::AirPods::Model::AirPods_1:
-        return "AirPods 1";
-    case Core::AirPods::Model::AirPods_2:
-        return "AirPods 2";
-    case Core::AirPods::Model::AirPods_3:
-        return "AirPods 3";
-    case Core::AirPods::Model::AirPods_4:
-        return "AirPods 4";
-    case Core::AirPods::Model::AirPods_4_ANC:
-        return "AirPods 4 (ANC)";
-    case Core::AirPods::Model::AirPods_Pro:
-        return "AirPods Pro";
-    case Core::AirPods::Model::AirPods_Pro_2:
-        return "AirPods Pro 2";
-    case Core::AirPods::Model::AirPods_Pro_2_USB_C:
-        return "AirPods Pro 2 (USB-C)";
-    case Core::AirPods::Model::AirPods_Max:
-        return "AirPods Max";
-    case Core::AirPods::Model::Powerbeats_3:
-        return "Powerbeats 3";
-    case Core::AirPods::Model::Beats_X:
-        return "BeatsX";
-    case Core::AirPods::Model::Beats_Solo3:
-        return "BeatsSolo3";
-    case Core::AirPods::Model::Beats_Fit_Pro:
-        return "Beats Fit Pro";
-    default:
-        return "Unknown";
-    }
+    const auto &displayName = Core::AirPods::GetModelInfo(value).displayName;
+    return QString::fromUtf8(displayName.data(), (int)displayName.size());
 }
 
 template <>
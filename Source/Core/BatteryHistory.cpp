@@ -0,0 +1,269 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "BatteryHistory.h"
+
+#include <array>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+
+#include <QFile>
+#include <QDateTime>
+
+#include "../Utils.h"
+#include "../Logger.h"
+
+namespace Core::BatteryHistory {
+
+namespace Details {
+
+constexpr char kMagic[8] = {'A', 'P', 'D', 'B', 'A', 'T', 'H', '\0'};
+constexpr uint32_t kVersion = 1;
+// 16 bytes a sample, 256 KiB in total
+constexpr uint32_t kCapacity = 16384;
+
+constexpr uint8_t kUnavailable = 0xFF;
+constexpr int64_t kMsPerMinute = 60'000;
+// The batteries are reported in steps of 10%, a fit over less than this is mostly noise
+constexpr int64_t kMinFitSpanMs = 10 * kMsPerMinute;
+// After a longer time without a step the device was likely put away, so it's a new discharge
+constexpr int64_t kMaxStepGapMs = 60 * kMsPerMinute;
+
+enum Flag : uint8_t {
+    kLeftCharging = 1 << 0,
+    kRightCharging = 1 << 1,
+    kCaseCharging = 1 << 2,
+    kLeftInEar = 1 << 3,
+    kRightInEar = 1 << 4,
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t capacity;
+    uint64_t count;
+};
+static_assert(sizeof(Header) == 24);
+
+struct Sample {
+    int64_t time;
+    std::array<uint8_t, Helper::ToUnderlying(Component::_Max)> battery;
+    uint8_t flags;
+    uint32_t reserved;
+};
+static_assert(sizeof(Sample) == 16 && std::is_trivially_copyable_v<Sample>);
+
+constexpr qint64 kFileSize = sizeof(Header) + sizeof(Sample) * kCapacity;
+
+// Least squares fit of the battery over the time of a discharge. Only the steps are fed, the
+// sums make each of them O(1).
+//
+class DrainFit
+{
+public:
+    void Feed(int64_t time, uint8_t battery, bool isCharging)
+    {
+        if (battery == kUnavailable || isCharging) {
+            Reset();
+            return;
+        }
+
+        if (_count != 0) {
+            if (battery > _lastBattery || time - _lastStepTime > kMaxStepGapMs) {
+                Reset();
+            }
+            else if (battery == _lastBattery) {
+                return;
+            }
+        }
+
+        if (_count == 0) {
+            _origin = time;
+        }
+
+        const double t = (double)(time - _origin) / kMsPerMinute;
+        _count += 1;
+        _sumT += t;
+        _sumB += battery;
+        _sumTT += t * t;
+        _sumTB += t * battery;
+        _lastStepTime = time;
+        _lastBattery = battery;
+    }
+
+    std::optional<std::chrono::minutes> Predict(int64_t now) const
+    {
+        if (_count < 2 || _lastStepTime - _origin < kMinFitSpanMs) {
+            return std::nullopt;
+        }
+
+        const double denominator = _count * _sumTT - _sumT * _sumT;
+        if (denominator <= 0) {
+            return std::nullopt;
+        }
+
+        // Percent per minute
+        const double slope = (_count * _sumTB - _sumT * _sumB) / denominator;
+        if (slope >= 0) {
+            return std::nullopt;
+        }
+
+        const double remaining =
+            _lastBattery / -slope - (double)(now - _lastStepTime) / kMsPerMinute;
+        return std::chrono::minutes{(int64_t)(std::max)(remaining, 0.0)};
+    }
+
+private:
+    int64_t _origin{0}, _lastStepTime{0};
+    uint8_t _lastBattery{0};
+    double _count{0}, _sumT{0}, _sumB{0}, _sumTT{0}, _sumTB{0};
+
+    void Reset()
+    {
+        *this = DrainFit{};
+    }
+};
+
+class History
+{
+public:
+    History()
+    {
+        if (!Map()) {
+            LOG(Warn, "Battery history is kept in memory only.");
+            return;
+        }
+
+        // Rebuild the fits from the samples still in the ring
+        //
+        const uint64_t count = _header->count;
+        for (uint64_t i = count - (std::min)(count, (uint64_t)kCapacity); i < count; ++i) {
+            Feed(_samples[i % kCapacity]);
+        }
+        LOG(Info, "Battery history loaded. Samples: {}", (std::min)(count, (uint64_t)kCapacity));
+    }
+
+    void Record(const AirPods::StateBits &state)
+    {
+        const auto battery = [](const Battery &value) {
+            return value.Available() ? (uint8_t)value.Value() : kUnavailable;
+        };
+
+        Sample sample{};
+        sample.time = QDateTime::currentMSecsSinceEpoch();
+        sample.battery = {
+            battery(state.GetBattery(AirPods::Side::Left)),
+            battery(state.GetBattery(AirPods::Side::Right)), battery(state.GetCaseBattery())};
+        sample.flags = (state.IsCharging(AirPods::Side::Left) ? kLeftCharging : 0) |
+                       (state.IsCharging(AirPods::Side::Right) ? kRightCharging : 0) |
+                       (state.IsCaseCharging() ? kCaseCharging : 0) |
+                       (state.IsInEar(AirPods::Side::Left) ? kLeftInEar : 0) |
+                       (state.IsInEar(AirPods::Side::Right) ? kRightInEar : 0);
+
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        if (_last.has_value() && _last->battery == sample.battery && _last->flags == sample.flags)
+        {
+            return;
+        }
+        _last = sample;
+        Feed(sample);
+
+        if (_header != nullptr) {
+            _samples[_header->count % kCapacity] = sample;
+            ++_header->count;
+        }
+    }
+
+    std::optional<std::chrono::minutes> PredictRemaining(Component component)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _fits[Helper::ToUnderlying(component)].Predict(
+            QDateTime::currentMSecsSinceEpoch());
+    }
+
+private:
+    std::mutex _mutex;
+    QFile _file;
+    Header *_header{nullptr};
+    Sample *_samples{nullptr};
+    std::optional<Sample> _last;
+    std::array<DrainFit, Helper::ToUnderlying(Component::_Max)> _fits;
+
+    bool Map()
+    {
+        _file.setFileName(Utils::File::GetWorkspace().absoluteFilePath("BatteryHistory.bin"));
+        if (!_file.open(QIODevice::ReadWrite)) {
+            LOG(Warn, "Open battery history failed. Error: {}", _file.errorString());
+            return false;
+        }
+
+        const bool isSizeMatched = _file.size() == kFileSize;
+        if (!isSizeMatched && !_file.resize(kFileSize)) {
+            LOG(Warn, "Resize battery history failed. Error: {}", _file.errorString());
+            return false;
+        }
+
+        auto *data = _file.map(0, kFileSize);
+        if (data == nullptr) {
+            LOG(Warn, "Map battery history failed. Error: {}", _file.errorString());
+            return false;
+        }
+        _header = reinterpret_cast<Header *>(data);
+        _samples = reinterpret_cast<Sample *>(data + sizeof(Header));
+
+        if (!isSizeMatched || std::memcmp(_header->magic, kMagic, sizeof(kMagic)) != 0 ||
+            _header->version != kVersion || _header->capacity != kCapacity)
+        {
+            std::memset(data, 0, kFileSize);
+            std::memcpy(_header->magic, kMagic, sizeof(kMagic));
+            _header->version = kVersion;
+            _header->capacity = kCapacity;
+            LOG(Info, "Battery history created.");
+        }
+        return true;
+    }
+
+    void Feed(const Sample &sample)
+    {
+        for (size_t i = 0; i < _fits.size(); ++i) {
+            _fits[i].Feed(sample.time, sample.battery[i], sample.flags & (1 << i));
+        }
+    }
+};
+
+History &GetHistory()
+{
+    static History i;
+    return i;
+}
+
+} // namespace Details
+
+void Record(const AirPods::StateBits &state)
+{
+    Details::GetHistory().Record(state);
+}
+
+std::optional<std::chrono::minutes> PredictRemaining(Component component)
+{
+    return Details::GetHistory().PredictRemaining(component);
+}
+
+} // namespace Core::BatteryHistory
@@ -0,0 +1,50 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <chrono>
+#include <optional>
+
+#include "AirPods.h"
+
+// A bounded history of the battery states on disk, and the drain rate fitted from it.
+//
+// The history is a ring of fixed-size samples in a memory-mapped file of the workspace, so it
+// keeps the same size however long the app runs and an append is only a few stores.
+//
+//   Header: "APDBATH\0", uint32 version, uint32 capacity, uint64 count of samples ever written
+//   Sample: int64 milliseconds since epoch, uint8 left, right, case battery (0xFF unavailable),
+//           uint8 flags (bit 0-2 left, right, case charging, bit 3-4 left, right in ear),
+//           uint32 reserved
+//
+namespace Core::BatteryHistory {
+
+enum class Component : uint32_t { Left, Right, Case, _Max };
+
+// Records the state if its batteries, charging or in ear states differ from the last sample.
+// Thread-safe.
+//
+void Record(const AirPods::StateBits &state);
+
+// The time left until the component runs out at the drain rate of its current discharge, or
+// `std::nullopt` if it's charging or the discharge is too short to tell. Thread-safe.
+//
+std::optional<std::chrono::minutes> PredictRemaining(Component component);
+
+} // namespace Core::BatteryHistory
@@ -18,9 +18,15 @@
 
 #pragma once
 
+#include <span>
+#include <vector>
+#include <optional>
 #include <functional>
 
+#include <QUuid>
+
 #include "../Helper.h"
+#include "Latency.h"
 
 namespace Core::Bluetooth {
 
@@ -46,29 +52,28 @@ public:
     virtual uint16_t GetProductId() const = 0;
     virtual uint16_t GetVendorId() const = 0;
     virtual DeviceState GetConnectionState() const = 0;
+    // Identifies the physical device across its interfaces, e.g. its audio endpoints
+    virtual QUuid GetContainerId() const = 0;
 
-    inline auto &CbConnectionStatusChanged()
-    {
-        return _cbConnectionStatusChanged;
-    }
-    inline auto &CbNameChanged()
-    {
-        return _cbNameChanged;
-    }
-
-private:
-    Helper::Callback<FnConnectionStatusChanged> _cbConnectionStatusChanged;
-    Helper::Callback<FnNameChanged> _cbNameChanged;
+    // Shared by all the handles of the same underlying device
+    //
+    virtual Helper::Callback<FnConnectionStatusChanged> &CbConnectionStatusChanged() = 0;
+    virtual Helper::Callback<FnNameChanged> &CbNameChanged() = 0;
 };
 
 template <class ConcreteDeviceT>
 class DeviceManagerAbstract
 {
 public:
+    using FnDevices = std::function<void(std::vector<ConcreteDeviceT>)>;
+    using FnDevice = std::function<void(std::optional<ConcreteDeviceT>)>;
+
     virtual inline ~DeviceManagerAbstract() {}
 
-    virtual std::vector<ConcreteDeviceT> GetDevicesByState(DeviceState state) const = 0;
-    virtual std::optional<ConcreteDeviceT> FindDevice(uint64_t address) const = 0;
+    // The callbacks may be invoked later, once the devices have been enumerated
+    //
+    virtual void GetDevicesByState(DeviceState state, FnDevices callback) = 0;
+    virtual void FindDevice(uint64_t address, FnDevice callback) = 0;
 };
 
 template <class Derived>
@@ -76,12 +81,46 @@ class AdvertisementWatcherAbstract
 {
 public:
     enum class State { Started, Stopped };
+    enum class FilterMode : uint32_t { Unfiltered, Filtered, _Max };
+    // `LowPower` is a passive scan that the stack is free to duty-cycle, `Full` is an active scan
+    // that reports every advertisement
+    enum class ScanMode : uint32_t { LowPower, Full };
+
+    // Manufacturer data whose bytes begin with `dataPrefix` from company `companyId`
+    //
+    struct ManufacturerDataFilter {
+        uint16_t companyId{};
+        std::vector<uint8_t> dataPrefix;
+    };
+
+    // Legacy advertisement payloads are at most 31 bytes, so a few inline entries are enough
+    //
+    constexpr static size_t kMaxManufacturerDataCount = 4;
+    constexpr static size_t kMaxManufacturerDataSize = 31;
+
+    struct ManufacturerData {
+        uint16_t companyId{};
+        Helper::StaticVector<uint8_t, kMaxManufacturerDataSize> data;
+    };
 
     struct ReceivedData {
         int16_t rssi{};
         typename Derived::Timestamp timestamp;
+        // The same moment as `timestamp` on the clock of the latency tracing
+        Latency::Clock::time_point originTime;
         uint64_t address{};
-        std::map<uint16_t, std::vector<uint8_t>> manufacturerDataMap;
+        Helper::StaticVector<ManufacturerData, kMaxManufacturerDataCount> manufacturerData;
+
+        inline std::optional<std::span<const uint8_t>>
+        FindManufacturerData(uint16_t companyId) const
+        {
+            for (const auto &entry : manufacturerData) {
+                if (entry.companyId == companyId) {
+                    return entry.data;
+                }
+            }
+            return std::nullopt;
+        }
     };
     using FnReceived = std::function<void(const ReceivedData &)>;
     using FnStateChanged = std::function<void(State, const std::optional<std::string> &)>;
@@ -100,6 +139,14 @@ public:
     virtual bool Start() = 0;
     virtual bool Stop() = 0;
 
+    virtual FilterMode GetFilterMode() const = 0;
+    virtual uint64_t GetReceivedCount(FilterMode mode) const = 0;
+
+    // Can be called at any time, a started watcher is restarted in the new mode
+    //
+    virtual void SetScanMode(ScanMode mode) = 0;
+    virtual ScanMode GetScanMode() const = 0;
+
 private:
     Helper::Callback<FnReceived> _cbReceived;
     Helper::Callback<FnStateChanged> _cbStateChanged;
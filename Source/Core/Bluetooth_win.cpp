@@ -18,8 +18,16 @@
 
 #include "Bluetooth_win.h"
 
+#include <deque>
+#include <unordered_map>
+
+#include <magic_enum.hpp>
+
 #include "../Logger.h"
+#include "../Assert.h"
+#include "../Profiler.h"
 #include "Debug.h"
+#include "Metrics.h"
 #include "OS/Windows.h"
 
 namespace Core::Bluetooth {
@@ -30,53 +38,208 @@ using namespace WinrtFoundation;
 using namespace WinrtBluetooth;
 using namespace WinrtBluetoothAdv;
 using namespace WinrtDevicesEnumeration;
+using namespace WinrtRadios;
+using namespace winrt::Windows::Storage::Streams;
 
 using namespace Core::Debug;
 
 //////////////////////////////////////////////////
-// Device
+// AsyncWorker
 //
 
-Device::Device(BluetoothDevice device) : _device{std::move(device)}
-{
-    RegisterHandlers();
-}
+namespace Details {
 
-Device::Device(const Device &rhs)
+// A persistent MTA thread for the blocking WinRT `.get()` calls, which are not allowed on the
+// STA UI thread
+//
+class AsyncWorker final : public Helper::Singleton<AsyncWorker>
 {
-    CopyFrom(rhs);
-}
+protected:
+    AsyncWorker() : _thread{&AsyncWorker::Thread, this} {}
+    friend Helper::Singleton<AsyncWorker>;
 
-Device::Device(Device &&rhs) noexcept
-{
-    MoveFrom(std::move(rhs));
-}
+public:
+    ~AsyncWorker()
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _destroy = true;
+        }
+        _conVar.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
 
-Device::~Device()
-{
-    UnregisterHandlers();
-}
+    template <class Function>
+    auto Post(Function &&function) -> std::future<std::invoke_result_t<Function>>
+    {
+        using ResultT = std::invoke_result_t<Function>;
+
+        auto task = std::make_shared<std::packaged_task<ResultT()>>(
+            std::forward<Function>(function));
+        auto future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _tasks.emplace_back([task] { (*task)(); });
+        }
+        _conVar.notify_one();
+        return future;
+    }
 
-Device &Device::operator=(const Device &rhs)
-{
-    CopyFrom(rhs);
-    return *this;
-}
+    // Runs inline if it's called from the worker thread, otherwise waits for the result
+    //
+    template <class Function>
+    auto Run(Function &&function) -> std::invoke_result_t<Function>
+    {
+        if (std::this_thread::get_id() == _thread.get_id()) {
+            return function();
+        }
+        return Post(std::forward<Function>(function)).get();
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _conVar;
+    std::deque<std::function<void()>> _tasks;
+    bool _destroy{false};
+    std::thread _thread;
+
+    void Thread()
+    {
+        winrt::init_apartment(winrt::apartment_type::multi_threaded);
+
+        std::unique_lock<std::mutex> lock{_mutex};
+        while (true) {
+            _conVar.wait(lock, [this] { return _destroy || !_tasks.empty(); });
+            if (_destroy) {
+                break;
+            }
+
+            auto task = std::move(_tasks.front());
+            _tasks.pop_front();
+
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+        _tasks.clear();
+        lock.unlock();
+
+        winrt::uninit_apartment();
+    }
+};
+} // namespace Details
+
+//////////////////////////////////////////////////
+// Device
+//
+
+struct Device::Impl : std::enable_shared_from_this<Impl> {
+    BluetoothDevice device;
+    std::mutex infoMutex;
+    std::optional<DeviceInformation> info;
+    IAsyncOperation<DeviceInformation> infoOperation{nullptr};
+
+    Helper::Callback<FnConnectionStatusChanged> cbConnectionStatusChanged;
+    Helper::Callback<FnNameChanged> cbNameChanged;
+
+    BluetoothDevice::ConnectionStatusChanged_revoker revokerConnectionStatusChanged;
+    BluetoothDevice::NameChanged_revoker revokerNameChanged;
+
+    Impl(BluetoothDevice device, std::optional<DeviceInformation> info)
+        : device{std::move(device)}, info{std::move(info)}
+    {
+    }
 
-Device &Device::operator=(Device &&rhs) noexcept
+    void Initialize()
+    {
+        // The handlers only hold a weak reference, so the last handle going away unregisters
+        // them
+        //
+        std::weak_ptr<Impl> weak = shared_from_this();
+
+        revokerConnectionStatusChanged = device.ConnectionStatusChanged(
+            winrt::auto_revoke, [weak](const BluetoothDevice &, const IInspectable &) {
+                if (auto impl = weak.lock()) {
+                    impl->cbConnectionStatusChanged.Invoke(GetConnectionState(impl->device));
+                }
+            });
+
+        revokerNameChanged = device.NameChanged(
+            winrt::auto_revoke, [weak](const BluetoothDevice &sender, const IInspectable &) {
+                if (auto impl = weak.lock()) {
+                    impl->cbNameChanged.Invoke(winrt::to_string(sender.Name()));
+                }
+            });
+
+        if (!info.has_value()) {
+            try {
+                infoOperation = FetchInfoAsync(device);
+            }
+            catch (const OS::Windows::Winrt::Exception &ex) {
+                LOG(Warn, "Device::FetchInfoAsync() failed. {}", Helper::ToString(ex));
+            }
+        }
+    }
+
+    // The lock isn't held while blocking on the worker, so that a job on the worker that needs
+    // the information of the same device doesn't deadlock. Concurrent callers may fetch it twice,
+    // the first result is kept.
+    //
+    std::optional<DeviceInformation> GetInfo()
+    {
+        IAsyncOperation<DeviceInformation> operation{nullptr};
+        {
+            std::lock_guard<std::mutex> lock{infoMutex};
+            if (info.has_value()) {
+                return info;
+            }
+            // Only one waiter can be attached to an operation
+            operation = std::exchange(infoOperation, nullptr);
+        }
+
+        std::optional<DeviceInformation> result;
+        Details::AsyncWorker::GetInstance().Run([&]() {
+            try {
+                // Wait for the request started on creation, or start a new one if it failed
+                //
+                result = (operation != nullptr ? operation : FetchInfoAsync(device)).get();
+            }
+            catch (const OS::Windows::Winrt::Exception &ex) {
+                LOG(Warn, "Device::FetchInfoAsync() failed. {}", Helper::ToString(ex));
+            }
+        });
+
+        std::lock_guard<std::mutex> lock{infoMutex};
+        if (!info.has_value()) {
+            info = std::move(result);
+        }
+        return info;
+    }
+
+    static DeviceState GetConnectionState(const BluetoothDevice &device)
+    {
+        return device.ConnectionStatus() == BluetoothConnectionStatus::Connected
+                   ? DeviceState::Connected
+                   : DeviceState::Disconnected;
+    }
+};
+
+Device::Device(BluetoothDevice device, std::optional<DeviceInformation> info)
+    : _impl{std::make_shared<Impl>(std::move(device), std::move(info))}
 {
-    MoveFrom(std::move(rhs));
-    return *this;
+    _impl->Initialize();
 }
 
 uint64_t Device::GetAddress() const
 {
-    return _device->BluetoothAddress();
+    return _impl->device.BluetoothAddress();
 }
 
 std::string Device::GetName() const
 {
-    return winrt::to_string(_device->Name());
+    return winrt::to_string(_impl->device.Name());
 }
 
 uint16_t Device::GetVendorId() const
@@ -91,184 +254,431 @@ uint16_t Device::GetProductId() const
 
 DeviceState Device::GetConnectionState() const
 {
-    return _device->ConnectionStatus() == BluetoothConnectionStatus::Connected
-               ? DeviceState::Connected
-               : DeviceState::Disconnected;
+    return Impl::GetConnectionState(_impl->device);
 }
 
-winrt::hstring Device::GetAepId() const
+Helper::Callback<Device::FnConnectionStatusChanged> &Device::CbConnectionStatusChanged()
 {
-    return GetProperty<winrt::hstring>(kPropertyAepContainerId, {});
+    return _impl->cbConnectionStatusChanged;
 }
 
-void Device::RegisterHandlers()
+Helper::Callback<Device::FnNameChanged> &Device::CbNameChanged()
 {
-    UnregisterHandlers();
-
-    _tokenConnectionStatusChanged = _device->ConnectionStatusChanged(
-        [this](const BluetoothDevice &sender, IInspectable) { OnConnectionStatusChanged(sender); });
+    return _impl->cbNameChanged;
+}
 
-    _tokenNameChanged = _device->NameChanged(
-        [this](const BluetoothDevice &sender, IInspectable) { OnNameChanged(sender); });
+IAsyncOperation<DeviceInformation> Device::FetchInfoAsync(const BluetoothDevice &device)
+{
+    // clang-format off
+    return DeviceInformation::CreateFromIdAsync(
+        device.DeviceInformation().Id(),
+        {
+            kPropertyBluetoothProductId, // uint16
+            kPropertyBluetoothVendorId,  // uint16
+            kPropertyAepContainerId,     // guid
+        }
+    );
+    // clang-format on
 }
 
-void Device::UnregisterHandlers()
+template <class T>
+T Device::GetProperty(const winrt::hstring &name, const T &defaultValue) const
 {
-    if (_tokenConnectionStatusChanged) {
-        _device->ConnectionStatusChanged(_tokenConnectionStatusChanged);
-        _tokenConnectionStatusChanged = {};
-    }
+    try {
+        const auto optInfo = _impl->GetInfo();
+        if (!optInfo.has_value()) {
+            LOG(Warn, "optInfo.has_value() false.");
+            return defaultValue;
+        }
 
-    if (_tokenNameChanged) {
-        _device->NameChanged(_tokenNameChanged);
-        _tokenNameChanged = {};
+        const auto boxed = optInfo->Properties().TryLookup(name);
+        return winrt::unbox_value_or<T>(boxed, defaultValue);
     }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        LOG(Warn, "GetProperty() failed. {}", Helper::ToString(ex));
+    }
+    return defaultValue;
 }
 
-void Device::CopyFrom(const Device &rhs)
+QUuid Device::GetContainerId() const
 {
-    _device = rhs._device;
-    _info = rhs._info;
-    RegisterHandlers();
+    const auto id = GetProperty<winrt::guid>(kPropertyAepContainerId, {});
+    return QUuid{id.Data1,    id.Data2,    id.Data3,    id.Data4[0], id.Data4[1], id.Data4[2],
+                 id.Data4[3], id.Data4[4], id.Data4[5], id.Data4[6], id.Data4[7]};
 }
 
-void Device::MoveFrom(Device &&rhs) noexcept
-{
-    rhs.UnregisterHandlers();
-    _device = std::move(rhs._device);
-    _info = std::move(rhs._info);
-    RegisterHandlers();
-}
+//////////////////////////////////////////////////
+// DevicesManager
+//
 
-const std::optional<DeviceInformation> &Device::GetInfo() const
+namespace Details {
+class DeviceManager final : public Helper::Singleton<DeviceManager>,
+                            Details::DeviceManagerAbstract<Device>
 {
-    if (_info.has_value()) {
-        return _info;
+protected:
+    DeviceManager()
+    {
+        // Make sure the scheduler outlives us, the restart task is cancelled in the destructor
+        //
+        Helper::Scheduler::GetInstance();
+
+        try {
+            _watcher = DeviceInformation::CreateWatcher(
+                BluetoothDevice::GetDeviceSelectorFromPairingState(true));
+        }
+        catch (const OS::Windows::Winrt::Exception &ex) {
+            LOG(Error, "DeviceInformation::CreateWatcher() failed. {}", Helper::ToString(ex));
+
+            std::lock_guard<std::mutex> lock{_mutex};
+            _destroy = true;
+            CompleteEnumeration();
+            return;
+        }
+
+        _watcher.Added(std::bind(&DeviceManager::OnAdded, this, _2));
+        _watcher.Updated(std::bind(&DeviceManager::OnUpdated, this, _2));
+        _watcher.Removed(std::bind(&DeviceManager::OnRemoved, this, _2));
+        _watcher.EnumerationCompleted(std::bind(&DeviceManager::OnEnumerationCompleted, this));
+        _watcher.Stopped(std::bind(&DeviceManager::OnStopped, this));
+
+        StartWatcher();
     }
+    friend Helper::Singleton<DeviceManager>;
+
+public:
+    ~DeviceManager()
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _destroy = true;
+        }
+
+        if (_restartTask != nullptr) {
+            Helper::Scheduler::GetInstance().Cancel(_restartTask);
+        }
 
-    std::thread{[this]() {
         try {
-            // clang-format off
-            _info = DeviceInformation::CreateFromIdAsync(
-                _device->DeviceInformation().Id(),
+            if (_watcher != nullptr) {
+                const auto status = _watcher.Status();
+                if (status == DeviceWatcherStatus::Started ||
+                    status == DeviceWatcherStatus::EnumerationCompleted)
                 {
-                    kPropertyBluetoothProductId, // uint16
-                    kPropertyBluetoothVendorId,  // uint16
-                    kPropertyAepContainerId,     // hstring
+                    _watcher.Stop();
                 }
-            ).get();
-            // clang-format on
+            }
         }
         catch (const OS::Windows::Winrt::Exception &ex) {
-            LOG(Warn, "DeviceInformation::CreateFromIdAsync() failed. {}", Helper::ToString(ex));
+            LOG(Warn, "DeviceWatcher::Stop() failed. {}", Helper::ToString(ex));
         }
-    }}.join();
+    }
 
-    return _info;
-}
+    void GetDevicesByState(DeviceState state, FnDevices callback) override
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
 
-void Device::OnConnectionStatusChanged(const BluetoothDevice &sender)
-{
-    CbConnectionStatusChanged().Invoke(GetConnectionState());
-}
+        if (!_ready) {
+            _pendingQueries.emplace_back(state, std::move(callback));
+            return;
+        }
+        Reply(std::move(callback), CollectDevices(state));
+    }
 
-void Device::OnNameChanged(const BluetoothDevice &sender)
-{
-    CbNameChanged().Invoke(GetName());
-}
+    void FindDevice(uint64_t address, FnDevice callback) override
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
 
-//////////////////////////////////////////////////
-// DevicesManager
-//
+        auto iter = _devices.find(address);
+        if (iter != _devices.end()) {
+            Reply(std::move(callback), std::optional<Device>{iter->second});
+            return;
+        }
 
-namespace Details {
-class DeviceManager final : public Helper::Singleton<DeviceManager>,
-                            Details::DeviceManagerAbstract<Device>
-{
-protected:
-    DeviceManager() = default;
-    friend Helper::Singleton<DeviceManager>;
+        if (!_ready) {
+            _pendingFinds.emplace(address, std::move(callback));
+            return;
+        }
+        Reply(std::move(callback), std::optional<Device>{});
+    }
 
-public:
-    std::vector<Device> GetDevicesByState(DeviceState state) const override
+private:
+    static constexpr inline auto kRestartInterval = 3s;
+
+    DeviceWatcher _watcher{nullptr};
+    std::mutex _mutex;
+    std::unordered_map<uint64_t, Device> _devices;
+    std::unordered_map<winrt::hstring, uint64_t> _addresses;
+    // The devices being resolved, mapped to whether they are still wanted
+    std::unordered_map<winrt::hstring, bool> _resolving;
+    bool _enumerated{false}, _ready{false}, _destroy{false};
+    std::unordered_multimap<uint64_t, FnDevice> _pendingFinds;
+    std::vector<std::pair<DeviceState, FnDevices>> _pendingQueries;
+    Helper::Scheduler::TaskPtr _restartTask;
+
+    // Posting to the worker never locks anything of ours, so it's fine to reply with the lock
+    // held
+    //
+    template <class Function, class Result>
+    static void Reply(Function &&callback, Result &&result)
+    {
+        AsyncWorker::GetInstance().Post(
+            [callback = std::forward<Function>(callback),
+             result = std::forward<Result>(result)]() mutable { callback(std::move(result)); });
+    }
+
+    std::vector<Device> CollectDevices(DeviceState state) const
     {
         std::vector<Device> result;
+        result.reserve(_devices.size());
+
+        for (const auto &[address, device] : _devices) {
+            if (state == DeviceState::Paired || device.GetConnectionState() == state) {
+                result.emplace_back(device);
+            }
+        }
+        return result;
+    }
+
+    // Must be called with the lock held
+    //
+    void CompleteEnumeration()
+    {
+        _ready = true;
+
+        LOG(Info, "Bluetooth device enumeration completed. Paired devices: {}", _devices.size());
+
+        for (auto &[address, callback] : _pendingFinds) {
+            Reply(std::move(callback), std::optional<Device>{});
+        }
+        _pendingFinds.clear();
+
+        for (auto &[state, callback] : _pendingQueries) {
+            Reply(std::move(callback), CollectDevices(state));
+        }
+        _pendingQueries.clear();
+    }
 
+    void StartWatcher()
+    {
         try {
-            winrt::hstring aqsString;
+            _watcher.Start();
+            LOG(Info, "Bluetooth device watcher started.");
+        }
+        catch (const OS::Windows::Winrt::Exception &ex) {
+            LOG(Warn, "DeviceWatcher::Start() failed. {}", Helper::ToString(ex));
+            OnStopped();
+        }
+    }
 
-            switch (state) {
-            case Core::Bluetooth::DeviceState::Paired:
-                aqsString = BluetoothDevice::GetDeviceSelectorFromPairingState(true);
-                break;
-            case Core::Bluetooth::DeviceState::Disconnected:
-                aqsString = BluetoothDevice::GetDeviceSelectorFromConnectionStatus(
-                    BluetoothConnectionStatus::Disconnected);
-                break;
-            case Core::Bluetooth::DeviceState::Connected:
-                aqsString = BluetoothDevice::GetDeviceSelectorFromConnectionStatus(
-                    BluetoothConnectionStatus::Connected);
-                break;
-            default:
-                APD_ASSERT(false);
-                break;
+    void RestartWatcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            if (_destroy) {
+                return;
             }
 
-            auto collection =
-                WinrtDevicesEnumeration::DeviceInformation::FindAllAsync(aqsString).get();
-
-            result.reserve(collection.Size());
+            // Removals may have been missed while the watcher was stopped, so everything is
+            // enumerated again
+            //
+            _devices.clear();
+            _addresses.clear();
+            for (auto &[id, wanted] : _resolving) {
+                wanted = false;
+            }
+            _enumerated = false;
+            _ready = false;
+        }
+        StartWatcher();
+    }
 
-            for (uint32_t i = 0; i < collection.Size(); ++i) {
-                const auto &deviceInfo = collection.GetAt(i);
+    // Resolves the `BluetoothDevice` and prefetches its information without blocking the
+    // watcher thread, so that all the devices are resolved concurrently
+    //
+    void Resolve(const winrt::hstring &id)
+    {
+        try {
+            BluetoothDevice::FromIdAsync(id).Completed(
+                [this, id](const IAsyncOperation<BluetoothDevice> &operation, AsyncStatus status) {
+                    OnDeviceResolved(id, operation, status);
+                });
+        }
+        catch (const OS::Windows::Winrt::Exception &ex) {
+            LOG(Warn, "BluetoothDevice::FromIdAsync() failed. {}", Helper::ToString(ex));
+            OnResolved(id, std::nullopt);
+        }
+    }
 
-                try {
-                    auto device = BluetoothDevice::FromIdAsync(deviceInfo.Id()).get();
-                    result.emplace_back(std::move(device));
-                }
-                catch (const OS::Windows::Winrt::Exception &ex) {
-                    LOG(Warn, "BluetoothDevice::FromIdAsync() failed. {}", Helper::ToString(ex));
-                }
+    void OnDeviceResolved(
+        const winrt::hstring &id, const IAsyncOperation<BluetoothDevice> &operation,
+        AsyncStatus status)
+    {
+        try {
+            auto device = status == AsyncStatus::Completed ? operation.GetResults() : nullptr;
+            if (device == nullptr) {
+                LOG(Warn, "BluetoothDevice::FromIdAsync() failed. Status: {}",
+                    magic_enum::enum_name(status));
+                OnResolved(id, std::nullopt);
+                return;
             }
 
-            return result;
+            Device::FetchInfoAsync(device).Completed(
+                [this, id, device](
+                    const IAsyncOperation<DeviceInformation> &operation, AsyncStatus status) {
+                    std::optional<DeviceInformation> info;
+                    try {
+                        if (status == AsyncStatus::Completed) {
+                            info = operation.GetResults();
+                        }
+                    }
+                    catch (const OS::Windows::Winrt::Exception &ex) {
+                        LOG(Warn, "Device::FetchInfoAsync() failed. {}", Helper::ToString(ex));
+                    }
+                    // The getters will fetch it again on demand if the prefetching failed
+                    OnResolved(id, Device{device, std::move(info)});
+                });
         }
         catch (const OS::Windows::Winrt::Exception &ex) {
-            return result;
+            LOG(Warn, "Resolving device failed. {}", Helper::ToString(ex));
+            OnResolved(id, std::nullopt);
+        }
+    }
+
+    void OnResolved(const winrt::hstring &id, std::optional<Device> optDevice)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        auto iter = _resolving.find(id);
+        if (iter == _resolving.end()) {
+            return;
+        }
+        const bool wanted = iter->second;
+        _resolving.erase(iter);
+
+        if (wanted && optDevice.has_value()) {
+            const auto address = optDevice->GetAddress();
+
+            auto [begin, end] = _pendingFinds.equal_range(address);
+            for (auto pending = begin; pending != end; ++pending) {
+                Reply(std::move(pending->second), std::optional<Device>{*optDevice});
+            }
+            _pendingFinds.erase(begin, end);
+
+            _addresses.insert_or_assign(id, address);
+            _devices.insert_or_assign(address, std::move(*optDevice));
+        }
+
+        if (_enumerated && !_ready && _resolving.empty()) {
+            CompleteEnumeration();
+        }
+    }
+
+    void OnAdded(const DeviceInformation &info)
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _resolving.insert_or_assign(info.Id(), true);
         }
+        Resolve(info.Id());
     }
 
-    std::optional<Device> FindDevice(uint64_t address) const override
+    void OnUpdated(const DeviceInformationUpdate &update)
     {
-        auto devices = GetDevicesByState(Bluetooth::DeviceState::Paired);
-        for (const auto &device : devices) {
-            if (device.GetAddress() == address) {
-                return device;
+        // The connection status and the name are tracked by `BluetoothDevice` itself, so an
+        // update only matters if the device failed to be resolved when it was added
+        //
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            if (_addresses.contains(update.Id()) || _resolving.contains(update.Id())) {
+                return;
             }
+            _resolving.emplace(update.Id(), true);
+        }
+        Resolve(update.Id());
+    }
+
+    void OnRemoved(const DeviceInformationUpdate &update)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        auto resolving = _resolving.find(update.Id());
+        if (resolving != _resolving.end()) {
+            resolving->second = false;
+        }
+
+        auto iter = _addresses.find(update.Id());
+        if (iter != _addresses.end()) {
+            _devices.erase(iter->second);
+            _addresses.erase(iter);
         }
-        return std::nullopt;
+    }
+
+    void OnEnumerationCompleted()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        _enumerated = true;
+        if (!_ready && _resolving.empty()) {
+            CompleteEnumeration();
+        }
+    }
+
+    void OnStopped()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (_destroy) {
+            return;
+        }
+
+        LOG(Warn, "Bluetooth device watcher stopped unexpectedly. Restart in {}s.",
+            std::chrono::duration_cast<std::chrono::seconds>(kRestartInterval).count());
+
+        // Don't leave the lookups waiting, answer them with what we have
+        //
+        if (!_ready) {
+            CompleteEnumeration();
+        }
+
+        _restartTask = Helper::Scheduler::GetInstance().ScheduleOnce(
+            kRestartInterval, [this] { RestartWatcher(); });
     }
 };
 } // namespace Details
 
 namespace DeviceManager {
 
-std::vector<Device> GetDevicesByState(DeviceState state)
+std::future<std::vector<Device>> GetDevicesByState(DeviceState state)
+{
+    auto promise = std::make_shared<std::promise<std::vector<Device>>>();
+    auto future = promise->get_future();
+    GetDevicesByState(
+        state, [promise](std::vector<Device> devices) { promise->set_value(std::move(devices)); });
+    return future;
+}
+
+std::future<std::optional<Device>> FindDevice(uint64_t address)
+{
+    auto promise = std::make_shared<std::promise<std::optional<Device>>>();
+    auto future = promise->get_future();
+    FindDevice(address, [promise](std::optional<Device> optDevice) {
+        promise->set_value(std::move(optDevice));
+    });
+    return future;
+}
+
+void GetDevicesByState(DeviceState state, FnDevices callback)
 {
-    std::vector<Device> result;
-    std::thread{[&]() {
-        result = Details::DeviceManager::GetInstance().GetDevicesByState(state);
-    }}.join();
-    return result;
+    // The watcher is created on the worker thread the first time
+    //
+    Details::AsyncWorker::GetInstance().Post([=, callback = std::move(callback)]() mutable {
+        Details::DeviceManager::GetInstance().GetDevicesByState(state, std::move(callback));
+    });
 }
 
-std::optional<Device> FindDevice(uint64_t address)
+void FindDevice(uint64_t address, FnDevice callback)
 {
-    std::optional<Device> result;
-    std::thread{[&]() {
-        result = Details::DeviceManager::GetInstance().FindDevice(address);
-    }}.join();
-    return result;
+    Details::AsyncWorker::GetInstance().Post([=, callback = std::move(callback)]() mutable {
+        Details::DeviceManager::GetInstance().FindDevice(address, std::move(callback));
+    });
 }
 } // namespace DeviceManager
 
@@ -276,20 +686,59 @@ std::optional<Device> FindDevice(uint64_t address)
 // AdvertisementWatcher
 //
 
-AdvertisementWatcher::AdvertisementWatcher()
+AdvertisementWatcher::AdvertisementWatcher(std::optional<ManufacturerDataFilter> filter)
+    : _filter{std::move(filter)}
 {
+    if (_filter.has_value()) {
+        _filterMode = FilterMode::Filtered;
+    }
+
+    _ingestThread = std::thread{&AdvertisementWatcher::IngestThread, this};
+
     _bleWatcher.Received(std::bind(&AdvertisementWatcher::OnReceived, this, _2));
     _bleWatcher.Stopped(std::bind(&AdvertisementWatcher::OnStopped, this, _2));
+
+    WatchAdapters();
 }
 
 AdvertisementWatcher::~AdvertisementWatcher()
 {
+    // Waits for the radio and adapter handlers running, none of them runs afterwards
+    //
+    {
+        std::lock_guard<std::recursive_mutex> lock{_lifetime->mutex};
+        _lifetime->alive = false;
+    }
+
     if (!_stop) {
         _destroy = true;
         Stop();
         std::unique_lock<std::mutex> lock{_conVarMutex};
         _destroyConVar.wait_for(lock, 1s);
     }
+    _destroy = true;
+
+    _ingest.Close();
+    if (_ingestThread.joinable()) {
+        _ingestThread.join();
+    }
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    _radioStateChangedRevoker.revoke();
+    _adapterAddedRevoker.revoke();
+    try {
+        if (_adapterWatcher != nullptr) {
+            const auto status = _adapterWatcher.Status();
+            if (status == DeviceWatcherStatus::Started ||
+                status == DeviceWatcherStatus::EnumerationCompleted)
+            {
+                _adapterWatcher.Stop();
+            }
+        }
+    }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        LOG(Warn, "Stop adapter watcher exception: {}", Helper::ToString(ex));
+    }
 }
 
 bool AdvertisementWatcher::Start()
@@ -298,27 +747,39 @@ bool AdvertisementWatcher::Start()
         _stop = false;
         _lastStartTime = std::chrono::steady_clock::now();
 
-        std::lock_guard<std::mutex> lock{_mutex};
-        _bleWatcher.Start();
-        LOG(Info, "Bluetooth AdvWatcher start succeeded.");
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            ApplyFilterMode(_filterMode);
+            ApplyScanMode(_scanMode);
+            _bleWatcher.Start();
+        }
+        LOG(Info, "Bluetooth AdvWatcher start succeeded. Filter mode: {}, scan mode: {}",
+            magic_enum::enum_name(_filterMode.load()), magic_enum::enum_name(_scanMode.load()));
         CbStateChanged().Invoke(State::Started, std::nullopt);
         return true;
     }
     catch (const OS::Windows::Winrt::Exception &ex) {
         LOG(Warn, "Start adv watcher exception: {}", Helper::ToString(ex));
-        return false;
     }
+
+    if (FallbackToUnfiltered("Start failed")) {
+        return Start();
+    }
+    return false;
 }
 
 bool AdvertisementWatcher::Stop()
 {
     try {
         _stop = true;
+        _recovering = false;
         _stopConVar.notify_all();
 
         std::lock_guard<std::mutex> lock{_mutex};
         _bleWatcher.Stop();
-        LOG(Info, "Bluetooth AdvWatcher stop succeeded.");
+        LOG(Info,
+            "Bluetooth AdvWatcher stop succeeded. Received count: Filtered {}, Unfiltered {}",
+            GetReceivedCount(FilterMode::Filtered), GetReceivedCount(FilterMode::Unfiltered));
         return true;
     }
     catch (const OS::Windows::Winrt::Exception &ex) {
@@ -327,35 +788,330 @@ bool AdvertisementWatcher::Stop()
     }
 }
 
+auto AdvertisementWatcher::GetFilterMode() const -> FilterMode
+{
+    return _filterMode;
+}
+
+uint64_t AdvertisementWatcher::GetReceivedCount(FilterMode mode) const
+{
+    return _receivedCount.at(Helper::ToUnderlying(mode)).load(std::memory_order_relaxed);
+}
+
+void AdvertisementWatcher::SetScanMode(ScanMode mode)
+{
+    if (_scanMode.exchange(mode) == mode) {
+        return;
+    }
+
+    LOG(Info, "Bluetooth AdvWatcher scan mode changed to {}.", magic_enum::enum_name(mode));
+
+    // A stopped watcher picks the mode up when it's started. A started one has to be stopped
+    // first, it's restarted as soon as the stopped event arrives.
+    //
+    if (_stop) {
+        return;
+    }
+
+    try {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (_bleWatcher.Status() != BluetoothLEAdvertisementWatcherStatus::Started) {
+            return;
+        }
+        _modeSwitch = true;
+        _bleWatcher.Stop();
+    }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        _modeSwitch = false;
+        LOG(Warn, "Stop adv watcher for switching scan mode exception: {}", Helper::ToString(ex));
+    }
+}
+
+auto AdvertisementWatcher::GetScanMode() const -> ScanMode
+{
+    return _scanMode;
+}
+
+// An adapter plugged in later, or coming back from a driver reset, brings a new radio with it
+//
+void AdvertisementWatcher::WatchAdapters()
+{
+    try {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _adapterWatcher = DeviceInformation::CreateWatcher(BluetoothAdapter::GetDeviceSelector());
+        _adapterAddedRevoker = _adapterWatcher.Added(
+            winrt::auto_revoke,
+            WhileAlive([this](const DeviceWatcher &, const DeviceInformation &) {
+                ResolveRadio();
+            }));
+        // Without a handler the watcher doesn't report the removals and updates
+        _adapterWatcher.Updated([](const DeviceWatcher &, const DeviceInformationUpdate &) {});
+        _adapterWatcher.Removed([](const DeviceWatcher &, const DeviceInformationUpdate &) {});
+        _adapterWatcher.Start();
+    }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        LOG(Warn, "Start adapter watcher exception: {}", Helper::ToString(ex));
+        ResolveRadio();
+    }
+}
+
+void AdvertisementWatcher::ResolveRadio()
+{
+    if (_destroy) {
+        return;
+    }
+
+    try {
+        BluetoothAdapter::GetDefaultAsync().Completed(WhileAlive(
+            [this](const IAsyncOperation<BluetoothAdapter> &operation, AsyncStatus status) {
+                try {
+                    auto adapter =
+                        status == AsyncStatus::Completed ? operation.GetResults() : nullptr;
+                    if (adapter == nullptr) {
+                        LOG(Warn, "No default Bluetooth adapter.");
+                        return;
+                    }
+
+                    adapter.GetRadioAsync().Completed(WhileAlive(
+                        [this](const IAsyncOperation<Radio> &operation, AsyncStatus status) {
+                            try {
+                                if (status == AsyncStatus::Completed) {
+                                    OnRadioResolved(operation.GetResults());
+                                }
+                            }
+                            catch (const OS::Windows::Winrt::Exception &ex) {
+                                LOG(Warn, "BluetoothAdapter::GetRadioAsync() failed. {}",
+                                    Helper::ToString(ex));
+                            }
+                        }));
+                }
+                catch (const OS::Windows::Winrt::Exception &ex) {
+                    LOG(Warn, "BluetoothAdapter::GetDefaultAsync() failed. {}",
+                        Helper::ToString(ex));
+                }
+            }));
+    }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        LOG(Warn, "BluetoothAdapter::GetDefaultAsync() failed. {}", Helper::ToString(ex));
+    }
+}
+
+void AdvertisementWatcher::OnRadioResolved(Radio radio)
+{
+    if (radio == nullptr || _destroy) {
+        return;
+    }
+
+    try {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _radioStateChangedRevoker.revoke();
+        _radio = radio;
+        _radioStateChangedRevoker = _radio.StateChanged(
+            winrt::auto_revoke,
+            WhileAlive([this](const Radio &radio, const auto &) { OnRadioStateChanged(radio); }));
+    }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        LOG(Warn, "Subscribe to the radio state exception: {}", Helper::ToString(ex));
+    }
+    LOG(Info, "Bluetooth radio resolved.");
+
+    // The adapter may be new, so a pending retry doesn't have to wait for its turn
+    //
+    OnRadioStateChanged(radio);
+}
+
+void AdvertisementWatcher::OnRadioStateChanged(const Radio &radio)
+{
+    try {
+        const auto state = radio.State();
+        LOG(Info, "Bluetooth radio state changed: {}", magic_enum::enum_name(state));
+
+        if (state == RadioState::On) {
+            WakeRetry();
+        }
+    }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        LOG(Warn, "Radio::State() failed. {}", Helper::ToString(ex));
+    }
+}
+
+void AdvertisementWatcher::WakeRetry()
+{
+    {
+        std::lock_guard<std::mutex> lock{_conVarMutex};
+        // Only a waiting retry is woken up, a stale flag would skip the backoff of the next one
+        //
+        if (!_retryWaiting) {
+            return;
+        }
+        _radioRecovered = true;
+        _retryInterval = kRetryInterval;
+    }
+    _stopConVar.notify_all();
+}
+
+// The watcher must be stopped
+//
+void AdvertisementWatcher::ApplyFilterMode(FilterMode mode)
+{
+    BluetoothLEAdvertisementFilter advFilter;
+
+    if (mode == FilterMode::Filtered) {
+        APD_ASSERT(_filter.has_value());
+
+        // The data of a manufacturer specific section starts with the little-endian company id
+        //
+        std::vector<uint8_t> pattern{
+            (uint8_t)(_filter->companyId & 0xFF), (uint8_t)(_filter->companyId >> 8)};
+        pattern.insert(pattern.end(), _filter->dataPrefix.begin(), _filter->dataPrefix.end());
+
+        DataWriter writer;
+        writer.WriteBytes(pattern);
+
+        advFilter.BytePatterns().Append(BluetoothLEAdvertisementBytePattern{
+            BluetoothLEAdvertisementDataTypes::ManufacturerSpecificData(), 0,
+            writer.DetachBuffer()});
+    }
+
+    _bleWatcher.AdvertisementFilter(advFilter);
+}
+
+// The watcher must be stopped
+//
+void AdvertisementWatcher::ApplyScanMode(ScanMode mode)
+{
+    // The passive scan sends no scan requests, and the sampling interval lets the stack coalesce
+    // the repeats of the same advertiser instead of waking us up for every one of them
+    //
+    if (mode == ScanMode::Full) {
+        _bleWatcher.ScanningMode(BluetoothLEScanningMode::Active);
+        _bleWatcher.SignalStrengthFilter().SamplingInterval(nullptr);
+    }
+    else {
+        _bleWatcher.ScanningMode(BluetoothLEScanningMode::Passive);
+        _bleWatcher.SignalStrengthFilter().SamplingInterval(
+            std::chrono::duration_cast<TimeSpan>(kLowPowerSamplingInterval));
+    }
+}
+
+// Unlike `Start()`, this is silent to the subscribers, the watcher is only away for the moment
+// between the stop and the restart
+//
+bool AdvertisementWatcher::RestartInScanMode()
+{
+    try {
+        std::lock_guard<std::mutex> lock{_mutex};
+        ApplyScanMode(_scanMode);
+        _bleWatcher.Start();
+    }
+    catch (const OS::Windows::Winrt::Exception &ex) {
+        LOG(Warn, "Restart adv watcher in scan mode {} exception: {}",
+            magic_enum::enum_name(_scanMode.load()), Helper::ToString(ex));
+        return false;
+    }
+
+    _lastStartTime = std::chrono::steady_clock::now();
+    LOG(Info, "Bluetooth AdvWatcher restarted in scan mode {}.",
+        magic_enum::enum_name(_scanMode.load()));
+    return true;
+}
+
+bool AdvertisementWatcher::FallbackToUnfiltered(const std::string &reason)
+{
+    auto expected = FilterMode::Filtered;
+    if (!_filterMode.compare_exchange_strong(expected, FilterMode::Unfiltered)) {
+        return false;
+    }
+
+    LOG(Warn,
+        "Bluetooth AdvWatcher falls back to unfiltered mode. Reason: '{}'. Filtered received "
+        "count: {}",
+        reason, GetReceivedCount(FilterMode::Filtered));
+    return true;
+}
+
 void AdvertisementWatcher::OnReceived(const BluetoothLEAdvertisementReceivedEventArgs &args)
 {
+    APD_PROFILE_ZONE();
+
+    if (_recovering.load(std::memory_order_relaxed) && _recovering.exchange(false)) [[unlikely]] {
+        const auto duration = std::chrono::steady_clock::now() - _recoveringSince.load();
+        Metrics::RecordWatcherRecovery(
+            std::chrono::duration_cast<std::chrono::milliseconds>(duration));
+        LOG(Info, "Bluetooth AdvWatcher recovered in {}ms.",
+            std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+    }
+
+    _receivedCount[Helper::ToUnderlying(_filterMode.load())].fetch_add(
+        1, std::memory_order_relaxed);
+
     ReceivedData receivedData;
 
-    receivedData.rssi = args.RawSignalStrengthInDBm();
-    receivedData.timestamp = args.Timestamp();
-    receivedData.address = args.BluetoothAddress();
+    const auto &advertisement = args.Advertisement();
+    const auto manufacturerDataArray =
+        _filter.has_value() ? advertisement.GetManufacturerDataByCompanyId(_filter->companyId)
+                            : advertisement.ManufacturerData().GetView();
 
-    const auto &manufacturerDataArray = args.Advertisement().ManufacturerData();
-    for (uint32_t i = 0; i < manufacturerDataArray.Size(); ++i) {
-        const auto &manufacturerData = manufacturerDataArray.GetAt(i);
-        const auto companyId = manufacturerData.CompanyId();
+    for (const auto &manufacturerData : manufacturerDataArray) {
         const auto &data = manufacturerData.Data();
 
-        std::vector<uint8_t> stdData(data.data(), data.data() + data.Length());
+        ManufacturerData entry;
+        entry.companyId = manufacturerData.CompanyId();
+
+        if (!entry.data.assign({data.data(), data.Length()})) {
+            LOG(Trace, "Manufacturer data too large, skipped. Size: {}", data.Length());
+            continue;
+        }
 
 #if defined APD_DEBUG
         auto overrideAdv = DebugConfig::GetInstance().GetOverrideAdv();
         if (overrideAdv.has_value()) {
-            stdData = std::move(overrideAdv.value());
-            LOG(Trace, "Adv override: {}", Helper::ToString(stdData));
+            entry.data.assign(overrideAdv.value());
+            LOG(Trace, "Adv override: {}", Helper::ToString(overrideAdv.value()));
         }
 #endif
 
-        receivedData.manufacturerDataMap.try_emplace(companyId, std::move(stdData));
+        if (!receivedData.manufacturerData.push_back(entry)) {
+            break;
+        }
+    }
+
+    if (_filter.has_value() && receivedData.manufacturerData.empty()) {
+        return;
     }
 
-    std::lock_guard<std::mutex> lock{_mutex};
-    CbReceived().Invoke(receivedData);
+    receivedData.rssi = args.RawSignalStrengthInDBm();
+    receivedData.timestamp = args.Timestamp();
+    receivedData.originTime =
+        Latency::Clock::now() - std::chrono::duration_cast<Latency::Clock::duration>(
+                                    winrt::clock::now() - receivedData.timestamp);
+    receivedData.address = args.BluetoothAddress();
+
+    Latency::Record(Latency::Stage::WatcherCallback, receivedData.originTime);
+
+    // The Received events of a watcher are delivered one at a time, so this is the only producer
+    //
+    if (!_ingest.Push(std::move(receivedData))) [[unlikely]] {
+        Metrics::Drop(Metrics::DropReason::IngestOverflow);
+    }
+}
+
+void AdvertisementWatcher::IngestThread()
+{
+    // The callbacks were invoked on the WinRT thread pool before, keep them in the MTA
+    //
+    winrt::init_apartment(winrt::apartment_type::multi_threaded);
+    APD_PROFILE_THREAD("AdvIngest");
+
+    while (_ingest.Wait()) {
+        while (auto receivedData = _ingest.Pop()) {
+            Latency::Record(Latency::Stage::Ingest, receivedData->originTime);
+            CbReceived().Invoke(receivedData.value());
+            APD_PROFILE_FRAME("Advertisement");
+        }
+    }
+
+    winrt::uninit_apartment();
 }
 
 void AdvertisementWatcher::OnStopped(const BluetoothLEAdvertisementWatcherStoppedEventArgs &args)
@@ -373,6 +1129,10 @@ void AdvertisementWatcher::OnStopped(const BluetoothLEAdvertisementWatcherStoppe
         {BluetoothError::TransportNotSupported, "TransportNotSupported"},
     };
 
+    if (_modeSwitch.exchange(false) && !_stop && RestartInScanMode()) {
+        return;
+    }
+
     std::unique_lock<std::mutex> lock{_mutex};
     auto status = _bleWatcher.Status();
     lock.unlock();
@@ -405,11 +1165,60 @@ void AdvertisementWatcher::OnStopped(const BluetoothLEAdvertisementWatcherStoppe
 
     CbStateChanged().Invoke(State::Stopped, optError);
 
+    // Some drivers accept the filter but abort the watcher afterwards
+    //
+    if (optError.has_value() && errorCode != BluetoothError::RadioNotAvailable &&
+        errorCode != BluetoothError::DisabledByUser &&
+        errorCode != BluetoothError::DisabledByPolicy)
+    {
+        FallbackToUnfiltered(optError.value());
+    }
+
     if (!_destroy) {
-        do {
-            std::unique_lock<std::mutex> lock{_conVarMutex};
-            _stopConVar.wait_until(lock, _lastStartTime.load() + kRetryInterval);
-        } while (!_stop && !Start());
+        if (!_stop && !_recovering.exchange(true)) {
+            _recoveringSince = std::chrono::steady_clock::now();
+        }
+
+        // The watcher can be started while the radio is off, it only stops again right after, so
+        // the interval keeps growing over the restarts until the radio comes back
+        //
+        const bool radioUnavailable = errorCode == BluetoothError::RadioNotAvailable ||
+                                      errorCode == BluetoothError::DisabledByUser;
+
+        std::unique_lock<std::mutex> lock{_conVarMutex};
+        if (!radioUnavailable) {
+            _retryInterval = kRetryInterval;
+        }
+        _retryWaiting = true;
+        _radioRecovered = false;
+
+        while (true) {
+            const bool woken = _stopConVar.wait_until(
+                lock, _lastStartTime.load() + _retryInterval,
+                [this] { return _stop || _radioRecovered; });
+            _radioRecovered = false;
+            if (!woken && radioUnavailable) {
+                _retryInterval = (std::min)(
+                    _retryInterval * 2,
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        kMaxRetryInterval));
+            }
+            if (_stop) {
+                break;
+            }
+
+            LOG(Info, "Restart Bluetooth AdvWatcher. Next retry in {}s if it fails.",
+                std::chrono::duration_cast<std::chrono::seconds>(_retryInterval).count());
+            Metrics::Increment(Metrics::Counter::WatcherRestarts);
+
+            lock.unlock();
+            const bool started = Start();
+            lock.lock();
+            if (started) {
+                break;
+            }
+        }
+        _retryWaiting = false;
     }
     else {
         _destroyConVar.notify_all();
@@ -27,6 +27,7 @@
 #include <winrt/Windows.Storage.Streams.h>
 #include <winrt/Windows.Devices.Enumeration.h>
 #include <winrt/Windows.Devices.Bluetooth.Advertisement.h>
+#include <winrt/Windows.Devices.Radios.h>
 #include <winrt/Windows.Networking.h>
 
 #include "Bluetooth_abstract.h"
@@ -40,23 +41,34 @@ namespace WinrtFoundation = winrt::Windows::Foundation;
 namespace WinrtBluetooth = winrt::Windows::Devices::Bluetooth;
 namespace WinrtBluetoothAdv = winrt::Windows::Devices::Bluetooth::Advertisement;
 namespace WinrtDevicesEnumeration = winrt::Windows::Devices::Enumeration;
+namespace WinrtRadios = winrt::Windows::Devices::Radios;
 
+// A cheap handle, the copies share the same underlying device. The event handlers are
+// registered once per underlying device and the properties are fetched in one batched request
+// when it's created.
+//
 class Device final : public Details::DeviceAbstract<uint64_t>
 {
 public:
-    Device(WinrtBluetooth::BluetoothDevice device);
-    Device(const Device &rhs);
-    Device(Device &&rhs) noexcept;
-    ~Device();
-
-    Device &operator=(const Device &rhs);
-    Device &operator=(Device &&rhs) noexcept;
+    Device(
+        WinrtBluetooth::BluetoothDevice device,
+        std::optional<WinrtDevicesEnumeration::DeviceInformation> info = std::nullopt);
 
     uint64_t GetAddress() const override;
     std::string GetName() const override;
     uint16_t GetVendorId() const override;
     uint16_t GetProductId() const override;
     DeviceState GetConnectionState() const override;
+    QUuid GetContainerId() const override;
+
+    Helper::Callback<FnConnectionStatusChanged> &CbConnectionStatusChanged() override;
+    Helper::Callback<FnNameChanged> &CbNameChanged() override;
+
+    // Fetches the information with the properties read by the getters above, so it can be
+    // prefetched and passed to the constructor
+    //
+    static WinrtFoundation::IAsyncOperation<WinrtDevicesEnumeration::DeviceInformation>
+    FetchInfoAsync(const WinrtBluetooth::BluetoothDevice &device);
 
 private:
     constexpr static auto kPropertyBluetoothVendorId = L"System.DeviceInterface.Bluetooth.VendorId";
@@ -64,46 +76,30 @@ private:
         L"System.DeviceInterface.Bluetooth.ProductId";
     constexpr static auto kPropertyAepContainerId = L"System.Devices.Aep.ContainerId";
 
-    std::optional<WinrtBluetooth::BluetoothDevice> _device;
-    mutable std::optional<WinrtDevicesEnumeration::DeviceInformation> _info;
-    winrt::event_token _tokenConnectionStatusChanged, _tokenNameChanged;
-
-    void RegisterHandlers();
-    void UnregisterHandlers();
-    void CopyFrom(const Device &rhs);
-    void MoveFrom(Device &&rhs) noexcept;
-
-    const std::optional<WinrtDevicesEnumeration::DeviceInformation> &GetInfo() const;
+    struct Impl;
+    std::shared_ptr<Impl> _impl;
 
     template <class T>
-    inline T GetProperty(const winrt::hstring &name, const T &defaultValue) const
-    {
-        try {
-            const auto &optInfo = GetInfo();
-            if (!optInfo.has_value()) {
-                LOG(Warn, "optInfo.has_value() false.");
-                return defaultValue;
-            }
-
-            const auto boxed = optInfo->Properties().TryLookup(name);
-            return winrt::unbox_value_or<T>(boxed, defaultValue);
-        }
-        catch (const OS::Windows::Winrt::Exception &ex) {
-            LOG(Warn, "GetProperty() failed. {}", Helper::ToString(ex));
-        }
-        return defaultValue;
-    }
-
-    winrt::hstring GetAepId() const;
-
-    void OnConnectionStatusChanged(const WinrtBluetooth::BluetoothDevice &sender);
-    void OnNameChanged(const WinrtBluetooth::BluetoothDevice &sender);
+    T GetProperty(const winrt::hstring &name, const T &defaultValue) const;
 };
 
+// The paired devices are cached by a `DeviceWatcher` after the first use, so the lookups are
+// answered from the cache once the initial enumeration is completed. A lookup of a device that
+// has already been added is answered immediately even during the enumeration.
+//
+// The lookups never block the calling thread (including the STA UI thread). The callback
+// overloads invoke the callback on a persistent MTA worker thread.
+//
 namespace DeviceManager {
 
-std::vector<Device> GetDevicesByState(DeviceState state);
-std::optional<Device> FindDevice(uint64_t address);
+using FnDevices = std::function<void(std::vector<Device>)>;
+using FnDevice = std::function<void(std::optional<Device>)>;
+
+std::future<std::vector<Device>> GetDevicesByState(DeviceState state);
+std::future<std::optional<Device>> FindDevice(uint64_t address);
+
+void GetDevicesByState(DeviceState state, FnDevices callback);
+void FindDevice(uint64_t address, FnDevice callback);
 
 } // namespace DeviceManager
 
@@ -113,22 +109,98 @@ class AdvertisementWatcher final
 public:
     using Timestamp = winrt::Windows::Foundation::DateTime;
 
-    explicit AdvertisementWatcher();
+    // If a filter is specified, only the manufacturer data of its company will be copied and
+    // delivered, and the filter will also be handed to the Bluetooth stack. If the driver
+    // rejects it, the watcher falls back to unfiltered scanning.
+    //
+    explicit AdvertisementWatcher(std::optional<ManufacturerDataFilter> filter = std::nullopt);
     ~AdvertisementWatcher();
 
     bool Start() override;
     bool Stop() override;
 
+    FilterMode GetFilterMode() const override;
+    uint64_t GetReceivedCount(FilterMode mode) const override;
+
+    void SetScanMode(ScanMode mode) override;
+    ScanMode GetScanMode() const override;
+
 private:
     static constexpr inline auto kRetryInterval = 3s;
+    // The retry interval doubles up to this while the radio is off or missing, the radio coming
+    // back wakes the retry up anyway
+    static constexpr inline auto kMaxRetryInterval = 5min;
+    static constexpr inline auto kLowPowerSamplingInterval = 1s;
+    static constexpr inline size_t kIngestCapacity = 256;
 
     WinrtBluetoothAdv::BluetoothLEAdvertisementWatcher _bleWatcher;
     std::mutex _mutex;
+    const std::optional<ManufacturerDataFilter> _filter;
+    std::atomic<FilterMode> _filterMode{FilterMode::Unfiltered};
+    std::array<std::atomic<uint64_t>, Helper::ToUnderlying(FilterMode::_Max)> _receivedCount{};
+    std::atomic<ScanMode> _scanMode{ScanMode::Full};
+    // Set while the watcher is being stopped only to be restarted in another scan mode
+    std::atomic<bool> _modeSwitch{false};
 
     std::atomic<bool> _stop{false}, _destroy{false};
     std::atomic<std::chrono::steady_clock::time_point> _lastStartTime;
     std::mutex _conVarMutex;
     std::condition_variable _stopConVar, _destroyConVar;
+    // Guarded by `_conVarMutex`
+    std::chrono::steady_clock::duration _retryInterval{kRetryInterval};
+    bool _retryWaiting{false}, _radioRecovered{false};
+
+    // Guarded by `_mutex`
+    WinrtDevicesEnumeration::DeviceWatcher _adapterWatcher{nullptr};
+    WinrtRadios::Radio _radio{nullptr};
+    WinrtRadios::Radio::StateChanged_revoker _radioStateChangedRevoker;
+    WinrtDevicesEnumeration::DeviceWatcher::Added_revoker _adapterAddedRevoker;
+
+    // The radio and adapter handlers are invoked on the WinRT thread pool and the asynchronous
+    // operations can complete after we're gone, so they hold this instead of relying on `this`
+    //
+    struct Lifetime {
+        std::recursive_mutex mutex;
+        bool alive{true};
+    };
+    std::shared_ptr<Lifetime> _lifetime{std::make_shared<Lifetime>()};
+
+    // The recursive lock lets a handler complete a nested operation synchronously
+    //
+    template <class Function>
+    inline auto WhileAlive(Function &&function)
+    {
+        return [lifetime = _lifetime,
+                function = std::forward<Function>(function)](auto &&...args) {
+            std::lock_guard<std::recursive_mutex> lock{lifetime->mutex};
+            if (lifetime->alive) {
+                function(std::forward<decltype(args)>(args)...);
+            }
+        };
+    }
+
+    // Set from the unexpected stop until the first advertisement received afterwards
+    std::atomic<bool> _recovering{false};
+    std::atomic<std::chrono::steady_clock::time_point> _recoveringSince;
+
+    // The WinRT callback only copies the advertisement into the ring, the rest of the pipeline
+    // runs on the ingest thread, so a stall downstream never holds up the Bluetooth stack
+    //
+    Helper::SpscRing<ReceivedData, kIngestCapacity> _ingest;
+    std::thread _ingestThread;
+
+    void IngestThread();
+
+    void WatchAdapters();
+    void ResolveRadio();
+    void OnRadioResolved(WinrtRadios::Radio radio);
+    void OnRadioStateChanged(const WinrtRadios::Radio &radio);
+    void WakeRetry();
+
+    void ApplyFilterMode(FilterMode mode);
+    void ApplyScanMode(ScanMode mode);
+    bool RestartInScanMode();
+    bool FallbackToUnfiltered(const std::string &reason);
 
     void OnReceived(const WinrtBluetoothAdv::BluetoothLEAdvertisementReceivedEventArgs &args);
     void OnStopped(const WinrtBluetoothAdv::BluetoothLEAdvertisementWatcherStoppedEventArgs &args);
@@ -22,6 +22,7 @@
 
 #include "../Utils.h"
 #include "../Logger.h"
+#include "../Profiler.h"
 
 namespace Core::GlobalMedia {
 
@@ -30,6 +31,35 @@ using namespace winrt::Windows::Media::Control;
 
 namespace Details {
 
+OS::Windows::Com::UniquePtr<IAudioSessionManager2> GetDefaultAudioSessionManager()
+{
+    OS::Windows::Com::UniquePtr<IMMDeviceEnumerator> deviceEnumerator;
+    HRESULT result = CoCreateInstance(
+        __uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, deviceEnumerator.GetIID(),
+        (void **)deviceEnumerator.ReleaseAndAddressOf());
+    if (FAILED(result)) {
+        LOG(Trace, "Create COM instance 'IMMDeviceEnumerator' failed. HRESULT: {:#x}", result);
+        return {};
+    }
+
+    OS::Windows::Com::UniquePtr<IMMDevice> audioEndpoint;
+    result = deviceEnumerator->GetDefaultAudioEndpoint(
+        eRender, eMultimedia, audioEndpoint.ReleaseAndAddressOf());
+    if (FAILED(result)) {
+        LOG(Trace, "'GetDefaultAudioEndpoint' failed. HRESULT: {:#x}", result);
+        return {};
+    }
+
+    OS::Windows::Com::UniquePtr<IAudioSessionManager2> sessionMgr;
+    result = audioEndpoint->Activate(
+        sessionMgr.GetIID(), CLSCTX_ALL, nullptr, (void **)sessionMgr.ReleaseAndAddressOf());
+    if (FAILED(result)) {
+        LOG(Trace, "'IMMDevice::Activate' IAudioSessionManager2 failed. HRESULT: {:#x}", result);
+        return {};
+    }
+    return sessionMgr;
+}
+
 class MediaProgramThroughVirtualKeyAbstract : public MediaProgramAbstract
 {
 public:
@@ -56,6 +86,22 @@ public:
         return true;
     }
 
+    // Same as `IsAvailable`, but looks for the window in the windows already enumerated, so that
+    // several programs are found in one enumeration
+    //
+    bool Resolve(const std::vector<OS::Windows::Window::WindowsInfo> &windowsInfo)
+    {
+        _windowProcess = MatchWindowAndProcess(windowsInfo);
+        if (!_windowProcess.has_value()) {
+            return false;
+        }
+
+        _audioMeterInfo = GetProcessAudioMeterInfo();
+        return true;
+    }
+
+    virtual std::wstring GetWindowClassName() const = 0;
+
     bool IsPlaying() const override
     {
         auto optAudioVolume = GetProcessAudioVolume();
@@ -84,9 +130,16 @@ public:
         return Switch();
     }
 
+    std::optional<HWND> GetWindow() const override
+    {
+        if (!_windowProcess.has_value()) {
+            return std::nullopt;
+        }
+        return _windowProcess->first;
+    }
+
 protected:
     virtual std::wstring GetProcessName() const = 0;
-    virtual std::wstring GetWindowClassName() const = 0;
     virtual std::optional<std::wstring> GetWindowTitleName() const
     {
         return std::nullopt;
@@ -94,41 +147,24 @@ protected:
     virtual WindowMatchingFlags GetWindowMatchingFlags() const = 0;
 
 private:
+    constexpr static inline auto kKeyPressDuration = 50ms;
+
     std::optional<std::pair<HWND, uint32_t>> _windowProcess;
     OS::Windows::Com::UniquePtr<IAudioMeterInformation> _audioMeterInfo;
+    std::shared_ptr<std::atomic<bool>> _pendingKeyUp;
 
     OS::Windows::Com::UniquePtr<IAudioMeterInformation> GetProcessAudioMeterInfo()
     {
         LOG(Trace, "Try to get IAudioMeterInformation of this process.");
 
-        OS::Windows::Com::UniquePtr<IMMDeviceEnumerator> deviceEnumerator;
-        HRESULT result = CoCreateInstance(
-            __uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, deviceEnumerator.GetIID(),
-            (void **)deviceEnumerator.ReleaseAndAddressOf());
-        if (FAILED(result)) {
-            LOG(Trace, "Create COM instance 'IMMDeviceEnumerator' failed. HRESULT: {:#x}", result);
-            return {};
-        }
-
-        OS::Windows::Com::UniquePtr<IMMDevice> audioEndpoint;
-        result = deviceEnumerator->GetDefaultAudioEndpoint(
-            eRender, eMultimedia, audioEndpoint.ReleaseAndAddressOf());
-        if (FAILED(result)) {
-            LOG(Trace, "'GetDefaultAudioEndpoint' failed. HRESULT: {:#x}", result);
-            return {};
-        }
-
-        OS::Windows::Com::UniquePtr<IAudioSessionManager2> sessionMgr;
-        result = audioEndpoint->Activate(
-            sessionMgr.GetIID(), CLSCTX_ALL, nullptr, (void **)sessionMgr.ReleaseAndAddressOf());
-        if (FAILED(result)) {
-            LOG(Trace, "'IMMDevice::Activate' IAudioSessionManager2 failed. HRESULT: {:#x}",
-                result);
+        auto sessionMgr = GetDefaultAudioSessionManager();
+        if (!sessionMgr) {
             return {};
         }
 
         OS::Windows::Com::UniquePtr<IAudioSessionEnumerator> sessionEnumerator;
-        result = sessionMgr->GetSessionEnumerator(sessionEnumerator.ReleaseAndAddressOf());
+        HRESULT result =
+            sessionMgr->GetSessionEnumerator(sessionEnumerator.ReleaseAndAddressOf());
         if (FAILED(result)) {
             LOG(Trace, "'IAudioSessionManager2::GetSessionEnumerator' failed. HRESULT: {:#x}",
                 result);
@@ -214,12 +250,11 @@ private:
 
     std::optional<std::pair<HWND, uint32_t>> FindWindowAndProcess() const
     {
-        auto processName = GetProcessName();
         auto className = GetWindowClassName();
         auto optTitleName = GetWindowTitleName();
 
         LOG(Trace, L"Try to find the media window. Process name: '{}', Class name: '{}'",
-            processName, className);
+            GetProcessName(), className);
 
         auto windowsInfo = OS::Windows::Window::FindWindowsInfo(className, optTitleName);
         if (windowsInfo.empty()) {
@@ -227,9 +262,25 @@ private:
             return std::nullopt;
         }
 
+        return MatchWindowAndProcess(windowsInfo);
+    }
+
+    std::optional<std::pair<HWND, uint32_t>>
+    MatchWindowAndProcess(const std::vector<OS::Windows::Window::WindowsInfo> &windowsInfo) const
+    {
+        auto processName = GetProcessName();
+        auto className = GetWindowClassName();
+        auto optTitleName = GetWindowTitleName();
+
         WindowMatchingFlags windowMatchingFlags = GetWindowMatchingFlags();
 
         for (const auto &info : windowsInfo) {
+            if (_wcsicmp(info.className.c_str(), className.c_str()) != 0 ||
+                optTitleName.has_value() && info.titleName != optTitleName.value())
+            {
+                continue;
+            }
+
             // LOG(Trace,
             //     L"Enumerating window. hwnd: {}, Process id: {}, Process name: {}",
             //     (void*)info.hwnd,
@@ -243,7 +294,7 @@ private:
             }
 
             if (windowMatchingFlags.testFlag(WindowMatchingFlag::HasChildren)) {
-                if (GetWindow(info.hwnd, GW_CHILD) == 0) {
+                if (::GetWindow(info.hwnd, GW_CHILD) == 0) {
                     // LOG(Trace, L"The window doesn't have any child windows.");
                     continue;
                 }
@@ -270,19 +321,38 @@ private:
 
     bool Switch()
     {
-        bool postDown = PostMessageW(_windowProcess->first, WM_KEYDOWN, VK_SPACE, 0) != 0;
-
-        std::this_thread::sleep_for(50ms);
+        const auto hwnd = _windowProcess->first;
 
-        bool postUp = PostMessageW(_windowProcess->first, WM_KEYUP, VK_SPACE, 0) != 0;
+        // Release the key of the previous switch first if it's still pressed
+        //
+        if (_pendingKeyUp != nullptr && _pendingKeyUp->exchange(false)) {
+            PostKeyUp(hwnd);
+        }
 
-        if (!postDown || !postUp) {
-            LOG(Trace, "Switch failed. Post messages failed: hwnd '{}' down '{}' up '{}'",
-                (void *)_windowProcess->first, postDown, postUp);
+        if (PostMessageW(hwnd, WM_KEYDOWN, VK_SPACE, 0) == 0) {
+            LOG(Trace, "Switch failed. Post message down failed: hwnd '{}'", (void *)hwnd);
             return false;
         }
+
+        // The key is released later on the scheduler thread instead of sleeping here, so that
+        // the caller returns immediately and the other programs are switched meanwhile
+        //
+        auto pending = std::make_shared<std::atomic<bool>>(true);
+        Helper::Scheduler::GetInstance().ScheduleOnce(kKeyPressDuration, [hwnd, pending] {
+            if (pending->exchange(false)) {
+                PostKeyUp(hwnd);
+            }
+        });
+        _pendingKeyUp = std::move(pending);
         return true;
     }
+
+    static void PostKeyUp(HWND hwnd)
+    {
+        if (PostMessageW(hwnd, WM_KEYUP, VK_SPACE, 0) == 0) {
+            LOG(Trace, "Switch failed. Post message up failed: hwnd '{}'", (void *)hwnd);
+        }
+    }
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(MediaProgramThroughVirtualKeyAbstract::WindowMatchingFlags)
@@ -291,34 +361,183 @@ Q_DECLARE_OPERATORS_FOR_FLAGS(MediaProgramThroughVirtualKeyAbstract::WindowMatch
 // Media programs
 //
 
-class UniversalSystemSession final : public MediaProgramAbstract
+// Keeps the session manager for the lifetime of the process and tracks the playback status of all
+// the sessions through their change events, so that nothing is requested or polled on demand
+//
+class SystemSessionTracker final : public Helper::Singleton<SystemSessionTracker>
 {
+protected:
+    SystemSessionTracker() = default;
+    friend Helper::Singleton<SystemSessionTracker>;
+
 public:
-    UniversalSystemSession() = default;
+    std::optional<GlobalSystemMediaTransportControlsSession> GetCurrentSession()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (!EnsureManager()) {
+            return std::nullopt;
+        }
+        return _currentSession;
+    }
 
-    bool IsAvailable() override
+    bool IsPlaying(const GlobalSystemMediaTransportControlsSession &session)
     {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        auto iter = FindSession(session);
+        if (iter == _sessions.end()) {
+            return QueryIsPlaying(session);
+        }
+        return iter->isPlaying;
+    }
+
+private:
+    using SessionManager = GlobalSystemMediaTransportControlsSessionManager;
+    using Session = GlobalSystemMediaTransportControlsSession;
+
+    struct TrackedSession {
+        Session session{nullptr};
+        Session::PlaybackInfoChanged_revoker revokerPlaybackInfoChanged;
+        bool isPlaying{false};
+    };
+
+    std::mutex _mutex;
+    SessionManager _manager{nullptr};
+    SessionManager::SessionsChanged_revoker _revokerSessionsChanged;
+    SessionManager::CurrentSessionChanged_revoker _revokerCurrentSessionChanged;
+    std::optional<Session> _currentSession;
+    std::vector<TrackedSession> _sessions;
+
+    // Must be called with the lock held, it's retried next time if it failed
+    //
+    bool EnsureManager()
+    {
+        if (_manager != nullptr) {
+            return true;
+        }
+
         try {
-            _currentSession = GetCurrentSession();
+            _manager = SessionManager::RequestAsync().get();
+
+            _revokerSessionsChanged = _manager.SessionsChanged(
+                winrt::auto_revoke, [this](const SessionManager &, const auto &) {
+                    std::lock_guard<std::mutex> lock{_mutex};
+                    UpdateSessions();
+                });
+            _revokerCurrentSessionChanged = _manager.CurrentSessionChanged(
+                winrt::auto_revoke, [this](const SessionManager &, const auto &) {
+                    std::lock_guard<std::mutex> lock{_mutex};
+                    UpdateCurrentSession();
+                });
+
+            UpdateSessions();
+            UpdateCurrentSession();
+            return true;
         }
         catch (const OS::Windows::Winrt::Exception &ex) {
-            LOG(Warn, "UniversalSystemSession get current session failed. Code: {:#x}, Message: {}",
-                ex.code(), winrt::to_string(ex.message()));
+            LOG(Warn, "SystemSessionTracker request session manager failed. {}",
+                Helper::ToString(ex));
+
+            _revokerSessionsChanged.revoke();
+            _revokerCurrentSessionChanged.revoke();
+            _manager = nullptr;
             return false;
         }
+    }
 
-        if (!_currentSession.value()) {
+    std::vector<TrackedSession>::iterator FindSession(const Session &session)
+    {
+        return std::find_if(_sessions.begin(), _sessions.end(), [&](const auto &tracked) {
+            return tracked.session == session;
+        });
+    }
+
+    void UpdateCurrentSession()
+    {
+        try {
+            auto session = _manager.GetCurrentSession();
+            _currentSession = session != nullptr ? std::optional<Session>{session} : std::nullopt;
+        }
+        catch (const OS::Windows::Winrt::Exception &ex) {
+            LOG(Warn, "SystemSessionTracker get current session failed. {}", Helper::ToString(ex));
             _currentSession.reset();
-            LOG(Trace, "UniversalSystemSession current session is unavailable.");
+        }
+    }
+
+    // The sessions still present keep their subscriptions, only the new ones are subscribed
+    //
+    void UpdateSessions()
+    {
+        std::vector<TrackedSession> sessions;
+
+        try {
+            const auto list = _manager.GetSessions();
+            sessions.reserve(list.Size());
+
+            for (const auto &session : list) {
+                auto iter = FindSession(session);
+                if (iter != _sessions.end()) {
+                    sessions.emplace_back(std::move(*iter));
+                    continue;
+                }
+
+                TrackedSession tracked;
+                tracked.session = session;
+                tracked.revokerPlaybackInfoChanged = session.PlaybackInfoChanged(
+                    winrt::auto_revoke, [this](const Session &sender, const auto &) {
+                        const bool isPlaying = QueryIsPlaying(sender);
+
+                        std::lock_guard<std::mutex> lock{_mutex};
+                        auto iter = FindSession(sender);
+                        if (iter != _sessions.end()) {
+                            iter->isPlaying = isPlaying;
+                        }
+                    });
+                tracked.isPlaying = QueryIsPlaying(session);
+                sessions.emplace_back(std::move(tracked));
+            }
+        }
+        catch (const OS::Windows::Winrt::Exception &ex) {
+            LOG(Warn, "SystemSessionTracker get sessions failed. {}", Helper::ToString(ex));
+            return;
+        }
+
+        LOG(Trace, "SystemSessionTracker sessions changed. Count: {}", sessions.size());
+        _sessions = std::move(sessions);
+    }
+
+    static bool QueryIsPlaying(const Session &session)
+    {
+        try {
+            return session.GetPlaybackInfo().PlaybackStatus() ==
+                   GlobalSystemMediaTransportControlsSessionPlaybackStatus::Playing;
+        }
+        catch (const OS::Windows::Winrt::Exception &ex) {
+            LOG(Warn, "UniversalSystemSession Get playback status failed. Code: {:#x}, Message: {}",
+                ex.code(), winrt::to_string(ex.message()));
             return false;
         }
+    }
+};
+
+class UniversalSystemSession final : public MediaProgramAbstract
+{
+public:
+    UniversalSystemSession() = default;
 
+    bool IsAvailable() override
+    {
+        _currentSession = SystemSessionTracker::GetInstance().GetCurrentSession();
+        if (!_currentSession.has_value()) {
+            LOG(Trace, "UniversalSystemSession current session is unavailable.");
+            return false;
+        }
         return true;
     }
 
     bool IsPlaying() const override
     {
-        return IsPlaying(_currentSession.value());
+        return SystemSessionTracker::GetInstance().IsPlaying(_currentSession.value());
     }
 
     bool Play() override
@@ -358,41 +577,6 @@ protected:
 
 private:
     std::optional<GlobalSystemMediaTransportControlsSession> _currentSession;
-
-    static GlobalSystemMediaTransportControlsSession GetCurrentSession()
-    {
-        return GlobalSystemMediaTransportControlsSessionManager::RequestAsync()
-            .get()
-            .GetCurrentSession();
-    }
-
-    static auto GetSessions()
-    {
-        auto sessions =
-            GlobalSystemMediaTransportControlsSessionManager::RequestAsync().get().GetSessions();
-
-        std::vector<GlobalSystemMediaTransportControlsSession> result;
-        result.reserve(sessions.Size());
-
-        for (size_t i = 0; i < sessions.Size(); ++i) {
-            result.emplace_back(sessions.GetAt(i));
-        }
-
-        return result;
-    }
-
-    static bool IsPlaying(const GlobalSystemMediaTransportControlsSession &gsmtcs)
-    {
-        try {
-            return gsmtcs.GetPlaybackInfo().PlaybackStatus() ==
-                   GlobalSystemMediaTransportControlsSessionPlaybackStatus::Playing;
-        }
-        catch (const OS::Windows::Winrt::Exception &ex) {
-            LOG(Warn, "UniversalSystemSession Get playback status failed. Code: {:#x}, Message: {}",
-                ex.code(), winrt::to_string(ex.message()));
-            return false;
-        }
-    }
 };
 
 class QQMusic final : public MediaProgramThroughVirtualKeyAbstract
@@ -476,24 +660,47 @@ protected:
     }
 };
 
-auto GetAvailablePrograms()
-{
-    std::vector<std::unique_ptr<MediaProgramAbstract>> result;
-
 #define PUSH_IF_AVAILABLE(type)                                                                    \
     {                                                                                              \
-        auto ptr = std::make_unique<type>();                                                       \
+        auto ptr = std::make_shared<type>();                                                       \
         if (ptr->IsAvailable()) {                                                                  \
             result.emplace_back(std::move(ptr));                                                   \
         }                                                                                          \
     }
 
-    PUSH_IF_AVAILABLE(UniversalSystemSession);
-    PUSH_IF_AVAILABLE(QQMusic);
-    PUSH_IF_AVAILABLE(NeteaseMusic);
-    PUSH_IF_AVAILABLE(KuGouMusic);
+// The programs found through their windows, they are kept by `ProgramRegistry`. All their windows
+// are found in one enumeration.
+//
+auto ResolveWindowPrograms()
+{
+    std::vector<std::shared_ptr<MediaProgramThroughVirtualKeyAbstract>> candidates{
+        std::make_shared<QQMusic>(), std::make_shared<NeteaseMusic>(),
+        std::make_shared<KuGouMusic>()};
 
-#undef PUSH_IF_AVAILABLE
+    std::vector<std::wstring> classNames;
+    classNames.reserve(candidates.size());
+    for (const auto &candidate : candidates) {
+        classNames.emplace_back(candidate->GetWindowClassName());
+    }
+
+    const auto windowsInfo = OS::Windows::Window::FindWindowsInfo(classNames);
+
+    std::vector<std::shared_ptr<MediaProgramAbstract>> result;
+    for (auto &candidate : candidates) {
+        if (candidate->Resolve(windowsInfo)) {
+            result.emplace_back(std::move(candidate));
+        }
+    }
+    return result;
+}
+
+auto GetAvailablePrograms(ProgramRegistry &registry)
+{
+    std::vector<std::shared_ptr<MediaProgramAbstract>> result = registry.GetPrograms();
+
+    // The current session is tracked by `SystemSessionTracker`
+    //
+    PUSH_IF_AVAILABLE(UniversalSystemSession);
 
     if (result.empty()) {
         return result;
@@ -507,10 +714,221 @@ auto GetAvailablePrograms()
 
     return result;
 }
+
+#undef PUSH_IF_AVAILABLE
+
+//////////////////////////////////////////////////
+// ProgramRegistry
+//
+
+class AudioSessionNotifier final : public IAudioSessionNotification
+{
+public:
+    AudioSessionNotifier(std::function<void()> callback) : _callback{std::move(callback)} {}
+
+    ULONG STDMETHODCALLTYPE AddRef() override
+    {
+        return ++_refCount;
+    }
+
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        const auto refCount = --_refCount;
+        if (refCount == 0) {
+            delete this;
+        }
+        return refCount;
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvInterface) override
+    {
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(IAudioSessionNotification)) {
+            *ppvInterface = static_cast<IAudioSessionNotification *>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppvInterface = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    HRESULT STDMETHODCALLTYPE OnSessionCreated(IAudioSessionControl *newSession) override
+    {
+        _callback();
+        return S_OK;
+    }
+
+private:
+    std::atomic<ULONG> _refCount{1};
+    std::function<void()> _callback;
+};
+
+ProgramRegistry::ProgramRegistry()
+{
+    _instance = this;
+
+    std::promise<DWORD> threadId;
+    auto future = threadId.get_future();
+    _thread = std::thread{&ProgramRegistry::Run, this, std::move(threadId)};
+    _threadId = future.get();
+}
+
+ProgramRegistry::~ProgramRegistry()
+{
+    PostThreadMessageW(_threadId, WM_QUIT, 0, 0);
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    _instance = nullptr;
+}
+
+std::vector<std::shared_ptr<MediaProgramAbstract>> ProgramRegistry::GetPrograms()
+{
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (_isResolved && _isWatching) {
+            return _programs;
+        }
+    }
+
+    // Nothing tells us when the programs change, so they are resolved every time
+    //
+    Refresh();
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _programs;
+}
+
+void ProgramRegistry::Invalidate()
+{
+    PostThreadMessageW(_threadId, kMessageInvalidate, 0, 0);
+}
+
+void ProgramRegistry::Refresh()
+{
+    auto programs = ResolveWindowPrograms();
+
+    std::vector<HWND> windows;
+    for (const auto &program : programs) {
+        const auto window = program->GetWindow();
+        if (window.has_value()) {
+            windows.emplace_back(window.value());
+        }
+    }
+
+    LOG(Trace, "ProgramRegistry: Refreshed. Programs: {}", programs.size());
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    _programs = std::move(programs);
+    _windows = std::move(windows);
+    _isResolved = true;
+}
+
+void ProgramRegistry::Run(std::promise<DWORD> threadId)
+{
+    const bool comInitialized = SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+
+    // Make sure the message queue is created before anything is posted to it
+    //
+    MSG msg;
+    PeekMessageW(&msg, nullptr, WM_USER, WM_USER, PM_NOREMOVE);
+    threadId.set_value(GetCurrentThreadId());
+
+    // Out of context hooks are called on this thread by the message loop below
+    //
+    HWINEVENTHOOK hook = SetWinEventHook(
+        EVENT_OBJECT_CREATE, EVENT_OBJECT_SHOW, nullptr, &ProgramRegistry::OnWinEvent, 0, 0,
+        WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+    if (hook == nullptr) {
+        LOG(Warn, "ProgramRegistry: SetWinEventHook() failed. Error: {}", GetLastError());
+    }
+
+    auto sessionMgr = GetDefaultAudioSessionManager();
+    AudioSessionNotifier *sessionNotifier = nullptr;
+    if (sessionMgr) {
+        // The notifications are only sent after the sessions have been enumerated once
+        //
+        OS::Windows::Com::UniquePtr<IAudioSessionEnumerator> sessionEnumerator;
+        sessionMgr->GetSessionEnumerator(sessionEnumerator.ReleaseAndAddressOf());
+
+        sessionNotifier = new AudioSessionNotifier{[this] { Invalidate(); }};
+        HRESULT result = sessionMgr->RegisterSessionNotification(sessionNotifier);
+        if (FAILED(result)) {
+            LOG(Warn, "ProgramRegistry: RegisterSessionNotification() failed. HRESULT: {:#x}",
+                result);
+            sessionNotifier->Release();
+            sessionNotifier = nullptr;
+        }
+    }
+
+    _isWatching = hook != nullptr;
+    if (_isWatching) {
+        Refresh();
+    }
+
+    UINT_PTR timer = 0;
+    while (GetMessageW(&msg, nullptr, 0, 0) > 0) {
+        // The events come in bursts, so the refreshing is delayed a bit
+        //
+        if (msg.message == kMessageInvalidate) {
+            timer = SetTimer(nullptr, timer, kRefreshDelayMs, nullptr);
+        }
+        else if (msg.message == WM_TIMER && msg.wParam == timer) {
+            KillTimer(nullptr, timer);
+            timer = 0;
+            Refresh();
+        }
+        else {
+            DispatchMessageW(&msg);
+        }
+    }
+
+    if (sessionNotifier != nullptr) {
+        sessionMgr->UnregisterSessionNotification(sessionNotifier);
+        sessionNotifier->Release();
+    }
+    sessionMgr = nullptr;
+
+    if (hook != nullptr) {
+        UnhookWinEvent(hook);
+    }
+    if (comInitialized) {
+        CoUninitialize();
+    }
+}
+
+void CALLBACK ProgramRegistry::OnWinEvent(
+    HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject, LONG idChild, DWORD idEventThread,
+    DWORD dwmsEventTime)
+{
+    if (idObject != OBJID_WINDOW || idChild != CHILDID_SELF) {
+        return;
+    }
+
+    auto registry = _instance.load();
+    if (registry == nullptr) {
+        return;
+    }
+
+    if (event == EVENT_OBJECT_DESTROY) {
+        std::lock_guard<std::mutex> lock{registry->_mutex};
+        if (std::find(registry->_windows.begin(), registry->_windows.end(), hwnd) ==
+            registry->_windows.end())
+        {
+            return;
+        }
+    }
+    else if (GetAncestor(hwnd, GA_PARENT) != GetDesktopWindow()) {
+        return;
+    }
+
+    registry->Invalidate();
+}
 } // namespace Details
 
 void Controller::Play()
 {
+    APD_PROFILE_ZONE();
+
     std::lock_guard<std::mutex> lock{_mutex};
 
     if (_pausedPrograms.empty()) {
@@ -532,9 +950,11 @@ void Controller::Play()
 
 void Controller::Pause()
 {
+    APD_PROFILE_ZONE();
+
     std::lock_guard<std::mutex> lock{_mutex};
 
-    auto programs = Details::GetAvailablePrograms();
+    auto programs = Details::GetAvailablePrograms(_registry);
 
     for (auto &&program : programs) {
         if (program->IsPlaying()) {
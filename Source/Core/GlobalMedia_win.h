@@ -33,6 +33,9 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <future>
 #include <functional>
 
 #include "GlobalMedia_abstract.h"
@@ -64,6 +67,49 @@ public:
 
     virtual std::wstring GetProgramName() const = 0;
     virtual Priority GetPriority() const = 0;
+
+    // The window the program was found through, if any
+    //
+    virtual std::optional<HWND> GetWindow() const
+    {
+        return std::nullopt;
+    }
+};
+
+// Keeps the programs found through their windows, so that pausing doesn't enumerate all the
+// windows and processes every time. They are resolved again in the background when a top-level
+// window is created or shown, when a resolved window is destroyed, or when an audio session is
+// created.
+//
+class ProgramRegistry
+{
+public:
+    ProgramRegistry();
+    ~ProgramRegistry();
+
+    std::vector<std::shared_ptr<MediaProgramAbstract>> GetPrograms();
+
+private:
+    constexpr static inline UINT kMessageInvalidate = WM_APP + 1;
+    constexpr static inline UINT kRefreshDelayMs = 100;
+
+    static inline std::atomic<ProgramRegistry *> _instance{nullptr};
+
+    std::mutex _mutex;
+    std::vector<std::shared_ptr<MediaProgramAbstract>> _programs;
+    std::vector<HWND> _windows;
+    bool _isResolved{false};
+    std::atomic<bool> _isWatching{false};
+    std::thread _thread;
+    DWORD _threadId{0};
+
+    void Invalidate();
+    void Refresh();
+    void Run(std::promise<DWORD> threadId);
+
+    static void CALLBACK OnWinEvent(
+        HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject, LONG idChild,
+        DWORD idEventThread, DWORD dwmsEventTime);
 };
 } // namespace Details
 
@@ -79,6 +125,7 @@ public:
 
 private:
     std::mutex _mutex;
-    std::vector<std::unique_ptr<Details::MediaProgramAbstract>> _pausedPrograms;
+    Details::ProgramRegistry _registry;
+    std::vector<std::shared_ptr<Details::MediaProgramAbstract>> _pausedPrograms;
 };
 } // namespace Core::GlobalMedia
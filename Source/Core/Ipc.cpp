@@ -0,0 +1,261 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Ipc.h"
+
+#include <array>
+#include <utility>
+
+#include <magic_enum.hpp>
+#include <nlohmann/json.hpp>
+
+#include "../Logger.h"
+
+using json = nlohmann::json;
+
+namespace Core::Ipc {
+
+namespace Details {
+
+namespace {
+
+// Spelled out, magic_enum only reflects the values in [-128, 128] and most of the fields are out of
+// it. The names are the protocol, they must not change.
+//
+constexpr std::array<std::pair<AirPods::StateField, std::string_view>, 11> kFieldNames{{
+    {AirPods::StateField::Model, "Model"},
+    {AirPods::StateField::DisplayName, "DisplayName"},
+    {AirPods::StateField::LeftBattery, "LeftBattery"},
+    {AirPods::StateField::LeftCharging, "LeftCharging"},
+    {AirPods::StateField::LeftInEar, "LeftInEar"},
+    {AirPods::StateField::RightBattery, "RightBattery"},
+    {AirPods::StateField::RightCharging, "RightCharging"},
+    {AirPods::StateField::RightInEar, "RightInEar"},
+    {AirPods::StateField::CaseBattery, "CaseBattery"},
+    {AirPods::StateField::CaseCharging, "CaseCharging"},
+    {AirPods::StateField::CaseLid, "CaseLid"},
+}};
+
+} // namespace
+
+std::string_view GetFieldName(AirPods::StateField field)
+{
+    for (const auto &[value, name] : kFieldNames) {
+        if (value == field) {
+            return name;
+        }
+    }
+    return {};
+}
+
+std::optional<AirPods::StateField> FindFieldByName(std::string_view name)
+{
+    for (const auto &[value, fieldName] : kFieldNames) {
+        if (fieldName == name) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+} // namespace Details
+
+namespace {
+
+json ToJson(const AirPods::State &state)
+{
+    const auto battery = [](const Battery &value) {
+        return value.Available() ? json(value.Value()) : json(nullptr);
+    };
+    const auto pod = [&](const AirPods::PodState &podState) {
+        return json{
+            {"battery", battery(podState.battery)},
+            {"charging", podState.isCharging},
+            {"inEar", podState.isInEar},
+        };
+    };
+
+    return json{
+        {"model", std::string{magic_enum::enum_name(state.model)}},
+        {"name", state.displayName.toStdString()},
+        {"left", pod(state.pods.left)},
+        {"right", pod(state.pods.right)},
+        {"case",
+         {
+             {"battery", battery(state.caseBox.battery)},
+             {"charging", state.caseBox.isCharging},
+             {"lidOpened", state.caseBox.isLidOpened},
+             {"bothPodsInCase", state.caseBox.isBothPodsInCase},
+         }},
+    };
+}
+
+json ToJson(AirPods::StateFields fields)
+{
+    auto result = json::array();
+    for (const auto &[field, name] : Details::kFieldNames) {
+        if (fields.testFlag(field)) {
+            result.push_back(std::string{name});
+        }
+    }
+    return result;
+}
+
+QByteArray ToLine(const json &message)
+{
+    auto line = QByteArray::fromStdString(message.dump());
+    line.append('\n');
+    return line;
+}
+
+} // namespace
+
+Server::Server(QObject *parent) : QObject{parent}
+{
+    qRegisterMetaType<AirPods::State>("Core::AirPods::State");
+    qRegisterMetaType<AirPods::StateFields>("Core::AirPods::StateFields");
+
+    connect(this, &Server::PublishStateSafely, this, &Server::PublishState);
+    connect(this, &Server::PublishStatusSafely, this, &Server::PublishStatus);
+    connect(&_server, &QLocalServer::newConnection, this, &Server::OnNewConnection);
+
+    _server.setSocketOptions(QLocalServer::UserAccessOption);
+}
+
+bool Server::Listen()
+{
+    if (!_server.listen(kName)) {
+        LOG(Warn, "IPC server listen failed. Error: {}", _server.errorString());
+        return false;
+    }
+    LOG(Info, "IPC server is listening on '{}'.", _server.fullServerName());
+    return true;
+}
+
+void Server::Send(QLocalSocket *socket, const QByteArray &message)
+{
+    if (socket->bytesToWrite() + message.size() > kMaxPendingBytes) {
+        LOG(Warn, "IPC client doesn't keep up, disconnect it.");
+        socket->abort();
+        return;
+    }
+    socket->write(message);
+}
+
+void Server::OnNewConnection()
+{
+    while (auto *socket = _server.nextPendingConnection()) {
+        connect(socket, &QLocalSocket::readyRead, this, [=] { OnReadyRead(socket); });
+        connect(socket, &QLocalSocket::disconnected, this, [=] { OnDisconnected(socket); });
+
+        _clients.emplace(socket, AirPods::StateField::All);
+        LOG(Info, "IPC client connected. Clients: {}", _clients.size());
+
+        if (!_lastMessage.isEmpty()) {
+            Send(socket, _lastMessage);
+        }
+    }
+}
+
+void Server::OnReadyRead(QLocalSocket *socket)
+{
+    auto iter = _clients.find(socket);
+    if (iter == _clients.end()) {
+        return;
+    }
+
+    while (socket->canReadLine()) {
+        const auto line = socket->readLine().trimmed();
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        const auto message = json::parse(line.toStdString(), nullptr, false);
+        if (!message.is_object() || !message.contains("subscribe") ||
+            !message["subscribe"].is_array())
+        {
+            LOG(Warn, "IPC client sent an unknown message: '{}'", line.toStdString());
+            continue;
+        }
+
+        AirPods::StateFields fields;
+        for (const auto &name : message["subscribe"]) {
+            const auto field = name.is_string()
+                                   ? Details::FindFieldByName(name.get_ref<const std::string &>())
+                                   : std::nullopt;
+            if (field.has_value()) {
+                fields |= field.value();
+            }
+        }
+        iter->second = fields;
+    }
+
+    // A line never comes to an end, don't buffer it forever
+    //
+    if (socket->bytesAvailable() > kMaxPendingBytes) {
+        LOG(Warn, "IPC client sent a line too long, disconnect it.");
+        socket->abort();
+    }
+}
+
+void Server::OnDisconnected(QLocalSocket *socket)
+{
+    if (_clients.erase(socket) == 0) {
+        return;
+    }
+    socket->deleteLater();
+    LOG(Info, "IPC client disconnected. Clients: {}", _clients.size());
+}
+
+void Server::PublishState(const AirPods::State &state, AirPods::StateFields changedFields)
+{
+    const auto stateJson = ToJson(state);
+
+    _lastMessage = ToLine(json{
+        {"type", "state"}, {"changed", ToJson(AirPods::StateFields{AirPods::StateField::All})},
+        {"state", stateJson}});
+    const auto message = ToLine(
+        json{{"type", "state"}, {"changed", ToJson(changedFields)}, {"state", stateJson}});
+
+    // Aborting a socket disconnects it synchronously, which erases it from the clients
+    //
+    std::vector<QLocalSocket *> sockets;
+    for (const auto &[socket, subscribed] : _clients) {
+        if (subscribed & changedFields) {
+            sockets.emplace_back(socket);
+        }
+    }
+    for (auto *socket : sockets) {
+        Send(socket, message);
+    }
+}
+
+void Server::PublishStatus(const QString &status)
+{
+    _lastMessage = ToLine(json{{"type", "status"}, {"status", status.toStdString()}});
+
+    std::vector<QLocalSocket *> sockets;
+    for (const auto &[socket, subscribed] : _clients) {
+        sockets.emplace_back(socket);
+    }
+    for (auto *socket : sockets) {
+        Send(socket, _lastMessage);
+    }
+}
+
+} // namespace Core::Ipc
@@ -0,0 +1,91 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+#include <QByteArray>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include "AirPods.h"
+
+// Pushes the device state to the local tools over the named pipe `\\.\pipe\AirPodsDesktop.State`.
+//
+// The protocol is line-delimited JSON in UTF-8. The server sends
+//
+//   {"type":"state","changed":["LeftBattery",...],"state":{"model":...,"name":...,
+//    "left":{"battery":80,"charging":false,"inEar":true},"right":{...},
+//    "case":{"battery":null,"charging":false,"lidOpened":false,"bothPodsInCase":false}}}
+//   {"type":"status","status":"Disconnected"}
+//
+// for every state update and status change, and the latest one of them on connection. A client
+// may send `{"subscribe":["LeftBattery",...]}` to only receive the updates changing those fields.
+//
+namespace Core::Ipc {
+
+namespace Details {
+
+// The names of the fields in the messages, `All` has none
+//
+std::string_view GetFieldName(AirPods::StateField field);
+std::optional<AirPods::StateField> FindFieldByName(std::string_view name);
+
+} // namespace Details
+
+class Server : public QObject
+{
+    Q_OBJECT
+
+public:
+    constexpr static inline auto kName = "AirPodsDesktop.State";
+
+    Server(QObject *parent = nullptr);
+
+    bool Listen();
+
+Q_SIGNALS:
+    // The messages are built and written on the thread of the server, the publishers never wait
+    // for the clients
+    //
+    void PublishStateSafely(const AirPods::State &state, AirPods::StateFields changedFields);
+    void PublishStatusSafely(const QString &status);
+
+private:
+    // A client that doesn't read is dropped rather than buffered for without bound
+    //
+    constexpr static inline qint64 kMaxPendingBytes = 64 * 1024;
+
+    QLocalServer _server{this};
+    std::unordered_map<QLocalSocket *, AirPods::StateFields> _clients;
+    // The message a new client starts with
+    QByteArray _lastMessage;
+
+    void Send(QLocalSocket *socket, const QByteArray &message);
+
+    void OnNewConnection();
+    void OnReadyRead(QLocalSocket *socket);
+    void OnDisconnected(QLocalSocket *socket);
+    void PublishState(const AirPods::State &state, AirPods::StateFields changedFields);
+    void PublishStatus(const QString &status);
+};
+
+} // namespace Core::Ipc
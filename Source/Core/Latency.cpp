@@ -0,0 +1,199 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Latency.h"
+
+#include <bit>
+#include <format>
+#include <algorithm>
+
+#include <magic_enum.hpp>
+
+#include "../Helper.h"
+#include "../Logger.h"
+
+namespace Core::Latency {
+
+namespace Details {
+
+struct StageData {
+    Histogram histogram;
+    std::atomic<Clock::rep> handoff{0};
+};
+
+std::array<StageData, Helper::ToUnderlying(Stage::_Max)> &GetStages()
+{
+    static std::array<StageData, Helper::ToUnderlying(Stage::_Max)> i;
+    return i;
+}
+
+StageData &GetStage(Stage stage)
+{
+    return GetStages().at(Helper::ToUnderlying(stage));
+}
+
+} // namespace Details
+
+size_t Histogram::BucketIndex(uint64_t value)
+{
+    if (value < kSubBuckets) {
+        return (size_t)value;
+    }
+
+    const size_t shift = std::min<size_t>(std::bit_width(value) - 1 - kSubBucketBits, kMaxShift);
+    const auto subBucket = std::min<uint64_t>(value >> shift, kSubBuckets * 2 - 1) - kSubBuckets;
+    return (shift + 1) * kSubBuckets + (size_t)subBucket;
+}
+
+uint64_t Histogram::BucketValue(size_t index)
+{
+    if (index < kSubBuckets) {
+        return index;
+    }
+
+    // The middle of the bucket
+    //
+    const size_t shift = index / kSubBuckets - 1;
+    const uint64_t lower = (uint64_t)(index % kSubBuckets + kSubBuckets) << shift;
+    return lower + ((1ull << shift) >> 1);
+}
+
+void Histogram::Record(uint64_t value)
+{
+    _buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(value, std::memory_order_relaxed);
+
+    auto max = _max.load(std::memory_order_relaxed);
+    while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+    auto min = _min.load(std::memory_order_relaxed);
+    while (value < min && !_min.compare_exchange_weak(min, value, std::memory_order_relaxed)) {
+    }
+}
+
+auto Histogram::GetSnapshot() const -> Snapshot
+{
+    Snapshot result;
+
+    // The buckets are summed up instead of reading `_count`, so that the percentiles are
+    // consistent with the buckets even if values are being recorded concurrently
+    //
+    std::array<uint64_t, kBuckets> buckets;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+        result.count += buckets[i];
+    }
+
+    if (result.count == 0) {
+        return result;
+    }
+
+    result.min = _min.load(std::memory_order_relaxed);
+    result.max = _max.load(std::memory_order_relaxed);
+    result.mean = (double)_sum.load(std::memory_order_relaxed) /
+                  (double)std::max<uint64_t>(_count.load(std::memory_order_relaxed), 1);
+
+    const auto percentile = [&](double ratio) {
+        const auto target = std::max<uint64_t>((uint64_t)(ratio * (double)result.count), 1);
+
+        uint64_t accumulated = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            accumulated += buckets[i];
+            if (accumulated >= target) {
+                return (double)std::clamp(BucketValue(i), result.min, result.max);
+            }
+        }
+        return (double)result.max;
+    };
+
+    result.p50 = percentile(0.5);
+    result.p90 = percentile(0.9);
+    result.p99 = percentile(0.99);
+    result.p999 = percentile(0.999);
+    return result;
+}
+
+void Histogram::Reset()
+{
+    for (auto &bucket : _buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    _count.store(0, std::memory_order_relaxed);
+    _sum.store(0, std::memory_order_relaxed);
+    _max.store(0, std::memory_order_relaxed);
+    _min.store(UINT64_MAX, std::memory_order_relaxed);
+}
+
+void Record(Stage stage, Clock::time_point origin)
+{
+    const auto elapsed = Clock::now() - origin;
+    Details::GetStage(stage).histogram.Record((uint64_t)std::max<int64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(), 0));
+}
+
+void Handoff(Stage stage, Clock::time_point origin)
+{
+    Details::GetStage(stage).handoff.store(
+        origin.time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+void Complete(Stage stage)
+{
+    const auto origin = Details::GetStage(stage).handoff.exchange(0, std::memory_order_relaxed);
+    if (origin != 0) {
+        Record(stage, Clock::time_point{Clock::duration{origin}});
+    }
+}
+
+Histogram::Snapshot GetSnapshot(Stage stage)
+{
+    return Details::GetStage(stage).histogram.GetSnapshot();
+}
+
+void Reset()
+{
+    for (auto &stage : Details::GetStages()) {
+        stage.histogram.Reset();
+    }
+}
+
+std::string Dump()
+{
+    std::string result;
+
+    for (size_t i = 0; i < Helper::ToUnderlying(Stage::_Max); ++i) {
+        const auto stage = static_cast<Stage>(i);
+        const auto snapshot = GetSnapshot(stage);
+
+        result += std::format(
+            "{:<16} count: {:<8} p50: {:>8.2f}ms  p90: {:>8.2f}ms  p99: {:>8.2f}ms  "
+            "p99.9: {:>8.2f}ms  max: {:>8.2f}ms\n",
+            magic_enum::enum_name(stage), snapshot.count, snapshot.p50 / 1000.0,
+            snapshot.p90 / 1000.0, snapshot.p99 / 1000.0, snapshot.p999 / 1000.0,
+            (double)snapshot.max / 1000.0);
+    }
+    return result;
+}
+
+void DumpToLog()
+{
+    LOG(Info, "Latency histograms:\n{}", Dump());
+}
+
+} // namespace Core::Latency
@@ -0,0 +1,93 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace Core::Latency {
+
+using Clock = std::chrono::steady_clock;
+
+// Each stage is measured from the moment the advertisement was received by the radio
+//
+enum class Stage : uint32_t {
+    WatcherCallback,
+    Ingest,
+    Decode,
+    StateAccepted,
+    StateChanged,
+    GuiDispatch,
+    WindowShown,
+    MediaAction,
+    _Max
+};
+
+// An HDR-style histogram of microsecond values. Every power of 2 range is split into
+// `kSubBuckets` linear buckets, so the relative error is bounded by 1 / `kSubBuckets`.
+//
+// Recording is lock-free and wait-free except for the minimum and the maximum, which are updated
+// by CAS loops.
+//
+class Histogram
+{
+public:
+    struct Snapshot {
+        uint64_t count{0}, min{0}, max{0};
+        double mean{0}, p50{0}, p90{0}, p99{0}, p999{0};
+    };
+
+    void Record(uint64_t value);
+    Snapshot GetSnapshot() const;
+    void Reset();
+
+private:
+    constexpr static inline size_t kSubBucketBits = 4;
+    constexpr static inline size_t kSubBuckets = 1 << kSubBucketBits;
+    // Values are clamped to about 19 hours
+    constexpr static inline size_t kMaxShift = 32;
+    constexpr static inline size_t kBuckets = (kMaxShift + 2) * kSubBuckets;
+
+    std::array<std::atomic<uint64_t>, kBuckets> _buckets{};
+    std::atomic<uint64_t> _count{0}, _sum{0}, _max{0};
+    std::atomic<uint64_t> _min{UINT64_MAX};
+
+    static size_t BucketIndex(uint64_t value);
+    static uint64_t BucketValue(size_t index);
+};
+
+// Records the latency of `stage` as the time elapsed since `origin`
+//
+void Record(Stage stage, Clock::time_point origin);
+
+// For the stages reached on another thread, the origin is handed off to the stage first and it's
+// completed later, only the latest handed off origin is kept
+//
+void Handoff(Stage stage, Clock::time_point origin);
+void Complete(Stage stage);
+
+Histogram::Snapshot GetSnapshot(Stage stage);
+void Reset();
+
+std::string Dump();
+void DumpToLog();
+
+} // namespace Core::Latency
@@ -0,0 +1,297 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "LoadGenerator.h"
+
+#include <memory>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "../Logger.h"
+#include "AirPods.h"
+#include "AdvCapture.h"
+
+using namespace std::chrono_literals;
+
+namespace Core::LoadGenerator {
+
+namespace {
+
+using ReceivedData = Bluetooth::AdvertisementWatcher::ReceivedData;
+using Timestamp = Bluetooth::AdvertisementWatcher::Timestamp;
+
+constexpr std::array<uint16_t, 4> kModelIds{0x200E, 0x2014, 0x200F, 0x2013};
+constexpr auto kBatteryStepMean = 20s;
+constexpr auto kInEarToggleMean = 30s;
+constexpr double kRssiNoise = 4; // Standard deviation, in dBm
+
+struct VirtualDevice {
+    uint16_t modelId{0};
+    Helper::Sides<uint64_t> addresses{};
+    Helper::Sides<uint8_t> pods{10, 10};
+    uint8_t caseBox{10};
+    Helper::Sides<bool> inEar{true, true};
+    double rssiMean{0};
+    AirPods::Side nextSide{AirPods::Side::Left};
+    Timestamp nextRotation{}, nextBatteryStep{}, nextInEarToggle{};
+};
+
+class Generator
+{
+public:
+    Generator(const LoadOptions &options, Timestamp begin)
+        : _options{options}, _random{options.seed}, _devices{options.devices}
+    {
+        for (size_t i = 0; i < _devices.size(); ++i) {
+            auto &device = _devices[i];
+
+            // Every third device has the model of the desired one
+            //
+            device.modelId = i % 3 == 0 ? kModelIds[0] : kModelIds[1 + i % (kModelIds.size() - 1)];
+            device.pods = {RandomBattery(), RandomBattery()};
+            device.caseBox = RandomBattery();
+            device.rssiMean = i == 0 ? -50 : Uniform(-85, -55);
+            device.nextSide = i % 2 == 0 ? AirPods::Side::Left : AirPods::Side::Right;
+
+            RotateAddresses(device);
+            // The rotations of the devices are not synchronized
+            device.nextRotation =
+                begin + std::chrono::duration_cast<Timestamp::duration>(
+                            options.addressRotation * Uniform(0, 1));
+            device.nextBatteryStep = begin + Exponential(kBatteryStepMean);
+            device.nextInEarToggle = begin + Exponential(kInEarToggleMean);
+        }
+    }
+
+    const VirtualDevice &GetDevice(size_t index) const
+    {
+        return _devices[index];
+    }
+
+    ReceivedData Next(size_t index, Timestamp now)
+    {
+        auto &device = _devices[index];
+        Evolve(device, now);
+
+        const auto side = device.nextSide;
+        device.nextSide = side == AirPods::Side::Left ? AirPods::Side::Right : AirPods::Side::Left;
+
+        const auto payload = MakePayload(PayloadFields{
+            .modelId = device.modelId,
+            .side = side,
+            .pods = device.pods,
+            .caseBox = device.caseBox,
+            .inEar = device.inEar,
+            .lidClosed = true,
+        });
+
+        ReceivedData data;
+        data.timestamp = now;
+        data.originTime = Latency::Clock::now();
+        data.address = side == AirPods::Side::Left ? device.addresses.left : device.addresses.right;
+        data.rssi = static_cast<int16_t>(std::clamp(
+            std::normal_distribution<double>{device.rssiMean, kRssiNoise}(_random), -127.0, 0.0));
+
+        Bluetooth::AdvertisementWatcher::ManufacturerData entry;
+        entry.companyId = AppleCP::VendorId;
+        entry.data.assign(payload);
+        data.manufacturerData.push_back(entry);
+        return data;
+    }
+
+private:
+    const LoadOptions &_options;
+    std::mt19937_64 _random;
+    std::vector<VirtualDevice> _devices;
+
+    double Uniform(double min, double max)
+    {
+        return std::uniform_real_distribution<double>{min, max}(_random);
+    }
+
+    Timestamp::duration Exponential(std::chrono::seconds mean)
+    {
+        const double seconds = std::exponential_distribution<double>{1.0 / mean.count()}(_random);
+        return std::chrono::duration_cast<Timestamp::duration>(
+            std::chrono::duration<double>{seconds});
+    }
+
+    uint8_t RandomBattery()
+    {
+        return static_cast<uint8_t>(std::uniform_int_distribution<uint32_t>{3, 10}(_random));
+    }
+
+    void RotateAddresses(VirtualDevice &device)
+    {
+        // 48-bit random addresses
+        std::uniform_int_distribution<uint64_t> distribution{1, (1ull << 48) - 1};
+        device.addresses = {distribution(_random), distribution(_random)};
+    }
+
+    void Evolve(VirtualDevice &device, Timestamp now)
+    {
+        while (now >= device.nextRotation) {
+            RotateAddresses(device);
+            device.nextRotation += _options.addressRotation;
+        }
+
+        // The pods in the ear slowly drain
+        //
+        while (now >= device.nextBatteryStep) {
+            auto &battery = Uniform(0, 1) < 0.5 ? device.pods.left : device.pods.right;
+            if (battery > 1) {
+                --battery;
+            }
+            device.nextBatteryStep += Exponential(kBatteryStepMean);
+        }
+
+        while (now >= device.nextInEarToggle) {
+            auto &inEar = Uniform(0, 1) < 0.5 ? device.inEar.left : device.inEar.right;
+            inEar = !inEar;
+            device.nextInEarToggle += Exponential(kInEarToggleMean);
+        }
+    }
+};
+
+bool IsCorrectDecision(const AirPods::State &state, const VirtualDevice &desired)
+{
+    return state.model == AirPods::FindModelById(desired.modelId) &&
+           state.pods.left.battery.Available() && state.pods.right.battery.Available() &&
+           state.pods.left.battery.Value() == desired.pods.left * 10u &&
+           state.pods.right.battery.Value() == desired.pods.right * 10u;
+}
+
+std::chrono::nanoseconds Percentile(std::vector<std::chrono::nanoseconds> &samples, double ratio)
+{
+    if (samples.empty()) {
+        return {};
+    }
+    const auto nth = samples.begin() + static_cast<size_t>(ratio * (samples.size() - 1));
+    std::nth_element(samples.begin(), nth, samples.end());
+    return *nth;
+}
+} // namespace
+
+std::array<uint8_t, AppleCP::AirPodsLayout::kSize> MakePayload(const PayloadFields &fields)
+{
+    namespace Layout = AppleCP::AirPodsLayout;
+
+    const auto put = [](auto &payload, const AppleCP::BitField &field, uint32_t value) {
+        payload[field.offset] |= static_cast<uint8_t>((value & ((1u << field.bits) - 1))
+                                                      << field.shift);
+    };
+
+    std::array<uint8_t, Layout::kSize> payload{};
+    payload[Layout::kOffsetPacketType] =
+        Helper::ToUnderlying(AppleCP::PacketType::ProximityPairing);
+    payload[Layout::kOffsetRemainingLength] = Layout::kSize - (Layout::kOffsetRemainingLength + 1);
+    payload[Layout::kOffsetModelId] = static_cast<uint8_t>(fields.modelId);
+    payload[Layout::kOffsetModelId + 1] = static_cast<uint8_t>(fields.modelId >> 8);
+
+    // The "current" fields belong to the broadcasting pod
+    //
+    const bool isLeft = fields.side == AirPods::Side::Left;
+    put(payload, Layout::kBroadcastFrom, isLeft);
+    put(payload, Layout::kCurrInEar, isLeft ? fields.inEar.left : fields.inEar.right);
+    put(payload, Layout::kAnotInEar, isLeft ? fields.inEar.right : fields.inEar.left);
+    put(payload, Layout::kBothInCase, fields.bothInCase);
+    put(payload, Layout::kCurrBattery, isLeft ? fields.pods.left : fields.pods.right);
+    put(payload, Layout::kAnotBattery, isLeft ? fields.pods.right : fields.pods.left);
+    put(payload, Layout::kCaseBattery, fields.caseBox);
+    put(payload, Layout::kLidClosed, fields.lidClosed);
+
+    return payload;
+}
+
+std::optional<LoadReport> Run(const LoadOptions &options)
+{
+    using namespace std::chrono;
+
+    if (options.devices == 0 || options.packetsPerSecond == 0) {
+        LOG(Warn, "LoadGenerator: Nothing to generate.");
+        return std::nullopt;
+    }
+
+    std::unique_ptr<AdvCapture::Writer> capture;
+    if (!options.capturePath.isEmpty()) {
+        capture = std::make_unique<AdvCapture::Writer>(options.capturePath);
+        if (!capture->IsOpen()) {
+            return std::nullopt;
+        }
+    }
+
+    const Timestamp begin = Timestamp{} + 1h;
+    const auto interval = duration_cast<Timestamp::duration>(1s) / options.packetsPerSecond;
+    const uint64_t packets = options.packetsPerSecond * options.duration.count();
+
+    Generator generator{options, begin};
+
+    AirPods::Details::StateManager stateMgr{false};
+    stateMgr.OnRssiMinChanged(options.rssiMin);
+    stateMgr.OnStateTimeoutChanged(options.stateTimeoutMin, options.stateTimeoutMax);
+    stateMgr.OnDesiredModelChanged(AirPods::FindModelById(generator.GetDevice(0).modelId));
+
+    LOG(Info, "LoadGenerator: Devices: {}, packets/s: {}, duration: {}s, address rotation: {}s",
+        options.devices, options.packetsPerSecond, options.duration.count(),
+        options.addressRotation.count());
+
+    LoadReport report;
+    std::vector<nanoseconds> callTimes;
+    callTimes.reserve(packets);
+
+    const auto wallBegin = steady_clock::now();
+
+    for (uint64_t i = 0; i < packets; ++i) {
+        const auto now = begin + interval * i;
+        const auto data = generator.Next(i % options.devices, now);
+        ++report.packets;
+
+        if (capture) {
+            capture->Append(data, data.manufacturerData[0].data);
+        }
+
+        stateMgr.AdvanceTo(now);
+
+        const auto optAdv = AirPods::Details::Advertisement::Decode(data);
+        if (!optAdv.has_value()) {
+            continue;
+        }
+
+        const auto callBegin = steady_clock::now();
+        const auto result = stateMgr.OnAdvReceived(optAdv.value());
+        callTimes.emplace_back(steady_clock::now() - callBegin);
+
+        report.accepted += result.accepted;
+        report.stateUpdates += result.updateEvent.has_value();
+
+        const auto optState = stateMgr.GetCurrentState();
+        if (optState.has_value()) {
+            ++report.decisions;
+            report.correctDecisions += IsCorrectDecision(optState.value(), generator.GetDevice(0));
+        }
+    }
+
+    report.elapsed = steady_clock::now() - wallBegin;
+    report.callP50 = Percentile(callTimes, 0.5);
+    report.callP99 = Percentile(callTimes, 0.99);
+    report.callMax = callTimes.empty() ? nanoseconds{} : *std::ranges::max_element(callTimes);
+    return report;
+}
+
+} // namespace Core::LoadGenerator
@@ -0,0 +1,75 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <optional>
+
+#include <QString>
+
+#include "AppleCP.h"
+#include "Bluetooth.h"
+
+namespace Core::LoadGenerator {
+
+// The fields of a synthesized proximity pairing payload, the batteries are in [0, 10]
+//
+struct PayloadFields {
+    uint16_t modelId{0x200E};
+    AirPods::Side side{AirPods::Side::Left};
+    Helper::Sides<uint8_t> pods{10, 10};
+    uint8_t caseBox{10};
+    Helper::Sides<bool> inEar{false, false};
+    bool bothInCase{false};
+    bool lidClosed{false};
+};
+
+std::array<uint8_t, AppleCP::AirPodsLayout::kSize> MakePayload(const PayloadFields &fields);
+
+struct LoadOptions {
+    size_t devices{20};
+    uint32_t packetsPerSecond{1000};
+    std::chrono::seconds duration{60};
+    // AirPods rotate their random addresses every few minutes, faster here to stress the tracker
+    std::chrono::seconds addressRotation{30};
+    uint64_t seed{1};
+    int16_t rssiMin{-80};
+    std::chrono::milliseconds stateTimeoutMin{2000}, stateTimeoutMax{10000};
+    // Also writes the synthesized stream as a capture, so that it can be replayed
+    QString capturePath;
+};
+
+struct LoadReport {
+    uint64_t packets{0}, accepted{0}, stateUpdates{0};
+    // The current state is checked against the desired device after every packet
+    uint64_t decisions{0}, correctDecisions{0};
+    std::chrono::nanoseconds elapsed{};
+    // The duration of the whole `StateManager::OnAdvReceived` call
+    std::chrono::nanoseconds callP50{}, callP99{}, callMax{};
+};
+
+// Synthesizes the advertisements of `devices` virtual AirPods on a virtual clock, with address
+// rotation, battery drift, in-ear transitions and RSSI noise, and feeds them through
+// `Advertisement` and a non-live `StateManager` as fast as possible. The first device is the
+// desired one, it's the closest but shares its model with some of the others.
+//
+std::optional<LoadReport> Run(const LoadOptions &options);
+
+} // namespace Core::LoadGenerator
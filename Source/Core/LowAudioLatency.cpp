@@ -28,6 +28,15 @@ namespace Core::LowAudioLatency {
 Controller::Controller(QObject *parent) : QObject{parent}
 {
     connect(this, &Controller::ControlSafely, this, &Controller::Control);
+    connect(this, &Controller::BoundDeviceChangedSafely, this, &Controller::OnBoundDeviceChanged);
+
+    // Usually the endpoint has been changed when the native stream stops by itself, so both of
+    // them are handled by checking the default endpoint again, without waiting
+    //
+    connect(this, &Controller::NativeStreamStoppedSafely, this, &Controller::Update,
+        Qt::QueuedConnection);
+    connect(this, &Controller::EndpointChangedSafely, this, &Controller::Update,
+        Qt::QueuedConnection);
 
     _initTimer.callOnTimeout([this] {
         if (Initialize()) {
@@ -67,8 +76,8 @@ bool Controller::Initialize()
 
     LOG(Info, "LowAudioLatency: Init successful. _enabled: {}", _enabled);
 
-    if (_enabled) {
-        Control(true);
+    if (_isActive && !IsNativeStreamRunning()) {
+        _mediaPlayer->play();
     }
 
     return true;
@@ -78,16 +87,117 @@ void Controller::Control(bool enable)
 {
     LOG(Info, "LowAudioLatency::Controller Control: {}, _inited: {}", enable, _inited);
 
-    if (_inited) {
-        if (enable) {
-            _mediaPlayer->play();
+    _enabled = enable;
+    Update();
+}
+
+// The stream is only kept while the default render endpoint is the bound device and it's
+// connected, it would just keep the audio engine of another endpoint busy otherwise
+//
+void Controller::Update()
+{
+    std::wstring endpointId;
+    bool isBoundEndpoint = _boundConnected;
+
+#if defined APD_OS_WIN
+    const auto endpoint = _endpointWatcher.GetDefaultEndpoint();
+    if (!endpoint.has_value()) {
+        isBoundEndpoint = false;
+    }
+    else {
+        endpointId = endpoint->id;
+
+        // Trust the connection state alone if any of the container IDs is unknown
+        //
+        if (!_boundContainerId.isNull() && !endpoint->containerId.isNull()) {
+            isBoundEndpoint = isBoundEndpoint && endpoint->containerId == _boundContainerId;
         }
-        else {
-            _mediaPlayer->stop();
+    }
+#endif
+
+    if (!_enabled || !isBoundEndpoint) {
+        if (_isActive) {
+            LOG(Info, "LowAudioLatency: Deactivate. _enabled: {}, _boundConnected: {}", _enabled,
+                _boundConnected);
+            Deactivate();
         }
+        return;
     }
 
-    _enabled = enable;
+    const bool isRunning =
+        IsNativeStreamRunning() ||
+        (_inited && _mediaPlayer->state() == QMediaPlayer::PlayingState);
+
+    if (_isActive && isRunning && endpointId == _activeEndpointId) {
+        return;
+    }
+
+    // The stream is bound to the endpoint it was started on, so it's restarted for the new one
+    //
+    LOG(Info, "LowAudioLatency: Activate.");
+    Deactivate();
+    Activate(std::move(endpointId));
+}
+
+void Controller::Activate(std::wstring endpointId)
+{
+    _isActive = true;
+    _activeEndpointId = std::move(endpointId);
+
+    if (StartNativeStream()) {
+        return;
+    }
+    LOG(Info, "LowAudioLatency: The native stream is unavailable, fall back to media player.");
+
+    if (_inited) {
+        _mediaPlayer->play();
+    }
+}
+
+void Controller::Deactivate()
+{
+    _isActive = false;
+    _activeEndpointId.clear();
+
+    StopNativeStream();
+    if (_inited) {
+        _mediaPlayer->stop();
+    }
+}
+
+bool Controller::StartNativeStream()
+{
+#if defined APD_OS_WIN
+    return _nativeStream.Start();
+#else
+    return false;
+#endif
+}
+
+void Controller::StopNativeStream()
+{
+#if defined APD_OS_WIN
+    _nativeStream.Stop();
+#endif
+}
+
+bool Controller::IsNativeStreamRunning() const
+{
+#if defined APD_OS_WIN
+    return _nativeStream.IsRunning();
+#else
+    return false;
+#endif
+}
+
+void Controller::OnBoundDeviceChanged(QUuid containerId, bool connected)
+{
+    LOG(Info, "LowAudioLatency: Bound device changed. containerId: {}, connected: {}",
+        containerId.toString(), connected);
+
+    _boundContainerId = containerId;
+    _boundConnected = connected;
+    Update();
 }
 
 void Controller::OnError(QMediaPlayer::Error error)
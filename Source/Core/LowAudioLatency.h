@@ -20,11 +20,17 @@
 
 #include <memory>
 #include <chrono>
+#include <string>
 
+#include <QUuid>
 #include <QTimer>
 #include <QMediaPlayer>
 #include <QMediaPlaylist>
 
+#if defined APD_OS_WIN
+    #include "LowAudioLatency_win.h"
+#endif
+
 using namespace std::chrono_literals;
 
 namespace Core::LowAudioLatency {
@@ -38,19 +44,41 @@ public:
 
 Q_SIGNALS:
     void ControlSafely(bool enable);
+    // A null `containerId` means that no device is bound or it's unknown
+    //
+    void BoundDeviceChangedSafely(QUuid containerId, bool connected);
+    void NativeStreamStoppedSafely();
+    void EndpointChangedSafely();
 
 private:
     constexpr static inline auto kRetryInterval = 30s;
 
+    // The native stream is preferred, the media player is the fallback
+    //
+#if defined APD_OS_WIN
+    Details::SilenceStream _nativeStream{[this] { NativeStreamStoppedSafely(); }};
+    Details::EndpointWatcher _endpointWatcher{[this] { EndpointChangedSafely(); }};
+#endif
     std::unique_ptr<QMediaPlayer> _mediaPlayer;
     std::unique_ptr<QMediaPlaylist> _mediaPlaylist;
     QTimer _initTimer;
-    bool _inited{false}, _enabled{false};
+    bool _inited{false}, _enabled{false}, _isActive{false};
+    QUuid _boundContainerId;
+    bool _boundConnected{false};
+    // The default endpoint the stream was started on
+    std::wstring _activeEndpointId;
 
     bool Initialize();
     void Control(bool enable);
+    void Update();
+    void Activate(std::wstring endpointId);
+    void Deactivate();
+    bool StartNativeStream();
+    void StopNativeStream();
+    bool IsNativeStreamRunning() const;
 
     void OnError(QMediaPlayer::Error error);
+    void OnBoundDeviceChanged(QUuid containerId, bool connected);
 };
 
 } // namespace Core::LowAudioLatency
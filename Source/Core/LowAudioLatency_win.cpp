@@ -0,0 +1,388 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "LowAudioLatency_win.h"
+
+#include <mmdeviceapi.h>
+#include <audioclient.h>
+
+#include "../Logger.h"
+#include "OS/Windows.h"
+
+namespace Core::LowAudioLatency::Details {
+
+SilenceStream::SilenceStream(FnStopped onStopped) : _onStopped{std::move(onStopped)}
+{
+    _stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+}
+
+SilenceStream::~SilenceStream()
+{
+    Stop();
+    if (_stopEvent != nullptr) {
+        CloseHandle(_stopEvent);
+    }
+}
+
+bool SilenceStream::Start()
+{
+    if (_isRunning) {
+        return true;
+    }
+    if (_stopEvent == nullptr) {
+        return false;
+    }
+
+    // The previous stream may have stopped by itself
+    //
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    ResetEvent(_stopEvent);
+
+    std::promise<bool> started;
+    auto future = started.get_future();
+    _thread = std::thread{&SilenceStream::Run, this, std::move(started)};
+
+    if (!future.get()) {
+        _thread.join();
+        return false;
+    }
+    return true;
+}
+
+void SilenceStream::Stop()
+{
+    if (_thread.joinable()) {
+        SetEvent(_stopEvent);
+        _thread.join();
+    }
+}
+
+void SilenceStream::Run(std::promise<bool> started)
+{
+    using OS::Windows::Com::UniquePtr;
+
+    const bool comInitialized = SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+
+    HANDLE bufferEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    WAVEFORMATEX *format = nullptr;
+    UniquePtr<IAudioClient3> audioClient;
+    UniquePtr<IAudioRenderClient> renderClient;
+    bool isStarted = false, isUnexpected = false;
+
+    do {
+        const auto failed = [](HRESULT result, const char *what) {
+            if (FAILED(result)) {
+                LOG(Warn, "LowAudioLatency: {} failed. HRESULT: {:#x}", what, result);
+                return true;
+            }
+            return false;
+        };
+
+        if (bufferEvent == nullptr) {
+            LOG(Warn, "LowAudioLatency: CreateEventW() failed. Error: {}", GetLastError());
+            break;
+        }
+
+        UniquePtr<IMMDeviceEnumerator> deviceEnumerator;
+        if (failed(
+                CoCreateInstance(
+                    __uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, deviceEnumerator.GetIID(),
+                    (void **)deviceEnumerator.ReleaseAndAddressOf()),
+                "CoCreateInstance(MMDeviceEnumerator)"))
+        {
+            break;
+        }
+
+        UniquePtr<IMMDevice> endpoint;
+        if (failed(
+                deviceEnumerator->GetDefaultAudioEndpoint(
+                    eRender, eConsole, endpoint.ReleaseAndAddressOf()),
+                "GetDefaultAudioEndpoint()"))
+        {
+            break;
+        }
+
+        // `IAudioClient3` is only available on Windows 10 and later, the caller falls back then
+        //
+        if (failed(
+                endpoint->Activate(
+                    audioClient.GetIID(), CLSCTX_ALL, nullptr,
+                    (void **)audioClient.ReleaseAndAddressOf()),
+                "IMMDevice::Activate(IAudioClient3)"))
+        {
+            break;
+        }
+
+        if (failed(audioClient->GetMixFormat(&format), "IAudioClient3::GetMixFormat()")) {
+            break;
+        }
+
+        UINT32 defaultPeriod = 0, fundamentalPeriod = 0, minPeriod = 0, maxPeriod = 0;
+        if (failed(
+                audioClient->GetSharedModeEnginePeriod(
+                    format, &defaultPeriod, &fundamentalPeriod, &minPeriod, &maxPeriod),
+                "IAudioClient3::GetSharedModeEnginePeriod()"))
+        {
+            break;
+        }
+
+        if (failed(
+                audioClient->InitializeSharedAudioStream(
+                    AUDCLNT_STREAMFLAGS_EVENTCALLBACK, minPeriod, format, nullptr),
+                "IAudioClient3::InitializeSharedAudioStream()"))
+        {
+            break;
+        }
+
+        if (failed(audioClient->SetEventHandle(bufferEvent), "IAudioClient3::SetEventHandle()") ||
+            failed(
+                audioClient->GetService(
+                    renderClient.GetIID(), (void **)renderClient.ReleaseAndAddressOf()),
+                "IAudioClient3::GetService(IAudioRenderClient)"))
+        {
+            break;
+        }
+
+        UINT32 bufferFrames = 0;
+        if (failed(audioClient->GetBufferSize(&bufferFrames), "IAudioClient3::GetBufferSize()")) {
+            break;
+        }
+
+        const auto renderSilence = [&]() -> HRESULT {
+            UINT32 padding = 0;
+            HRESULT result = audioClient->GetCurrentPadding(&padding);
+            if (FAILED(result)) {
+                return result;
+            }
+
+            const UINT32 frames = bufferFrames - padding;
+            if (frames == 0) {
+                return S_OK;
+            }
+
+            BYTE *buffer = nullptr;
+            result = renderClient->GetBuffer(frames, &buffer);
+            if (FAILED(result)) {
+                return result;
+            }
+            return renderClient->ReleaseBuffer(frames, AUDCLNT_BUFFERFLAGS_SILENT);
+        };
+
+        if (failed(renderSilence(), "Prefilling silence") ||
+            failed(audioClient->Start(), "IAudioClient3::Start()"))
+        {
+            break;
+        }
+
+        LOG(Info, "LowAudioLatency: Native stream started. Period: {} frames, {} Hz", minPeriod,
+            format->nSamplesPerSec);
+
+        isStarted = true;
+        _isRunning = true;
+        started.set_value(true);
+
+        const HANDLE events[] = {_stopEvent, bufferEvent};
+        while (true) {
+            const DWORD wait = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+            if (wait != WAIT_OBJECT_0 + 1) {
+                break;
+            }
+
+            if (failed(renderSilence(), "Rendering silence")) {
+                isUnexpected = true;
+                break;
+            }
+        }
+
+        audioClient->Stop();
+    } while (false);
+
+    _isRunning = false;
+    if (!isStarted) {
+        started.set_value(false);
+    }
+
+    renderClient = nullptr;
+    audioClient = nullptr;
+    if (format != nullptr) {
+        CoTaskMemFree(format);
+    }
+    if (bufferEvent != nullptr) {
+        CloseHandle(bufferEvent);
+    }
+    if (comInitialized) {
+        CoUninitialize();
+    }
+
+    if (isUnexpected) {
+        LOG(Warn, "LowAudioLatency: Native stream stopped unexpectedly.");
+        if (_onStopped) {
+            _onStopped();
+        }
+    }
+}
+
+// `PKEY_Device_ContainerId`, defined here to avoid depending on `INITGUID`
+//
+constexpr PROPERTYKEY kPropertyContainerId{
+    {0x8c7ed206, 0x3f8a, 0x4827, {0xb3, 0xab, 0xae, 0x9e, 0x1f, 0xae, 0xfc, 0x6c}}, 2};
+
+class EndpointWatcher::Notifier final : public IMMNotificationClient
+{
+public:
+    Notifier(FnChanged onChanged) : _onChanged{std::move(onChanged)} {}
+
+    ULONG STDMETHODCALLTYPE AddRef() override
+    {
+        return ++_refCount;
+    }
+
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        const auto refCount = --_refCount;
+        if (refCount == 0) {
+            delete this;
+        }
+        return refCount;
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvInterface) override
+    {
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(IMMNotificationClient)) {
+            *ppvInterface = static_cast<IMMNotificationClient *>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppvInterface = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR defaultDeviceId) override
+    {
+        if (flow == eRender && role == eConsole) {
+            _onChanged();
+        }
+        return S_OK;
+    }
+
+    // The default endpoint becomes unavailable before the default device is changed, e.g. the
+    // AirPods are disconnected
+    //
+    HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR deviceId, DWORD newState) override
+    {
+        _onChanged();
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR deviceId) override
+    {
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR deviceId) override
+    {
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    OnPropertyValueChanged(LPCWSTR deviceId, const PROPERTYKEY key) override
+    {
+        return S_OK;
+    }
+
+private:
+    std::atomic<ULONG> _refCount{1};
+    FnChanged _onChanged;
+};
+
+EndpointWatcher::EndpointWatcher(FnChanged onChanged)
+{
+    HRESULT result = CoCreateInstance(
+        __uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, _deviceEnumerator.GetIID(),
+        (void **)_deviceEnumerator.ReleaseAndAddressOf());
+    if (FAILED(result)) {
+        LOG(Warn, "LowAudioLatency: CoCreateInstance(MMDeviceEnumerator) failed. HRESULT: {:#x}",
+            result);
+        return;
+    }
+
+    _notifier = new Notifier{std::move(onChanged)};
+    result = _deviceEnumerator->RegisterEndpointNotificationCallback(_notifier);
+    if (FAILED(result)) {
+        LOG(Warn, "LowAudioLatency: RegisterEndpointNotificationCallback() failed. HRESULT: {:#x}",
+            result);
+        _notifier->Release();
+        _notifier = nullptr;
+    }
+}
+
+EndpointWatcher::~EndpointWatcher()
+{
+    // Blocks until the callbacks in flight are returned
+    //
+    if (_notifier != nullptr) {
+        _deviceEnumerator->UnregisterEndpointNotificationCallback(_notifier);
+        _notifier->Release();
+    }
+}
+
+auto EndpointWatcher::GetDefaultEndpoint() const -> std::optional<Endpoint>
+{
+    if (!_deviceEnumerator) {
+        return std::nullopt;
+    }
+
+    OS::Windows::Com::UniquePtr<IMMDevice> device;
+    HRESULT result =
+        _deviceEnumerator->GetDefaultAudioEndpoint(eRender, eConsole, device.ReleaseAndAddressOf());
+    if (FAILED(result)) {
+        // E_NOTFOUND if there is no render endpoint at all
+        return std::nullopt;
+    }
+
+    Endpoint endpoint;
+
+    LPWSTR id = nullptr;
+    if (SUCCEEDED(device->GetId(&id))) {
+        endpoint.id = id;
+        CoTaskMemFree(id);
+    }
+
+    OS::Windows::Com::UniquePtr<IPropertyStore> propertyStore;
+    result = device->OpenPropertyStore(STGM_READ, propertyStore.ReleaseAndAddressOf());
+    if (FAILED(result)) {
+        LOG(Warn, "LowAudioLatency: IMMDevice::OpenPropertyStore() failed. HRESULT: {:#x}",
+            result);
+        return endpoint;
+    }
+
+    PROPVARIANT value;
+    PropVariantInit(&value);
+    if (SUCCEEDED(propertyStore->GetValue(kPropertyContainerId, &value)) && value.vt == VT_CLSID &&
+        value.puuid != nullptr)
+    {
+        endpoint.containerId = QUuid{*value.puuid};
+    }
+    PropVariantClear(&value);
+
+    return endpoint;
+}
+} // namespace Core::LowAudioLatency::Details
@@ -0,0 +1,102 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#if !defined APD_OS_WIN
+    #error "This file shouldn't be compiled."
+#endif
+
+#include <Windows.h>
+#include <mmdeviceapi.h>
+
+#include <atomic>
+#include <thread>
+#include <future>
+#include <string>
+#include <optional>
+#include <functional>
+
+#include <QUuid>
+
+#include "OS/Windows.h"
+
+namespace Core::LowAudioLatency::Details {
+
+// Renders silence to the default render endpoint through `IAudioClient3` with the minimum
+// shared-mode period. The buffers are flagged silent, so nothing is decoded or even filled.
+//
+class SilenceStream
+{
+public:
+    using FnStopped = std::function<void()>;
+
+    // `onStopped` is called on the stream thread if the stream stops unexpectedly, e.g. the
+    // endpoint is removed or the default endpoint is changed
+    //
+    SilenceStream(FnStopped onStopped);
+    ~SilenceStream();
+
+    bool Start();
+    void Stop();
+
+    inline bool IsRunning() const
+    {
+        return _isRunning;
+    }
+
+private:
+    FnStopped _onStopped;
+    HANDLE _stopEvent{nullptr};
+    std::thread _thread;
+    std::atomic<bool> _isRunning{false};
+
+    void Run(std::promise<bool> started);
+};
+
+// Watches the render endpoints through `IMMNotificationClient`, so that the stream can follow
+// the default endpoint immediately instead of polling it.
+//
+class EndpointWatcher
+{
+public:
+    using FnChanged = std::function<void()>;
+
+    struct Endpoint
+    {
+        std::wstring id;
+        // Shared by all the endpoints of the same physical device, e.g. the stereo and the
+        // hands-free endpoints of the AirPods
+        QUuid containerId;
+    };
+
+    // `onChanged` is called on an arbitrary MTA thread when the default render endpoint is
+    // changed or the state of any endpoint is changed, it must not block
+    //
+    EndpointWatcher(FnChanged onChanged);
+    ~EndpointWatcher();
+
+    std::optional<Endpoint> GetDefaultEndpoint() const;
+
+private:
+    class Notifier;
+
+    OS::Windows::Com::UniquePtr<IMMDeviceEnumerator> _deviceEnumerator;
+    Notifier *_notifier{nullptr};
+};
+} // namespace Core::LowAudioLatency::Details
@@ -0,0 +1,207 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Metrics.h"
+
+#include <array>
+#include <algorithm>
+#include <format>
+
+#include <magic_enum.hpp>
+
+#include "../Helper.h"
+#include "../Logger.h"
+
+namespace Core::Metrics {
+
+namespace Details {
+
+struct Data {
+    std::array<std::atomic<uint64_t>, Helper::ToUnderlying(Counter::_Max)> counters{};
+    std::array<std::atomic<uint64_t>, Helper::ToUnderlying(DropReason::_Max)> drops{};
+    std::array<std::atomic<int64_t>, Helper::ToUnderlying(Gauge::_Max)> gauges{};
+    Latency::Histogram managerLockWait;
+    Latency::Histogram watcherRecovery;
+
+    // The values at the last summary, only touched by `Summary`
+    std::mutex summaryMutex;
+    std::array<uint64_t, Helper::ToUnderlying(Counter::_Max)> summaryCounters{};
+    std::array<uint64_t, Helper::ToUnderlying(DropReason::_Max)> summaryDrops{};
+};
+
+Data &GetData()
+{
+    static Data i;
+    return i;
+}
+
+} // namespace Details
+
+void Increment(Counter counter)
+{
+    Details::GetData().counters[Helper::ToUnderlying(counter)].fetch_add(
+        1, std::memory_order_relaxed);
+}
+
+void Drop(DropReason reason)
+{
+    Details::GetData().drops[Helper::ToUnderlying(reason)].fetch_add(
+        1, std::memory_order_relaxed);
+}
+
+void Set(Gauge gauge, int64_t value)
+{
+    Details::GetData().gauges[Helper::ToUnderlying(gauge)].store(
+        value, std::memory_order_relaxed);
+}
+
+uint64_t Get(Counter counter)
+{
+    return Details::GetData().counters[Helper::ToUnderlying(counter)].load(
+        std::memory_order_relaxed);
+}
+
+uint64_t Get(DropReason reason)
+{
+    return Details::GetData().drops[Helper::ToUnderlying(reason)].load(std::memory_order_relaxed);
+}
+
+int64_t Get(Gauge gauge)
+{
+    return Details::GetData().gauges[Helper::ToUnderlying(gauge)].load(std::memory_order_relaxed);
+}
+
+Latency::Histogram::Snapshot GetManagerLockWait()
+{
+    return Details::GetData().managerLockWait.GetSnapshot();
+}
+
+void RecordWatcherRecovery(std::chrono::milliseconds duration)
+{
+    Details::GetData().watcherRecovery.Record((uint64_t)(std::max)(duration.count(), (int64_t)0));
+}
+
+Latency::Histogram::Snapshot GetWatcherRecovery()
+{
+    return Details::GetData().watcherRecovery.GetSnapshot();
+}
+
+ManagerLockGuard::ManagerLockGuard(Profiler::Lockable<std::mutex> &mutex) : _mutex{mutex}
+{
+    Increment(Counter::ManagerLocks);
+
+    if (_mutex.try_lock()) {
+        return;
+    }
+
+    const auto begin = Latency::Clock::now();
+    _mutex.lock();
+    const auto wait = Latency::Clock::now() - begin;
+
+    Increment(Counter::ManagerLocksContended);
+    Details::GetData().managerLockWait.Record(
+        (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(wait).count());
+}
+
+ManagerLockGuard::~ManagerLockGuard()
+{
+    _mutex.unlock();
+}
+
+void Reset()
+{
+    auto &data = Details::GetData();
+
+    for (auto &counter : data.counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    for (auto &drop : data.drops) {
+        drop.store(0, std::memory_order_relaxed);
+    }
+    data.managerLockWait.Reset();
+    data.watcherRecovery.Reset();
+
+    std::lock_guard<std::mutex> lock{data.summaryMutex};
+    data.summaryCounters.fill(0);
+    data.summaryDrops.fill(0);
+}
+
+std::string Dump()
+{
+    std::string result;
+
+    for (size_t i = 0; i < Helper::ToUnderlying(Counter::_Max); ++i) {
+        const auto counter = static_cast<Counter>(i);
+        result += std::format("{:<24} {}\n", magic_enum::enum_name(counter), Get(counter));
+    }
+
+    result += "Dropped:\n";
+    for (size_t i = 0; i < Helper::ToUnderlying(DropReason::_Max); ++i) {
+        const auto reason = static_cast<DropReason>(i);
+        result += std::format("  {:<22} {}\n", magic_enum::enum_name(reason), Get(reason));
+    }
+
+    for (size_t i = 0; i < Helper::ToUnderlying(Gauge::_Max); ++i) {
+        const auto gauge = static_cast<Gauge>(i);
+        result += std::format("{:<24} {}\n", magic_enum::enum_name(gauge), Get(gauge));
+    }
+
+    const auto wait = GetManagerLockWait();
+    result += std::format(
+        "ManagerLockWait          count: {}  p50: {:.0f}us  p99: {:.0f}us  max: {}us\n", wait.count,
+        wait.p50, wait.p99, wait.max);
+
+    const auto recovery = GetWatcherRecovery();
+    result += std::format(
+        "WatcherRecovery          count: {}  p50: {:.0f}ms  p99: {:.0f}ms  max: {}ms\n",
+        recovery.count, recovery.p50, recovery.p99, recovery.max);
+    return result;
+}
+
+std::string Summary()
+{
+    auto &data = Details::GetData();
+    std::lock_guard<std::mutex> lock{data.summaryMutex};
+
+    std::string result;
+    const auto append = [&](std::string_view name, uint64_t current, uint64_t &last) {
+        if (current != last) {
+            result += std::format("{}{}: +{}", result.empty() ? "" : ", ", name, current - last);
+            last = current;
+        }
+    };
+
+    for (size_t i = 0; i < Helper::ToUnderlying(Counter::_Max); ++i) {
+        const auto counter = static_cast<Counter>(i);
+        append(magic_enum::enum_name(counter), Get(counter), data.summaryCounters[i]);
+    }
+    for (size_t i = 0; i < Helper::ToUnderlying(DropReason::_Max); ++i) {
+        const auto reason = static_cast<DropReason>(i);
+        append(
+            std::format("Dropped.{}", magic_enum::enum_name(reason)), Get(reason),
+            data.summaryDrops[i]);
+    }
+    return result;
+}
+
+void DumpToLog()
+{
+    LOG(Info, "Metrics:\n{}", Dump());
+}
+
+} // namespace Core::Metrics
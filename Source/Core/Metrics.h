@@ -0,0 +1,102 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <string>
+
+#include "../Profiler.h"
+#include "Latency.h"
+
+// Counters and gauges of the Bluetooth and state pipeline. They are relaxed atomics, so they can
+// be updated on every packet without Trace logging.
+//
+namespace Core::Metrics {
+
+enum class Counter : uint32_t {
+    PacketsReceived,
+    AcceptedUpdates,
+    WatcherRestarts,
+    ManagerLocks,
+    ManagerLocksContended,
+    _Max
+};
+
+enum class DropReason : uint32_t {
+    NonApple,
+    InvalidPacket,
+    Disconnected,
+    RssiTooLow,
+    ModelMismatch,
+    BatteryDiff,
+    RssiDiff,
+    NotDesired,     // From another device of the desired model
+    IngestOverflow, // The oldest in the ingest ring, dropped because the pipeline fell behind
+    _Max
+};
+
+enum class Gauge : uint32_t {
+    TrackedSources,
+    TrackedClusters,
+    _Max
+};
+
+void Increment(Counter counter);
+void Drop(DropReason reason);
+void Set(Gauge gauge, int64_t value);
+
+uint64_t Get(Counter counter);
+uint64_t Get(DropReason reason);
+int64_t Get(Gauge gauge);
+
+// The wait for `Manager::_mutex`, in microseconds, only recorded if it was contended
+//
+Latency::Histogram::Snapshot GetManagerLockWait();
+
+// The time from the advertisement watcher stopping unexpectedly to the first advertisement
+// received after it's back, in milliseconds
+//
+void RecordWatcherRecovery(std::chrono::milliseconds duration);
+Latency::Histogram::Snapshot GetWatcherRecovery();
+
+// A `std::lock_guard` that records the wait for `Manager::_mutex`. The clock is only read if the
+// mutex is contended, so an uncontended lock costs one more `try_lock`.
+//
+class ManagerLockGuard
+{
+public:
+    explicit ManagerLockGuard(Profiler::Lockable<std::mutex> &mutex);
+    ~ManagerLockGuard();
+
+    ManagerLockGuard(const ManagerLockGuard &) = delete;
+    ManagerLockGuard &operator=(const ManagerLockGuard &) = delete;
+
+private:
+    Profiler::Lockable<std::mutex> &_mutex;
+};
+
+void Reset();
+
+std::string Dump();
+// A single line of the counters changed since the last summary, empty if nothing changed
+std::string Summary();
+void DumpToLog();
+
+} // namespace Core::Metrics
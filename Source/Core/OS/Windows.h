@@ -18,11 +18,16 @@
 
 #pragma once
 
+#include <mutex>
 #include <iostream>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
 
 #include <Windows.h>
 #include <winternl.h>
 #include <tlhelp32.h>
+#include <psapi.h>
 #include <shellapi.h>
 #include <unknwn.h>
 #include <winrt/Windows.Foundation.h>
@@ -42,7 +47,7 @@
 namespace Core::OS::Windows {
 namespace Process {
 
-inline std::optional<std::wstring> GetNameById(uint32_t targetId)
+inline std::optional<std::wstring> GetNameByIdFromSnapshot(uint32_t targetId)
 {
     std::optional<std::wstring> result;
 
@@ -67,6 +72,80 @@ inline std::optional<std::wstring> GetNameById(uint32_t targetId)
     return result;
 }
 
+// The names are cached by the process id along with the creation time of the process, so a
+// reused process id doesn't get the name of the exited process
+//
+inline std::optional<std::wstring> GetNameById(uint32_t targetId)
+{
+    constexpr size_t kMaxCacheSize = 1024;
+
+    struct CacheEntry {
+        uint64_t creationTime{};
+        std::wstring name;
+    };
+    static std::mutex cacheMutex;
+    static std::unordered_map<uint32_t, CacheEntry> cache;
+
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, targetId);
+    if (hProcess == nullptr) {
+        // Some protected processes can't be opened, there is nothing to tell the reuse of their
+        // ids, so they are not cached
+        //
+        return GetNameByIdFromSnapshot(targetId);
+    }
+
+    std::optional<std::wstring> result;
+
+    do {
+        FILETIME creationTime{}, exitTime{}, kernelTime{}, userTime{};
+        if (!GetProcessTimes(hProcess, &creationTime, &exitTime, &kernelTime, &userTime)) {
+            result = GetNameByIdFromSnapshot(targetId);
+            break;
+        }
+        const auto creationTimeValue =
+            (uint64_t)creationTime.dwHighDateTime << 32 | creationTime.dwLowDateTime;
+
+        {
+            std::lock_guard<std::mutex> lock{cacheMutex};
+            auto iter = cache.find(targetId);
+            if (iter != cache.end() && iter->second.creationTime == creationTimeValue) {
+                result = iter->second.name;
+                break;
+            }
+        }
+
+        wchar_t path[MAX_PATH]{};
+        DWORD pathSize = MAX_PATH;
+        if (!QueryFullProcessImageNameW(hProcess, 0, path, &pathSize)) {
+            result = GetNameByIdFromSnapshot(targetId);
+            break;
+        }
+
+        const std::wstring_view pathView{path, pathSize};
+        const auto separator = pathView.find_last_of(L"\\/");
+        result = std::wstring{
+            separator == std::wstring_view::npos ? pathView : pathView.substr(separator + 1)};
+
+        std::lock_guard<std::mutex> lock{cacheMutex};
+        if (cache.size() >= kMaxCacheSize) {
+            cache.clear();
+        }
+        cache.insert_or_assign(targetId, CacheEntry{creationTimeValue, result.value()});
+    } while (false);
+
+    CloseHandle(hProcess);
+    return result;
+}
+
+inline std::optional<size_t> GetWorkingSetSize()
+{
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return std::nullopt;
+    }
+    return counters.WorkingSetSize;
+}
+
 inline void AttachConsole()
 {
     if (!::AttachConsole(ATTACH_PARENT_PROCESS)) {
@@ -145,6 +224,63 @@ FindWindowsInfo(const std::wstring &className, const std::optional<std::wstring>
     return result;
 }
 
+// Finds the top-level windows of any of the classes in a single enumeration
+//
+inline std::vector<WindowsInfo> FindWindowsInfo(const std::vector<std::wstring> &classNames)
+{
+    struct Context {
+        const std::vector<std::wstring> &classNames;
+        std::vector<WindowsInfo> result;
+    } context{classNames};
+
+    EnumWindows(
+        [](HWND hwnd, LPARAM lParam) -> BOOL {
+            auto &context = *reinterpret_cast<Context *>(lParam);
+
+            wchar_t className[256]{}, titleName[256]{};
+            if (GetClassNameW(hwnd, className, 256) == 0) {
+                return TRUE;
+            }
+
+            // Class names are case-insensitive
+            //
+            const auto matched = std::any_of(
+                context.classNames.begin(), context.classNames.end(),
+                [&](const std::wstring &name) { return _wcsicmp(name.c_str(), className) == 0; });
+            if (!matched) {
+                return TRUE;
+            }
+
+            if (GetWindowTextW(hwnd, titleName, 256) == 0) {
+                if (GetLastError() != 0) {
+                    return TRUE;
+                }
+            }
+
+            WindowsInfo info;
+            info.hwnd = hwnd;
+            info.className = className;
+            info.titleName = titleName;
+
+            info.threadId = GetWindowThreadProcessId(hwnd, (DWORD *)&info.processId);
+            if (info.threadId == 0 || info.processId == 0) {
+                return TRUE;
+            }
+
+            auto optWindowProcessName = Process::GetNameById(info.processId);
+            if (!optWindowProcessName.has_value()) {
+                return TRUE;
+            }
+            info.processName = std::move(optWindowProcessName.value());
+
+            context.result.emplace_back(std::move(info));
+            return TRUE;
+        },
+        reinterpret_cast<LPARAM>(&context));
+
+    return std::move(context.result);
+}
+
 inline QRect RectToQRect(const RECT &rect)
 {
     return QRect{rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top};
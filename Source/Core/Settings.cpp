@@ -19,6 +19,9 @@
 #include "Settings.h"
 
 #include <mutex>
+#include <bitset>
+#include <utility>
+#include <optional>
 #include <QDir>
 #include <boost/pfr.hpp>
 #include <magic_enum.hpp>
@@ -30,6 +33,7 @@
 #include "LowAudioLatency.h"
 
 using namespace boost;
+using namespace std::chrono_literals;
 
 namespace Core::Settings {
 
@@ -72,14 +76,16 @@ void OnApply_low_audio_latency(const Fields &newFields)
 {
     LOG(Info, "OnApply_low_audio_latency: {}", newFields.low_audio_latency);
 
-    ApdApp->GetLowAudioLatencyController()->ControlSafely(newFields.low_audio_latency);
+    if (const auto &controller = ApdApp->GetLowAudioLatencyController()) {
+        controller->ControlSafely(newFields.low_audio_latency);
+    }
 }
 
 void OnApply_automatic_ear_detection(const Fields &newFields)
 {
     LOG(Info, "OnApply_automatic_ear_detection: {}", newFields.automatic_ear_detection);
 
-    ApdApp->GetMainWindow()->GetApdMgr().OnAutomaticEarDetectionChanged(
+    ApdApp->GetApdMgr()->OnAutomaticEarDetectionChanged(
         newFields.automatic_ear_detection);
 }
 
@@ -87,44 +93,97 @@ void OnApply_rssi_min(const Fields &newFields)
 {
     LOG(Info, "OnApply_rssi_min: {}", newFields.rssi_min);
 
-    ApdApp->GetMainWindow()->GetApdMgr().OnRssiMinChanged(newFields.rssi_min);
+    ApdApp->GetApdMgr()->OnRssiMinChanged(newFields.rssi_min);
 }
 
 void OnApply_device_address(const Fields &newFields)
 {
     LOG(Info, "OnApply_device_address: {}", LogSensitiveData(newFields.device_address));
 
-    if (newFields.device_address == 0) {
-        ApdApp->GetMainWindow()->UnbindSafely();
-    }
-    else {
-        ApdApp->GetMainWindow()->BindSafely();
+    if (const auto &mainWindow = ApdApp->GetMainWindow()) {
+        if (newFields.device_address == 0) {
+            mainWindow->UnbindSafely();
+        }
+        else {
+            mainWindow->BindSafely();
+        }
     }
 
-    ApdApp->GetMainWindow()->GetApdMgr().OnBoundDeviceAddressChanged(newFields.device_address);
+    ApdApp->GetApdMgr()->OnBoundDeviceAddressChanged(newFields.device_address);
 }
 
 void OnApply_tray_icon_battery(const Fields &newFields)
 {
     LOG(Info, "OnApply_tray_icon_battery: {}", newFields.tray_icon_battery);
 
-    ApdApp->GetTrayIcon()->OnTrayIconBatteryChangedSafely(newFields.tray_icon_battery);
+    if (const auto &trayIcon = ApdApp->GetTrayIcon()) {
+        trayIcon->OnTrayIconBatteryChangedSafely(newFields.tray_icon_battery);
+    }
 }
 
 void OnApply_battery_on_taskbar(const Fields &newFields)
 {
     LOG(Info, "OnApply_battery_on_taskbar: {}", newFields.battery_on_taskbar);
 
-    ApdApp->GetTaskbarStatus()->OnSettingsChangedSafely(newFields.battery_on_taskbar);
+    ApdApp->SetTaskbarStatusBehaviorSafely(newFields.battery_on_taskbar);
+}
+
+void OnApply_state_timeout(const Fields &newFields)
+{
+    LOG(Info, "OnApply_state_timeout: min: {}ms, max: {}ms", newFields.state_timeout_min_ms,
+        newFields.state_timeout_max_ms);
+
+    ApdApp->GetApdMgr()->OnStateTimeoutChanged(
+        std::chrono::milliseconds{newFields.state_timeout_min_ms},
+        std::chrono::milliseconds{newFields.state_timeout_max_ms});
+}
+
+void OnApply_max_state_updates_per_second(const Fields &newFields)
+{
+    LOG(Info, "OnApply_max_state_updates_per_second: {}", newFields.max_state_updates_per_second);
+
+    ApdApp->GetApdMgr()->OnStateUpdateRateChanged(
+        newFields.max_state_updates_per_second);
+}
+
+void OnApply_transition_debounce_ms(const Fields &newFields)
+{
+    LOG(Info, "OnApply_transition_debounce_ms: {}", newFields.transition_debounce_ms);
+
+    ApdApp->GetApdMgr()->OnTransitionDebounceChanged(
+        std::chrono::milliseconds{newFields.transition_debounce_ms});
 }
 
 class Manager : public Helper::Singleton<Manager>
 {
 protected:
-    Manager() = default;
+    Manager()
+    {
+        // Make sure the scheduler outlives us, the flush task is cancelled in the destructor
+        //
+        Helper::Scheduler::GetInstance();
+    }
     friend Helper::Singleton<Manager>;
 
 public:
+    ~Manager()
+    {
+        Helper::Scheduler::TaskPtr flushTask;
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            flushTask = _flushTask;
+        }
+
+        // Not cancelled with the lock held, the task may be waiting for it
+        //
+        if (flushTask != nullptr) {
+            Helper::Scheduler::GetInstance().Cancel(flushTask);
+        }
+
+        std::lock_guard<std::mutex> lock{_mutex};
+        FlushWithoutLock();
+    }
+
     LoadResult Load()
     {
         const auto &loadKey = [&](const std::string_view &keyName, auto &value,
@@ -178,6 +237,11 @@ public:
 
         std::lock_guard<std::mutex> lock{_mutex};
 
+        // Everything is written on the next flush unless it's loaded successfully
+        //
+        _isAbiVersionDirty = true;
+        _dirtyFields.set();
+
         std::decay_t<decltype(kFieldsAbiVersion)> abi_version = 0;
         if (!loadKey("abi_version", abi_version)) {
             LOG(Warn, "No abi_version key. Load default settings.");
@@ -190,10 +254,18 @@ public:
                     abi_version, kFieldsAbiVersion);
                 return LoadResult::AbiIncompatible;
             }
-
-            pfr::for_each_field(_fieldsMeta, [&](auto &field) {
-                loadKey(field.GetName(), field.GetValue(_fields), field.IsSensitive());
+            _isAbiVersionDirty = false;
+
+            // The deprecated keys stay dirty, so they are removed on the next flush
+            //
+            pfr::for_each_field(_fieldsMeta, [&](auto &field, std::size_t index) {
+                if (!field.IsDeprecated() &&
+                    loadKey(field.GetName(), field.GetValue(_fields), field.IsSensitive()))
+                {
+                    _dirtyFields.reset(index);
+                }
             });
+            ScheduleFlushWithoutLock();
             return LoadResult::Successful;
         }
     }
@@ -202,11 +274,18 @@ public:
     {
         std::lock_guard<std::mutex> lock{_mutex};
 
-        _fields = std::move(newFields);
-        SaveWithoutLock();
+        const auto oldFields = std::exchange(_fields, std::move(newFields));
+        SaveWithoutLock(oldFields);
         ApplyWithoutLock();
     }
 
+    void Flush()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        FlushWithoutLock();
+    }
+
     void Apply()
     {
         std::lock_guard<std::mutex> lock{_mutex};
@@ -232,14 +311,52 @@ public:
     }
 
 private:
+    // Bursts of changes (e.g. dragging a slider) are coalesced into one write
+    //
+    static constexpr inline auto kFlushDelay = 500ms;
+
     MetaFields _fieldsMeta;
 
     std::mutex _mutex;
     Fields _fields;
     QSettings _settings{QSettings::UserScope, Config::ProgramName, Config::ProgramName};
+    std::bitset<pfr::tuple_size_v<MetaFields>> _dirtyFields;
+    bool _isAbiVersionDirty{false};
+    Helper::Scheduler::TaskPtr _flushTask;
+    std::optional<Fields> _appliedFields;
+
+    // Only marks the fields that differ from `oldFields` as dirty, they are written on the
+    // scheduler thread later
+    //
+    void SaveWithoutLock(const Fields &oldFields)
+    {
+        pfr::for_each_field(_fieldsMeta, [&](const auto &fieldMeta, std::size_t index) {
+            if (fieldMeta.GetValue(oldFields) != fieldMeta.GetValue(_fields)) {
+                _dirtyFields.set(index);
+            }
+        });
+        ScheduleFlushWithoutLock();
+    }
+
+    void ScheduleFlushWithoutLock()
+    {
+        if ((_dirtyFields.none() && !_isAbiVersionDirty) || _flushTask != nullptr) {
+            return;
+        }
 
-    void SaveWithoutLock()
+        _flushTask = Helper::Scheduler::GetInstance().ScheduleOnce(kFlushDelay, [this] {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _flushTask.reset();
+            FlushWithoutLock();
+        });
+    }
+
+    void FlushWithoutLock()
     {
+        if (_dirtyFields.none() && !_isAbiVersionDirty) {
+            return;
+        }
+
         const auto &saveKey = [&]<class T>(
                                   const std::string_view &keyName, const T &value,
                                   bool isSensitive = false, bool isDeprecated = false) {
@@ -268,34 +385,51 @@ private:
             }
         };
 
-        saveKey("abi_version", kFieldsAbiVersion);
+        if (_isAbiVersionDirty) {
+            saveKey("abi_version", kFieldsAbiVersion);
+            _isAbiVersionDirty = false;
+        }
 
-        pfr::for_each_field(_fieldsMeta, [&](const auto &fieldMeta) {
-            saveKey(
-                fieldMeta.GetName(), fieldMeta.GetValue(_fields), fieldMeta.IsSensitive(),
-                fieldMeta.IsDeprecated());
+        pfr::for_each_field(_fieldsMeta, [&](const auto &fieldMeta, std::size_t index) {
+            if (_dirtyFields.test(index)) {
+                saveKey(
+                    fieldMeta.GetName(), fieldMeta.GetValue(_fields), fieldMeta.IsSensitive(),
+                    fieldMeta.IsDeprecated());
+            }
         });
-    }
-
-    void ApplyWithoutLock()
-    {
-        LOG(Info, "ApplyWithoutLock");
+        _dirtyFields.reset();
 
-        pfr::for_each_field(_fieldsMeta, [&](const auto &fieldMeta) {
-            fieldMeta.OnApply().Invoke(std::cref(_fields));
-        });
+        _settings.sync();
+        if (_settings.status() != QSettings::NoError) {
+            LOG(Warn, "QSettings::sync() failed. Status: {}",
+                magic_enum::enum_name(_settings.status()));
+        }
     }
 
-    void ApplyChangedFieldsOnlyWithoutLock(const Fields &oldFields)
+    // Everything is applied the first time, after that only the handlers of the fields that
+    // differ from the last applied ones are invoked. Some of them are expensive, e.g. applying
+    // `device_address` drops the connection and looks up the device again.
+    //
+    void ApplyWithoutLock()
     {
-        LOG(Info, "ApplyChangedFieldsOnlyWithoutLock");
+        if (!_appliedFields.has_value()) {
+            LOG(Info, "ApplyWithoutLock: Apply all fields");
 
-        pfr::for_each_field(_fieldsMeta, [&](const auto &fieldMeta) {
-            if (fieldMeta.GetValue(oldFields) != fieldMeta.GetValue(_fields)) {
-                LOG(Info, "Changed field: {}", fieldMeta.GetName());
+            pfr::for_each_field(_fieldsMeta, [&](const auto &fieldMeta) {
                 fieldMeta.OnApply().Invoke(std::cref(_fields));
-            }
-        });
+            });
+        }
+        else {
+            LOG(Info, "ApplyWithoutLock: Apply changed fields only");
+
+            pfr::for_each_field(_fieldsMeta, [&](const auto &fieldMeta) {
+                if (fieldMeta.GetValue(*_appliedFields) != fieldMeta.GetValue(_fields)) {
+                    LOG(Info, "Changed field: {}", fieldMeta.GetName());
+                    fieldMeta.OnApply().Invoke(std::cref(_fields));
+                }
+            });
+        }
+        _appliedFields = _fields;
     }
 
     friend class ModifiableSafeAccessor;
@@ -308,8 +442,8 @@ ModifiableSafeAccessor::ModifiableSafeAccessor(std::mutex &lock, Fields &fields)
 
 ModifiableSafeAccessor::~ModifiableSafeAccessor()
 {
-    Manager::GetInstance().SaveWithoutLock();
-    Manager::GetInstance().ApplyChangedFieldsOnlyWithoutLock(_oldFields);
+    Manager::GetInstance().SaveWithoutLock(_oldFields);
+    Manager::GetInstance().ApplyWithoutLock();
 }
 
 LoadResult Load()
@@ -327,6 +461,11 @@ void Apply()
     return Manager::GetInstance().Apply();
 }
 
+void Flush()
+{
+    return Manager::GetInstance().Flush();
+}
+
 Fields GetCurrent()
 {
     return Manager::GetInstance().GetCurrent();
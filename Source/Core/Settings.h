@@ -53,7 +53,13 @@ enum class LoadResult : uint32_t { AbiIncompatible, NoAbiField, Successful };
     callback(TrayIconBatteryBehavior, tray_icon_battery, {TrayIconBatteryBehavior::Disable},       \
         Impl::OnApply(&OnApply_tray_icon_battery))                                                 \
     callback(TaskbarStatusBehavior, battery_on_taskbar, {TaskbarStatusBehavior::Disable},          \
-        Impl::OnApply(&OnApply_battery_on_taskbar))
+        Impl::OnApply(&OnApply_battery_on_taskbar))                                                \
+    callback(uint32_t, state_timeout_min_ms, {2000}, Impl::OnApply(&OnApply_state_timeout))        \
+    callback(uint32_t, state_timeout_max_ms, {10000}, Impl::OnApply(&OnApply_state_timeout))      \
+    callback(uint32_t, max_state_updates_per_second, {4},                                          \
+        Impl::OnApply(&OnApply_max_state_updates_per_second))                                      \
+    callback(uint32_t, transition_debounce_ms, {300},                                              \
+        Impl::OnApply(&OnApply_transition_debounce_ms))
 // clang-format on
 
 struct Fields {
@@ -215,6 +221,9 @@ void OnApply_rssi_min(const Fields &newFields);
 void OnApply_device_address(const Fields &newFields);
 void OnApply_tray_icon_battery(const Fields &newFields);
 void OnApply_battery_on_taskbar(const Fields &newFields);
+void OnApply_state_timeout(const Fields &newFields);
+void OnApply_max_state_updates_per_second(const Fields &newFields);
+void OnApply_transition_debounce_ms(const Fields &newFields);
 
 struct MetaFields {
 #define DECLARE_META_FIELD(type, name, dft, ...)                                                   \
@@ -230,8 +239,12 @@ inline const auto &GetConstMetaFields()
 }
 
 LoadResult Load();
+// The changed fields are written in the background a moment later, call `Flush` to write
+// them immediately
+//
 void Save(Fields newFields);
 void Apply();
+void Flush();
 Fields GetCurrent();
 Fields GetDefault();
 
@@ -18,17 +18,28 @@
 
 #include "Update.h"
 
+#include <array>
+#include <mutex>
+#include <format>
+#include <utility>
+#include <algorithm>
 #include <optional>
+#include <unordered_map>
 
+#include <QDir>
 #include <QUrl>
+#include <QFile>
+#include <QSaveFile>
+#include <QDateTime>
 #include <QProcess>
-#include <QTemporaryDir>
+#include <QCryptographicHash>
 #include <QDesktopServices>
 
 #include <cpr/cpr.h>
 #include <nlohmann/json.hpp>
 
 #include <Config.h>
+#include "../Utils.h"
 #include "../Logger.h"
 #include "../Application.h"
 
@@ -48,11 +59,11 @@ QVersionNumber ToVersionNumber(QString str)
 
 namespace Impl {
 
-std::optional<ReleaseInfo> ParseSingleReleaseResponse(const std::string &text)
+constexpr inline auto kCacheMaxAge = 1h;
+
+std::optional<ReleaseInfo> ParseRelease(const json &root)
 {
     try {
-        const auto root = json::parse(text);
-
         auto tag = QString::fromStdString(root["tag_name"].get<std::string>());
         auto body = QString::fromStdString(root["body"].get<std::string>());
         auto url = QString::fromStdString(root["html_url"].get<std::string>());
@@ -141,6 +152,17 @@ std::optional<ReleaseInfo> ParseSingleReleaseResponse(const std::string &text)
             info.downloadUrl = std::move(downloadUrl);
             info.fileSize = fileSize;
 
+            // "sha256:<hex>", only published for the assets uploaded since GitHub added it
+            //
+            const auto digest = asset.value("digest", std::string{});
+            constexpr std::string_view kDigestPrefix = "sha256:";
+            if (digest.starts_with(kDigestPrefix)) {
+                info.sha256 = QString::fromStdString(digest.substr(kDigestPrefix.size())).toLower();
+            }
+            else {
+                LOG(Warn, "ParseSRResponse: No SHA-256 digest published for the asset.");
+            }
+
             LOG(Info, "ParseSRResponse: Found matching file.");
             break;
         }
@@ -148,89 +170,428 @@ std::optional<ReleaseInfo> ParseSingleReleaseResponse(const std::string &text)
         return info;
     }
     catch (const json::exception &ex) {
-        LOG(Warn, "ParseSRResponse: json parse failed. what: '{}', text: '{}'", ex.what(), text);
+        LOG(Warn, "ParseSRResponse: json parse failed. what: '{}', json: '{}'", ex.what(),
+            root.dump());
         return std::nullopt;
     }
 }
 
-std::optional<ReleaseInfo> ParseMultipleReleasesResponseFirst(const std::string &text)
+std::optional<ReleaseInfo> ParseSingleReleaseResponse(const std::string &text)
 {
     try {
-        auto root = json::parse(text);
-        const auto &release = root.front();
-        auto optInfo = ParseSingleReleaseResponse(release.dump());
-        if (!optInfo.has_value()) {
-            LOG(Warn, "One release info parsing failed.");
-            return std::nullopt;
-        }
-        return optInfo.value();
+        return ParseRelease(json::parse(text));
     }
-    catch (json::exception &ex) {
-        LOG(Warn, "ParseMRResponse: json parse failed. what: '{}', text: '{}'", ex.what(), text);
+    catch (const json::exception &ex) {
+        LOG(Warn, "ParseSRResponse: json parse failed. what: '{}', text: '{}'", ex.what(), text);
         return std::nullopt;
     }
 }
 
-std::optional<ReleaseInfo> FetchLatestStableRelease()
+// Builds the DOM of the first element of the top-level array only, with just the fields
+// `ParseRelease` reads, and stops the parsing as soon as the element ends. The rest of the
+// releases are neither parsed nor materialized.
+//
+class FirstReleaseSax final : public json::json_sax_t
 {
-    const cpr::Response response = cpr::Get(
-        cpr::Url{"https://api.github.com/repos/SpriteOvO/AirPodsDesktop/releases/latest"},
-        cpr::Header{{"Accept", "application/vnd.github.v3+json"}});
+public:
+    inline bool IsCompleted() const
+    {
+        return _isCompleted;
+    }
 
-    if (response.status_code != 200) {
-        LOG(Warn,
-            "FetchLatestRelease: GitHub REST API response status code isn't 200. "
-            "code: {} text: '{}'",
-            response.status_code, response.text);
+    inline json &GetResult()
+    {
+        return _result;
+    }
+
+    bool null() override
+    {
+        return Value(nullptr);
+    }
+
+    bool boolean(bool value) override
+    {
+        return Value(value);
+    }
+
+    bool number_integer(number_integer_t value) override
+    {
+        return Value(value);
+    }
+
+    bool number_unsigned(number_unsigned_t value) override
+    {
+        return Value(value);
+    }
+
+    bool number_float(number_float_t value, const string_t &) override
+    {
+        return Value(value);
+    }
+
+    bool string(string_t &value) override
+    {
+        return Value(std::move(value));
+    }
+
+    bool binary(binary_t &) override
+    {
+        return Value(nullptr);
+    }
+
+    bool start_object(std::size_t) override
+    {
+        if (!_isInTopArray) {
+            LOG(Warn, "ParseMRResponse: The top-level value isn't an array.");
+            return false;
+        }
+        return StartContainer(json::object());
+    }
+
+    bool end_object() override
+    {
+        return EndContainer();
+    }
+
+    bool start_array(std::size_t) override
+    {
+        if (!_isInTopArray) {
+            _isInTopArray = true;
+            return true;
+        }
+        return StartContainer(json::array());
+    }
+
+    bool end_array() override
+    {
+        return EndContainer();
+    }
+
+    bool key(string_t &value) override
+    {
+        if (_skipDepth != 0) {
+            return true;
+        }
+
+        // The release object, or an asset object in its "assets" array
+        //
+        constexpr std::array kReleaseKeys{"tag_name", "body", "html_url", "prerelease", "assets"};
+        constexpr std::array kAssetKeys{"name", "size", "browser_download_url", "digest"};
+
+        const auto isWanted = [&](const auto &keys) {
+            return std::find(keys.begin(), keys.end(), value) != keys.end();
+        };
+
+        _isSkippingValue = _stack.size() == 1   ? !isWanted(kReleaseKeys)
+                           : _stack.size() == 3 ? !isWanted(kAssetKeys)
+                                                : false;
+        _key = std::move(value);
+        return true;
+    }
+
+    bool parse_error(std::size_t position, const std::string &, const json::exception &ex) override
+    {
+        LOG(Warn, "ParseMRResponse: json parse failed at {}. what: '{}'", position, ex.what());
+        return false;
+    }
+
+private:
+    json _result;
+    std::vector<json *> _stack;
+    string_t _key;
+    size_t _skipDepth{0};
+    bool _isInTopArray{false}, _isSkippingValue{false}, _isCompleted{false};
+
+    json *Insert(json value)
+    {
+        auto &parent = *_stack.back();
+        if (parent.is_object()) {
+            return &(parent[_key] = std::move(value));
+        }
+        parent.push_back(std::move(value));
+        return &parent.back();
+    }
+
+    bool Value(json value)
+    {
+        if (_skipDepth != 0 || std::exchange(_isSkippingValue, false) || _stack.empty()) {
+            return true;
+        }
+        Insert(std::move(value));
+        return true;
+    }
+
+    bool StartContainer(json container)
+    {
+        if (_skipDepth != 0 || std::exchange(_isSkippingValue, false)) {
+            ++_skipDepth;
+            return true;
+        }
+
+        if (_stack.empty()) {
+            _result = std::move(container);
+            _stack.push_back(&_result);
+        }
+        else {
+            _stack.push_back(Insert(std::move(container)));
+        }
+        return true;
+    }
+
+    bool EndContainer()
+    {
+        if (_skipDepth != 0) {
+            --_skipDepth;
+            return true;
+        }
+        if (_stack.empty()) {
+            return true; // The top-level array ends, it's empty
+        }
+
+        _stack.pop_back();
+        if (_stack.empty()) {
+            // Stop parsing, the first release is all we need
+            _isCompleted = true;
+            return false;
+        }
+        return true;
+    }
+};
+
+std::optional<ReleaseInfo> ParseMultipleReleasesResponseFirst(const std::string &text)
+{
+    FirstReleaseSax sax;
+    json::sax_parse(text, &sax);
+
+    if (!sax.IsCompleted()) {
+        LOG(Warn, "ParseMRResponse: No release found. text: '{}'", text);
         return std::nullopt;
     }
 
-    return Impl::ParseSingleReleaseResponse(response.text);
+    auto optInfo = ParseRelease(sax.GetResult());
+    if (!optInfo.has_value()) {
+        LOG(Warn, "One release info parsing failed.");
+        return std::nullopt;
+    }
+    return optInfo;
 }
 
-std::optional<ReleaseInfo> FetchReleaseByVersion(const QVersionNumber &version)
+//////////////////////////////////////////////////
+// Response cache
+//
+// The parsed result of each GitHub API request is persisted together with the validators
+// (ETag and Last-Modified) of its response. The requests are conditional, a 304 response is a
+// cache hit and doesn't count against the rate limit.
+//
+
+using ParserT = std::optional<ReleaseInfo> (*)(const std::string &text);
+
+class ResponseCache
 {
-    const std::string tag = version.toString().toStdString();
-    const cpr::Response response = cpr::Get(
-        cpr::Url{"https://api.github.com/repos/SpriteOvO/AirPodsDesktop/releases/tags/" + tag},
-        cpr::Header{{"Accept", "application/vnd.github.v3+json"}});
+public:
+    struct Entry {
+        std::string etag, lastModified;
+        int64_t fetchedAt{0}; // Seconds since epoch
+        ReleaseInfo info;
+    };
+
+    constexpr static inline auto kFileName = "UpdateCache.json";
+
+    ResponseCache()
+    {
+        Load();
+    }
+
+    std::optional<Entry> Find(const std::string &url) const
+    {
+        auto iter = _entries.find(url);
+        if (iter == _entries.end()) {
+            return std::nullopt;
+        }
+        return iter->second;
+    }
+
+    void Store(const std::string &url, Entry entry)
+    {
+        _entries.insert_or_assign(url, std::move(entry));
+        Save();
+    }
+
+private:
+    std::unordered_map<std::string, Entry> _entries;
+
+    static QString GetFilePath()
+    {
+        return Utils::File::GetWorkspace().absoluteFilePath(kFileName);
+    }
+
+    void Load()
+    {
+        QFile file{GetFilePath()};
+        if (!file.open(QIODevice::ReadOnly)) {
+            return;
+        }
+
+        try {
+            const auto root = json::parse(file.readAll().toStdString());
+
+            for (const auto &[url, value] : root.items()) {
+                Entry entry;
+                entry.etag = value["etag"].get<std::string>();
+                entry.lastModified = value["last_modified"].get<std::string>();
+                entry.fetchedAt = value["fetched_at"].get<int64_t>();
+
+                const auto &info = value["info"];
+                entry.info.version = QVersionNumber::fromString(
+                    QString::fromStdString(info["version"].get<std::string>()));
+                entry.info.url = QString::fromStdString(info["url"].get<std::string>());
+                entry.info.fileName = QString::fromStdString(info["file_name"].get<std::string>());
+                entry.info.downloadUrl = info["download_url"].get<std::string>();
+                entry.info.fileSize = info["file_size"].get<size_t>();
+                entry.info.changeLog =
+                    QString::fromStdString(info["change_log"].get<std::string>());
+                entry.info.isPreRelease = info["pre_release"].get<bool>();
+                entry.info.sha256 = QString::fromStdString(info.value("sha256", std::string{}));
+
+                _entries.insert_or_assign(url, std::move(entry));
+            }
+            LOG(Info, "ResponseCache: Loaded {} entries.", _entries.size());
+        }
+        catch (const json::exception &ex) {
+            LOG(Warn, "ResponseCache: Load failed, discard it. what: '{}'", ex.what());
+            _entries.clear();
+        }
+    }
+
+    void Save() const
+    {
+        json root = json::object();
+
+        for (const auto &[url, entry] : _entries) {
+            root[url] = {
+                {"etag", entry.etag},
+                {"last_modified", entry.lastModified},
+                {"fetched_at", entry.fetchedAt},
+                {"info",
+                 {
+                     {"version", entry.info.version.toString().toStdString()},
+                     {"url", entry.info.url.toStdString()},
+                     {"file_name", entry.info.fileName.toStdString()},
+                     {"download_url", entry.info.downloadUrl},
+                     {"file_size", entry.info.fileSize},
+                     {"change_log", entry.info.changeLog.toStdString()},
+                     {"pre_release", entry.info.isPreRelease},
+                     {"sha256", entry.info.sha256.toStdString()},
+                 }},
+            };
+        }
+
+        QSaveFile file{GetFilePath()};
+        if (!file.open(QIODevice::WriteOnly)) {
+            LOG(Warn, "ResponseCache: Open file failed. error: '{}'", file.errorString());
+            return;
+        }
+        const auto text = root.dump();
+        file.write(text.data(), text.size());
+        if (!file.commit()) {
+            LOG(Warn, "ResponseCache: Commit file failed. error: '{}'", file.errorString());
+        }
+    }
+};
+
+// If `preferCache` is true, a cached result younger than `kCacheMaxAge` is returned
+// without any network I/O
+//
+std::optional<ReleaseInfo> FetchRelease(const std::string &url, ParserT parser, bool preferCache)
+{
+    static std::mutex mutex;
+    static ResponseCache cache;
+
+    std::lock_guard<std::mutex> lock{mutex};
+
+    const auto now = QDateTime::currentSecsSinceEpoch();
+    const auto optCached = cache.Find(url);
+
+    if (preferCache && optCached.has_value() &&
+        now - optCached->fetchedAt <
+            std::chrono::duration_cast<std::chrono::seconds>(kCacheMaxAge).count())
+    {
+        LOG(Info, "FetchRelease: Use the cached result. url: '{}'", url);
+        return optCached->info;
+    }
+
+    cpr::Header header{{"Accept", "application/vnd.github.v3+json"}};
+    if (optCached.has_value()) {
+        if (!optCached->etag.empty()) {
+            header.emplace("If-None-Match", optCached->etag);
+        }
+        else if (!optCached->lastModified.empty()) {
+            header.emplace("If-Modified-Since", optCached->lastModified);
+        }
+    }
+
+    const cpr::Response response = cpr::Get(cpr::Url{url}, std::move(header));
+
+    if (response.status_code == 304 && optCached.has_value()) {
+        LOG(Info, "FetchRelease: Not modified, use the cached result. url: '{}'", url);
+
+        auto entry = std::move(*optCached);
+        entry.fetchedAt = now;
+        auto info = entry.info;
+        cache.Store(url, std::move(entry));
+        return info;
+    }
 
     if (response.status_code != 200) {
         LOG(Warn,
-            "FetchReleaseByVersion: GitHub REST API response status code isn't 200. "
-            "code: {} text: '{}'",
-            response.status_code, response.text);
+            "FetchRelease: GitHub REST API response status code isn't 200. "
+            "code: {} url: '{}' text: '{}'",
+            response.status_code, url, response.text);
         return std::nullopt;
     }
 
-    return Impl::ParseSingleReleaseResponse(response.text);
+    auto optInfo = parser(response.text);
+    if (optInfo.has_value()) {
+        const auto findHeader = [&](const std::string &name) {
+            auto iter = response.header.find(name);
+            return iter != response.header.end() ? iter->second : std::string{};
+        };
+
+        cache.Store(url, {findHeader("ETag"), findHeader("Last-Modified"), now, *optInfo});
+    }
+    return optInfo;
 }
 
-std::optional<ReleaseInfo> FetchLatestRelease(bool includePreRelease)
+std::optional<ReleaseInfo> FetchLatestStableRelease(bool preferCache)
 {
-    if (includePreRelease) {
+    return FetchRelease(
+        "https://api.github.com/repos/SpriteOvO/AirPodsDesktop/releases/latest",
+        &ParseSingleReleaseResponse, preferCache);
+}
 
-        const cpr::Response response = cpr::Get(
-            cpr::Url{"https://api.github.com/repos/SpriteOvO/AirPodsDesktop/releases"},
-            cpr::Header{{"Accept", "application/vnd.github.v3+json"}});
+std::optional<ReleaseInfo> FetchReleaseByVersion(const QVersionNumber &version, bool preferCache)
+{
+    const std::string tag = version.toString().toStdString();
+    return FetchRelease(
+        "https://api.github.com/repos/SpriteOvO/AirPodsDesktop/releases/tags/" + tag,
+        &ParseSingleReleaseResponse, preferCache);
+}
 
-        if (response.status_code != 200) {
-            LOG(Warn,
-                "FetchRecentReleases: GitHub REST API response status code isn't 200. "
-                "code: {} text: '{}'",
-                response.status_code, response.text);
-            return {};
-        }
-        return Impl::ParseMultipleReleasesResponseFirst(response.text);
+std::optional<ReleaseInfo> FetchLatestRelease(bool includePreRelease, bool preferCache)
+{
+    if (includePreRelease) {
+        return FetchRelease(
+            "https://api.github.com/repos/SpriteOvO/AirPodsDesktop/releases",
+            &ParseMultipleReleasesResponseFirst, preferCache);
     }
     else {
-        return FetchLatestStableRelease();
+        return FetchLatestStableRelease(preferCache);
     }
 }
 
-bool IsCurrentPreRelease()
+bool IsCurrentPreRelease(bool preferCache)
 {
-    const auto optInfo = Impl::FetchReleaseByVersion(GetLocalVersion());
+    const auto optInfo = Impl::FetchReleaseByVersion(GetLocalVersion(), preferCache);
     if (!optInfo.has_value()) {
         LOG(Warn, "IsCurrentPreRelease: FetchReleaseByVersion() failed.");
         return false;
@@ -270,12 +631,12 @@ QVersionNumber GetLocalVersion()
 
 //////////////////////////////////////////////////
 
-std::optional<ReleaseInfo> FetchUpdateRelease()
+std::optional<ReleaseInfo> FetchUpdateRelease(bool preferCache)
 {
-    const auto isCurrentPreRelease = Impl::IsCurrentPreRelease();
+    const auto isCurrentPreRelease = Impl::IsCurrentPreRelease(preferCache);
     LOG(Info, "Update: isCurrentPreRelease: '{}'", isCurrentPreRelease);
 
-    const auto optInfo = Impl::FetchLatestRelease(isCurrentPreRelease);
+    const auto optInfo = Impl::FetchLatestRelease(isCurrentPreRelease, preferCache);
     if (!optInfo.has_value()) {
         LOG(Warn, "Update: FetchLatestRelease() returned nullopt.");
         return std::nullopt;
@@ -301,6 +662,10 @@ std::optional<ReleaseInfo> FetchUpdateRelease()
 
 //////////////////////////////////////////////////
 
+// The installer is downloaded to a partial file in the workspace, so that an interrupted
+// download is resumed with a range request next time if the asset has a digest to verify it.
+// It's hashed while being written, only the resumed part already on disk is read again.
+//
 bool DownloadInstall(const ReleaseInfo &info, const FnProgress &progressCallback)
 {
     APD_ASSERT(Impl::NeedToUpdate(info));
@@ -310,49 +675,156 @@ bool DownloadInstall(const ReleaseInfo &info, const FnProgress &progressCallback
         return false;
     }
 
-    QTemporaryDir tempPath;
-    if (!tempPath.isValid()) {
-        auto errorString = tempPath.errorString();
-        LOG(Warn, "DownloadInstall: QTemporaryDir construct failed. error: '{}'", errorString);
+    QDir directory = Utils::File::GetWorkspace();
+    if (!directory.mkpath("Update") || !directory.cd("Update")) {
+        LOG(Warn, "DownloadInstall: Create the download directory failed.");
         return false;
     }
 
-    const QString filePath = QFileInfo{tempPath.filePath(info.fileName)}.absoluteFilePath();
+    const QString filePath = directory.absoluteFilePath(info.fileName);
+    const QString partFilePath = filePath + ".part";
+
+    QFile partFile{partFilePath};
+    if (!partFile.open(QIODevice::ReadWrite)) {
+        LOG(Warn, "DownloadInstall: Open '{}' failed. error: '{}'", partFilePath,
+            partFile.errorString());
+        return false;
+    }
 
-    LOG(Info, "DownloadInstall: Ready to download to '{}'.", filePath);
+    QCryptographicHash hash{QCryptographicHash::Sha256};
 
-    // Begin download
+    // Without a digest the joined parts cannot be verified, so the file is downloaded whole
+    //
+    size_t resumeFrom = partFile.size();
+    if (resumeFrom >= info.fileSize || info.sha256.isEmpty()) {
+        resumeFrom = 0;
+    }
+    else if (resumeFrom != 0 && !hash.addData(&partFile)) {
+        LOG(Warn, "DownloadInstall: Hash the partial file failed, download again.");
+        hash.reset();
+        resumeFrom = 0;
+    }
+
+    if (!partFile.resize(resumeFrom) || !partFile.seek(resumeFrom)) {
+        LOG(Warn, "DownloadInstall: Prepare the partial file failed. error: '{}'",
+            partFile.errorString());
+        return false;
+    }
+
+    LOG(Info, "DownloadInstall: Ready to download to '{}'. Resume from {} bytes.", partFilePath,
+        resumeFrom);
+
+    cpr::Header header;
+    if (resumeFrom != 0) {
+        header.emplace("Range", std::format("bytes={}-", resumeFrom));
+    }
+
+    // Redirections produce more than one status line, only the last one matters
+    //
+    long statusCode = 0;
+    bool isWriteFailed = false;
 
-    std::ofstream outFile{filePath.toStdString(), std::ios::binary};
     auto response = cpr::Download(
-        outFile, cpr::Url{info.downloadUrl},
+        cpr::WriteCallback{[&](std::string data, intptr_t userdata) {
+            // The body of an error, e.g. the page of a proxy, is not a part of the installer
+            //
+            if (statusCode != 200 && statusCode != 206) {
+                return true;
+            }
+
+            // The server may ignore the range and send the whole file
+            //
+            if (statusCode == 200 && resumeFrom != 0) {
+                LOG(Warn, "DownloadInstall: The range request is ignored, download again.");
+                hash.reset();
+                resumeFrom = 0;
+                if (!partFile.resize(0) || !partFile.seek(0)) {
+                    isWriteFailed = true;
+                    return false;
+                }
+            }
+
+            if (partFile.write(data.data(), data.size()) != static_cast<qint64>(data.size())) {
+                isWriteFailed = true;
+                return false;
+            }
+            hash.addData(data.data(), static_cast<int>(data.size()));
+            return true;
+        }},
+        cpr::Url{info.downloadUrl}, std::move(header),
+        cpr::HeaderCallback{[&](std::string line, intptr_t userdata) {
+            if (line.starts_with("HTTP/")) {
+                const auto codePos = line.find(' ');
+                if (codePos != std::string::npos) {
+                    statusCode = std::strtol(line.c_str() + codePos + 1, nullptr, 10);
+                }
+            }
+            return true;
+        }},
         cpr::ProgressCallback{[&](cpr::cpr_off_t downloadTotal, cpr::cpr_off_t downloadNow,
                                   cpr::cpr_off_t uploadTotal, cpr::cpr_off_t uploadNow,
                                   intptr_t userdata) {
-            LOG(Trace, "Downloaded {} / {} bytes.", downloadNow, downloadTotal);
-            return progressCallback(downloadNow, downloadTotal);
+            LOG(Trace, "Downloaded {} + {} / {} bytes.", resumeFrom, downloadNow, info.fileSize);
+            return progressCallback(resumeFrom + downloadNow, info.fileSize);
         }});
 
-    if (response.status_code != 200) {
+    if (isWriteFailed) {
+        LOG(Warn, "DownloadInstall: Write the partial file failed. error: '{}'",
+            partFile.errorString());
+        return false;
+    }
+
+    if (response.status_code != 200 && response.status_code != 206) {
         LOG(Warn,
-            "DownloadInstall: Download response status code is not 200. code: {}, message: '{}'",
+            "DownloadInstall: Download response status code is not 200 or 206. code: {}, "
+            "message: '{}'",
             response.status_code, response.error.message);
+
+        // Any response other than the asset, e.g. 416 if the partial file doesn't match it
+        // anymore. Only a download that got no response at all is resumed next time.
+        //
+        if (response.status_code != 0) {
+            partFile.remove();
+        }
         return false;
     }
 
-    if (response.downloaded_bytes != info.fileSize) {
+    const auto downloadedSize = static_cast<size_t>(partFile.size());
+    partFile.close();
+
+    if (downloadedSize != info.fileSize) {
         LOG(Warn, "Download: Download file size mismatch. Downloaded: {}, expect: {}",
-            response.downloaded_bytes, info.fileSize);
+            downloadedSize, info.fileSize);
+        if (downloadedSize > info.fileSize) {
+            partFile.remove();
+        }
         return false;
     }
 
-    outFile.close();
-    tempPath.setAutoRemove(false);
+    // Reject the corrupt downloads before running anything
+    //
+    if (!info.sha256.isEmpty()) {
+        const auto actual = QString::fromLatin1(hash.result().toHex());
+        if (actual != info.sha256) {
+            LOG(Warn, "Download: SHA-256 mismatch. Downloaded: {}, expect: {}", actual,
+                info.sha256);
+            partFile.remove();
+            return false;
+        }
+        LOG(Info, "Download: SHA-256 verified.");
+    }
+
+    QFile::remove(filePath);
+    if (!partFile.rename(filePath)) {
+        LOG(Warn, "DownloadInstall: Rename the partial file failed. error: '{}'",
+            partFile.errorString());
+        return false;
+    }
 
     // Download succeeded
     //
     LOG(Info, "Download: Downloaded succeeded. filePath: '{}', size: {}", filePath,
-        response.downloaded_bytes);
+        downloadedSize);
 
     if (!QProcess::startDetached(filePath)) {
         LOG(Warn, "DownloadInstall: Start installer failed.");
@@ -377,14 +849,23 @@ AsyncChecker::~AsyncChecker()
 
 void AsyncChecker::Start()
 {
+    // The timers share one thread, so the network requests are not performed on it
+    //
     // clang-format off
-    _timer.Start(kInterval, [this] { Checker(); }, true);
+    _timer.Start(kInterval, [this] {
+        if (!_checking.valid() || Helper::IsFutureReady(_checking)) {
+            _checking = std::async(std::launch::async, [this] { Checker(); });
+        }
+    }, true);
     // clang-format on
 }
 
 void AsyncChecker::Stop()
 {
     _timer.Stop();
+    if (_checking.valid()) {
+        _checking.wait();
+    }
 }
 
 void AsyncChecker::Checker()
@@ -392,7 +873,10 @@ void AsyncChecker::Checker()
     LOG(Info, "Checking update...");
 
     do {
-        const auto optReleaseInfo = Core::Update::FetchUpdateRelease();
+        // The app is usually launched at login, so the check at startup is answered from the
+        // cache if it's recent enough
+        //
+        const auto optReleaseInfo = Core::Update::FetchUpdateRelease(_isFirst);
         if (!optReleaseInfo.has_value()) {
             break;
         }
@@ -41,6 +41,7 @@ struct ReleaseInfo {
     QString fileName;
     std::string downloadUrl;
     size_t fileSize{0};
+    QString sha256; // Lower case hex, empty if the release doesn't publish it
     QString changeLog;
     bool isPreRelease{false};
 };
@@ -49,7 +50,9 @@ QVersionNumber ToVersionNumber(QString str);
 
 QVersionNumber GetLocalVersion();
 
-std::optional<ReleaseInfo> FetchUpdateRelease();
+// The responses are cached on disk, see `Impl::FetchRelease`
+//
+std::optional<ReleaseInfo> FetchUpdateRelease(bool preferCache = false);
 bool DownloadInstall(const ReleaseInfo &info, const FnProgress &progressCallback);
 
 class AsyncChecker
@@ -69,6 +72,7 @@ private:
 
     FnCallback _callback;
     Helper::Timer _timer;
+    std::future<void> _checking;
     bool _isFirst = true;
 
     void Checker();
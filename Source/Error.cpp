@@ -29,6 +29,7 @@
 
 #include <Config.h>
 #include "Utils.h"
+#include "Logger.h"
 
 constexpr auto kStackTraceFileName = "StackTrace.log";
 
@@ -59,6 +60,7 @@ void Initialize()
 [[noreturn]] void FatalError(const std::string &content, bool report)
 {
     Error::Impl::WriteStackTraceFile();
+    Logger::Shutdown();
 
 #if !defined APD_OS_WIN
     #error "Need to port."
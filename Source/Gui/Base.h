@@ -18,6 +18,9 @@
 
 #pragma once
 
+#include <chrono>
+#include <optional>
+
 #include <QString>
 
 namespace Gui {
@@ -42,4 +45,20 @@ inline QString DisplayableStatus(const Gui::Status &value)
     }
 }
 
+// The predicted time left of a battery, empty if there is no prediction
+//
+inline QString DisplayableRemaining(const std::optional<std::chrono::minutes> &remaining)
+{
+    if (!remaining.has_value()) {
+        return {};
+    }
+
+    const auto hours = std::chrono::duration_cast<std::chrono::hours>(remaining.value());
+    const auto minutes = remaining.value() - hours;
+
+    return hours.count() > 0
+               ? QObject::tr("%1h %2min left").arg(hours.count()).arg(minutes.count())
+               : QObject::tr("%1min left").arg(minutes.count());
+}
+
 } // namespace Gui
@@ -21,12 +21,17 @@
 #include <QScreen>
 #include <QPainter>
 #include <QMessageBox>
+#include <QDir>
+#include <QFileInfo>
+#include <QResource>
 
 #include <Config.h>
 #include "../Helper.h"
 #include "../Error.h"
 #include "../Application.h"
 #include "../Core/AppleCP.h"
+#include "../Core/Latency.h"
+#include "../Core/BatteryHistory.h"
 #include "SelectWindow.h"
 
 using namespace std::chrono_literals;
@@ -137,12 +142,19 @@ public:
 
 Q_SIGNALS:
     void Clicked();
+    void Painted();
 
 private:
     void mouseReleaseEvent(QMouseEvent *event) override
     {
         Q_EMIT Clicked();
     }
+
+    void paintEvent(QPaintEvent *event) override
+    {
+        QVideoWidget::paintEvent(event);
+        Q_EMIT Painted();
+    }
 };
 
 //////////////////////////////////////////////////
@@ -193,6 +205,9 @@ NewVersionAction NewVersionMessageBox(
 MainWindow::MainWindow(QWidget *parent) : QDialog{parent}
 {
     qRegisterMetaType<Core::AirPods::State>("Core::AirPods::State");
+    qRegisterMetaType<Core::AirPods::StateFields>("Core::AirPods::StateFields");
+    qRegisterMetaType<std::optional<Core::AirPods::Model>>(
+        "std::optional<Core::AirPods::Model>");
     qRegisterMetaType<Core::Update::ReleaseInfo>("Core::Update::ReleaseInfo");
 
     _videoWidget = new VideoWidget{this};
@@ -213,8 +228,11 @@ MainWindow::MainWindow(QWidget *parent) : QDialog{parent}
     connect(_ui.pushButton, &QPushButton::clicked, this, &MainWindow::OnButtonClicked);
     connect(&_posAnimation, &QPropertyAnimation::finished, this, &MainWindow::OnPosMoveFinished);
     connect(_videoWidget, &VideoWidget::Clicked, this, &MainWindow::OnAnimationClicked);
+    connect(_videoWidget, &VideoWidget::Painted, this, &MainWindow::OnAnimationPainted);
     connect(_closeButton, &CloseButton::Clicked, this, &MainWindow::DoHide);
     connect(_mediaPlayer, &QMediaPlayer::stateChanged, this, &MainWindow::OnPlayerStateChanged);
+    connect(
+        _mediaPlayer, &QMediaPlayer::mediaStatusChanged, this, &MainWindow::OnMediaStatusChanged);
 
     connect(this, &MainWindow::UpdateStateSafely, this, &MainWindow::UpdateState);
     connect(this, &MainWindow::AvailableSafely, this, &MainWindow::Available);
@@ -224,11 +242,15 @@ MainWindow::MainWindow(QWidget *parent) : QDialog{parent}
     connect(this, &MainWindow::UnbindSafely, this, &MainWindow::Unbind);
     connect(this, &MainWindow::ShowSafely, this, &MainWindow::show);
     connect(this, &MainWindow::HideSafely, this, &MainWindow::DoHide);
+    connect(this, &MainWindow::PreloadAnimationSafely, this, &MainWindow::PreloadAnimation);
     connect(
         this, &MainWindow::VersionUpdateAvailableSafely, this, &MainWindow::VersionUpdateAvailable);
 
     _posAnimation.setDuration(500);
     _autoHideTimer->callOnTimeout([this] { DoHide(); });
+    _releaseAnimationTimer->setSingleShot(true);
+    _releaseAnimationTimer->setInterval(kReleaseAnimationDelay);
+    _releaseAnimationTimer->callOnTimeout([this] { ReleaseAnimation(); });
     _mediaPlayer->setMuted(true);
     _mediaPlayer->setVideoOutput(_videoWidget);
 
@@ -246,15 +268,62 @@ MainWindow::MainWindow(QWidget *parent) : QDialog{parent}
     _updateChecker.Start();
 }
 
-void MainWindow::UpdateState(const Core::AirPods::State &state)
+void MainWindow::UpdateState(
+    const Core::AirPods::State &state, Core::AirPods::StateFields changedFields)
 {
-    LOG(Info, "MainWindow::UpdateState");
+    Core::Latency::Complete(Core::Latency::Stage::GuiDispatch);
+
+    LOG(Info, "MainWindow::UpdateState. Changed fields: {:#x}", changedFields.toInt());
+
+    // Everything is redrawn when coming from another status
+    //
+    if (_status != Status::Updating || !_cachedState.has_value()) {
+        changedFields = Core::AirPods::StateField::All;
+    }
 
     _status = Status::Updating;
     _cachedState = state;
-    Repaint();
-    ApdApp->GetTrayIcon()->UpdateState(state);
-    ApdApp->GetTaskbarStatus()->UpdateState(state);
+    Repaint(changedFields);
+    ApdApp->GetTrayIcon()->UpdateState(state, changedFields);
+    if (const auto &taskbarStatus = ApdApp->GetTaskbarStatus()) {
+        taskbarStatus->UpdateState(state, changedFields);
+    }
+}
+
+void MainWindow::OnStateUpdated(
+    const Core::AirPods::State &state, Core::AirPods::StateFields changedFields)
+{
+    UpdateStateSafely(state, changedFields);
+}
+
+void MainWindow::OnDisconnected()
+{
+    DisconnectSafely();
+}
+
+void MainWindow::OnAvailable()
+{
+    AvailableSafely();
+}
+
+void MainWindow::OnUnavailable()
+{
+    UnavailableSafely();
+}
+
+void MainWindow::OnBoundModelChanged(std::optional<Core::AirPods::Model> model)
+{
+    PreloadAnimationSafely(model);
+}
+
+void MainWindow::OnLidOpened(bool opened)
+{
+    if (opened) {
+        ShowSafely();
+    }
+    else {
+        HideSafely();
+    }
 }
 
 void MainWindow::Available()
@@ -276,7 +345,9 @@ void MainWindow::Unavailable()
     _cachedState.reset();
     Repaint();
     ApdApp->GetTrayIcon()->Unavailable();
-    ApdApp->GetTaskbarStatus()->Unavailable();
+    if (const auto &taskbarStatus = ApdApp->GetTaskbarStatus()) {
+        taskbarStatus->Unavailable();
+    }
 }
 
 void MainWindow::Disconnect()
@@ -290,7 +361,9 @@ void MainWindow::Disconnect()
     _cachedState.reset();
     Repaint();
     ApdApp->GetTrayIcon()->Disconnect();
-    ApdApp->GetTaskbarStatus()->Disconnect();
+    if (const auto &taskbarStatus = ApdApp->GetTaskbarStatus()) {
+        taskbarStatus->Disconnect();
+    }
 }
 
 void MainWindow::Bind()
@@ -311,6 +384,19 @@ void MainWindow::Unbind()
     ApdApp->GetTrayIcon()->Unbind();
 }
 
+void MainWindow::SyncTaskbarStatus(TaskbarStatus &taskbarStatus) const
+{
+    if (_status == Status::Updating && _cachedState.has_value()) {
+        taskbarStatus.UpdateState(_cachedState.value(), Core::AirPods::StateField::All);
+    }
+    else if (_status == Status::Unavailable) {
+        taskbarStatus.Unavailable();
+    }
+    else {
+        taskbarStatus.Disconnect();
+    }
+}
+
 void MainWindow::AskUserUpdate(const Core::Update::ReleaseInfo &releaseInfo)
 {
     auto releaseVersion = releaseInfo.version.toString();
@@ -387,81 +473,146 @@ void MainWindow::ChangeButtonAction(ButtonAction action)
     _ui.pushButton->show();
 }
 
+void MainWindow::PreloadAnimation(std::optional<Core::AirPods::Model> model)
+{
+    LOG(Info, "Preload animation: '{}'",
+        model.has_value() ? Helper::ToString(model.value()) : QString{"none"});
+
+    _preloadModel = model;
+
+    // Only the animation not in use is replaced
+    //
+    if (!_cacheModel.has_value()) {
+        LoadAnimation(_preloadModel);
+        PrerollAnimation();
+    }
+}
+
 void MainWindow::SetAnimation(std::optional<Core::AirPods::Model> model)
 {
     if (model == _cacheModel) {
         return;
     }
+    _cacheModel = model;
 
     if (!model.has_value()) {
+        // Keep the preloaded animation ready for the next state
+        //
         StopAnimation();
-        _mediaPlayer->setMedia(QMediaContent{});
+        LoadAnimation(_preloadModel);
+        PrerollAnimation();
+        return;
+    }
+
+    LoadAnimation(model);
+    if (_isVisible) {
+        PlayAnimation();
     }
     else {
-        QString media;
-
-        // It's not possible to set video padding background color or get video resolution just
-        // through Qt, so we hardcode it here
-        QSize videoSize{};
-
-        switch (model.value()) {
-        case Core::AirPods::Model::AirPods_1:
-            media = "qrc:/Resource/Video/AirPods_1.avi";
-            videoSize = QSize{800, 400};
-            break;
-        case Core::AirPods::Model::AirPods_2:
-            media = "qrc:/Resource/Video/AirPods_2.avi";
-            videoSize = QSize{800, 400};
-            break;
-        case Core::AirPods::Model::AirPods_3:
-            media = "qrc:/Resource/Video/AirPods_3.avi";
-            videoSize = QSize{900, 450};
-            break;
-        case Core::AirPods::Model::AirPods_Pro:
-            media = "qrc:/Resource/Video/AirPods_Pro.avi";
-            videoSize = QSize{900, 450};
-            break;
-        case Core::AirPods::Model::AirPods_Pro_2:
-        case Core::AirPods::Model::AirPods_Pro_2_USB_C:
-            media = "qrc:/Resource/Video/AirPods_Pro_2.avi";
-            videoSize = QSize{900, 450};
-            break;
-        case Core::AirPods::Model::AirPods_Max:
-            media = "qrc:/Resource/Video/AirPods_Max.avi";
-            videoSize = QSize{600, 650};
-            break;
-        case Core::AirPods::Model::Beats_Fit_Pro:
-            media = "qrc:/Resource/Video/Beats_Fit_Pro.avi";
-            videoSize = QSize{900, 450};
-            break;
-        case Core::AirPods::Model::Powerbeats_3:
-        case Core::AirPods::Model::Beats_X:
-        case Core::AirPods::Model::Beats_Solo3:
-        default:
-            media = "qrc:/Resource/Video/AirPods_1.avi";
-            videoSize = QSize{800, 400};
-            break;
-        }
+        PrerollAnimation();
+    }
+}
+
+void MainWindow::LoadAnimation(std::optional<Core::AirPods::Model> model)
+{
+    if (model == _loadedModel) {
+        return;
+    }
+    _loadedModel = model;
+    _isAnimationReady = false;
+
+    // The player must let go of the old clip before its package is unmapped
+    //
+    _mediaPlayer->stop();
+    _mediaPlayer->setMedia(QMediaContent{});
+    UnmapAnimation();
+
+    if (!model.has_value()) {
+        return;
+    }
 
-        auto aspectRatio = (float)videoSize.width() / (float)videoSize.height();
-        auto widgetWidth = _videoWidget->height() * aspectRatio;
-        _videoWidget->setFixedWidth(widgetWidth);
+    const auto &info = Core::AirPods::GetModelInfo(model.value());
 
-        _mediaPlayer->setMedia(QUrl{media});
+    const auto media = QString::fromUtf8(info.animation.data(), (int)info.animation.size());
+    MapAnimation(media);
 
-        PlayAnimation();
+    if (!_isVisible) {
+        _releaseAnimationTimer->start();
     }
+    const QSize videoSize{info.animationWidth, info.animationHeight};
 
-    _cacheModel = model;
+    auto aspectRatio = (float)videoSize.width() / (float)videoSize.height();
+    auto widgetWidth = _videoWidget->height() * aspectRatio;
+    _videoWidget->setFixedWidth(widgetWidth);
+
+    _mediaPlayer->setMedia(QUrl{media});
+}
+
+// Each clip is packaged as its own binary resource next to the executable, Qt maps the file when
+// it's registered, so only the clip in use takes up memory
+//
+void MainWindow::MapAnimation(const QString &media)
+{
+    const auto name = QFileInfo{QUrl{media}.path()}.completeBaseName();
+    const auto package = QDir{QCoreApplication::applicationDirPath()}.absoluteFilePath(
+        QString{"Animations/%1.rcc"}.arg(name));
+
+    if (!QResource::registerResource(package)) {
+        LOG(Warn, "Register animation package '{}' failed.", package);
+        return;
+    }
+    _mappedAnimation = package;
+}
+
+void MainWindow::UnmapAnimation()
+{
+    if (_mappedAnimation.isEmpty()) {
+        return;
+    }
+
+    if (!QResource::unregisterResource(_mappedAnimation)) {
+        LOG(Warn, "Unregister animation package '{}' failed.", _mappedAnimation);
+    }
+    _mappedAnimation.clear();
+}
+
+// The models are kept, the clip is mapped again the next time the window is shown
+//
+void MainWindow::ReleaseAnimation()
+{
+    if (_isVisible || !_loadedModel.has_value()) {
+        return;
+    }
+
+    LOG(Info, "Release animation: '{}'", Helper::ToString(_loadedModel.value()));
+    LoadAnimation(std::nullopt);
 }
 
 void MainWindow::PlayAnimation()
 {
+    if (!_loadedModel.has_value()) {
+        return;
+    }
+
     _isAnimationPlaying = true;
     _mediaPlayer->play();
     _videoWidget->show();
 }
 
+// Pausing at the first frame decodes and presents it, so the widget isn't black when it's shown
+// and playing resumes without opening the media again
+//
+void MainWindow::PrerollAnimation()
+{
+    if (!_loadedModel.has_value()) {
+        return;
+    }
+
+    _isAnimationPlaying = false;
+    _mediaPlayer->pause();
+    _mediaPlayer->setPosition(0);
+}
+
 void MainWindow::StopAnimation()
 {
     // The player will go black after stopping
@@ -476,7 +627,19 @@ void MainWindow::BindDevice()
 {
     LOG(Info, "BindDevice");
 
-    const auto devices = Core::AirPods::GetDevices();
+    // Don't block the UI thread while enumerating devices
+    //
+    _ui.pushButton->setDisabled(true);
+    Core::AirPods::GetDevices([this](std::vector<Core::Bluetooth::Device> devices) {
+        Utils::Qt::Dispatch([this, devices = std::move(devices)] {
+            _ui.pushButton->setDisabled(false);
+            OnBindDevicesFetched(devices);
+        });
+    });
+}
+
+void MainWindow::OnBindDevicesFetched(const std::vector<Core::Bluetooth::Device> &devices)
+{
     if (devices.empty()) {
         QMessageBox::warning(
             this, Config::ProgramName,
@@ -545,8 +708,19 @@ void MainWindow::VersionUpdateAvailable(const Core::Update::ReleaseInfo &release
     }
 }
 
-void MainWindow::Repaint()
+void MainWindow::Repaint(Core::AirPods::StateFields fields)
 {
+    using Core::AirPods::StateField;
+
+    // Only the widgets affected by the changed fields are updated
+    //
+    if (fields != Core::AirPods::StateFields{StateField::All} && _status == Status::Updating &&
+        _cachedState.has_value())
+    {
+        RepaintState(fields);
+        return;
+    }
+
     const auto &noState = [this] {
         SetAnimation(std::nullopt);
         _leftBattery->hide();
@@ -583,38 +757,55 @@ void MainWindow::Repaint()
         return;
     }
 
-    const auto &state = _cachedState.value();
+    RepaintState(StateField::All);
+}
 
-    _ui.deviceLabel->setText(state.displayName);
+void MainWindow::RepaintState(Core::AirPods::StateFields fields)
+{
+    using Core::AirPods::StateField;
 
-    SetAnimation(state.model);
+    const auto &state = _cachedState.value();
 
-    if (!state.pods.left.battery.Available()) {
-        _leftBattery->hide();
-    }
-    else {
-        _leftBattery->setCharging(state.pods.left.isCharging);
-        _leftBattery->setValue(state.pods.left.battery.Value());
-        _leftBattery->show();
+    if (fields.testFlag(StateField::DisplayName)) {
+        _ui.deviceLabel->setText(state.displayName);
     }
 
-    if (!state.pods.right.battery.Available()) {
-        _rightBattery->hide();
-    }
-    else {
-        _rightBattery->setCharging(state.pods.right.isCharging);
-        _rightBattery->setValue(state.pods.right.battery.Value());
-        _rightBattery->show();
+    if (fields.testFlag(StateField::Model)) {
+        SetAnimation(state.model);
     }
 
-    if (!state.caseBox.battery.Available()) {
-        _caseBattery->hide();
-    }
-    else {
-        _caseBattery->setCharging(state.caseBox.isCharging);
-        _caseBattery->setValue(state.caseBox.battery.Value());
-        _caseBattery->show();
-    }
+    using Core::BatteryHistory::Component;
+
+    const auto repaintBattery = [&](Widget::Battery *widget,
+                                    const Core::AirPods::Details::BasicState &basicState,
+                                    Core::AirPods::StateFields mask, Component component) {
+        if (!(fields & mask)) {
+            return;
+        }
+
+        if (!basicState.battery.Available()) {
+            widget->hide();
+        }
+        else {
+            widget->setCharging(basicState.isCharging);
+            widget->setValue(basicState.battery.Value());
+            widget->setToolTip(
+                basicState.isCharging
+                    ? QString{}
+                    : DisplayableRemaining(Core::BatteryHistory::PredictRemaining(component)));
+            widget->show();
+        }
+    };
+
+    repaintBattery(
+        _leftBattery, state.pods.left, StateField::LeftBattery | StateField::LeftCharging,
+        Component::Left);
+    repaintBattery(
+        _rightBattery, state.pods.right, StateField::RightBattery | StateField::RightCharging,
+        Component::Right);
+    repaintBattery(
+        _caseBattery, state.caseBox, StateField::CaseBattery | StateField::CaseCharging,
+        Component::Case);
 }
 
 void MainWindow::OnAppStateChanged(Qt::ApplicationState state)
@@ -627,7 +818,8 @@ void MainWindow::OnPosMoveFinished()
 {
     if (!_isVisible) {
         hide();
-        StopAnimation();
+        PrerollAnimation();
+        _releaseAnimationTimer->start();
     }
 }
 
@@ -670,6 +862,34 @@ void MainWindow::OnPlayerStateChanged(QMediaPlayer::State newState)
     }
 }
 
+void MainWindow::OnMediaStatusChanged(QMediaPlayer::MediaStatus status)
+{
+    if (status != QMediaPlayer::BufferedMedia || _isAnimationReady) {
+        return;
+    }
+    _isAnimationReady = true;
+
+    // The frame is presented by the repaint that follows
+    //
+    if (_isWaitingFirstFrame) {
+        _videoWidget->update();
+    }
+}
+
+// The first paint of the widget with the media ready after the window is shown is when the first
+// frame is presented
+//
+void MainWindow::OnAnimationPainted()
+{
+    if (!_isWaitingFirstFrame || !_isAnimationReady) {
+        return;
+    }
+    _isWaitingFirstFrame = false;
+
+    LOG(Info, "Animation first frame latency: {}ms ({})", _firstFrameTimer.elapsed(),
+        _isFirstFramePreloaded ? "preloaded" : "not preloaded");
+}
+
 void MainWindow::DoHide()
 {
     LOG(Trace, "MainWindow: Hide");
@@ -699,6 +919,17 @@ void MainWindow::showEvent(QShowEvent *event)
     }
     _isVisible = true;
 
+    Core::Latency::Complete(Core::Latency::Stage::WindowShown);
+
+    _releaseAnimationTimer->stop();
+    if (!_loadedModel.has_value()) {
+        LoadAnimation(_cacheModel.has_value() ? _cacheModel : _preloadModel);
+    }
+
+    _firstFrameTimer.start();
+    _isFirstFramePreloaded = _isAnimationReady;
+    _isWaitingFirstFrame = _loadedModel.has_value();
+
     PlayAnimation();
     ControlAutoHideTimer(true);
 
@@ -24,6 +24,7 @@
 
 #include <QVideoWidget>
 #include <QMediaPlayer>
+#include <QElapsedTimer>
 #include <QPropertyAnimation>
 
 #include "../Utils.h"
@@ -36,6 +37,7 @@ namespace Gui {
 
 class CloseButton;
 class VideoWidget;
+class TaskbarStatus;
 class BatteryInfo;
 
 enum class ButtonAction : uint32_t {
@@ -43,19 +45,14 @@ enum class ButtonAction : uint32_t {
     Bind,
 };
 
-class MainWindow : public QDialog
+class MainWindow : public QDialog, public Core::AirPods::Observer
 {
     Q_OBJECT
 
 public:
     MainWindow(QWidget *parent = nullptr);
 
-    inline auto &GetApdMgr()
-    {
-        return _apdMgr;
-    }
-
-    void UpdateState(const Core::AirPods::State &state);
+    void UpdateState(const Core::AirPods::State &state, Core::AirPods::StateFields changedFields);
     void Available();
     void Unavailable();
     void Disconnect();
@@ -63,8 +60,23 @@ public:
     void Unbind();
     void AskUserUpdate(const Core::Update::ReleaseInfo &releaseInfo);
 
+    // Brings a `TaskbarStatus` constructed later up to date
+    //
+    void SyncTaskbarStatus(TaskbarStatus &taskbarStatus) const;
+
+    // Core::AirPods::Observer
+    //
+    void OnStateUpdated(
+        const Core::AirPods::State &state, Core::AirPods::StateFields changedFields) override;
+    void OnDisconnected() override;
+    void OnAvailable() override;
+    void OnUnavailable() override;
+    void OnBoundModelChanged(std::optional<Core::AirPods::Model> model) override;
+    void OnLidOpened(bool opened) override;
+
 Q_SIGNALS:
-    void UpdateStateSafely(const Core::AirPods::State &state);
+    void UpdateStateSafely(
+        const Core::AirPods::State &state, Core::AirPods::StateFields changedFields);
     void AvailableSafely();
     void UnavailableSafely();
     void DisconnectSafely();
@@ -72,10 +84,12 @@ Q_SIGNALS:
     void UnbindSafely();
     void ShowSafely();
     void HideSafely();
+    void PreloadAnimationSafely(std::optional<Core::AirPods::Model> model);
     bool VersionUpdateAvailableSafely(const Core::Update::ReleaseInfo &releaseInfo, bool silent);
 
 private:
     constexpr static QSize _screenMargin{50, 100};
+    constexpr static auto kReleaseAnimationDelay = std::chrono::minutes{10};
 
     Ui::MainWindow _ui;
 
@@ -83,12 +97,12 @@ private:
     VideoWidget *_videoWidget;
     QMediaPlayer *_mediaPlayer = new QMediaPlayer{this};
     QTimer *_autoHideTimer = new QTimer{this};
+    QTimer *_releaseAnimationTimer = new QTimer{this};
     CloseButton *_closeButton;
     Widget::Battery *_leftBattery = new Widget::Battery{this};
     Widget::Battery *_rightBattery = new Widget::Battery{this};
     Widget::Battery *_caseBattery = new Widget::Battery{this};
 
-    Core::AirPods::Manager _apdMgr;
     Core::Update::AsyncChecker _updateChecker{[this](auto &&...args) {
         VersionUpdateAvailableSafely(std::forward<decltype(args)>(args)...);
     }};
@@ -99,20 +113,39 @@ private:
     bool _isVisible{false};
     bool _isAnimationPlaying{false};
 
+    // The animation of the bound device is loaded and paused at its first frame in advance, so
+    // that showing the window doesn't wait for the media to be opened and decoded
+    //
+    std::optional<Core::AirPods::Model> _preloadModel, _loadedModel;
+    bool _isAnimationReady{false}, _isWaitingFirstFrame{false}, _isFirstFramePreloaded{false};
+    QElapsedTimer _firstFrameTimer;
+    // The animation package currently registered
+    QString _mappedAnimation;
+
     void ChangeButtonAction(ButtonAction action);
+    void PreloadAnimation(std::optional<Core::AirPods::Model> model);
     void SetAnimation(std::optional<Core::AirPods::Model> model);
+    void LoadAnimation(std::optional<Core::AirPods::Model> model);
+    void MapAnimation(const QString &media);
+    void UnmapAnimation();
+    void ReleaseAnimation();
     void PlayAnimation();
+    void PrerollAnimation();
     void StopAnimation();
     void BindDevice();
+    void OnBindDevicesFetched(const std::vector<Core::Bluetooth::Device> &devices);
     void ControlAutoHideTimer(bool start);
     void VersionUpdateAvailable(const Core::Update::ReleaseInfo &releaseInfo, bool silent);
-    void Repaint();
+    void Repaint(Core::AirPods::StateFields fields = Core::AirPods::StateField::All);
+    void RepaintState(Core::AirPods::StateFields fields);
 
     void OnAppStateChanged(Qt::ApplicationState state);
     void OnPosMoveFinished();
     void OnAnimationClicked();
+    void OnAnimationPainted();
     void OnButtonClicked();
     void OnPlayerStateChanged(QMediaPlayer::State newState);
+    void OnMediaStatusChanged(QMediaPlayer::MediaStatus status);
 
     void DoHide();
     void showEvent(QShowEvent *event) override;
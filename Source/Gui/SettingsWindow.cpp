@@ -29,6 +29,8 @@
 
 #include "../Application.h"
 #include "../Core/Debug.h"
+#include "../Core/Latency.h"
+#include "../Core/Metrics.h"
 
 using namespace std::chrono_literals;
 
@@ -80,6 +82,24 @@ SettingsWindow::SettingsWindow(QWidget *parent) : QDialog{parent}
     connect(
         _ui.teAdvOverride, &QTextEdit::textChanged, this,
         &SettingsWindow::On_teAdvOverride_textChanged);
+
+    connect(
+        _ui.pbLatencyRefresh, &QPushButton::clicked, this,
+        &SettingsWindow::On_pbLatencyRefresh_clicked);
+    connect(
+        _ui.pbLatencyDump, &QPushButton::clicked, this, &SettingsWindow::On_pbLatencyDump_clicked);
+    connect(
+        _ui.pbLatencyReset, &QPushButton::clicked, this,
+        &SettingsWindow::On_pbLatencyReset_clicked);
+
+    connect(
+        _ui.pbMetricsRefresh, &QPushButton::clicked, this,
+        &SettingsWindow::On_pbMetricsRefresh_clicked);
+    connect(
+        _ui.pbMetricsDump, &QPushButton::clicked, this, &SettingsWindow::On_pbMetricsDump_clicked);
+    connect(
+        _ui.pbMetricsReset, &QPushButton::clicked, this,
+        &SettingsWindow::On_pbMetricsReset_clicked);
 #endif
 
     InitCreditsText();
@@ -421,6 +441,38 @@ void SettingsWindow::On_teAdvOverride_textChanged()
     UpdateAdvOverride();
 }
 
+void SettingsWindow::On_pbLatencyRefresh_clicked()
+{
+    _ui.teLatency->setPlainText(QString::fromStdString(Core::Latency::Dump()));
+}
+
+void SettingsWindow::On_pbLatencyDump_clicked()
+{
+    Core::Latency::DumpToLog();
+}
+
+void SettingsWindow::On_pbLatencyReset_clicked()
+{
+    Core::Latency::Reset();
+    On_pbLatencyRefresh_clicked();
+}
+
+void SettingsWindow::On_pbMetricsRefresh_clicked()
+{
+    _ui.teMetrics->setPlainText(QString::fromStdString(Core::Metrics::Dump()));
+}
+
+void SettingsWindow::On_pbMetricsDump_clicked()
+{
+    Core::Metrics::DumpToLog();
+}
+
+void SettingsWindow::On_pbMetricsReset_clicked()
+{
+    Core::Metrics::Reset();
+    On_pbMetricsRefresh_clicked();
+}
+
 } // namespace Gui
 
 #include "SettingsWindow.moc"
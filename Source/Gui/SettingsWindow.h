@@ -76,6 +76,12 @@ private:
     // Debug
     void On_cbAdvOverride_toggled(bool checked);
     void On_teAdvOverride_textChanged();
+    void On_pbLatencyRefresh_clicked();
+    void On_pbLatencyDump_clicked();
+    void On_pbLatencyReset_clicked();
+    void On_pbMetricsRefresh_clicked();
+    void On_pbMetricsDump_clicked();
+    void On_pbMetricsReset_clicked();
 
     UTILS_QT_DISABLE_ESC_QUIT(QDialog);
     UTILS_QT_REGISTER_LANGUAGECHANGE(QDialog, [this] {
@@ -24,6 +24,7 @@
 
 #include "../Core/OS/Windows.h"
 #include "../Application.h"
+#include "../Profiler.h"
 
 //
 // Windows 10
@@ -54,27 +55,41 @@
 // * All these windows are the same height.
 //
 
-std::optional<TaskBarInfo> GetTaskBarInfo()
+std::optional<TaskBarInfo> GetTaskBarInfo(const TaskBarInfo *cached)
 {
     std::optional<TaskBarInfo> result;
 
     do {
-        HWND hShellTrayWnd = FindWindowW(L"Shell_TrayWnd", nullptr);
-        if (hShellTrayWnd == nullptr) {
-            LOG(Warn, "Find window 'Shell_TrayWnd' failed.");
-            break;
+        HWND hShellTrayWnd, hReBarWindow32, hMSTaskSwWClass;
+
+        // The handles stay valid until the taskbar is recreated, so they are only looked up
+        // again after that
+        //
+        if (cached != nullptr && IsWindow(cached->hShellTrayWnd) &&
+            IsWindow(cached->hReBarWindow32) && IsWindow(cached->hMSTaskSwWClass))
+        {
+            hShellTrayWnd = cached->hShellTrayWnd;
+            hReBarWindow32 = cached->hReBarWindow32;
+            hMSTaskSwWClass = cached->hMSTaskSwWClass;
         }
+        else {
+            hShellTrayWnd = FindWindowW(L"Shell_TrayWnd", nullptr);
+            if (hShellTrayWnd == nullptr) {
+                LOG(Warn, "Find window 'Shell_TrayWnd' failed.");
+                break;
+            }
 
-        HWND hReBarWindow32 = FindWindowExW(hShellTrayWnd, nullptr, L"ReBarWindow32", nullptr);
-        if (hReBarWindow32 == nullptr) {
-            LOG(Warn, "Find window 'ReBarWindow32' failed.");
-            break;
-        }
+            hReBarWindow32 = FindWindowExW(hShellTrayWnd, nullptr, L"ReBarWindow32", nullptr);
+            if (hReBarWindow32 == nullptr) {
+                LOG(Warn, "Find window 'ReBarWindow32' failed.");
+                break;
+            }
 
-        HWND hMSTaskSwWClass = FindWindowExW(hReBarWindow32, nullptr, L"MSTaskSwWClass", nullptr);
-        if (hMSTaskSwWClass == nullptr) {
-            LOG(Warn, "Find window 'MSTaskSwWClass' failed.");
-            break;
+            hMSTaskSwWClass = FindWindowExW(hReBarWindow32, nullptr, L"MSTaskSwWClass", nullptr);
+            if (hMSTaskSwWClass == nullptr) {
+                LOG(Warn, "Find window 'MSTaskSwWClass' failed.");
+                break;
+            }
         }
 
         RECT rectShellTrayWnd{}, rectReBarWindow32{}, rectMSTaskSwWClass{},
@@ -135,6 +150,11 @@ TaskbarStatus::TaskbarStatus(QWidget *parent) : QDialog{parent}
     connect(this, &TaskbarStatus::OnSettingsChangedSafely, this, &TaskbarStatus::OnSettingsChanged);
 
     _updateTimer.callOnTimeout([this] { OnUpdateTimer(); });
+    _eventTimer.setSingleShot(true);
+    _eventTimer.callOnTimeout([this] { OnUpdateTimer(); });
+
+    _taskbarCreatedMessage = RegisterWindowMessageW(L"TaskbarCreated");
+    qApp->installNativeEventFilter(this);
 
     //
     // `Qt::FramelessWindowHint` will cause a qt internal error:
@@ -174,15 +194,21 @@ TaskbarStatus::TaskbarStatus(QWidget *parent) : QDialog{parent}
 
 TaskbarStatus::~TaskbarStatus()
 {
+    qApp->removeNativeEventFilter(this);
+
     _isStateReady = false;
     UpdateVisible();
+    UninstallHook();
 }
 
-void TaskbarStatus::UpdateState(const Core::AirPods::State &state)
+void TaskbarStatus::UpdateState(
+    const Core::AirPods::State &state, Core::AirPods::StateFields changedFields)
 {
+    const bool isUpdated = _status == Status::Updating && _airPodsState.has_value();
+
     _status = Status::Updating;
     _airPodsState = state;
-    Repaint();
+    Repaint(isUpdated ? changedFields : Core::AirPods::StateField::All);
 }
 
 void TaskbarStatus::UpdateVisible()
@@ -205,7 +231,7 @@ void TaskbarStatus::UpdateVisible()
 
 bool TaskbarStatus::Enable()
 {
-    const auto optInfo = GetTaskBarInfo();
+    const auto optInfo = QueryTaskBarInfo();
     if (!optInfo.has_value()) {
         LOG(Error, "Try to enable, but failed to `GetTaskBarInfo()`");
         return false;
@@ -217,14 +243,18 @@ bool TaskbarStatus::Enable()
     setAttribute(Qt::WA_TranslucentBackground);
     UpdatePos(info, true);
     _isFirstTimeout = true;
-    _updateTimer.start(kUpdateInterval);
+    _eventTimer.start(kEventDelay);
+    if (!InstallHook(info)) {
+        LOG(Warn, "Failed to hook the taskbar events, fall back to polling.");
+        _updateTimer.start(kFallbackUpdateInterval);
+    }
     show();
     return true;
 }
 
 bool TaskbarStatus::Disable()
 {
-    const auto optInfo = GetTaskBarInfo();
+    const auto optInfo = QueryTaskBarInfo();
     if (!optInfo.has_value()) {
         LOG(Error, "Try to disable, but failed to `GetTaskBarInfo()`");
         return false;
@@ -232,11 +262,119 @@ bool TaskbarStatus::Disable()
     const auto &info = optInfo.value();
 
     hide();
+    UninstallHook();
     _updateTimer.stop();
+    _eventTimer.stop();
     UpdatePos(info, false);
     return true;
 }
 
+std::optional<TaskBarInfo> TaskbarStatus::QueryTaskBarInfo()
+{
+    _cachedInfo = GetTaskBarInfo(_cachedInfo.has_value() ? &_cachedInfo.value() : nullptr);
+    return _cachedInfo;
+}
+
+bool TaskbarStatus::InstallHook(const TaskBarInfo &info)
+{
+    UninstallHook();
+
+    DWORD processId = 0;
+    if (GetWindowThreadProcessId(info.hShellTrayWnd, &processId) == 0) {
+        LOG(Warn, "GetWindowThreadProcessId() failed. Error: {}", GetLastError());
+        return false;
+    }
+
+    // Out of context hooks are called on this thread by the message loop
+    //
+    _hook = SetWinEventHook(
+        EVENT_OBJECT_LOCATIONCHANGE, EVENT_OBJECT_LOCATIONCHANGE, nullptr,
+        &TaskbarStatus::OnWinEvent, processId, 0, WINEVENT_OUTOFCONTEXT);
+    if (_hook == nullptr) {
+        LOG(Warn, "SetWinEventHook() failed. Error: {}", GetLastError());
+        return false;
+    }
+
+    _hookOwner = this;
+    return true;
+}
+
+void TaskbarStatus::UninstallHook()
+{
+    if (_hook != nullptr) {
+        UnhookWinEvent(_hook);
+        _hook = nullptr;
+        _hookOwner = nullptr;
+    }
+}
+
+void TaskbarStatus::ScheduleUpdate()
+{
+    // Coalesce the bursts of events while the taskbar is being resized
+    //
+    if (_isActuallyEnabled && !_eventTimer.isActive()) {
+        _eventTimer.start(kEventDelay);
+    }
+}
+
+void CALLBACK TaskbarStatus::OnWinEvent(
+    HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject, LONG idChild, DWORD idEventThread,
+    DWORD dwmsEventTime)
+{
+    if (idObject != OBJID_WINDOW || _hookOwner == nullptr ||
+        !_hookOwner->_cachedInfo.has_value())
+    {
+        return;
+    }
+
+    const auto &info = _hookOwner->_cachedInfo.value();
+    if (hwnd == info.hShellTrayWnd || hwnd == info.hReBarWindow32 ||
+        hwnd == info.hMSTaskSwWClass)
+    {
+        _hookOwner->ScheduleUpdate();
+    }
+}
+
+bool TaskbarStatus::nativeEventFilter(const QByteArray &eventType, void *message, long *result)
+{
+    if (eventType != "windows_generic_MSG") {
+        return false;
+    }
+
+    const auto msg = static_cast<const MSG *>(message);
+
+    if (msg->message == _taskbarCreatedMessage && _taskbarCreatedMessage != 0) {
+        LOG(Info, "The taskbar is recreated.");
+
+        // Deferred to get out of the native event handling
+        //
+        QMetaObject::invokeMethod(this, [this] { OnTaskbarCreated(); }, Qt::QueuedConnection);
+    }
+    else if (msg->message == WM_DISPLAYCHANGE || msg->message == WM_DPICHANGED ||
+             msg->message == WM_SETTINGCHANGE)
+    {
+        // The length of the taskbar may stay the same while the scaling changes
+        _isForcedUpdate = true;
+        ScheduleUpdate();
+    }
+    return false;
+}
+
+void TaskbarStatus::OnTaskbarCreated()
+{
+    UninstallHook();
+    _updateTimer.stop();
+    _eventTimer.stop();
+    _cachedInfo.reset();
+
+    if (_isActuallyEnabled) {
+        hide();
+        windowHandle()->setParent(nullptr);
+        _isActuallyEnabled = false;
+        UpdateVisible();
+    }
+}
+
 void TaskbarStatus::UpdatePos(const TaskBarInfo &info, bool enable)
 {
     LOG(Trace, "The taskbar is '{}'", info.isHorizontal ? "horizontal" : "vertical");
@@ -331,8 +469,41 @@ void TaskbarStatus::Unbind()
     Repaint();
 }
 
-void TaskbarStatus::Repaint()
+void TaskbarStatus::Repaint(Core::AirPods::StateFields fields)
 {
+    using Core::AirPods::StateField;
+
+    const auto repaintSide = [&](const Core::AirPods::PodState &podState, QLabel *label,
+                                 Widget::Battery *battery, MiniIcon *icon,
+                                 Core::AirPods::StateFields mask) {
+        if (!(fields & mask)) {
+            return;
+        }
+
+        if (podState.battery.Available()) {
+            const auto batteryValue = podState.battery.Value();
+
+            label->setText(QString{"%1%"}.arg(batteryValue));
+            battery->setValue(batteryValue);
+            battery->setCharging(podState.isCharging);
+
+            icon->show();
+            if (_behavior == TaskbarStatusBehavior::Text) {
+                label->show();
+                battery->hide();
+            }
+            else {
+                label->hide();
+                battery->show();
+            }
+        }
+        else {
+            icon->hide();
+            label->hide();
+            battery->hide();
+        }
+    };
+
     switch (_status) {
     case Status::Unavailable:
     case Status::Disconnected:
@@ -347,51 +518,12 @@ void TaskbarStatus::Repaint()
         }
         const auto &state = _airPodsState.value();
 
-        if (state.pods.left.battery.Available()) {
-            const auto batteryValue = state.pods.left.battery.Value();
-
-            _ui.labelLeft->setText(QString{"%1%"}.arg(batteryValue));
-            _battery.left->setValue(batteryValue);
-            _battery.left->setCharging(state.pods.left.isCharging);
-
-            _icon.left->show();
-            if (_behavior == TaskbarStatusBehavior::Text) {
-                _ui.labelLeft->show();
-                _battery.left->hide();
-            }
-            else {
-                _ui.labelLeft->hide();
-                _battery.left->show();
-            }
-        }
-        else {
-            _icon.left->hide();
-            _ui.labelLeft->hide();
-            _battery.left->hide();
-        }
-
-        if (state.pods.right.battery.Available()) {
-            const auto batteryValue = state.pods.right.battery.Value();
-
-            _ui.labelRight->setText(QString{"%1%"}.arg(batteryValue));
-            _battery.right->setValue(batteryValue);
-            _battery.right->setCharging(state.pods.right.isCharging);
-
-            _icon.right->show();
-            if (_behavior == TaskbarStatusBehavior::Text) {
-                _ui.labelRight->show();
-                _battery.right->hide();
-            }
-            else {
-                _ui.labelRight->hide();
-                _battery.right->show();
-            }
-        }
-        else {
-            _icon.right->hide();
-            _ui.labelRight->hide();
-            _battery.right->hide();
-        }
+        repaintSide(
+            state.pods.left, _ui.labelLeft, _battery.left, _icon.left,
+            StateField::LeftBattery | StateField::LeftCharging);
+        repaintSide(
+            state.pods.right, _ui.labelRight, _battery.right, _icon.right,
+            StateField::RightBattery | StateField::RightCharging);
 
         _isStateReady = true;
         break;
@@ -407,7 +539,9 @@ void TaskbarStatus::Repaint()
 
 void TaskbarStatus::OnUpdateTimer()
 {
-    const auto optInfo = GetTaskBarInfo();
+    APD_PROFILE_ZONE();
+
+    const auto optInfo = QueryTaskBarInfo();
     if (!optInfo.has_value()) {
         LOG(Trace, "Try to update, but failed to `GetTaskBarInfo()`");
         return;
@@ -416,7 +550,8 @@ void TaskbarStatus::OnUpdateTimer()
 
     bool taskbarResized = _cachedLength != (info.isHorizontal ? info.rectReBarWindow32.width()
                                                               : info.rectReBarWindow32.height());
-    bool needToUpdate = taskbarResized || _isFirstTimeout;
+    bool needToUpdate = taskbarResized || _isFirstTimeout || _isForcedUpdate;
+    _isForcedUpdate = false;
 
     // We update the position again at the second time after the window is displayed, because the
     // first update may cause some shifting, I guess it's `setParent` causing some weird Qt bugs.
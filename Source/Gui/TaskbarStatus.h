@@ -20,6 +20,7 @@
 
 #include <optional>
 
+#include <QAbstractNativeEventFilter>
 #include <QDialog>
 
 #include "ui_TaskbarStatus.h"
@@ -36,6 +37,10 @@ struct TaskBarInfo {
     QRect rectReBarWindow32, rectMSTaskSwWClass, rectMSTaskSwWClassForParent;
 };
 
+// If `cached` is specified, its window handles are reused while they are still valid
+//
+std::optional<TaskBarInfo> GetTaskBarInfo(const TaskBarInfo *cached = nullptr);
+
 namespace Gui {
 
 using namespace std::chrono_literals;
@@ -112,7 +117,10 @@ protected:
     }
 };
 
-class TaskbarStatus : public QDialog
+// The position is updated on the location changes of the taskbar windows, on the taskbar being
+// recreated and on display changes, it's only polled if hooking the events fails.
+//
+class TaskbarStatus : public QDialog, public QAbstractNativeEventFilter
 {
     Q_OBJECT
 
@@ -120,7 +128,7 @@ public:
     TaskbarStatus(QWidget *parent = nullptr);
     ~TaskbarStatus();
 
-    void UpdateState(const Core::AirPods::State &state);
+    void UpdateState(const Core::AirPods::State &state, Core::AirPods::StateFields changedFields);
     void Unavailable();
     void Disconnect();
     void Unbind();
@@ -132,7 +140,10 @@ private:
     constexpr static inline auto kFixedWidth{60};  // for horizontal taskbar
     constexpr static inline auto kFixedHeight{40}; // for vertical taskbar
 
-    constexpr static inline auto kUpdateInterval{100ms};
+    constexpr static inline auto kEventDelay{100ms};
+    constexpr static inline auto kFallbackUpdateInterval{2s};
+
+    static inline TaskbarStatus *_hookOwner{nullptr};
 
     Ui::TaskbarStatus _ui;
     Helper::Sides<MiniIcon *> _icon = {new MiniIcon{this}, new MiniIcon{this}};
@@ -140,9 +151,12 @@ private:
         new Widget::Battery{this}, new Widget::Battery{this}};
     TaskbarStatusBehavior _behavior{TaskbarStatusBehavior::Disable};
     bool _isWin11OrGreater{false}, _isActuallyEnabled{false}, _isStateReady{false},
-        _isFirstTimeout{false};
+        _isFirstTimeout{false}, _isForcedUpdate{false};
     int _cachedLength{0};
-    QTimer _updateTimer;
+    QTimer _updateTimer, _eventTimer;
+    std::optional<TaskBarInfo> _cachedInfo;
+    HWINEVENTHOOK _hook{nullptr};
+    UINT _taskbarCreatedMessage{0};
     std::optional<Core::AirPods::State> _airPodsState;
     Status _status{Status::Unavailable};
 #if defined APD_DEBUG
@@ -153,11 +167,22 @@ private:
     bool Enable();
     bool Disable();
     void UpdatePos(const TaskBarInfo &info, bool enable);
-    void Repaint();
+    std::optional<TaskBarInfo> QueryTaskBarInfo();
+    bool InstallHook(const TaskBarInfo &info);
+    void UninstallHook();
+    void ScheduleUpdate();
+    void Repaint(Core::AirPods::StateFields fields = Core::AirPods::StateField::All);
 
     void OnUpdateTimer();
+    void OnTaskbarCreated();
     void OnSettingsChanged(TaskbarStatusBehavior value);
 
+    static void CALLBACK OnWinEvent(
+        HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject, LONG idChild,
+        DWORD idEventThread, DWORD dwmsEventTime);
+
+    bool nativeEventFilter(const QByteArray &eventType, void *message, long *result) override;
+
     void paintEvent(QPaintEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
 
@@ -18,12 +18,16 @@
 
 #include "TrayIcon.h"
 
+#include <cmath>
+
 #include <QFont>
 #include <QPainter>
 #include <QSvgRenderer>
 
 #include <Config.h>
 #include "../Application.h"
+#include "../Profiler.h"
+#include "../Core/BatteryHistory.h"
 #include "MainWindow.h"
 
 namespace Gui {
@@ -54,11 +58,26 @@ TrayIcon::TrayIcon()
     _tray->show();
 }
 
-void TrayIcon::UpdateState(const Core::AirPods::State &state)
+void TrayIcon::UpdateState(
+    const Core::AirPods::State &state, Core::AirPods::StateFields changedFields)
 {
+    using Core::AirPods::StateField;
+
+    // The tooltip and the icon only show the name, the batteries and the charging states
+    //
+    const Core::AirPods::StateFields kDisplayedFields =
+        StateField::DisplayName | StateField::LeftBattery | StateField::LeftCharging |
+        StateField::RightBattery | StateField::RightCharging | StateField::CaseBattery |
+        StateField::CaseCharging;
+
+    const bool isUpdated = _status == Status::Updating && _airPodsState.has_value();
+
     _status = Status::Updating;
     _airPodsState = state;
-    Repaint();
+
+    if (!isUpdated || (changedFields & kDisplayedFields)) {
+        Repaint();
+    }
 }
 
 void TrayIcon::Unavailable()
@@ -96,6 +115,8 @@ void TrayIcon::ShowMainWindow()
 
 void TrayIcon::Repaint()
 {
+    APD_PROFILE_ZONE();
+
     QString toolTipContent;
     Core::AirPods::Battery minBattery;
 
@@ -119,6 +140,17 @@ void TrayIcon::Repaint()
         const auto textCharging = QString{" (%1)"}.arg(strCharging),
                    textPlaceHolder = QString{"\n%1: %2%%3"};
 
+        using Core::BatteryHistory::Component;
+
+        const auto textState = [&](bool isCharging, Component component) {
+            if (isCharging) {
+                return textCharging;
+            }
+            const auto remaining =
+                DisplayableRemaining(Core::BatteryHistory::PredictRemaining(component));
+            return remaining.isEmpty() ? QString{} : QString{" (%1)"}.arg(remaining);
+        };
+
         // clang-format off
         if (state.pods.left.battery.Available()) {
             const auto batteryValue = state.pods.left.battery.Value();
@@ -126,7 +158,7 @@ void TrayIcon::Repaint()
             toolTipContent += textPlaceHolder
                 .arg(strLeft)
                 .arg(batteryValue)
-                .arg(state.pods.left.isCharging ? textCharging : QString{});
+                .arg(textState(state.pods.left.isCharging, Component::Left));
 
             minBattery = batteryValue;
         }
@@ -137,7 +169,7 @@ void TrayIcon::Repaint()
             toolTipContent += textPlaceHolder
                 .arg(strRight)
                 .arg(batteryValue)
-                .arg(state.pods.right.isCharging ? textCharging : QString{});
+                .arg(textState(state.pods.right.isCharging, Component::Right));
 
             if (minBattery.Available() && batteryValue < minBattery.Value() ||
                 !minBattery.Available()) {
@@ -149,7 +181,7 @@ void TrayIcon::Repaint()
             toolTipContent += textPlaceHolder
                 .arg(strCase)
                 .arg(state.caseBox.battery.Value())
-                .arg(state.caseBox.isCharging ? textCharging : QString{});
+                .arg(textState(state.caseBox.isCharging, Component::Case));
         }
         // clang-format on
         break;
@@ -166,7 +198,7 @@ void TrayIcon::Repaint()
 
     // RepaintIcon
 
-    std::optional<QString> iconText;
+    std::optional<uint32_t> iconBattery;
 
     do {
         if (minBattery.Available()) {
@@ -184,23 +216,57 @@ void TrayIcon::Repaint()
             }();
 
             if (drawBattery) {
-                iconText = QString::number(minBattery.Value());
+                iconBattery = minBattery.Value();
                 break;
             }
         }
 
-        iconText.reset();
+        iconBattery.reset();
     } while (false);
 
+    RepaintIcon(iconBattery, _updateReleaseInfo.has_value());
+}
+
+void TrayIcon::RepaintIcon(const std::optional<uint32_t> &battery, bool newVersionDot)
+{
     static const QColor kNewVersionAvailableDot = Qt::yellow;
 
-    auto optIcon = GenerateIcon(
-        64, iconText,
-        _updateReleaseInfo.has_value() ? std::optional<QColor>{kNewVersionAvailableDot}
-                                       : std::nullopt);
-    if (optIcon.has_value()) {
-        _tray->setIcon(QIcon{QPixmap::fromImage(optIcon.value())});
+    // The rendered icon only depends on these and the battery value is quantized, so there are
+    // only a handful of distinct icons. They are rendered once and then looked up.
+    //
+    const auto devicePixelRatio = qApp->devicePixelRatio();
+    const auto fontFamily = ApdApp->font().family();
+
+    if (devicePixelRatio != _iconCacheDevicePixelRatio || fontFamily != _iconCacheFontFamily) {
+        LOG(Trace, "Tray icon cache invalidated. Cached icons: {}", _iconCache.size());
+
+        _iconCache.clear();
+        _iconCacheDevicePixelRatio = devicePixelRatio;
+        _iconCacheFontFamily = fontFamily;
+        _currentIconKey.reset();
+    }
+
+    const uint32_t key = (battery.has_value() ? battery.value() : kIconKeyNoBattery) |
+                         (newVersionDot ? kIconKeyDotBit : 0);
+    if (key == _currentIconKey) {
+        return;
+    }
+
+    auto iter = _iconCache.find(key);
+    if (iter == _iconCache.end()) {
+        auto optIcon = GenerateIcon(
+            std::lround(kIconSize * devicePixelRatio),
+            battery.has_value() ? std::optional<QString>{QString::number(battery.value())}
+                                : std::nullopt,
+            newVersionDot ? std::optional<QColor>{kNewVersionAvailableDot} : std::nullopt);
+        if (!optIcon.has_value()) {
+            return;
+        }
+        iter = _iconCache.emplace(key, QIcon{QPixmap::fromImage(optIcon.value())}).first;
     }
+
+    _tray->setIcon(iter->second);
+    _currentIconKey = key;
 }
 
 std::optional<QImage> TrayIcon::GenerateIcon(
@@ -317,23 +383,36 @@ void TrayIcon::OnNewVersionClicked()
     ApdApp->GetMainWindow()->AskUserUpdate(releaseInfo);
 }
 
+SettingsWindow &TrayIcon::GetSettingsWindow()
+{
+    if (_settingsWindow == nullptr) {
+        LOG(Info, "Construct SettingsWindow on first use.");
+        _settingsWindow = std::make_unique<SettingsWindow>();
+    }
+    return *_settingsWindow;
+}
+
 void TrayIcon::OnSettingsClicked()
 {
-    if (!_settingsWindow.isVisible() ||
-        _settingsWindow.GetTabCurrentIndex() == _settingsWindow.GetTabLastVisibleIndex())
+    auto &settingsWindow = GetSettingsWindow();
+
+    if (!settingsWindow.isVisible() ||
+        settingsWindow.GetTabCurrentIndex() == settingsWindow.GetTabLastVisibleIndex())
     {
-        _settingsWindow.SetTabIndex(0);
+        settingsWindow.SetTabIndex(0);
     }
 
-    _settingsWindow.show();
-    _settingsWindow.raise();
+    settingsWindow.show();
+    settingsWindow.raise();
 }
 
 void TrayIcon::OnAboutClicked()
 {
-    _settingsWindow.SetTabIndex(_settingsWindow.GetTabLastVisibleIndex());
-    _settingsWindow.show();
-    _settingsWindow.raise();
+    auto &settingsWindow = GetSettingsWindow();
+
+    settingsWindow.SetTabIndex(settingsWindow.GetTabLastVisibleIndex());
+    settingsWindow.show();
+    settingsWindow.raise();
 }
 
 void TrayIcon::OnIconClicked(QSystemTrayIcon::ActivationReason reason)
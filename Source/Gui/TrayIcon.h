@@ -18,6 +18,9 @@
 
 #pragma once
 
+#include <memory>
+#include <unordered_map>
+
 #include <QSystemTrayIcon>
 #include <QMenu>
 #include <QAction>
@@ -52,12 +55,15 @@ public:
         return _tray->toolTip();
     }
 
-    void UpdateState(const Core::AirPods::State &state);
+    void UpdateState(const Core::AirPods::State &state, Core::AirPods::StateFields changedFields);
     void Unavailable();
     void Disconnect();
     void Unbind();
     void VersionUpdateAvailable(const Core::Update::ReleaseInfo &releaseInfo);
 
+    static std::optional<QImage>
+    GenerateIcon(int size, const std::optional<QString> &optText, const std::optional<QColor> &dot);
+
 Q_SIGNALS:
     void OnTrayIconBatteryChangedSafely(Core::Settings::TrayIconBatteryBehavior value);
 
@@ -75,11 +81,17 @@ private:
     std::optional<QString> _displayName;
     std::optional<Core::Update::ReleaseInfo> _updateReleaseInfo;
 
+    constexpr static inline int kIconSize{64};
+    constexpr static inline uint32_t kIconKeyNoBattery{0xFF}, kIconKeyDotBit{1 << 8};
+
+    std::unordered_map<uint32_t, QIcon> _iconCache;
+    std::optional<uint32_t> _currentIconKey;
+    qreal _iconCacheDevicePixelRatio{0};
+    QString _iconCacheFontFamily;
+
     void ShowMainWindow();
     void Repaint();
-
-    static std::optional<QImage>
-    GenerateIcon(int size, const std::optional<QString> &optText, const std::optional<QColor> &dot);
+    void RepaintIcon(const std::optional<uint32_t> &battery, bool newVersionDot);
 
     void OnNewVersionClicked();
     void OnSettingsClicked();
@@ -87,8 +99,12 @@ private:
     void OnIconClicked(QSystemTrayIcon::ActivationReason reason);
     void OnTrayIconBatteryChanged(Core::Settings::TrayIconBatteryBehavior value);
 
+    // Constructed on first use, most launches never open it
+    //
+    SettingsWindow &GetSettingsWindow();
+
 protected:
-    SettingsWindow _settingsWindow;
+    std::unique_ptr<SettingsWindow> _settingsWindow;
 
     UTILS_QT_REGISTER_LANGUAGECHANGE(QWidget, [this] { Repaint(); });
 };
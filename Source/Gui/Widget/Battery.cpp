@@ -21,6 +21,8 @@
 #include <QPainter>
 #include <QPainterPath>
 
+#include "../../Profiler.h"
+
 namespace Gui::Widget {
 
 Battery::Battery(QWidget *parent) : QWidget{parent}
@@ -35,6 +37,49 @@ Battery::Battery(QWidget *parent) : QWidget{parent}
 }
 
 void Battery::paintEvent(QPaintEvent *event)
+{
+    APD_PROFILE_ZONE();
+
+    const qreal devicePixelRatio = devicePixelRatioF();
+    if (_layer.isNull() || _layer.devicePixelRatio() != devicePixelRatio) {
+        updateLayer(devicePixelRatio);
+    }
+
+    QPainter painter{this};
+    painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+
+    // The head and the charging icon never overlap the background, so it's fine to draw the
+    // background after them
+    //
+    painter.drawPixmap(0, 0, _layer);
+    drawBackground(painter);
+    drawText(painter);
+}
+
+void Battery::resizeEvent(QResizeEvent *event)
+{
+    invalidateLayer();
+    QWidget::resizeEvent(event);
+}
+
+void Battery::changeEvent(QEvent *event)
+{
+    if (event->type() == QEvent::FontChange) {
+        invalidateLayer();
+    }
+    QWidget::changeEvent(event);
+}
+
+void Battery::invalidateLayer()
+{
+    _layer = QPixmap{};
+    update();
+}
+
+// The border, the head and the charging icon only depend on the geometry and the colors, so they
+// are rendered into a pixmap once and only blitted by the subsequent paints
+//
+void Battery::updateLayer(qreal devicePixelRatio)
 {
     QFontMetrics fontMetrics{this->fontMetrics()};
 
@@ -56,14 +101,16 @@ void Battery::paintEvent(QPaintEvent *event)
     _headRect = QRectF{
         _batteryRect.right(), _batteryRect.bottom() / 3.0, headWidth, _batteryRect.bottom() / 3.0};
 
-    QPainter painter{this};
+    _layer = QPixmap{size() * devicePixelRatio};
+    _layer.setDevicePixelRatio(devicePixelRatio);
+    _layer.fill(Qt::transparent);
+
+    QPainter painter{&_layer};
     painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
 
     drawBorder(painter);
-    drawBackground(painter);
     drawHead(painter);
     drawChargingIcon(painter);
-    drawText(painter);
 }
 
 void Battery::drawBorder(QPainter &painter)
@@ -304,7 +351,7 @@ void Battery::setBorderWidth(qreal value)
         return;
     }
     _borderWidth = value;
-    update();
+    invalidateLayer();
 }
 
 void Battery::setBorderRadius(qreal value)
@@ -313,7 +360,7 @@ void Battery::setBorderRadius(qreal value)
         return;
     }
     _borderRadius = value;
-    update();
+    invalidateLayer();
 }
 
 void Battery::setBackgroundRadius(qreal value)
@@ -331,7 +378,7 @@ void Battery::setHeadRadius(qreal value)
         return;
     }
     _headRadius = value;
-    update();
+    invalidateLayer();
 }
 
 void Battery::setBorderColor(const QColor &value)
@@ -340,7 +387,7 @@ void Battery::setBorderColor(const QColor &value)
         return;
     }
     _borderColor = value;
-    update();
+    invalidateLayer();
 }
 
 void Battery::setAlarmColor(const QColor &value)
@@ -367,7 +414,7 @@ void Battery::setChargingIconColor(const QColor &value)
         return;
     }
     _chargingIconColor = value;
-    update();
+    invalidateLayer();
 }
 
 void Battery::setCharging(bool value)
@@ -376,7 +423,7 @@ void Battery::setCharging(bool value)
         return;
     }
     _isCharging = value;
-    update();
+    invalidateLayer();
 
     Q_EMIT chargingStateChanged(_isCharging);
 }
@@ -387,7 +434,7 @@ void Battery::setShowText(bool value)
         return;
     }
     _isShowText = value;
-    update();
+    invalidateLayer();
 }
 
 void Battery::setTextPadding(qreal value)
@@ -396,7 +443,7 @@ void Battery::setTextPadding(qreal value)
         return;
     }
     _textPadding = value;
-    update();
+    invalidateLayer();
 }
 
 void Battery::setBatterySize(int width, int height)
@@ -407,7 +454,7 @@ void Battery::setBatterySize(int width, int height)
     setFixedSize(
         width + getChargingIconWidth() + getHeadWidth() + ChargingPadding,
         height + (_isShowText ? (fontMetrics.height() + _textPadding) : 0));
-    update();
+    invalidateLayer();
 }
 
 qreal Battery::getHeadWidth() const
@@ -28,6 +28,7 @@
 
 #pragma once
 
+#include <QPixmap>
 #include <QWidget>
 
 namespace Gui::Widget {
@@ -138,6 +139,11 @@ private:
 
     QSizeF _batterySize{};
 
+    QPixmap _layer;
+
+    void invalidateLayer();
+    void updateLayer(qreal devicePixelRatio);
+
     void drawBorder(QPainter &painter);
     void drawBackground(QPainter &painter);
     void drawHead(QPainter &painter);
@@ -149,5 +155,7 @@ private:
 
 protected:
     void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void changeEvent(QEvent *event) override;
 };
 } // namespace Gui::Widget
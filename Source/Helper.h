@@ -18,7 +18,14 @@
 
 #pragma once
 
+#include <span>
+#include <array>
+#include <algorithm>
+#include <queue>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <optional>
 #include <vector>
 #include <chrono>
 #include <thread>
@@ -28,6 +35,8 @@
 
 #include <QString>
 
+#include "Profiler.h"
+
 #define __TO_STRING(expr) #expr
 #define TO_STRING(expr) __TO_STRING(expr)
 
@@ -114,7 +123,7 @@ using MemberPointerType = typename Impl::MemberPointerType<T>::Type;
 template <class T>
 inline bool IsFutureReady(const std::future<T> &future)
 {
-    return future.wait_for(0s) == std::future_status::ready;
+    return future.wait_for(std::chrono::seconds{0}) == std::future_status::ready;
 }
 
 //////////////////////////////////////////////////
@@ -123,14 +132,14 @@ template <class T>
 QString ToString(const T &value);
 
 template <>
-inline QString ToString<std::vector<uint8_t>>(const std::vector<uint8_t> &value)
+inline QString ToString<std::span<const uint8_t>>(const std::span<const uint8_t> &value)
 {
     QString result;
 
     size_t bytesSize = value.size();
 
     for (size_t i = 0; i < bytesSize; ++i) {
-        result += QString::number(value.at(i), 16).rightJustified(2, '0');
+        result += QString::number(value[i], 16).rightJustified(2, '0');
 
         if (i + 1 != bytesSize) {
             result += ' ';
@@ -140,6 +149,12 @@ inline QString ToString<std::vector<uint8_t>>(const std::vector<uint8_t> &value)
     return result;
 }
 
+template <>
+inline QString ToString<std::vector<uint8_t>>(const std::vector<uint8_t> &value)
+{
+    return ToString(std::span<const uint8_t>{value});
+}
+
 template <>
 inline QString ToString<Qt::ApplicationState>(const Qt::ApplicationState &value)
 {
@@ -168,51 +183,302 @@ struct Sides {
 
 //////////////////////////////////////////////////
 
+// A vector with a fixed capacity and inline storage, it never allocates.
+//
+template <class T, size_t N>
+class StaticVector
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    using value_type = T;
+    using iterator = T *;
+    using const_iterator = const T *;
+
+    constexpr StaticVector() noexcept = default;
+
+    constexpr StaticVector(std::span<const T> values) noexcept
+    {
+        assign(values);
+    }
+
+    constexpr static size_t capacity() noexcept
+    {
+        return N;
+    }
+
+    constexpr size_t size() const noexcept
+    {
+        return _size;
+    }
+
+    constexpr bool empty() const noexcept
+    {
+        return _size == 0;
+    }
+
+    constexpr bool full() const noexcept
+    {
+        return _size == N;
+    }
+
+    constexpr T *data() noexcept
+    {
+        return _data.data();
+    }
+
+    constexpr const T *data() const noexcept
+    {
+        return _data.data();
+    }
+
+    constexpr iterator begin() noexcept
+    {
+        return data();
+    }
+
+    constexpr iterator end() noexcept
+    {
+        return data() + _size;
+    }
+
+    constexpr const_iterator begin() const noexcept
+    {
+        return data();
+    }
+
+    constexpr const_iterator end() const noexcept
+    {
+        return data() + _size;
+    }
+
+    constexpr T &operator[](size_t index) noexcept
+    {
+        return _data[index];
+    }
+
+    constexpr const T &operator[](size_t index) const noexcept
+    {
+        return _data[index];
+    }
+
+    constexpr void clear() noexcept
+    {
+        _size = 0;
+    }
+
+    // Returns false if it's full
+    //
+    constexpr bool push_back(const T &value) noexcept
+    {
+        if (full()) {
+            return false;
+        }
+        _data[_size++] = value;
+        return true;
+    }
+
+    // Returns false and leaves it empty if the values cannot fit
+    //
+    constexpr bool assign(std::span<const T> values) noexcept
+    {
+        if (values.size() > N) {
+            _size = 0;
+            return false;
+        }
+        std::copy(values.begin(), values.end(), _data.begin());
+        _size = values.size();
+        return true;
+    }
+
+    constexpr operator std::span<const T>() const noexcept
+    {
+        return {data(), _size};
+    }
+
+private:
+    std::array<T, N> _data{};
+    size_t _size{0};
+};
+
+//////////////////////////////////////////////////
+
+// A bounded lock-free ring for one producer and one consumer. When it's full, the producer drops
+// the oldest element instead of waiting, so pushing never blocks on the consumer.
+//
+// Every slot carries a sequence number as in Vyukov's bounded queue. To drop the oldest element
+// the producer claims it from the consumer by a CAS on the head, so the only wait left is the
+// consumer copying out the slot it has already claimed.
+//
+template <class T, size_t N>
+class SpscRing : NonCopyable
+{
+    static_assert(N != 0 && (N & (N - 1)) == 0, "The capacity must be a power of 2.");
+
+public:
+    inline SpscRing()
+    {
+        for (size_t i = 0; i < N; ++i) {
+            _slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    constexpr static size_t capacity() noexcept
+    {
+        return N;
+    }
+
+    // Producer only. Returns false if the oldest element was dropped to make room.
+    //
+    inline bool Push(T value)
+    {
+        const size_t pos = _tail.load(std::memory_order_relaxed);
+        auto &slot = _slots[pos & kMask];
+        bool dropped = false;
+
+        while (slot.seq.load(std::memory_order_acquire) != pos) {
+            // The slot still holds the element of the previous lap, take it from the consumer
+            //
+            size_t oldest = pos - N;
+            if (_head.compare_exchange_weak(oldest, oldest + 1, std::memory_order_acq_rel)) {
+                dropped = true;
+                break;
+            }
+        }
+
+        slot.value = std::move(value);
+        slot.seq.store(pos + 1, std::memory_order_release);
+        _tail.store(pos + 1, std::memory_order_release);
+
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_one();
+        return !dropped;
+    }
+
+    // Consumer only
+    //
+    inline std::optional<T> Pop()
+    {
+        size_t pos = _head.load(std::memory_order_relaxed);
+        while (true) {
+            auto &slot = _slots[pos & kMask];
+            const size_t seq = slot.seq.load(std::memory_order_acquire);
+
+            if (seq == pos + 1) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_acq_rel)) {
+                    std::optional<T> result{std::move(slot.value)};
+                    slot.seq.store(pos + N, std::memory_order_release);
+                    return result;
+                }
+            }
+            else if ((std::make_signed_t<size_t>)(seq - (pos + 1)) < 0) {
+                return std::nullopt;
+            }
+            else {
+                // The producer dropped it and has already written the next lap
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer only. Blocks until something may have been pushed, returns false once it's closed.
+    //
+    inline bool Wait()
+    {
+        const auto signal = _signal.load(std::memory_order_acquire);
+        if (_closed.load(std::memory_order_acquire)) {
+            return false;
+        }
+        if (_head.load(std::memory_order_acquire) != _tail.load(std::memory_order_acquire)) {
+            return true;
+        }
+        _signal.wait(signal, std::memory_order_acquire);
+        return !_closed.load(std::memory_order_acquire);
+    }
+
+    // Wakes the consumer up for good, the elements left are dropped
+    //
+    inline void Close()
+    {
+        _closed.store(true, std::memory_order_release);
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_all();
+    }
+
+private:
+    constexpr static size_t kMask = N - 1;
+
+    struct Slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::array<Slot, N> _slots;
+    alignas(64) std::atomic<size_t> _head{0};
+    alignas(64) std::atomic<size_t> _tail{0};
+    alignas(64) std::atomic<uint32_t> _signal{0};
+    std::atomic<bool> _closed{false};
+};
+
+//////////////////////////////////////////////////
+
 using CbHandle = uint64_t;
 
+// The subscriber list is copy-on-write. `Invoke` takes a snapshot of it and runs the callbacks
+// without holding any lock, so callbacks may register or unregister, and a slow callback never
+// blocks the writers. As a consequence, a callback may still be invoked once by an `Invoke` that
+// started before it was unregistered.
+//
 template <class Function>
 class Callback
 {
 public:
     inline CbHandle Register(Function &&callback)
     {
-        std::lock_guard<std::mutex> lock{_mutex};
+        std::lock_guard<decltype(_writeMutex)> lock{_writeMutex};
 
         auto thisHandle = _nextHandle++;
-        _callbacks.emplace_back(thisHandle, std::move(callback));
+        auto callbacks = std::make_shared<List>(*_callbacks.load());
+        callbacks->emplace_back(thisHandle, std::move(callback));
+        _callbacks.store(std::move(callbacks));
         return thisHandle;
     }
 
     inline bool Unregister(CbHandle handle)
     {
-        std::lock_guard<std::mutex> lock{_mutex};
+        std::lock_guard<decltype(_writeMutex)> lock{_writeMutex};
+
+        auto callbacks = std::make_shared<List>(*_callbacks.load());
 
         auto iter =
-            std::find_if(_callbacks.begin(), _callbacks.end(), [handle](const auto &callbackInfo) {
+            std::find_if(callbacks->begin(), callbacks->end(), [handle](const auto &callbackInfo) {
                 return callbackInfo.first == handle;
             });
 
-        if (iter == _callbacks.end()) {
+        if (iter == callbacks->end()) {
             return false;
         }
 
-        _callbacks.erase(iter);
+        callbacks->erase(iter);
+        _callbacks.store(std::move(callbacks));
         return true;
     }
 
     inline void UnregisterAll()
     {
-        std::lock_guard<std::mutex> lock{_mutex};
+        std::lock_guard<decltype(_writeMutex)> lock{_writeMutex};
 
-        _callbacks.clear();
+        _callbacks.store(std::make_shared<List>());
     }
 
     template <class... Args>
     inline void Invoke(Args &&...args) const
     {
-        std::lock_guard<std::mutex> lock{_mutex};
+        APD_PROFILE_ZONE_NAMED("Callback::Invoke");
 
-        for (const auto &callbackInfo : _callbacks) {
+        const auto callbacks = _callbacks.load();
+
+        for (const auto &callbackInfo : *callbacks) {
             callbackInfo.second(args...);
         }
     }
@@ -224,67 +490,162 @@ public:
     }
 
 private:
-    mutable std::mutex _mutex;
+    using List = std::vector<std::pair<CbHandle, Function>>;
+
+    APD_PROFILE_LOCKABLE(std::mutex, _writeMutex);
     CbHandle _nextHandle{1};
-    std::vector<std::pair<CbHandle, Function>> _callbacks;
+    std::atomic<std::shared_ptr<const List>> _callbacks{std::make_shared<const List>()};
 };
 
-class ConWorker
+// A single process-wide thread that runs the deadlines of all `Timer`s, so a timer costs no
+// thread of its own. The callbacks are run on this thread, so they must not block for long.
+//
+class Scheduler : public Singleton<Scheduler>
 {
 public:
-    using FnCallback = std::function<bool()>;
-
-    ConWorker() = default;
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
 
-    inline ConWorker(std::chrono::milliseconds interval, FnCallback callback)
+    struct Task {
+        std::function<void()> callback;
+        std::atomic<std::chrono::milliseconds> interval{}; // Zero for one-shot tasks
+        std::atomic<TimePoint> deadline;
+        std::atomic<bool> cancelled{false};
+        std::atomic<uint64_t> generation{0};
+        std::mutex runMutex;
+    };
+    using TaskPtr = std::shared_ptr<Task>;
+
+    inline ~Scheduler()
     {
-        Start(std::move(interval), std::move(callback));
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _destroy = true;
+        }
+        _conVar.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
     }
 
-    inline ~ConWorker()
+    // Queues the task at its current deadline, any previously queued entry of it is discarded
+    //
+    inline void Schedule(const TaskPtr &task)
     {
-        Stop();
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _queue.push(Entry{task->deadline.load(), ++task->generation, task});
+        }
+        _conVar.notify_one();
     }
 
-    inline void Start(std::chrono::milliseconds interval, FnCallback callback)
+    // Runs the callback once after the delay, the returned task can be passed to `Cancel`
+    //
+    inline TaskPtr ScheduleOnce(std::chrono::milliseconds delay, std::function<void()> callback)
     {
-        Stop();
-        _interval = std::move(interval);
-        _callback = std::move(callback);
-        _destroyFlag = false;
-        _thread = std::thread{[this] { Thread(); }};
+        auto task = std::make_shared<Task>();
+        task->callback = std::move(callback);
+        task->deadline = Clock::now() + delay;
+        Schedule(task);
+        return task;
     }
 
-    inline void Stop()
+    // The callback is guaranteed not to be running or to run again after this returns, unless
+    // it's called from inside a callback
+    //
+    inline void Cancel(const TaskPtr &task)
     {
-        _destroyFlag = true;
-        Notify();
-        if (_thread.joinable()) {
-            _thread.join();
+        task->cancelled = true;
+        if (!IsInSchedulerThread()) {
+            std::lock_guard<std::mutex> lock{task->runMutex};
         }
     }
 
-    inline void Notify()
+    inline bool IsInSchedulerThread() const
     {
-        _destroyConVar.notify_all();
+        return std::this_thread::get_id() == _thread.get_id();
     }
 
 private:
-    std::chrono::milliseconds _interval{};
-    FnCallback _callback;
-    std::thread _thread;
+    struct Entry {
+        TimePoint when;
+        uint64_t generation;
+        TaskPtr task;
+
+        inline bool operator>(const Entry &rhs) const
+        {
+            return when > rhs.when;
+        }
+    };
+
     std::mutex _mutex;
-    std::condition_variable _destroyConVar;
-    std::atomic<bool> _destroyFlag{false};
+    std::condition_variable _conVar;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<>> _queue;
+    bool _destroy{false};
+    std::thread _thread;
 
-    void Thread()
+    friend Singleton<Scheduler>;
+
+    inline Scheduler() : _thread{&Scheduler::Thread, this} {}
+
+    inline void Thread()
     {
-        while (!_destroyFlag) {
-            if (!_callback()) {
-                break;
+        std::unique_lock<std::mutex> lock{_mutex};
+
+        while (!_destroy) {
+            if (_queue.empty()) {
+                _conVar.wait(lock);
+                continue;
+            }
+
+            const auto now = Clock::now();
+            if (_queue.top().when > now) {
+                _conVar.wait_until(lock, _queue.top().when);
+                continue;
+            }
+
+            auto entry = _queue.top();
+            _queue.pop();
+
+            if (entry.task->cancelled || entry.generation != entry.task->generation) {
+                continue;
+            }
+
+            // Deadlines are bumped by a plain atomic store (see `Timer::Reset`), so they are
+            // checked lazily here and the entry is queued again if it has been moved
+            //
+            const auto deadline = entry.task->deadline.load();
+            if (deadline > now) {
+                entry.when = deadline;
+                _queue.push(std::move(entry));
+                continue;
+            }
+
+            lock.unlock();
+            Run(entry.task, entry.generation);
+            lock.lock();
+        }
+    }
+
+    inline void Run(const TaskPtr &task, uint64_t generation)
+    {
+        const auto interval = task->interval.load();
+        {
+            std::lock_guard<std::mutex> runLock{task->runMutex};
+            if (task->cancelled) {
+                return;
+            }
+            if (interval.count() != 0) {
+                task->deadline = Clock::now() + interval;
+            }
+            task->callback();
+        }
+
+        if (interval.count() != 0 && !task->cancelled) {
+            std::lock_guard<std::mutex> lock{_mutex};
+            if (generation == task->generation) {
+                _queue.push(Entry{task->deadline.load(), generation, task});
             }
-            std::unique_lock<std::mutex> lock{_mutex};
-            _destroyConVar.wait_for(lock, _interval);
         }
     }
 };
@@ -311,61 +672,101 @@ public:
     Start(std::chrono::milliseconds interval, FnTrigger callback, bool immediatelyOnce = false)
     {
         Stop();
-        _destroyFlag = false;
-        _interval = std::move(interval);
-        _thread =
-            std::thread{&Timer::Thread, this, std::move(callback), immediatelyOnce};
+
+        auto task = std::make_shared<Scheduler::Task>();
+        task->callback = std::move(callback);
+        task->interval = interval;
+        task->deadline = immediatelyOnce ? Scheduler::Clock::now()
+                                         : Scheduler::Clock::now() + interval;
+
+        _task = std::move(task);
+        Scheduler::GetInstance().Schedule(_task);
     }
 
     inline void Stop()
     {
-        _destroyFlag = true;
-        _destroyConVar.notify_all();
-        if (_thread.joinable()) {
-            _thread.join();
+        if (_task != nullptr) {
+            Scheduler::GetInstance().Cancel(_task);
+            _task.reset();
         }
     }
 
+    // O(1), only stores the new deadline
+    //
     inline void Reset()
     {
-        _deadline = Clock::now() + _interval.load();
+        if (_task != nullptr) {
+            _task->deadline = Scheduler::Clock::now() + _task->interval.load();
+        }
+    }
+
+    // Also changes the interval. The task is queued again only if the deadline is brought
+    // forward, a later deadline is picked up lazily
+    //
+    inline void Reset(std::chrono::milliseconds interval)
+    {
+        if (_task != nullptr) {
+            _task->interval = interval;
+            const auto deadline = Scheduler::Clock::now() + interval;
+            if (deadline < _task->deadline.exchange(deadline)) {
+                Scheduler::GetInstance().Schedule(_task);
+            }
+        }
+    }
+
+    // Triggers the callback as soon as possible
+    //
+    inline void Trigger()
+    {
+        if (_task != nullptr) {
+            _task->deadline = Scheduler::Clock::now();
+            Scheduler::GetInstance().Schedule(_task);
+        }
     }
 
 private:
-    using Clock = std::chrono::steady_clock;
-    using TimePoint = Clock::time_point;
+    Scheduler::TaskPtr _task;
+};
 
-    std::atomic<bool> _destroyFlag{false};
-    std::mutex _mutex;
-    std::condition_variable _destroyConVar;
-    std::atomic<std::chrono::milliseconds> _interval;
-    std::atomic<TimePoint> _deadline;
-    std::thread _thread;
+class ConWorker
+{
+public:
+    using FnCallback = std::function<bool()>;
 
-    inline void Thread(FnTrigger callback, bool immediatelyOnce)
+    ConWorker() = default;
+
+    inline ConWorker(std::chrono::milliseconds interval, FnCallback callback)
     {
-        if (immediatelyOnce) {
-            callback();
-        }
+        Start(std::move(interval), std::move(callback));
+    }
 
-        Reset();
+    inline ~ConWorker()
+    {
+        Stop();
+    }
 
-        while (true) {
-            std::unique_lock<std::mutex> lock{_mutex};
-            {
-                _destroyConVar.wait_until(lock, _deadline.load());
+    inline void Start(std::chrono::milliseconds interval, FnCallback callback)
+    {
+        // clang-format off
+        _timer.Start(interval, [this, callback = std::move(callback)] {
+            if (!callback()) {
+                _timer.Stop();
             }
-            lock.unlock();
+        }, true);
+        // clang-format on
+    }
 
-            if (_destroyFlag) {
-                break;
-            }
-            if (_deadline.load() > Clock::now()) {
-                continue;
-            }
-            Reset();
-            callback();
-        }
+    inline void Stop()
+    {
+        _timer.Stop();
     }
+
+    inline void Notify()
+    {
+        _timer.Trigger();
+    }
+
+private:
+    Timer _timer;
 };
 } // namespace Helper
@@ -18,11 +18,15 @@
 
 #include "Logger.h"
 
+#include <unordered_map>
+
 #include <QUrl>
 #include <QDir>
 #include <QMessageBox>
+#include <spdlog/async.h>
 #include <spdlog/sinks/sink.h>
-#include <spdlog/sinks/basic_file_sink.h>
+#include <spdlog/sinks/base_sink.h>
+#include <spdlog/sinks/rotating_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/pattern_formatter.h>
 
@@ -46,7 +50,152 @@ QDir GetLogFilePath()
     return result.value();
 }
 
-bool Initialize(bool enableTrace)
+namespace Details {
+
+namespace {
+// A bounded ring buffer, the oldest messages are dropped if the sink thread can't keep up
+//
+constexpr size_t kAsyncQueueSize = 8192;
+
+// The previous file is kept on launch, so a crash log survives the restart
+//
+constexpr size_t kMaxLogFileSize = 8 * 1024 * 1024;
+constexpr size_t kMaxLogFiles = 2;
+
+std::shared_ptr<spdlog::logger> gAsyncLogger, gErrorLogger;
+
+// Forwards to the wrapped sinks, but lets each call site write at most `kBurst` messages per
+// `kWindow`. The rest are counted and written as a single line once the window is over, so a
+// warning on every rejected packet doesn't flood the file. Errors are never suppressed.
+//
+class RepeatSuppressingSink final : public spdlog::sinks::base_sink<std::mutex>
+{
+public:
+    explicit RepeatSuppressingSink(std::vector<spdlog::sink_ptr> sinks) : _sinks{std::move(sinks)}
+    {
+    }
+
+protected:
+    void sink_it_(const spdlog::details::log_msg &msg) override
+    {
+        if (msg.source.empty() || msg.level >= spdlog::level::err) {
+            Forward(msg);
+            return;
+        }
+
+        auto &site = _sites[CallSite{msg.source.filename, msg.source.line}];
+
+        if (msg.time - site.windowBegin >= kWindow) {
+            Summarize(msg.source, site, msg.time);
+            site.windowBegin = msg.time;
+            site.count = 0;
+        }
+
+        if (++site.count > kBurst) {
+            site.level = msg.level;
+            site.loggerName.assign(msg.logger_name.data(), msg.logger_name.size());
+            return;
+        }
+        Forward(msg);
+    }
+
+    void flush_() override
+    {
+        // The flush is periodic, so a site gone quiet doesn't keep its count forever
+        //
+        const auto now = spdlog::log_clock::now();
+        for (auto iter = _sites.begin(); iter != _sites.end();) {
+            auto &[callSite, site] = *iter;
+            if (now - site.windowBegin < kWindow) {
+                ++iter;
+                continue;
+            }
+            Summarize({callSite.filename, callSite.line, ""}, site, now);
+            iter = _sites.erase(iter);
+        }
+
+        for (const auto &sink : _sinks) {
+            sink->flush();
+        }
+    }
+
+    void set_pattern_(const std::string &pattern) override
+    {
+        set_formatter_(std::make_unique<spdlog::pattern_formatter>(pattern));
+    }
+
+    void set_formatter_(std::unique_ptr<spdlog::formatter> formatter) override
+    {
+        for (const auto &sink : _sinks) {
+            sink->set_formatter(formatter->clone());
+        }
+        formatter_ = std::move(formatter);
+    }
+
+private:
+    constexpr static inline auto kWindow = std::chrono::seconds{5};
+    constexpr static inline size_t kBurst = 10;
+
+    struct CallSite {
+        const char *filename;
+        int line;
+
+        bool operator==(const CallSite &rhs) const = default;
+    };
+
+    struct CallSiteHash {
+        size_t operator()(const CallSite &callSite) const
+        {
+            return std::hash<const char *>{}(callSite.filename) ^ (size_t)callSite.line;
+        }
+    };
+
+    struct Site {
+        spdlog::log_clock::time_point windowBegin;
+        size_t count{0};
+        spdlog::level::level_enum level{spdlog::level::info};
+        // Copied, in async mode the name of the message points into a buffer that is reused
+        std::string loggerName;
+    };
+
+    std::vector<spdlog::sink_ptr> _sinks;
+    std::unordered_map<CallSite, Site, CallSiteHash> _sites;
+
+    void Forward(const spdlog::details::log_msg &msg)
+    {
+        for (const auto &sink : _sinks) {
+            if (sink->should_log(msg.level)) {
+                sink->log(msg);
+            }
+        }
+    }
+
+    void Summarize(
+        const spdlog::source_loc &source, const Site &site, spdlog::log_clock::time_point time)
+    {
+        if (site.count <= kBurst) {
+            return;
+        }
+
+        const auto text = std::format(
+            "The message of {}:{} was repeated {} more times in {}s.", source.filename,
+            source.line, site.count - kBurst,
+            std::chrono::duration_cast<std::chrono::seconds>(kWindow).count());
+
+        spdlog::details::log_msg summary{
+            time, source, spdlog::string_view_t{site.loggerName}, site.level, text};
+        Forward(summary);
+    }
+};
+} // namespace
+
+spdlog::logger *GetErrorLogger()
+{
+    return gErrorLogger.get();
+}
+} // namespace Details
+
+bool Initialize(bool enableTrace, bool enableAsync)
 {
 #if defined APD_DEBUG
     enableTrace = true;
@@ -55,22 +204,40 @@ bool Initialize(bool enableTrace)
     try {
         const auto logFilePath = GetLogFilePath().absolutePath().toStdWString();
 
-        // clang-format off
-        auto logger = std::make_shared<spdlog::logger>(
-            "Main", std::initializer_list<spdlog::sink_ptr>{
-                std::make_shared<spdlog::sinks::basic_file_sink_mt>(logFilePath, true),
-                std::make_shared<spdlog::sinks::stdout_color_sink_mt>()
-            }
-        );
-        // clang-format on
+        const std::initializer_list<spdlog::sink_ptr> sinks{
+            std::make_shared<Details::RepeatSuppressingSink>(std::vector<spdlog::sink_ptr>{
+                std::make_shared<spdlog::sinks::rotating_file_sink_st>(
+                    logFilePath, Details::kMaxLogFileSize, Details::kMaxLogFiles, true),
+                std::make_shared<spdlog::sinks::stdout_color_sink_st>()})};
+
+        std::shared_ptr<spdlog::logger> logger;
 
-        int ix = 100;
+        if (enableAsync) {
+            spdlog::init_thread_pool(Details::kAsyncQueueSize, 1);
+            logger = std::make_shared<spdlog::async_logger>(
+                "Main", sinks, spdlog::thread_pool(),
+                spdlog::async_overflow_policy::overrun_oldest);
+            Details::gAsyncLogger = logger;
+
+            // Shares the sinks with the async logger, but writes on the caller thread. Note that
+            // an error message may be written before the lower level messages still in the queue.
+            //
+            Details::gErrorLogger = std::make_shared<spdlog::logger>("Error", sinks);
+            spdlog::register_logger(Details::gErrorLogger);
+        }
+        else {
+            logger = std::make_shared<spdlog::logger>("Main", sinks);
+            Details::gErrorLogger = logger;
+        }
 
         spdlog::register_logger(logger);
         spdlog::set_default_logger(logger);
 
         spdlog::set_level(enableTrace ? spdlog::level::trace : spdlog::level::info);
-        spdlog::flush_on(spdlog::level::trace);
+        spdlog::flush_on(enableAsync ? spdlog::level::err : spdlog::level::trace);
+        if (enableAsync) {
+            spdlog::flush_every(std::chrono::seconds{1});
+        }
 
 #if defined APD_DEBUG
         spdlog::set_error_handler([](const std::string &msg) { Utils::Debug::BreakPoint(); });
@@ -83,21 +250,18 @@ bool Initialize(bool enableTrace)
     }
 }
 
-// TODO: Remove this function in [v1.0.0]
-void CleanUpOldLogFiles()
+void Shutdown()
 {
-    auto workspace = Utils::File::GetWorkspace();
-
-    for (size_t i = 1; i < 10000; ++i) {
-        auto logFile = QString{CONFIG_PROGRAM_NAME ".%1.log"}.arg(i);
-
-        if (!workspace.exists(logFile)) {
-            LOG(Info, "Clean up old log file: '{}' doesn't exist, break the loop", logFile);
-            break;
-        }
-
-        LOG(Info, "Clean up old log file: '{}' exists, remove it", logFile);
-        workspace.remove(logFile);
+    if (Details::gAsyncLogger != nullptr) {
+        // Route everything to the synchronous logger, then destroy the thread pool, which
+        // processes all queued messages before its thread exits. `gAsyncLogger` is kept alive
+        // so that a thread still holding it only gets a logged error rather than a dangling
+        // pointer.
+        //
+        spdlog::set_default_logger(Details::gErrorLogger);
+        spdlog::details::registry::instance().set_tp(nullptr);
     }
+    spdlog::default_logger_raw()->flush();
 }
+
 } // namespace Logger
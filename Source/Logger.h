@@ -37,43 +37,75 @@ enum class Level : uint32_t {
     Critical,
 };
 
+#if !defined APD_LOG_MIN_LEVEL
+    #define APD_LOG_MIN_LEVEL Trace
+#endif
+
+// Log statements below this level are compiled out entirely
+//
+constexpr inline Level kMinLevel = Level::APD_LOG_MIN_LEVEL;
+
+template <Level level>
+constexpr spdlog::level::level_enum ToSpdlogLevel()
+{
+    if constexpr (level == Level::Trace) {
+        return spdlog::level::trace;
+    }
+    else if constexpr (level == Level::Debug) {
+        return spdlog::level::debug;
+    }
+    else if constexpr (level == Level::Info) {
+        return spdlog::level::info;
+    }
+    else if constexpr (level == Level::Warn) {
+        return spdlog::level::warn;
+    }
+    else if constexpr (level == Level::Error) {
+        return spdlog::level::err;
+    }
+    else if constexpr (level == Level::Critical) {
+        return spdlog::level::critical;
+    }
+    else {
+        static_assert(false);
+    }
+}
+
+// Messages at error level and above bypass the async queue, so they are on disk immediately.
+// Null until `Logger::Initialize` has succeeded.
+//
+spdlog::logger *GetErrorLogger();
+
+template <Level level>
+inline bool ShouldLog()
+{
+    return spdlog::default_logger_raw()->should_log(ToSpdlogLevel<level>());
+}
+
 template <Level level, class... Args>
 inline void Log(const spdlog::source_loc &srcloc, Args &&...args)
 {
-    constexpr auto spdlogLevel = []() {
-        if constexpr (level == Level::Trace) {
-            return spdlog::level::trace;
+    auto *logger = spdlog::default_logger_raw();
+    if constexpr (level >= Level::Error) {
+        // Falls back to the default logger if the initialization hasn't happened or failed
+        //
+        if (auto *errorLogger = GetErrorLogger(); errorLogger != nullptr) {
+            logger = errorLogger;
         }
-        else if constexpr (level == Level::Debug) {
-            return spdlog::level::debug;
-        }
-        else if constexpr (level == Level::Info) {
-            return spdlog::level::info;
-        }
-        else if constexpr (level == Level::Warn) {
-            return spdlog::level::warn;
-        }
-        else if constexpr (level == Level::Error) {
-            return spdlog::level::err;
-        }
-        else if constexpr (level == Level::Critical) {
-            return spdlog::level::critical;
-        }
-        else {
-            static_assert(false);
-        }
-    }();
+    }
 
-    spdlog::default_logger_raw()->log(srcloc, spdlogLevel, std::forward<Args>(args)...);
+    logger->log(srcloc, ToSpdlogLevel<level>(), std::forward<Args>(args)...);
 }
 
 } // namespace Details
 
-bool Initialize(bool enableTrace);
+bool Initialize(bool enableTrace, bool enableAsync);
 
-QDir GetLogFilePath();
+// Drains the async queue and writes everything to disk
+//
+void Shutdown();
 
-void CleanUpOldLogFiles();
+QDir GetLogFilePath();
 
 } // namespace Logger
 
@@ -83,6 +115,14 @@ inline OutStream &operator<<(OutStream &outStream, const QString &qstr)
     return outStream << qstr.toStdString().c_str();
 }
 
+// The arguments are not evaluated if the level is compiled out or disabled at runtime
+//
 #define LOG(level, ...)                                                                            \
-    Logger::Details::Log<Logger::Details::Level::level>(                                           \
-        spdlog::source_loc{__FILE__, __LINE__, SPDLOG_FUNCTION}, __VA_ARGS__)
+    do {                                                                                           \
+        if constexpr (Logger::Details::Level::level >= Logger::Details::kMinLevel) {               \
+            if (Logger::Details::ShouldLog<Logger::Details::Level::level>()) {                     \
+                Logger::Details::Log<Logger::Details::Level::level>(                               \
+                    spdlog::source_loc{__FILE__, __LINE__, SPDLOG_FUNCTION}, __VA_ARGS__);         \
+            }                                                                                      \
+        }                                                                                          \
+    } while (false)
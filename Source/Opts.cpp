@@ -40,7 +40,38 @@ const LaunchOpts &LaunchOptsManager::Parse(int argc, char *argv[])
 
         parser.add_options()          //
             ("help", "Print options") //
-            ("trace", "Enable trace level logging.", value<bool>()->default_value("false"));
+            ("trace", "Enable trace level logging.", value<bool>()->default_value("false")) //
+            ("async-log", "Write logs on a background thread.",
+             value<bool>()->default_value("true")) //
+            ("startup-profile", "Log the duration of each startup phase.",
+             value<bool>()->default_value("false")) //
+            ("capture", "Record the received Apple advertisements to the workspace.",
+             value<bool>()->default_value("false")) //
+            ("replay", "Replay a capture file without the GUI, print a report and exit.",
+             value<std::string>()->default_value("")) //
+            ("replay-max-speed", "Replay as fast as possible instead of the original pacing.",
+             value<bool>()->default_value("false")) //
+            ("load-test", "Feed the advertisements of N synthetic devices to the tracker, print a "
+                          "report and exit.",
+             value<uint32_t>()->default_value("0")) //
+            ("load-rate", "Packets per second of the load test.",
+             value<uint32_t>()->default_value("1000")) //
+            ("load-duration", "Seconds of advertisements to generate for the load test.",
+             value<uint32_t>()->default_value("60")) //
+            ("headless", "Run only the ear detection and the IPC endpoint, without any window.",
+             value<bool>()->default_value("false"));
+
+#if defined APD_BUILD_BENCHMARK
+        parser.add_options()(
+            "benchmark", "Run the benchmarks, write the results as JSON to the file and exit.",
+            value<std::string>()->default_value(""));
+#endif
+
+#if defined APD_BUILD_SELF_TEST
+        parser.add_options()(
+            "self-test", "Run the unit tests, print the results and exit.",
+            value<bool>()->default_value("false"));
+#endif
 
         auto names = enum_names<PrintAllLocales>();
         auto namesStr = std::accumulate(
@@ -65,6 +96,21 @@ const LaunchOpts &LaunchOptsManager::Parse(int argc, char *argv[])
         }
 
         _opts.enableTrace = args["trace"].as<bool>();
+        _opts.enableAsyncLog = args["async-log"].as<bool>();
+        _opts.startupProfile = args["startup-profile"].as<bool>();
+        _opts.captureAdv = args["capture"].as<bool>();
+        _opts.replayPath = args["replay"].as<std::string>();
+        _opts.replayMaxSpeed = args["replay-max-speed"].as<bool>();
+        _opts.loadTestDevices = args["load-test"].as<uint32_t>();
+        _opts.loadTestRate = args["load-rate"].as<uint32_t>();
+        _opts.loadTestDuration = args["load-duration"].as<uint32_t>();
+        _opts.headless = args["headless"].as<bool>();
+#if defined APD_BUILD_BENCHMARK
+        _opts.benchmarkPath = args["benchmark"].as<std::string>();
+#endif
+#if defined APD_BUILD_SELF_TEST
+        _opts.selfTest = args["self-test"].as<bool>();
+#endif
 
         auto printAllLocales =
             enum_cast<PrintAllLocales>(args["print-all-locales"].as<std::string>());
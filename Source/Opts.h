@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <string>
 #include <format>
 #include <optional>
 
@@ -30,11 +31,28 @@ enum class PrintAllLocales { None, Complete, LangOnly };
 
 struct LaunchOpts {
     bool enableTrace{false};
+    bool enableAsyncLog{true};
+    bool startupProfile{false};
+    bool captureAdv{false};
+    std::string replayPath;
+    bool replayMaxSpeed{false};
+    bool selfTest{false};
+    std::string benchmarkPath;
+    uint32_t loadTestDevices{0};
+    uint32_t loadTestRate{1000};
+    uint32_t loadTestDuration{60};
+    bool headless{false};
 
     template <class OutStream>
     friend inline OutStream &operator<<(OutStream &outStream, const Opts::LaunchOpts &opts)
     {
-        return outStream << std::format("{{ trace: {} }}", opts.enableTrace);
+        return outStream << std::format(
+                   "{{ trace: {}, asyncLog: {}, startupProfile: {}, capture: {}, replay: '{}', "
+                   "replayMaxSpeed: {}, benchmark: '{}', loadTest: {{ devices: {}, rate: {}, "
+                   "duration: {}s }}, headless: {} }}",
+                   opts.enableTrace, opts.enableAsyncLog, opts.startupProfile, opts.captureAdv,
+                   opts.replayPath, opts.replayMaxSpeed, opts.benchmarkPath, opts.loadTestDevices,
+                   opts.loadTestRate, opts.loadTestDuration, opts.headless);
     }
 };
 
@@ -0,0 +1,55 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+// Tracy instrumentation, compiled in only with `APD_ENABLE_PROFILING`. Otherwise the macros
+// expand to nothing and the lockables are the plain types, so a release build pays nothing.
+//
+// The names passed to the macros must be string literals, Tracy keeps the pointers.
+//
+
+#if defined APD_ENABLE_PROFILING
+
+    #include <tracy/Tracy.hpp>
+
+    #define APD_PROFILE_ZONE() ZoneScoped
+    #define APD_PROFILE_ZONE_NAMED(name) ZoneScopedN(name)
+    #define APD_PROFILE_FRAME(name) FrameMarkNamed(name)
+    #define APD_PROFILE_THREAD(name) tracy::SetThreadName(name)
+    #define APD_PROFILE_LOCKABLE(type, name) TracyLockable(type, name)
+
+namespace Profiler {
+template <class T>
+using Lockable = tracy::Lockable<T>;
+} // namespace Profiler
+
+#else
+
+    #define APD_PROFILE_ZONE()
+    #define APD_PROFILE_ZONE_NAMED(name)
+    #define APD_PROFILE_FRAME(name)
+    #define APD_PROFILE_THREAD(name)
+    #define APD_PROFILE_LOCKABLE(type, name) type name
+
+namespace Profiler {
+template <class T>
+using Lockable = T;
+} // namespace Profiler
+
+#endif
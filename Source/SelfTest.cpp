@@ -0,0 +1,431 @@
+//
+// AirPodsDesktop - AirPods Desktop User Experience Enhancement Program.
+// Copyright (C) 2021-2022 SpriteOvO
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "SelfTest.h"
+
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <random>
+#include <span>
+#include <vector>
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include <QFile>
+#include <QTemporaryDir>
+
+#include "Logger.h"
+#include "Core/AirPods.h"
+#include "Core/AppleCP.h"
+#include "Core/AdvCapture.h"
+#include "Core/Ipc.h"
+#include "Core/LoadGenerator.h"
+
+using namespace std::chrono_literals;
+
+namespace SelfTest {
+
+namespace {
+
+uint32_t gFailedChecks = 0;
+
+void Check(bool passed, std::string_view expression, std::string_view file, int line)
+{
+    if (!passed) {
+        ++gFailedChecks;
+        std::cerr << std::format("{}({}): Check failed: {}", file, line, expression) << std::endl;
+    }
+}
+
+#define APD_CHECK(expression) Check(static_cast<bool>(expression), #expression, __FILE__, __LINE__)
+
+using ReceivedData = Core::AdvCapture::ReceivedData;
+
+//
+// AdvCapture
+//
+
+void TestCaptureReaderRoundTrip()
+{
+    using Timestamp = Core::AdvCapture::Timestamp;
+
+    QTemporaryDir dir;
+    APD_CHECK(dir.isValid());
+    const auto path = dir.filePath("Replay.apdcap");
+
+    // The reader doesn't decode the payloads, any bytes do
+    //
+    std::array<uint8_t, Core::AppleCP::AirPodsLayout::kSize> payload;
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+
+    const std::array<uint64_t, 3> addresses{0x1122334455, 0x66778899AA, 0x1122334455};
+    {
+        Core::AdvCapture::Writer writer{path};
+        APD_CHECK(writer.IsOpen());
+
+        for (size_t i = 0; i < addresses.size(); ++i) {
+            ReceivedData data;
+            data.timestamp = Timestamp{Timestamp::duration{1000 * (int64_t)i}};
+            data.address = addresses[i];
+            data.rssi = static_cast<int16_t>(-40 - (int16_t)i);
+            writer.Append(data, payload);
+        }
+    }
+
+    std::vector<ReceivedData> records;
+    {
+        Core::AdvCapture::Reader reader{path};
+        APD_CHECK(reader.IsOpen());
+        while (auto optData = reader.Next()) {
+            records.emplace_back(std::move(optData.value()));
+        }
+    }
+
+    APD_CHECK(records.size() == addresses.size());
+    if (records.size() != addresses.size()) {
+        return;
+    }
+    for (size_t i = 0; i < records.size(); ++i) {
+        const auto &data = records[i];
+        APD_CHECK(data.timestamp == Timestamp{Timestamp::duration{1000 * (int64_t)i}});
+        APD_CHECK(data.rssi == -40 - (int16_t)i);
+        APD_CHECK(data.manufacturerData.size() == 1);
+        APD_CHECK(data.manufacturerData.front().companyId == Core::AppleCP::VendorId);
+        const auto &appleData = data.manufacturerData.front().data;
+        APD_CHECK(std::equal(appleData.begin(), appleData.end(), payload.begin(), payload.end()));
+    }
+
+    // The addresses are mixed, but the sources stay distinct
+    //
+    APD_CHECK(records[0].address != addresses[0]);
+    APD_CHECK(records[0].address == records[2].address);
+    APD_CHECK(records[0].address != records[1].address);
+
+    // A record cut short ends the replay, the complete ones before it are still read
+    //
+    {
+        QFile file{path};
+        APD_CHECK(file.resize(file.size() - 4));
+    }
+    Core::AdvCapture::Reader truncated{path};
+    APD_CHECK(truncated.Next().has_value());
+    APD_CHECK(truncated.Next().has_value());
+    APD_CHECK(!truncated.Next().has_value());
+    APD_CHECK(!truncated.Next().has_value());
+}
+
+void TestCaptureReaderRejectsOtherFiles()
+{
+    QTemporaryDir dir;
+    APD_CHECK(dir.isValid());
+    const auto path = dir.filePath("NotACapture.apdcap");
+    {
+        QFile file{path};
+        APD_CHECK(file.open(QIODevice::WriteOnly));
+        file.write(QByteArray{"APDADVX\0\1\0\0\0", 12});
+    }
+
+    Core::AdvCapture::Reader reader{path};
+    APD_CHECK(!reader.IsOpen());
+    APD_CHECK(!reader.Next().has_value());
+
+    Core::AdvCapture::Reader missing{dir.filePath("Missing.apdcap")};
+    APD_CHECK(!missing.IsOpen());
+}
+
+void TestReplayTimeToFirstState()
+{
+    using Timestamp = Core::AdvCapture::Timestamp;
+    using Core::AirPods::Side;
+
+    constexpr auto kInterval = 100ms;
+    constexpr auto kOwnSince = 1000ms;
+
+    QTemporaryDir dir;
+    APD_CHECK(dir.isValid());
+    const auto path = dir.filePath("FirstState.apdcap");
+
+    // The pair of a neighbour of the same model is out of range, then the lid of the user's own
+    // pair is opened nearby
+    //
+    {
+        Core::AdvCapture::Writer writer{path};
+
+        const auto append = [&](std::chrono::milliseconds time, Side side, uint64_t address,
+                                int16_t rssi, uint8_t battery) {
+            const auto payload = Core::LoadGenerator::MakePayload(
+                Core::LoadGenerator::PayloadFields{.side = side, .pods = {battery, battery}});
+
+            ReceivedData data;
+            data.timestamp = Timestamp{} + time;
+            data.address = address + Helper::ToUnderlying(side);
+            data.rssi = rssi;
+            writer.Append(data, payload);
+        };
+
+        for (auto time = 0ms; time < 2000ms; time += kInterval) {
+            const auto side = (time / kInterval) % 2 == 0 ? Side::Left : Side::Right;
+            append(time, side, 0x1122334400, -95, 3);
+            if (time >= kOwnSince) {
+                append(time, side, 0x6677889900, -50, 9);
+            }
+        }
+    }
+
+    Core::AdvCapture::ReplayOptions options;
+    options.path = path;
+    options.rssiMin = -80;
+
+    const auto optReport = Core::AdvCapture::Replay(options);
+    APD_CHECK(optReport.has_value());
+    if (!optReport.has_value()) {
+        return;
+    }
+
+    // The first packet of the user's pair is enough, the weak one must not hold it off
+    //
+    const auto &timeToFirstState = optReport->timeToFirstState;
+    APD_CHECK(timeToFirstState.has_value());
+    APD_CHECK(timeToFirstState >= kOwnSince);
+    APD_CHECK(timeToFirstState < kOwnSince + kInterval);
+}
+
+//
+// AppleCP
+//
+
+// Records the payloads to a capture file and reads them back, the way a day of captures is fed to
+// the decoders
+//
+std::vector<uint8_t> CaptureRoundTrip(const QString &path, const std::vector<uint8_t> &records)
+{
+    constexpr auto kSize = Core::AppleCP::AirPodsLayout::kSize;
+
+    {
+        Core::AdvCapture::Writer writer{path};
+        for (size_t offset = 0; offset < records.size(); offset += kSize) {
+            ReceivedData data;
+            data.rssi = -50;
+            data.address = offset / kSize;
+            writer.Append(data, std::span{records}.subspan(offset, kSize));
+        }
+    }
+
+    std::vector<uint8_t> result;
+    Core::AdvCapture::Reader reader{path};
+    while (const auto optData = reader.Next()) {
+        const auto &appleData = optData->manufacturerData.front().data;
+        result.insert(result.end(), appleData.begin(), appleData.end());
+    }
+    return result;
+}
+
+void TestBatchMatchesView()
+{
+    namespace AppleCP = Core::AppleCP;
+    using AirPodsBatch = AppleCP::AirPodsBatch;
+
+    // Not a multiple of the lanes, so the tail is decoded too
+    //
+    constexpr size_t kRecords = 1003;
+    constexpr auto kSize = AppleCP::AirPodsLayout::kSize;
+
+    // Random status bytes cover the combinations a real capture rarely has, e.g. the batteries
+    // over 10. Every seventh record is not a proximity pairing packet.
+    //
+    std::mt19937 random{1};
+    std::vector<uint8_t> records;
+    for (size_t i = 0; i < kRecords; ++i) {
+        auto payload = Core::LoadGenerator::MakePayload({});
+        // The status fields live in the bytes 5 to 8
+        //
+        for (size_t offset = 5; offset < 9; ++offset) {
+            payload[offset] = static_cast<uint8_t>(random());
+        }
+        if (i % 7 == 0) {
+            payload[AppleCP::AirPodsLayout::kOffsetPacketType] = 0;
+        }
+        records.insert(records.end(), payload.begin(), payload.end());
+    }
+
+    QTemporaryDir dir;
+    APD_CHECK(dir.isValid());
+    const auto captured = CaptureRoundTrip(dir.filePath("Batch.apdcap"), records);
+    APD_CHECK(captured == records);
+
+    AirPodsBatch batch;
+    AppleCP::DecodeAirPodsBatch(captured, batch);
+    APD_CHECK(batch.size() == captured.size() / kSize);
+
+    const auto toBatch = [](const Core::AirPods::Battery &battery) {
+        return battery.Available() ? static_cast<uint8_t>(battery.Value())
+                                   : AirPodsBatch::kBatteryUnavailable;
+    };
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const auto record = std::span{captured}.subspan(i * kSize, kSize);
+
+        const bool isValid = AppleCP::AirPodsView::IsValid(record);
+        APD_CHECK((batch.isValid[i] != 0) == isValid);
+        if (!isValid) {
+            continue;
+        }
+
+        const AppleCP::AirPodsView view{record.first<kSize>()};
+        APD_CHECK(batch.modelId[i] == view.GetModelId());
+        APD_CHECK(batch.side[i] == Helper::ToUnderlying(view.GetBroadcastedSide()));
+        APD_CHECK(batch.leftBattery[i] == toBatch(view.GetLeftBattery()));
+        APD_CHECK(batch.rightBattery[i] == toBatch(view.GetRightBattery()));
+        APD_CHECK(batch.caseBattery[i] == toBatch(view.GetCaseBattery()));
+        APD_CHECK(
+            batch.charging[i] == ((view.IsLeftCharging() ? AirPodsBatch::kLeft : 0) |
+                                  (view.IsRightCharging() ? AirPodsBatch::kRight : 0) |
+                                  (view.IsCaseCharging() ? AirPodsBatch::kCase : 0)));
+        APD_CHECK(
+            batch.inEar[i] == ((view.IsLeftInEar() ? AirPodsBatch::kLeft : 0) |
+                               (view.IsRightInEar() ? AirPodsBatch::kRight : 0)));
+        APD_CHECK(
+            batch.lid[i] == ((view.IsLidOpened() ? AirPodsBatch::kLidOpened : 0) |
+                             (view.IsBothPodsInCase() ? AirPodsBatch::kBothInCase : 0)));
+    }
+}
+
+//
+// TransitionDebouncer
+//
+
+void TestTransitionDebounced()
+{
+    Core::AirPods::Details::TransitionDebouncer debouncer{[] {}};
+    debouncer.SetWindow(300ms);
+    debouncer.Reset(false);
+
+    APD_CHECK(!debouncer.Feed(true, false).has_value());
+    APD_CHECK(!debouncer.Expire().has_value());
+
+    // Flipped back before the window has passed
+    //
+    APD_CHECK(!debouncer.Feed(false, false).has_value());
+    APD_CHECK(!debouncer.Expire().has_value());
+
+    // Both sides agree
+    //
+    APD_CHECK(debouncer.Feed(true, true) == true);
+}
+
+void TestTransitionCommittedAfterWindow()
+{
+    Core::AirPods::Details::TransitionDebouncer debouncer{[] {}};
+    debouncer.SetWindow(20ms);
+    debouncer.Reset(false);
+
+    APD_CHECK(!debouncer.Feed(true, false).has_value());
+    std::this_thread::sleep_for(40ms);
+    APD_CHECK(debouncer.Expire() == true);
+}
+
+void TestFirstLidOpenIsNotDelayed()
+{
+    Core::AirPods::Details::TransitionDebouncer debouncer{[] {}, true};
+    debouncer.SetWindow(300ms);
+
+    // As `Manager::OnStateChanged` seeds it for the first state
+    //
+    debouncer.Reset(false);
+    APD_CHECK(debouncer.Feed(true, false) == true);
+}
+
+void TestLidCloseIsDebounced()
+{
+    Core::AirPods::Details::TransitionDebouncer debouncer{[] {}, true};
+    debouncer.SetWindow(300ms);
+    debouncer.Reset(true);
+
+    APD_CHECK(!debouncer.Feed(false, false).has_value());
+    APD_CHECK(!debouncer.Expire().has_value());
+
+    // Reopened before the window has passed
+    //
+    APD_CHECK(!debouncer.Feed(true, false).has_value());
+    APD_CHECK(!debouncer.Expire().has_value());
+
+    APD_CHECK(debouncer.Feed(false, true) == false);
+}
+
+//
+// Ipc
+//
+
+void TestStateFieldNamesRoundTrip()
+{
+    using Core::AirPods::StateField;
+
+    // Every single field, including the ones out of the range magic_enum reflects
+    //
+    for (uint32_t bit = 1; bit <= Helper::ToUnderlying(StateField::All); bit <<= 1) {
+        const auto field = static_cast<StateField>(bit);
+        const auto name = Core::Ipc::Details::GetFieldName(field);
+        APD_CHECK(!name.empty());
+        APD_CHECK(Core::Ipc::Details::FindFieldByName(name) == field);
+    }
+
+    APD_CHECK(Core::Ipc::Details::GetFieldName(StateField::All).empty());
+    APD_CHECK(!Core::Ipc::Details::FindFieldByName("All").has_value());
+    APD_CHECK(!Core::Ipc::Details::FindFieldByName("caseLid").has_value());
+}
+
+} // namespace
+
+int Run()
+{
+    LOG(Info, "SelfTest: Started.");
+
+    const std::pair<std::string_view, void (*)()> tests[] = {
+        {"CaptureReaderRoundTrip", &TestCaptureReaderRoundTrip},
+        {"CaptureReaderRejectsOtherFiles", &TestCaptureReaderRejectsOtherFiles},
+        {"BatchMatchesView", &TestBatchMatchesView},
+        {"TransitionDebounced", &TestTransitionDebounced},
+        {"TransitionCommittedAfterWindow", &TestTransitionCommittedAfterWindow},
+        {"FirstLidOpenIsNotDelayed", &TestFirstLidOpenIsNotDelayed},
+        {"LidCloseIsDebounced", &TestLidCloseIsDebounced},
+        {"ReplayTimeToFirstState", &TestReplayTimeToFirstState},
+        {"StateFieldNamesRoundTrip", &TestStateFieldNamesRoundTrip},
+    };
+
+    uint32_t failedTests = 0;
+    for (const auto &[name, test] : tests) {
+        const auto failedChecks = gFailedChecks;
+        test();
+
+        const bool passed = gFailedChecks == failedChecks;
+        failedTests += passed ? 0 : 1;
+        std::cout << std::format("[{}] {}", passed ? "PASS" : "FAIL", name) << std::endl;
+    }
+
+    LOG(Info, "SelfTest: Finished, {} of {} tests failed.", failedTests, std::size(tests));
+    std::cout << std::format("{} of {} tests failed.", failedTests, std::size(tests)) << std::endl;
+    return failedTests == 0 ? 0 : 1;
+}
+
+} // namespace SelfTest